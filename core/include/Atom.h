@@ -0,0 +1,229 @@
+#ifndef BROWSER_ATOM_H
+#define BROWSER_ATOM_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+namespace BrowserParser {
+
+// Interned identifier shared by the HTML and CSS parsers. Tag names, ids,
+// class names and attribute names are interned once so that selector
+// matching compares integers instead of strings.
+using Atom = uint32_t;
+
+constexpr Atom null_atom = 0;
+
+// One bit of a 64-bit signature; a set of atoms ORs its bits together so
+// that a missing bit rules out membership without scanning the set
+inline uint64_t atom_signature_bit(Atom atom) {
+    return uint64_t(1) << ((atom * 0x9E3779B1u) >> 26);
+}
+
+// Open-addressing hash set of atoms. Ids are recycled, so they are not
+// dense; the table grows with the number of atoms in the set, not with the
+// largest id in the process.
+class AtomSet {
+public:
+    // Returns true if atom was not in the set
+    bool insert(Atom atom) {
+        if (atom == null_atom) return false;
+        if ((count_ + 1) * 2 > slots_.size()) grow();
+        size_t mask = slots_.size() - 1;
+        for (size_t i = slot(atom, mask);; i = (i + 1) & mask) {
+            if (slots_[i] == atom) return false;
+            if (slots_[i] == null_atom) {
+                slots_[i] = atom;
+                count_++;
+                return true;
+            }
+        }
+    }
+
+    bool contains(Atom atom) const {
+        if (atom == null_atom || slots_.empty()) return false;
+        size_t mask = slots_.size() - 1;
+        for (size_t i = slot(atom, mask);; i = (i + 1) & mask) {
+            if (slots_[i] == atom) return true;
+            if (slots_[i] == null_atom) return false;
+        }
+    }
+
+    template <typename Visit>
+    void for_each(Visit&& visit) const {
+        for (Atom atom : slots_) {
+            if (atom != null_atom) visit(atom);
+        }
+    }
+
+    size_t size() const { return count_; }
+    bool empty() const { return count_ == 0; }
+    void clear() { slots_.clear(); count_ = 0; }
+
+private:
+    static size_t slot(Atom atom, size_t mask) { return (atom * 0x9E3779B1u) & mask; }
+
+    void grow() {
+        std::vector<Atom> old;
+        old.swap(slots_);
+        slots_.assign(old.empty() ? 16 : old.size() * 2, null_atom);
+        count_ = 0;
+        for (Atom atom : old) {
+            if (atom != null_atom) insert(atom);
+        }
+    }
+
+    std::vector<Atom> slots_; // null_atom marks an empty slot
+    size_t count_ = 0;
+};
+
+class AtomLease;
+
+// The process-wide name table. An atom interned under an AtomLease is
+// released when the last lease holding it goes away, and its id is reused;
+// an atom interned with no lease is permanent. The table therefore holds
+// the names of live documents and sheets plus the fixed vocabulary, rather
+// than every name ever seen.
+class AtomTable {
+public:
+    static AtomTable& instance() {
+        static AtomTable table;
+        return table;
+    }
+
+    // Returns the atom for text, creating it on first use. The atom is held
+    // by lease, or made permanent when lease is null.
+    Atom intern(std::string_view text, AtomLease* lease);
+
+    // Returns null_atom if text is not interned
+    Atom find(std::string_view text) const {
+        if (text.empty()) return null_atom;
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = ids_.find(text);
+        return it != ids_.end() ? it->second : null_atom;
+    }
+
+    // The view stays valid while the atom is held
+    std::string_view name(Atom atom) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return atom < entries_.size() ? std::string_view(entries_[atom].name) : std::string_view();
+    }
+
+    // Live atoms, null_atom included
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return entries_.size() - free_.size();
+    }
+
+private:
+    friend class AtomLease;
+
+    struct Entry {
+        std::string name;
+        uint32_t leases = 0;
+        bool permanent = false;
+    };
+
+    AtomTable() { entries_.emplace_back().permanent = true; } // slot 0 is null_atom
+
+    void release(const AtomSet& atoms) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        atoms.for_each([&](Atom atom) {
+            Entry& entry = entries_[atom];
+            if (--entry.leases > 0 || entry.permanent) return;
+            ids_.erase(std::string_view(entry.name));
+            entry.name = std::string();
+            free_.push_back(atom);
+        });
+    }
+
+    mutable std::shared_mutex mutex_;
+    std::deque<Entry> entries_;
+    std::vector<Atom> free_;
+    std::unordered_map<std::string_view, Atom> ids_;
+};
+
+// Holds the atoms interned while it is current (see AtomScope). Whatever
+// stores those atoms - a document's nodes, a sheet's values and compiled
+// selectors - keeps the lease alive alongside, the way it keeps the
+// CSSValueArena its values point into.
+class AtomLease {
+public:
+    AtomLease() = default;
+    AtomLease(const AtomLease&) = delete;
+    AtomLease& operator=(const AtomLease&) = delete;
+    ~AtomLease() { AtomTable::instance().release(atoms_); }
+
+    bool holds(Atom atom) const { return atoms_.contains(atom); }
+    size_t size() const { return atoms_.size(); }
+
+private:
+    friend class AtomTable;
+
+    AtomSet atoms_; // touched only by the thread the lease is current on
+};
+
+inline Atom AtomTable::intern(std::string_view text, AtomLease* lease) {
+    if (text.empty()) return null_atom;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = ids_.find(text);
+        if (it != ids_.end() && (lease ? lease->holds(it->second) : entries_[it->second].permanent)) {
+            return it->second;
+        }
+    }
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    Atom atom;
+    auto it = ids_.find(text);
+    if (it != ids_.end()) {
+        atom = it->second;
+    } else if (!free_.empty()) {
+        atom = free_.back();
+        free_.pop_back();
+        entries_[atom].name.assign(text.data(), text.size());
+        ids_.emplace(std::string_view(entries_[atom].name), atom);
+    } else {
+        atom = static_cast<Atom>(entries_.size());
+        entries_.push_back(Entry{std::string(text)});
+        ids_.emplace(std::string_view(entries_.back().name), atom);
+    }
+    if (!lease) {
+        entries_[atom].permanent = true;
+    } else if (lease->atoms_.insert(atom)) {
+        entries_[atom].leases++;
+    }
+    return atom;
+}
+
+// Makes lease current on this thread until the scope ends; intern_atom
+// attaches new atoms to it. A null lease makes them permanent, which is
+// what static tables built on first use need.
+class AtomScope {
+public:
+    explicit AtomScope(AtomLease* lease) : previous_(current()) { current() = lease; }
+    ~AtomScope() { current() = previous_; }
+    AtomScope(const AtomScope&) = delete;
+    AtomScope& operator=(const AtomScope&) = delete;
+
+    static AtomLease*& current() {
+        thread_local AtomLease* lease = nullptr;
+        return lease;
+    }
+
+private:
+    AtomLease* previous_;
+};
+
+inline Atom intern_atom(std::string_view text) { return AtomTable::instance().intern(text, AtomScope::current()); }
+inline Atom intern_permanent_atom(std::string_view text) { return AtomTable::instance().intern(text, nullptr); }
+inline Atom find_atom(std::string_view text) { return AtomTable::instance().find(text); }
+inline std::string_view atom_name(Atom atom) { return AtomTable::instance().name(atom); }
+
+} // namespace BrowserParser
+
+#endif // BROWSER_ATOM_H
@@ -7,6 +7,9 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <list>
+#include <mutex>
 
 namespace BrowserParser {
 
@@ -14,16 +17,167 @@ namespace BrowserParser {
 class StyleEngine;
 class CSSMatcher;
 
+// Which media conditions of a RuleSet hold in one environment, one bit each
+class MediaMatches {
+public:
+    bool test(uint32_t condition) const {
+        size_t word = condition >> 6;
+        return word < bits_.size() && (bits_[word] >> (condition & 63) & 1) != 0;
+    }
+    void set(uint32_t condition) {
+        size_t word = condition >> 6;
+        if (word >= bits_.size()) bits_.resize(word + 1, 0);
+        bits_[word] |= uint64_t(1) << (condition & 63);
+    }
+    
+private:
+    std::vector<uint64_t> bits_;
+};
+
+// Style rules that can possibly match a document, in cascade order. A rule is
+// dropped when every one of its selectors needs a tag, id, class or attribute
+// name the document never uses, so matching scales with the relevant rules.
+// Rules inside @media blocks are kept with the condition they sit under;
+// @supports blocks that hold add their rules unconditionally.
+class RuleSet {
+public:
+    struct Entry {
+        const CSS3Parser::StyleRule* rule = nullptr;
+        std::vector<uint32_t> selectors; // indices of selectors that may match
+        uint64_t order_base = 0;         // added to sheet-local cascade keys
+        uint32_t media = 0;              // media condition; 0 when there is none
+        uint32_t block_end = 0;          // one past the last following entry with the same condition
+        uint32_t scope = 0;              // @scope block; 0 when there is none
+    };
+    
+    // An @media block: its own query list and the condition of the block
+    // around it. Blocks with the same prelude under the same parent share one
+    struct MediaCondition {
+        uint32_t parent = 0;
+        const CSS3Parser::MediaQueryList* query = nullptr;
+    };
+    
+    // An @scope block and the @scope block around it
+    struct ScopeRule {
+        uint32_t parent = 0;
+        const CSS3Parser::ScopeBounds* bounds = nullptr;
+    };
+    
+    // features == nullptr keeps every selector
+    static RuleSet build(const std::vector<std::shared_ptr<const CSS3Parser::CSSStyleSheet>>& stylesheets,
+                         const AtomSet* features = nullptr);
+    
+    // The rule set of a document from the unpruned rule sets of its sheets,
+    // in order, as build() would make it from the sheets themselves: the
+    // sheets are not walked again, only each selector's atoms are checked.
+    // Media conditions are not shared across sheets
+    static RuleSet merge(const std::vector<const RuleSet*>& sheets, const AtomSet* features = nullptr);
+    
+    const std::vector<Entry>& entries() const { return entries_; }
+    const Entry* find(const CSS3Parser::StyleRule* rule) const;
+    
+    size_t total_rules() const { return total_rules_; }
+    size_t pruned_rules() const { return total_rules_ - entries_.size(); }
+    
+    const std::vector<MediaCondition>& media_conditions() const { return media_conditions_; }
+    const std::vector<ScopeRule>& scopes() const { return scopes_; }
+    
+    // Scope proximity of a scoped entry's selector matching element, or
+    // CSSMatcher::no_scope; the element must also lie in every enclosing scope
+    uint32_t match_scope(const Entry& entry, const CSS3Parser::CompiledSelector& selector,
+                         const HTML5Parser::Node& element) const;
+    
+    // Evaluates every distinct query list once; condition 0 always holds
+    MediaMatches evaluate_media(const CSS3Parser::MediaEnvironment& environment) const;
+    
+private:
+    std::vector<Entry> entries_;
+    std::vector<MediaCondition> media_conditions_{MediaCondition()};
+    std::vector<ScopeRule> scopes_{ScopeRule()};
+    std::unordered_map<const CSS3Parser::StyleRule*, size_t> index_;
+    size_t total_rules_ = 0;
+    uint64_t order_count_ = 0; // source positions used by the sheets, where the next sheet's begin
+    
+    void link_media_runs();
+};
+
+// Parsed stylesheets shared across documents. An entry is keyed by a hash of
+// the CSS text and of the parse options that change the result, and is
+// confirmed against the stored text, so a hit is exactly what parsing would
+// have produced. Entries are immutable and outlive eviction for as long as a
+// document holds them; the least recently used go first once the estimated
+// size of the cached entries passes the byte budget. Safe to share between
+// threads; concurrent misses on one text may both parse, and the first to
+// finish is kept.
+class StyleSheetCache {
+public:
+    struct Entry {
+        std::shared_ptr<const CSS3Parser::CSSStyleSheet> stylesheet;
+        std::vector<CSS3Parser::CSSParseError> errors;
+        RuleSet rule_set; // every rule of the sheet, unpruned; documents merge these
+        size_t bytes = 0; // estimated footprint charged against the budget
+    };
+    
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+        size_t entries = 0;
+        size_t bytes = 0;
+    };
+    
+    static constexpr size_t default_byte_budget = 64u << 20;
+    
+    explicit StyleSheetCache(size_t byte_budget = default_byte_budget) : byte_budget_(byte_budget) {}
+    StyleSheetCache(const StyleSheetCache&) = delete;
+    StyleSheetCache& operator=(const StyleSheetCache&) = delete;
+    
+    // The process-wide cache WebPageParser uses
+    static StyleSheetCache& shared();
+    
+    // The parsed sheet for css, parsed now on a miss. A sheet larger than
+    // the whole budget is returned without being kept
+    std::shared_ptr<const Entry> get(const std::string& css, const CSS3Parser::CSSParser::ParseOptions& options);
+    
+    void set_byte_budget(size_t bytes); // evicts down to the new budget
+    size_t byte_budget() const;
+    void clear(); // drops every entry and zeroes the counters
+    Stats stats() const;
+    
+private:
+    struct Slot {
+        uint64_t key = 0;
+        std::string css;
+        std::string options; // the result-changing options, spelled out
+        std::shared_ptr<const Entry> entry;
+    };
+    
+    mutable std::mutex mutex_;
+    size_t byte_budget_;
+    std::list<Slot> slots_; // most recently used first
+    std::unordered_multimap<uint64_t, std::list<Slot>::iterator> index_;
+    Stats stats_;
+    
+    std::list<Slot>::iterator find(uint64_t key, const std::string& css, const std::string& options);
+    void evict(); // callers hold mutex_
+};
+
 struct ParsedDocument {
     std::unique_ptr<HTML5Parser::Node> html_document;
-    std::vector<std::unique_ptr<CSS3Parser::CSSStyleSheet>> stylesheets;
+    std::vector<std::shared_ptr<const CSS3Parser::CSSStyleSheet>> stylesheets; // shared with StyleSheetCache
+    size_t linked_stylesheets = 0; // trailing entries of stylesheets that came from outside the HTML
     std::map<std::string, std::string> inline_styles; // element id/class -> style
     std::vector<std::string> parse_errors;
     
+    // Atoms used by the HTML and the style rules that survive them
+    AtomSet document_features;
+    RuleSet rule_set;
+    
     // Statistics
     struct Stats {
         size_t html_elements = 0;
         size_t css_rules = 0;
+        size_t css_rules_pruned = 0;
         size_t css_declarations = 0;
         size_t parse_time_us = 0;
         size_t total_size = 0;
@@ -43,6 +197,7 @@ public:
         bool extract_inline_styles = true;
         bool extract_style_elements = true;
         bool extract_linked_styles = false; // Would require file system access
+        bool cache_stylesheets = true; // share parsed sheets through StyleSheetCache::shared()
         bool validate_css_against_html = true;
         bool compute_specificity = true;
     };
@@ -50,8 +205,11 @@ public:
     explicit WebPageParser(const ParseOptions& options);
     WebPageParser();
     
-    ParsedDocument parse_html_with_css(const std::string& html_content);
-    ParsedDocument parse_html_file(const std::string& file_path);
+    // Linked stylesheets follow the document's own <style> sheets in cascade order
+    ParsedDocument parse_html_with_css(const std::string& html_content,
+                                       const std::vector<std::string>& linked_stylesheets = {});
+    ParsedDocument parse_html_file(const std::string& file_path,
+                                   const std::vector<std::string>& linked_stylesheets = {});
     
     // Individual parsing methods
     std::unique_ptr<HTML5Parser::Node> parse_html(const std::string& html);
@@ -64,9 +222,12 @@ public:
     // Analysis methods
     std::vector<std::string> validate_css_selectors_against_html(
         const CSS3Parser::CSSStyleSheet& stylesheet, 
-        const HTML5Parser::Node& html_doc);
+        const HTML5Parser::Node& html_doc,
+        const AtomSet* document_features = nullptr);
     
-    std::map<std::string, int> compute_selector_specificity(const CSS3Parser::CSSStyleSheet& stylesheet);
+    // Read from the compiled selectors, in stylesheet order
+    std::vector<std::pair<const CSS3Parser::ComplexSelector*, CSS3Parser::Specificity>>
+    compute_selector_specificity(const CSS3Parser::CSSStyleSheet& stylesheet);
     
     // Error handling
     const std::vector<std::string>& get_errors() const { return errors_; }
@@ -88,7 +249,7 @@ class CSSMatcher {
 public:
     struct MatchResult {
         bool matches = false;
-        int specificity = 0;
+        CSS3Parser::Specificity specificity;
         std::string matched_selector;
     };
     
@@ -106,10 +267,59 @@ public:
         const CSS3Parser::SelectorList& selectors,
         const HTML5Parser::Node& document_root);
     
-private:
+    // How states a parsed document cannot show are treated. Cascade matches
+    // the document as it stands: dynamic (:hover, :focus, ...) and unknown
+    // pseudo-classes never match, nor does a selector for a pseudo-element,
+    // which styles a generated box rather than the element. Reachable asks
+    // whether a rule could ever apply, so all of those are assumed to hold;
+    // unused-rule analysis matches this way
+    enum class MatchMode { Cascade, Reachable };
+    
+    // Compiled path: executes the selector bytecode stored on StyleRule.
+    // scope binds :scope; without one :scope is the root element
+    static bool matches_compiled_selector(const CSS3Parser::CompiledSelector& selector,
+                                          const HTML5Parser::Node& element,
+                                          const HTML5Parser::Node* scope = nullptr,
+                                          MatchMode mode = MatchMode::Cascade);
+    
+    // A selector inside @scope. Scoping roots are tried from the element
+    // outwards, binding :scope to each, and a root is passed over when one of
+    // the limits sits between it and the element. Returns the generations
+    // from the element up to the root it matched under, or no_scope.
+    // selector == nullptr only asks whether the element is in scope
+    static constexpr uint32_t no_scope = UINT32_MAX;
+    static uint32_t match_in_scope(const CSS3Parser::CompiledSelector* selector,
+                                   const CSS3Parser::ScopeBounds& scope,
+                                   const HTML5Parser::Node& element);
+    
+    static std::vector<const HTML5Parser::Node*> find_matching_elements(
+        const std::vector<CSS3Parser::CompiledSelector>& selectors,
+        const HTML5Parser::Node& document_root);
+    
+    // Allocation-free; honors the 'i' flag with ASCII case folding
     static bool matches_attribute_selector(const CSS3Parser::AttributeSelector& attr_sel,
                                           const HTML5Parser::Node& element);
     
+private:
+    static bool run_selector_program(const CSS3Parser::CompiledSelector& selector,
+                                     size_t pc,
+                                     const HTML5Parser::Node& element,
+                                     const HTML5Parser::Node* scope,
+                                     MatchMode mode);
+    
+    static bool has_class(const HTML5Parser::Node& element, CSS3Parser::Atom class_atom);
+    
+    static bool matches_pseudo_class(const CSS3Parser::CompiledPseudo& pseudo,
+                                     const HTML5Parser::Node& element,
+                                     const HTML5Parser::Node* scope,
+                                     MatchMode mode);
+    
+    static bool matches_relative_selector(const CSS3Parser::CompiledSelector& selector,
+                                          const HTML5Parser::Node& anchor,
+                                          MatchMode mode);
+    
+    static const HTML5Parser::Node* previous_element_sibling(const HTML5Parser::Node& element);
+    
     static bool matches_pseudo_selector(const CSS3Parser::PseudoSelector& pseudo_sel,
                                        const HTML5Parser::Node& element,
                                        const HTML5Parser::Node& document_root);
@@ -125,15 +335,25 @@ class StyleEngine {
 public:
     struct ComputedStyle {
         std::map<std::string, CSS3Parser::CSSValue> properties;
-        std::map<std::string, int> specificity; // property -> specificity
+        std::map<std::string, CSS3Parser::Specificity> specificity; // property -> specificity
         std::map<std::string, std::string> source; // property -> source rule
+        CSS3Parser::CustomPropertyMap variables;   // custom properties live here rather than in properties
     };
     
+    // Values substituted for var() live in the engine, so computed styles
+    // that use them stay valid as long as it does
     explicit StyleEngine(const ParsedDocument& document);
     
     ComputedStyle compute_style(const HTML5Parser::Node& element);
     std::map<const HTML5Parser::Node*, ComputedStyle> compute_all_styles();
     
+    // One style map per environment, in order. Selectors are matched once per
+    // element; only rules under @media conditions are weighed per environment,
+    // and environments that agree on an element share a single cascade, which
+    // their maps then point to rather than copy
+    using SharedStyleMap = std::map<const HTML5Parser::Node*, std::shared_ptr<const ComputedStyle>>;
+    std::vector<SharedStyleMap> compute_all_styles(const std::vector<CSS3Parser::MediaEnvironment>& environments);
+    
     // Cascade resolution
     CSS3Parser::CSSValue resolve_property(const std::string& property, 
                                          const HTML5Parser::Node& element);
@@ -148,12 +368,40 @@ public:
                                       const std::string& property,
                                       const HTML5Parser::Node& element);
     
+    const CSS3Parser::VariableResolver::Stats& variable_stats() const { return variables_.stats(); }
+    
+    // Rules in @media blocks that do not match the environment are skipped.
+    // Media queries are evaluated once per distinct environment and cached.
+    void set_environment(const CSS3Parser::MediaEnvironment& environment);
+    const CSS3Parser::MediaEnvironment& environment() const { return environment_; }
+    
 private:
     const ParsedDocument& document_;
-    std::map<std::string, bool> inheritable_properties_;
+    const RuleSet* rules_;
+    RuleSet unpruned_rules_; // used when the document carries no rule set
+    CSS3Parser::VariableResolver variables_;
+    CSS3Parser::MediaEnvironment environment_;
+    MediaMatches media_;
+    std::vector<std::pair<CSS3Parser::MediaEnvironment, MediaMatches>> media_cache_;
+    
+    // A rule whose selectors match, with the most specific matching selector
+    struct MatchedRule {
+        uint32_t entry = 0;
+        const CSS3Parser::ComplexSelector* selector = nullptr;
+        CSS3Parser::Specificity specificity;
+        uint32_t proximity = CSSMatcher::no_scope; // generations to the @scope root
+    };
     
-    void initialize_inheritable_properties();
-    std::vector<std::pair<CSS3Parser::CSSDeclaration, int>> get_matching_declarations(
+    const MediaMatches& media_for(const CSS3Parser::MediaEnvironment& environment);
+    ComputedStyle cascade(const HTML5Parser::Node& element, const ComputedStyle* parent_style);
+    // Scoped entries match only inside their @scope and report its proximity
+    bool matches_entry(const RuleSet::Entry& entry, const CSS3Parser::CompiledSelector& selector,
+                       const HTML5Parser::Node& element, uint32_t& proximity) const;
+    // media == nullptr matches rules under every condition
+    std::vector<MatchedRule> match_rules(const HTML5Parser::Node& element, const MediaMatches* media) const;
+    ComputedStyle resolve(const HTML5Parser::Node& element, const std::vector<MatchedRule>& matched,
+                          const MediaMatches& media, const ComputedStyle* parent_style);
+    std::vector<std::pair<CSS3Parser::CSSDeclaration, uint64_t>> get_matching_declarations(
         const std::string& property, const HTML5Parser::Node& element);
 };
 
@@ -174,7 +422,7 @@ public:
         size_t unused_selectors = 0;
         size_t invalid_properties = 0;
         std::map<std::string, size_t> property_usage;
-        std::map<int, size_t> specificity_distribution;
+        std::map<CSS3Parser::Specificity, size_t> specificity_distribution;
         
         // Integration analysis
         size_t inline_styles = 0;
@@ -193,9 +441,11 @@ public:
     static std::string generate_json_report(const AnalysisReport& report);
     
 private:
-    static void analyze_html_structure(const HTML5Parser::Node& node, AnalysisReport& report);
+    static void analyze_html_structure(const HTML5Parser::Node& node, AnalysisReport& report,
+                                       std::unordered_map<Atom, size_t>& class_counts);
     static void analyze_css_usage(const CSS3Parser::CSSStyleSheet& stylesheet, 
                                  const HTML5Parser::Node& html_doc, 
+                                 const RuleSet& rule_set,
                                  AnalysisReport& report);
 };
 
@@ -216,7 +466,8 @@ public:
                                                        const std::map<const HTML5Parser::Node*, 
                                                                      StyleEngine::ComputedStyle>& styles);
     
-    static std::string render_css_summary(const std::vector<std::unique_ptr<CSS3Parser::CSSStyleSheet>>& stylesheets);
+    static std::string render_css_summary(
+        const std::vector<std::shared_ptr<const CSS3Parser::CSSStyleSheet>>& stylesheets);
     
 private:
     static void render_node_with_styles(const HTML5Parser::Node& node,
@@ -0,0 +1,111 @@
+#ifndef BROWSER_LINE_INDEX_H
+#define BROWSER_LINE_INDEX_H
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace BrowserParser {
+
+// Maps byte offsets to 1-based line/column pairs. Parsers only track byte
+// offsets while scanning; the table of line starts is built on the first
+// lookup, so input that never reports a position never pays for it.
+// "\n", "\r\n" and a lone "\r" each end a line; columns count bytes.
+class LineIndex {
+public:
+    struct Location {
+        size_t line = 0;
+        size_t column = 0;
+    };
+
+    LineIndex() = default;
+    explicit LineIndex(std::string_view text) : text_(text) {}
+
+    // The viewed text must outlive the index
+    void reset(std::string_view text) {
+        text_ = text;
+        line_starts_.clear();
+        built_ = false;
+    }
+
+    Location locate(size_t offset) const {
+        build();
+        offset = std::min(offset, text_.size());
+        auto it = std::upper_bound(line_starts_.begin(), line_starts_.end(), offset);
+        size_t line = static_cast<size_t>(it - line_starts_.begin());
+        return {line, offset - line_starts_[line - 1] + 1};
+    }
+
+    size_t line_count() const {
+        build();
+        return line_starts_.size();
+    }
+
+private:
+    std::string_view text_;
+    mutable std::vector<size_t> line_starts_;
+    mutable bool built_ = false;
+
+    static bool ends_line(std::string_view text, size_t i) {
+        return text[i] == '\n' || (text[i] == '\r' && (i + 1 == text.size() || text[i + 1] != '\n'));
+    }
+
+    void build() const {
+        if (built_) return;
+        built_ = true;
+
+        const char* data = text_.data();
+        const size_t size = text_.size();
+        line_starts_.reserve(count_breaks(data, size) + 1);
+        line_starts_.push_back(0);
+
+        size_t i = 0;
+#if defined(__SSE2__)
+        const __m128i lf = _mm_set1_epi8('\n');
+        const __m128i cr = _mm_set1_epi8('\r');
+        for (; i + 16 <= size; i += 16) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+                _mm_or_si128(_mm_cmpeq_epi8(block, lf), _mm_cmpeq_epi8(block, cr))));
+            while (mask != 0) {
+                size_t at = i + static_cast<size_t>(__builtin_ctz(mask));
+                if (ends_line(text_, at)) line_starts_.push_back(at + 1);
+                mask &= mask - 1;
+            }
+        }
+#endif
+        for (; i < size; ++i) {
+            if ((data[i] == '\n' || data[i] == '\r') && ends_line(text_, i)) {
+                line_starts_.push_back(i + 1);
+            }
+        }
+    }
+
+    // Upper bound on the number of line breaks, used to size the table once
+    static size_t count_breaks(const char* data, size_t size) {
+        size_t count = 0;
+        size_t i = 0;
+#if defined(__SSE2__)
+        const __m128i lf = _mm_set1_epi8('\n');
+        const __m128i cr = _mm_set1_epi8('\r');
+        for (; i + 16 <= size; i += 16) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            count += static_cast<size_t>(__builtin_popcount(static_cast<unsigned>(_mm_movemask_epi8(
+                _mm_or_si128(_mm_cmpeq_epi8(block, lf), _mm_cmpeq_epi8(block, cr))))));
+        }
+#endif
+        for (; i < size; ++i) {
+            count += data[i] == '\n' || data[i] == '\r';
+        }
+        return count;
+    }
+};
+
+} // namespace BrowserParser
+
+#endif // BROWSER_LINE_INDEX_H
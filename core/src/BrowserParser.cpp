@@ -4,14 +4,91 @@
 #include <sstream>
 #include <algorithm>
 #include <regex>
+#include <unordered_set>
 
 namespace BrowserParser {
 
+namespace {
+
+// Early-exit search for any element the selector could ever match
+bool matches_any_element(const CSS3Parser::CompiledSelector& selector, const HTML5Parser::Node& node) {
+    if (node.type == HTML5Parser::NodeType::Element &&
+        CSSMatcher::matches_compiled_selector(selector, node, nullptr, CSSMatcher::MatchMode::Reachable)) {
+        return true;
+    }
+    for (const auto& child : node.children) {
+        if (matches_any_element(selector, *child)) return true;
+    }
+    return false;
+}
+
+bool is_inherited(const std::string& property) {
+    return CSS3Parser::property_info(CSS3Parser::property_id(property)).inherited;
+}
+
+bool is_inherit_keyword(const CSS3Parser::CSSValue& value) {
+    static const Atom inherit_atom = intern_permanent_atom("inherit");
+    return value.is_keyword() && value.atom() == inherit_atom;
+}
+
+bool is_root_element(const HTML5Parser::Node& element) {
+    return !element.parent || element.parent->type == HTML5Parser::NodeType::Document;
+}
+
+// 1-based position among the parent's element children, counted from the
+// last one when from_end, and among those with the same tag when of_type
+size_t sibling_position(const HTML5Parser::Node& element, bool from_end, bool of_type) {
+    if (!element.parent) return 1;
+    const auto& siblings = element.parent->children;
+    size_t position = 0;
+    for (size_t i = 0; i < siblings.size(); ++i) {
+        const HTML5Parser::Node& sibling = *siblings[from_end ? siblings.size() - 1 - i : i];
+        if (sibling.type != HTML5Parser::NodeType::Element) continue;
+        if (of_type && sibling.tag_atom != element.tag_atom) continue;
+        ++position;
+        if (&sibling == &element) break;
+    }
+    return position;
+}
+
+bool matches_nth(int32_t step, int32_t offset, size_t position) {
+    int64_t distance = static_cast<int64_t>(position) - offset;
+    if (step == 0) return distance == 0;
+    return distance / step >= 0 && distance % step == 0;
+}
+
+bool is_form_control(const std::string& tag) {
+    return tag == "input" || tag == "button" || tag == "select" || tag == "textarea" ||
+           tag == "option" || tag == "optgroup" || tag == "fieldset";
+}
+
+bool declares_layers(const CSS3Parser::CSSStyleSheet& stylesheet) {
+    CSS3Parser::CascadeLayers layers;
+    layers.add(stylesheet.rules);
+    return layers.size() > 0;
+}
+
+std::unique_ptr<CSS3Parser::CSSStyleSheet> copy_stylesheet(const CSS3Parser::CSSStyleSheet& stylesheet) {
+    auto copy = std::make_unique<CSS3Parser::CSSStyleSheet>();
+    for (const auto& rule : stylesheet.rules) copy->rules.push_back(rule->clone());
+    copy->imports = stylesheet.imports;
+    copy->href = stylesheet.href;
+    copy->media = stylesheet.media;
+    copy->disabled = stylesheet.disabled;
+    copy->origin = stylesheet.origin;
+    copy->cascade_order_count = stylesheet.cascade_order_count;
+    copy->arenas = stylesheet.arenas;
+    return copy;
+}
+
+} // namespace
+
 WebPageParser::WebPageParser() : options_({}) {}
 
 WebPageParser::WebPageParser(const ParseOptions& options) : options_(options) {}
 
-ParsedDocument WebPageParser::parse_html_with_css(const std::string& html_content) {
+ParsedDocument WebPageParser::parse_html_with_css(const std::string& html_content,
+                                                  const std::vector<std::string>& linked_stylesheets) {
     auto start_time = std::chrono::high_resolution_clock::now();
     
     ParsedDocument document;
@@ -20,10 +97,12 @@ ParsedDocument WebPageParser::parse_html_with_css(const std::string& html_conten
     HTML5Parser::Parser html_parser(html_content, options_.html_options.strict_mode);
     html_parser.set_options(options_.html_options);
     document.html_document = html_parser.parse();
+    document.document_features = html_parser.get_document_features();
     
     // Collect HTML parse errors
     for (const auto& error : html_parser.get_errors()) {
-        document.parse_errors.push_back(std::string("HTML: ") + error.what());
+        document.parse_errors.push_back(std::string("HTML: ") + error.what() +
+                                        " (line " + std::to_string(error.line) + ")");
     }
     
     if (!document.html_document) {
@@ -31,25 +110,41 @@ ParsedDocument WebPageParser::parse_html_with_css(const std::string& html_conten
         return document;
     }
     
+    // Cache entries of the sheets that came from StyleSheetCache, by sheet index
+    std::vector<std::shared_ptr<const StyleSheetCache::Entry>> cached_sheets;
+    
+    // Parse a CSS source, or take it from the cache when another document had it
+    auto add_stylesheet = [&](const std::string& css_content, const std::string& label) {
+        if (css_content.empty()) return false;
+        auto report = [&](const std::vector<CSS3Parser::CSSParseError>& errors) {
+            for (const auto& error : errors) {
+                document.parse_errors.push_back(label + ": " + error.message +
+                                                " (line " + std::to_string(error.line) + ")");
+            }
+        };
+        
+        std::shared_ptr<const CSS3Parser::CSSStyleSheet> stylesheet;
+        if (options_.cache_stylesheets) {
+            auto cached = StyleSheetCache::shared().get(css_content, options_.css_options);
+            report(cached->errors);
+            stylesheet = cached->stylesheet;
+            cached_sheets.resize(document.stylesheets.size());
+            cached_sheets.push_back(std::move(cached));
+        } else {
+            CSS3Parser::CSSParser css_parser(css_content, options_.css_options);
+            stylesheet = css_parser.parse_stylesheet();
+            report(css_parser.get_errors());
+        }
+        
+        if (!stylesheet) return false;
+        document.stylesheets.push_back(std::move(stylesheet));
+        return true;
+    };
+    
     // Extract CSS from HTML
     if (options_.extract_style_elements || options_.extract_inline_styles) {
-        auto css_sources = extract_css_from_html(*document.html_document);
-        
-        // Parse each CSS source
-        for (const auto& css_content : css_sources) {
-            if (!css_content.empty()) {
-                CSS3Parser::CSSParser css_parser(css_content, options_.css_options);
-                auto stylesheet = css_parser.parse_stylesheet();
-                
-                // Collect CSS parse errors
-                for (const auto& error : css_parser.get_errors()) {
-                    document.parse_errors.push_back("CSS: " + error.message);
-                }
-                
-                if (stylesheet) {
-                    document.stylesheets.push_back(std::move(stylesheet));
-                }
-            }
+        for (const auto& css_content : extract_css_from_html(*document.html_document)) {
+            add_stylesheet(css_content, "CSS");
         }
         
         // Extract inline styles
@@ -58,10 +153,66 @@ ParsedDocument WebPageParser::parse_html_with_css(const std::string& html_conten
         }
     }
     
+    // Linked sheets join before layers are ranked and rules pruned, so they
+    // share the document's layer order and rule set
+    for (const auto& css_content : linked_stylesheets) {
+        if (add_stylesheet(css_content, "External CSS")) document.linked_stylesheets++;
+    }
+    
+    // One layer order spans every sheet of the document, so a later sheet
+    // can reorder layers an earlier one named; re-rank once all are in.
+    // Sheets may be shared, so those that declare layers are re-ranked as
+    // copies, made first because CascadeLayers knows anonymous layers by rule
+    if (document.stylesheets.size() > 1) {
+        auto& stylesheets = document.stylesheets;
+        std::vector<std::unique_ptr<CSS3Parser::CSSStyleSheet>> copies(stylesheets.size());
+        bool layered = false;
+        for (size_t i = 0; i < stylesheets.size(); ++i) {
+            if (!declares_layers(*stylesheets[i])) continue;
+            copies[i] = copy_stylesheet(*stylesheets[i]);
+            layered = true;
+        }
+        if (layered) {
+            CSS3Parser::CascadeLayers layers;
+            for (size_t i = 0; i < stylesheets.size(); ++i) {
+                layers.add(copies[i] ? copies[i]->rules : stylesheets[i]->rules);
+            }
+            for (size_t i = 0; i < stylesheets.size(); ++i) {
+                if (!copies[i]) continue;
+                copies[i]->assign_cascade_keys(&layers);
+                stylesheets[i] = std::move(copies[i]);
+            }
+        }
+    }
+    
+    // Drop rules that need atoms the document never uses. Cached sheets bring
+    // their rule sets along; re-ranked copies and uncached sheets get theirs here
+    cached_sheets.resize(document.stylesheets.size());
+    bool any_cached = std::any_of(cached_sheets.begin(), cached_sheets.end(),
+                                  [](const auto& cached) { return cached != nullptr; });
+    if (!any_cached) {
+        document.rule_set = RuleSet::build(document.stylesheets, &document.document_features);
+    } else {
+        std::vector<RuleSet> built;
+        built.reserve(document.stylesheets.size());
+        std::vector<const RuleSet*> sheet_rules;
+        for (size_t i = 0; i < document.stylesheets.size(); ++i) {
+            const auto& cached = cached_sheets[i];
+            if (cached && cached->stylesheet == document.stylesheets[i]) {
+                sheet_rules.push_back(&cached->rule_set);
+            } else {
+                built.push_back(RuleSet::build({document.stylesheets[i]}));
+                sheet_rules.push_back(&built.back());
+            }
+        }
+        document.rule_set = RuleSet::merge(sheet_rules, &document.document_features);
+    }
+    
     // Validation
     if (options_.validate_css_against_html) {
         for (const auto& stylesheet : document.stylesheets) {
-            auto validation_errors = validate_css_selectors_against_html(*stylesheet, *document.html_document);
+            auto validation_errors = validate_css_selectors_against_html(*stylesheet, *document.html_document,
+                                                                         &document.document_features);
             for (const auto& error : validation_errors) {
                 document.parse_errors.push_back("Validation: " + error);
             }
@@ -79,7 +230,8 @@ ParsedDocument WebPageParser::parse_html_with_css(const std::string& html_conten
     return document;
 }
 
-ParsedDocument WebPageParser::parse_html_file(const std::string& file_path) {
+ParsedDocument WebPageParser::parse_html_file(const std::string& file_path,
+                                              const std::vector<std::string>& linked_stylesheets) {
     std::ifstream file(file_path);
     if (!file.is_open()) {
         add_error("Could not open file: " + file_path);
@@ -88,7 +240,7 @@ ParsedDocument WebPageParser::parse_html_file(const std::string& file_path) {
     
     std::stringstream buffer;
     buffer << file.rdbuf();
-    return parse_html_with_css(buffer.str());
+    return parse_html_with_css(buffer.str(), linked_stylesheets);
 }
 
 std::unique_ptr<HTML5Parser::Node> WebPageParser::parse_html(const std::string& html) {
@@ -153,17 +305,18 @@ void WebPageParser::extract_styles_recursive(const HTML5Parser::Node& node,
                 inline_styles[element_id] = style_attr->second;
             }
         }
-        
-        // Recursively process children
-        for (const auto& child : node.children) {
-            extract_styles_recursive(*child, styles, inline_styles);
-        }
+    }
+    
+    // Recursively process children (the document node included)
+    for (const auto& child : node.children) {
+        extract_styles_recursive(*child, styles, inline_styles);
     }
 }
 
 std::vector<std::string> WebPageParser::validate_css_selectors_against_html(
     const CSS3Parser::CSSStyleSheet& stylesheet, 
-    const HTML5Parser::Node& html_doc) {
+    const HTML5Parser::Node& html_doc,
+    const AtomSet* document_features) {
     
     std::vector<std::string> errors;
     
@@ -171,12 +324,13 @@ std::vector<std::string> WebPageParser::validate_css_selectors_against_html(
         if (rule->type == CSS3Parser::RuleType::Style) {
             auto style_rule = static_cast<const CSS3Parser::StyleRule*>(rule.get());
             
-            for (const auto& complex_selector : style_rule->selectors.selectors) {
-                auto matching_elements = CSSMatcher::find_matching_elements(
-                    CSS3Parser::SelectorList{}, html_doc);
+            for (size_t i = 0; i < style_rule->compiled_selectors.size(); ++i) {
+                const auto& compiled = style_rule->compiled_selectors[i];
                 
-                if (matching_elements.empty()) {
-                    errors.push_back("Selector '" + complex_selector.to_string() + 
+                // A missing atom settles it without walking the tree
+                bool possible = !document_features || compiled.may_match(*document_features);
+                if (!possible || !matches_any_element(compiled, html_doc)) {
+                    errors.push_back("Selector '" + style_rule->selectors.selectors[i].to_string() + 
                                    "' does not match any elements");
                 }
             }
@@ -186,20 +340,22 @@ std::vector<std::string> WebPageParser::validate_css_selectors_against_html(
     return errors;
 }
 
-std::map<std::string, int> WebPageParser::compute_selector_specificity(const CSS3Parser::CSSStyleSheet& stylesheet) {
-    std::map<std::string, int> specificity_map;
+std::vector<std::pair<const CSS3Parser::ComplexSelector*, CSS3Parser::Specificity>>
+WebPageParser::compute_selector_specificity(const CSS3Parser::CSSStyleSheet& stylesheet) {
+    std::vector<std::pair<const CSS3Parser::ComplexSelector*, CSS3Parser::Specificity>> specificities;
     
     for (const auto& rule : stylesheet.rules) {
         if (rule->type == CSS3Parser::RuleType::Style) {
             auto style_rule = static_cast<const CSS3Parser::StyleRule*>(rule.get());
             
-            for (const auto& complex_selector : style_rule->selectors.selectors) {
-                specificity_map[complex_selector.to_string()] = complex_selector.specificity();
+            for (size_t i = 0; i < style_rule->compiled_selectors.size(); ++i) {
+                specificities.emplace_back(&style_rule->selectors.selectors[i],
+                                           style_rule->compiled_selectors[i].specificity);
             }
         }
     }
     
-    return specificity_map;
+    return specificities;
 }
 
 void WebPageParser::add_error(const std::string& message) {
@@ -224,6 +380,8 @@ ParsedDocument::Stats WebPageParser::compute_statistics(const ParsedDocument& do
         count_elements(*document.html_document);
     }
     
+    stats.css_rules_pruned = document.rule_set.pruned_rules();
+    
     // Count CSS rules and declarations
     for (const auto& stylesheet : document.stylesheets) {
         stats.css_rules += stylesheet->rules.size();
@@ -242,6 +400,187 @@ ParsedDocument::Stats WebPageParser::compute_statistics(const ParsedDocument& do
     return stats;
 }
 
+// RuleSet implementation
+RuleSet RuleSet::build(const std::vector<std::shared_ptr<const CSS3Parser::CSSStyleSheet>>& stylesheets,
+                       const AtomSet* features) {
+    RuleSet rule_set;
+    uint64_t order_base = 0;
+    
+    auto add = [&](const CSS3Parser::StyleRule* style_rule, uint32_t media, uint32_t scope) {
+        rule_set.total_rules_++;
+        
+        Entry entry;
+        entry.rule = style_rule;
+        entry.order_base = order_base;
+        entry.media = media;
+        entry.scope = scope;
+        for (size_t i = 0; i < style_rule->compiled_selectors.size(); ++i) {
+            if (!features || style_rule->compiled_selectors[i].may_match(*features)) {
+                entry.selectors.push_back(static_cast<uint32_t>(i));
+            }
+        }
+        
+        if (!entry.selectors.empty()) {
+            rule_set.index_.emplace(style_rule, rule_set.entries_.size());
+            rule_set.entries_.push_back(std::move(entry));
+        }
+    };
+    
+    // Conditions are keyed by the preludes of every enclosing @media block
+    std::map<std::string, uint32_t> condition_ids;
+    std::string condition_key;
+    std::function<void(const std::vector<std::unique_ptr<CSS3Parser::CSSRule>>&, uint32_t, uint32_t)> visit =
+        [&](const std::vector<std::unique_ptr<CSS3Parser::CSSRule>>& rules, uint32_t media, uint32_t scope) {
+            for (const auto& rule : rules) {
+                if (rule->type == CSS3Parser::RuleType::Style) {
+                    add(static_cast<const CSS3Parser::StyleRule*>(rule.get()), media, scope);
+                    continue;
+                }
+                if (rule->type != CSS3Parser::RuleType::AtRule) continue;
+                const auto* at_rule = static_cast<const CSS3Parser::AtRule*>(rule.get());
+                if (at_rule->name == "supports" || at_rule->name == "layer") {
+                    // @supports was settled when the sheet loaded, and layer
+                    // ranks are already part of every cascade key
+                    if (at_rule->supported) visit(at_rule->rules, media, scope);
+                    continue;
+                }
+                if (at_rule->name == "scope") {
+                    if (!at_rule->supported) continue;
+                    const auto& roots = at_rule->scope.compiled_roots;
+                    bool reachable = roots.empty() || !features ||
+                                     std::any_of(roots.begin(), roots.end(), [&](const auto& root) {
+                                         return root.may_match(*features);
+                                     });
+                    if (!reachable) continue;
+                    rule_set.scopes_.push_back(ScopeRule{scope, &at_rule->scope});
+                    visit(at_rule->rules, media, static_cast<uint32_t>(rule_set.scopes_.size() - 1));
+                    continue;
+                }
+                if (at_rule->name != "media") continue;
+                
+                size_t key_size = condition_key.size();
+                condition_key += at_rule->prelude;
+                condition_key += '\n';
+                auto [it, inserted] = condition_ids.emplace(condition_key,
+                                                            static_cast<uint32_t>(rule_set.media_conditions_.size()));
+                if (inserted) rule_set.media_conditions_.push_back(MediaCondition{media, &at_rule->media});
+                visit(at_rule->rules, it->second, scope);
+                condition_key.resize(key_size);
+            }
+        };
+    
+    // Later sheets continue the source order where the previous one stopped
+    for (const auto& stylesheet : stylesheets) {
+        visit(stylesheet->rules, 0, 0);
+        order_base += stylesheet->cascade_order_count;
+    }
+    rule_set.order_count_ = order_base;
+    
+    rule_set.link_media_runs();
+    return rule_set;
+}
+
+RuleSet RuleSet::merge(const std::vector<const RuleSet*>& sheets, const AtomSet* features) {
+    constexpr uint32_t unreachable = UINT32_MAX;
+    RuleSet rule_set;
+    uint64_t order_base = 0;
+    
+    for (const RuleSet* sheet : sheets) {
+        // Conditions and scopes are renumbered past the ones already in;
+        // a parent always comes before the blocks inside it
+        uint32_t media_base = static_cast<uint32_t>(rule_set.media_conditions_.size() - 1);
+        for (size_t i = 1; i < sheet->media_conditions_.size(); ++i) {
+            MediaCondition condition = sheet->media_conditions_[i];
+            if (condition.parent != 0) condition.parent += media_base;
+            rule_set.media_conditions_.push_back(condition);
+        }
+        
+        std::vector<uint32_t> scope_ids(sheet->scopes_.size(), 0);
+        for (size_t i = 1; i < sheet->scopes_.size(); ++i) {
+            const ScopeRule& scope = sheet->scopes_[i];
+            const auto& roots = scope.bounds->compiled_roots;
+            bool reachable = scope_ids[scope.parent] != unreachable &&
+                             (roots.empty() || !features ||
+                              std::any_of(roots.begin(), roots.end(), [&](const auto& root) {
+                                  return root.may_match(*features);
+                              }));
+            if (!reachable) {
+                scope_ids[i] = unreachable;
+                continue;
+            }
+            rule_set.scopes_.push_back(ScopeRule{scope_ids[scope.parent], scope.bounds});
+            scope_ids[i] = static_cast<uint32_t>(rule_set.scopes_.size() - 1);
+        }
+        
+        // Like build(), rules under an unreachable @scope are not counted
+        rule_set.total_rules_ += sheet->total_rules_;
+        for (const Entry& source : sheet->entries_) {
+            if (scope_ids[source.scope] == unreachable) {
+                rule_set.total_rules_--;
+                continue;
+            }
+            Entry entry;
+            entry.rule = source.rule;
+            entry.order_base = source.order_base + order_base;
+            entry.media = source.media != 0 ? source.media + media_base : 0;
+            entry.scope = scope_ids[source.scope];
+            for (uint32_t i : source.selectors) {
+                if (!features || source.rule->compiled_selectors[i].may_match(*features)) {
+                    entry.selectors.push_back(i);
+                }
+            }
+            if (!entry.selectors.empty()) {
+                rule_set.index_.emplace(entry.rule, rule_set.entries_.size());
+                rule_set.entries_.push_back(std::move(entry));
+            }
+        }
+        order_base += sheet->order_count_;
+    }
+    rule_set.order_count_ = order_base;
+    
+    rule_set.link_media_runs();
+    return rule_set;
+}
+
+// Runs of entries under one condition are skipped together
+void RuleSet::link_media_runs() {
+    for (size_t i = entries_.size(); i-- > 0;) {
+        bool run_continues = i + 1 < entries_.size() && entries_[i + 1].media == entries_[i].media;
+        entries_[i].block_end = run_continues ? entries_[i + 1].block_end : static_cast<uint32_t>(i + 1);
+    }
+}
+
+MediaMatches RuleSet::evaluate_media(const CSS3Parser::MediaEnvironment& environment) const {
+    // A block's parent always comes first, so one pass settles every condition
+    MediaMatches matches;
+    matches.set(0);
+    for (uint32_t i = 1; i < media_conditions_.size(); ++i) {
+        const MediaCondition& condition = media_conditions_[i];
+        if (matches.test(condition.parent) && condition.query->evaluate(environment)) {
+            matches.set(i);
+        }
+    }
+    return matches;
+}
+
+uint32_t RuleSet::match_scope(const Entry& entry, const CSS3Parser::CompiledSelector& selector,
+                              const HTML5Parser::Node& element) const {
+    const ScopeRule& scope = scopes_[entry.scope];
+    uint32_t proximity = CSSMatcher::match_in_scope(&selector, *scope.bounds, element);
+    for (uint32_t outer = scope.parent; outer != 0 && proximity != CSSMatcher::no_scope;
+         outer = scopes_[outer].parent) {
+        if (CSSMatcher::match_in_scope(nullptr, *scopes_[outer].bounds, element) == CSSMatcher::no_scope) {
+            return CSSMatcher::no_scope;
+        }
+    }
+    return proximity;
+}
+
+const RuleSet::Entry* RuleSet::find(const CSS3Parser::StyleRule* rule) const {
+    auto it = index_.find(rule);
+    return it != index_.end() ? &entries_[it->second] : nullptr;
+}
+
 // CSSMatcher implementation
 CSSMatcher::MatchResult CSSMatcher::matches_selector(const CSS3Parser::ComplexSelector& selector, 
                                                      const HTML5Parser::Node& element,
@@ -309,6 +648,7 @@ CSSMatcher::MatchResult CSSMatcher::matches_simple_selector(const CSS3Parser::Si
     
     switch (selector.type) {
         case CSS3Parser::SelectorType::Universal:
+        case CSS3Parser::SelectorType::Nesting:
             result.matches = true;
             break;
             
@@ -317,13 +657,8 @@ CSSMatcher::MatchResult CSSMatcher::matches_simple_selector(const CSS3Parser::Si
             break;
             
         case CSS3Parser::SelectorType::Class: {
-            auto class_attr = element.attributes.find("class");
-            if (class_attr != element.attributes.end()) {
-                // Simple class matching (space-separated)
-                std::string class_list = " " + class_attr->second + " ";
-                std::string target_class = " " + selector.name + " ";
-                result.matches = (class_list.find(target_class) != std::string::npos);
-            }
+            CSS3Parser::Atom class_atom = BrowserParser::find_atom(selector.name);
+            result.matches = class_atom != BrowserParser::null_atom && has_class(element, class_atom);
             break;
         }
         
@@ -352,49 +687,80 @@ CSSMatcher::MatchResult CSSMatcher::matches_simple_selector(const CSS3Parser::Si
     return result;
 }
 
-bool CSSMatcher::matches_attribute_selector(const CSS3Parser::AttributeSelector& attr_sel,
-                                           const HTML5Parser::Node& element) {
-    auto attr_it = element.attributes.find(attr_sel.name);
+std::vector<const HTML5Parser::Node*> CSSMatcher::find_matching_elements(
+    const CSS3Parser::SelectorList& selectors,
+    const HTML5Parser::Node& document_root) {
     
-    if (attr_it == element.attributes.end()) {
+    std::vector<const HTML5Parser::Node*> matching_elements;
+    
+    std::function<void(const HTML5Parser::Node&)> search_elements = 
+        [&](const HTML5Parser::Node& node) {
+            if (node.type == HTML5Parser::NodeType::Element) {
+                for (const auto& complex_selector : selectors.selectors) {
+                    auto result = matches_selector(complex_selector, node, document_root);
+                    if (result.matches) {
+                        matching_elements.push_back(&node);
+                        break; // Don't add the same element multiple times
+                    }
+                }
+            }
+            
+            for (const auto& child : node.children) {
+                search_elements(*child);
+            }
+        };
+    
+    search_elements(document_root);
+    return matching_elements;
+}
+
+bool CSSMatcher::matches_compiled_selector(const CSS3Parser::CompiledSelector& selector,
+                                           const HTML5Parser::Node& element,
+                                           const HTML5Parser::Node* scope,
+                                           MatchMode mode) {
+    if (selector.empty() || element.type != HTML5Parser::NodeType::Element) {
         return false;
     }
+    return run_selector_program(selector, 0, element, scope, mode);
+}
+
+uint32_t CSSMatcher::match_in_scope(const CSS3Parser::CompiledSelector* selector,
+                                    const CSS3Parser::ScopeBounds& scope,
+                                    const HTML5Parser::Node& element) {
+    auto any_matches = [](const std::vector<CSS3Parser::CompiledSelector>& selectors,
+                          const HTML5Parser::Node& node, const HTML5Parser::Node* root) {
+        for (const auto& compiled : selectors) {
+            if (matches_compiled_selector(compiled, node, root)) return true;
+        }
+        return false;
+    };
     
-    const std::string& attr_value = attr_it->second;
+    // A selector without :scope matches the same from every root, so test it once
+    if (selector && !selector->uses_scope) {
+        if (!matches_compiled_selector(*selector, element)) return no_scope;
+        selector = nullptr;
+    }
     
-    switch (attr_sel.match_type) {
-        case CSS3Parser::AttributeMatchType::Exists:
-            return true;
-            
-        case CSS3Parser::AttributeMatchType::Exact:
-            return attr_value == attr_sel.value;
-            
-        case CSS3Parser::AttributeMatchType::Include: {
-            std::string value_list = " " + attr_value + " ";
-            std::string target_value = " " + attr_sel.value + " ";
-            return value_list.find(target_value) != std::string::npos;
-        }
+    uint32_t generations = 0;
+    for (const HTML5Parser::Node* root = &element; root && root->type == HTML5Parser::NodeType::Element;
+         root = root->parent, ++generations) {
+        bool is_root = scope.compiled_roots.empty() ? is_root_element(*root)
+                                                    : any_matches(scope.compiled_roots, *root, nullptr);
+        if (!is_root) continue;
         
-        case CSS3Parser::AttributeMatchType::Dash:
-            return attr_value == attr_sel.value || 
-                   attr_value.substr(0, attr_sel.value.length() + 1) == attr_sel.value + "-";
-            
-        case CSS3Parser::AttributeMatchType::Prefix:
-            return attr_value.substr(0, attr_sel.value.length()) == attr_sel.value;
-            
-        case CSS3Parser::AttributeMatchType::Suffix:
-            return attr_value.length() >= attr_sel.value.length() &&
-                   attr_value.substr(attr_value.length() - attr_sel.value.length()) == attr_sel.value;
-            
-        case CSS3Parser::AttributeMatchType::Substring:
-            return attr_value.find(attr_sel.value) != std::string::npos;
+        // Limits are matched with :scope bound to the root they cut off
+        bool limited = false;
+        for (const HTML5Parser::Node* node = &element; node != root && !limited; node = node->parent) {
+            limited = any_matches(scope.compiled_limits, *node, root);
+        }
+        if (limited) continue;
+        if (!selector || matches_compiled_selector(*selector, element, root)) return generations;
     }
-    
-    return false;
+    return no_scope;
 }
 
 std::vector<const HTML5Parser::Node*> CSSMatcher::find_matching_elements(
-    const CSS3Parser::SelectorList& selectors,
+    const std::vector<CSS3Parser::CompiledSelector>& selectors,
     const HTML5Parser::Node& document_root) {
     
     std::vector<const HTML5Parser::Node*> matching_elements;
@@ -402,9 +768,8 @@ std::vector<const HTML5Parser::Node*> CSSMatcher::find_matching_elements(
     std::function<void(const HTML5Parser::Node&)> search_elements = 
         [&](const HTML5Parser::Node& node) {
             if (node.type == HTML5Parser::NodeType::Element) {
-                for (const auto& complex_selector : selectors.selectors) {
-                    auto result = matches_selector(complex_selector, node, document_root);
-                    if (result.matches) {
+                for (const auto& compiled : selectors) {
+                    if (matches_compiled_selector(compiled, node)) {
                         matching_elements.push_back(&node);
                         break; // Don't add the same element multiple times
                     }
@@ -420,6 +785,595 @@ std::vector<const HTML5Parser::Node*> CSSMatcher::find_matching_elements(
     return matching_elements;
 }
 
+bool CSSMatcher::run_selector_program(const CSS3Parser::CompiledSelector& selector,
+                                      size_t pc,
+                                      const HTML5Parser::Node& element,
+                                      const HTML5Parser::Node* scope,
+                                      MatchMode mode) {
+    using CSS3Parser::SelectorOp;
+    
+    // Compound tests run until the next combinator; combinators recurse so
+    // that descendant and general sibling steps can backtrack
+    for (; pc < selector.program.size(); ++pc) {
+        const auto& instruction = selector.program[pc];
+        
+        switch (instruction.op) {
+            case SelectorOp::Universal:
+                break;
+                
+            case SelectorOp::Tag:
+                if (element.tag_atom != instruction.operand) return false;
+                break;
+                
+            case SelectorOp::Id:
+                if (element.id_atom != instruction.operand) return false;
+                break;
+                
+            case SelectorOp::Class:
+                if (!has_class(element, instruction.operand)) return false;
+                break;
+                
+            case SelectorOp::Attribute:
+                if (!matches_attribute_selector(selector.attributes[instruction.operand].selector, element)) {
+                    return false;
+                }
+                break;
+                
+            case SelectorOp::Pseudo:
+                if (!matches_pseudo_class(selector.pseudos[instruction.operand], element, scope, mode)) {
+                    return false;
+                }
+                break;
+                
+            case SelectorOp::PseudoElement:
+                // Pseudo-elements style generated boxes of the subject
+                if (mode == MatchMode::Cascade) return false;
+                break;
+                
+            case SelectorOp::Scope:
+                if (scope ? &element != scope : !is_root_element(element)) return false;
+                break;
+                
+            case SelectorOp::Ancestor:
+                for (const HTML5Parser::Node* ancestor = element.parent; 
+                     ancestor && ancestor->type == HTML5Parser::NodeType::Element;
+                     ancestor = ancestor->parent) {
+                    if (run_selector_program(selector, pc + 1, *ancestor, scope, mode)) return true;
+                }
+                return false;
+                
+            case SelectorOp::Parent: {
+                const HTML5Parser::Node* parent = element.parent;
+                return parent && parent->type == HTML5Parser::NodeType::Element &&
+                       run_selector_program(selector, pc + 1, *parent, scope, mode);
+            }
+                
+            case SelectorOp::Previous: {
+                const HTML5Parser::Node* sibling = previous_element_sibling(element);
+                return sibling && run_selector_program(selector, pc + 1, *sibling, scope, mode);
+            }
+                
+            case SelectorOp::AnyPrevious:
+                for (const HTML5Parser::Node* sibling = previous_element_sibling(element);
+                     sibling; sibling = previous_element_sibling(*sibling)) {
+                    if (run_selector_program(selector, pc + 1, *sibling, scope, mode)) return true;
+                }
+                return false;
+                
+            case SelectorOp::Match:
+                return true;
+        }
+    }
+    
+    return true;
+}
+
+bool CSSMatcher::has_class(const HTML5Parser::Node& element, CSS3Parser::Atom class_atom) {
+    if (!(element.class_signature & BrowserParser::atom_signature_bit(class_atom))) {
+        return false;
+    }
+    for (CSS3Parser::Atom atom : element.class_atoms) {
+        if (atom == class_atom) return true;
+    }
+    return false;
+}
+
+bool CSSMatcher::matches_pseudo_class(const CSS3Parser::CompiledPseudo& pseudo,
+                                      const HTML5Parser::Node& element,
+                                      const HTML5Parser::Node* scope,
+                                      MatchMode mode) {
+    const std::string& name = pseudo.selector.name;
+    
+    // Selector-list arguments; one that failed to parse leaves the pseudo unknown
+    if (pseudo.selector.selectors) {
+        auto any_argument = [&](MatchMode argument_mode) {
+            for (const auto& argument : pseudo.arguments) {
+                if (matches_compiled_selector(argument, element, scope, argument_mode)) return true;
+            }
+            return false;
+        };
+        if (name == ":is" || name == ":where" || name == ":matches") return any_argument(mode);
+        // Some state of the element escapes every argument only if none
+        // matches as the document stands, so :not(:hover) stays reachable
+        if (name == ":not") return !any_argument(MatchMode::Cascade);
+        for (const auto& argument : pseudo.arguments) {
+            if (matches_relative_selector(argument, element, mode)) return true;
+        }
+        return false;
+    }
+    
+    if (name == ":root") {
+        return is_root_element(element);
+    }
+    if (name == ":scope") {
+        return scope ? &element == scope : is_root_element(element);
+    }
+    if (name == ":empty") {
+        return element.children.empty();
+    }
+    if (name == ":first-child") return sibling_position(element, false, false) == 1;
+    if (name == ":last-child") return sibling_position(element, true, false) == 1;
+    if (name == ":only-child") {
+        return sibling_position(element, false, false) == 1 && sibling_position(element, true, false) == 1;
+    }
+    if (name == ":first-of-type") return sibling_position(element, false, true) == 1;
+    if (name == ":last-of-type") return sibling_position(element, true, true) == 1;
+    if (name == ":only-of-type") {
+        return sibling_position(element, false, true) == 1 && sibling_position(element, true, true) == 1;
+    }
+    if (name == ":nth-child" || name == ":nth-last-child" || name == ":nth-of-type" ||
+        name == ":nth-last-of-type") {
+        bool from_end = name == ":nth-last-child" || name == ":nth-last-of-type";
+        bool of_type = name == ":nth-of-type" || name == ":nth-last-of-type";
+        return matches_nth(pseudo.nth_step, pseudo.nth_offset, sibling_position(element, from_end, of_type));
+    }
+    
+    // Nothing has been visited yet, so every link is unvisited
+    if (name == ":link" || name == ":any-link") {
+        return (element.tag_name == "a" || element.tag_name == "area") && element.attributes.count("href");
+    }
+    if (name == ":checked") {
+        return element.attributes.count(element.tag_name == "option" ? "selected" : "checked") != 0;
+    }
+    if (name == ":disabled" || name == ":enabled") {
+        if (!is_form_control(element.tag_name)) return false;
+        return (element.attributes.count("disabled") != 0) == (name == ":disabled");
+    }
+    if (name == ":required" || name == ":optional") {
+        const std::string& tag = element.tag_name;
+        if (tag != "input" && tag != "select" && tag != "textarea") return false;
+        return (element.attributes.count("required") != 0) == (name == ":required");
+    }
+    if (name == ":defined") {
+        return true;
+    }
+    
+    // Dynamic (:hover, :focus, :visited, ...) and unsupported pseudo-classes
+    return mode == MatchMode::Reachable;
+}
+
+bool CSSMatcher::matches_relative_selector(const CSS3Parser::CompiledSelector& selector,
+                                           const HTML5Parser::Node& anchor,
+                                           MatchMode mode) {
+    using CSS3Parser::SelectorOp;
+    
+    // The anchor's :scope compound is compiled last, right after the
+    // combinator the argument opened with; a sibling one reaches the
+    // following siblings and their descendants, any other the descendants
+    const auto& program = selector.program;
+    SelectorOp opening = program.size() >= 3 ? program[program.size() - 3].op : SelectorOp::Ancestor;
+    
+    std::function<bool(const HTML5Parser::Node&)> any_descendant = [&](const HTML5Parser::Node& node) {
+        for (const auto& child : node.children) {
+            if (child->type != HTML5Parser::NodeType::Element) continue;
+            if (matches_compiled_selector(selector, *child, &anchor, mode) || any_descendant(*child)) return true;
+        }
+        return false;
+    };
+    
+    if (opening != SelectorOp::Previous && opening != SelectorOp::AnyPrevious) {
+        return any_descendant(anchor);
+    }
+    if (!anchor.parent) return false;
+    bool following = false;
+    for (const auto& sibling : anchor.parent->children) {
+        if (sibling.get() == &anchor) {
+            following = true;
+            continue;
+        }
+        if (!following || sibling->type != HTML5Parser::NodeType::Element) continue;
+        if (matches_compiled_selector(selector, *sibling, &anchor, mode) || any_descendant(*sibling)) return true;
+    }
+    return false;
+}
+
+const HTML5Parser::Node* CSSMatcher::previous_element_sibling(const HTML5Parser::Node& element) {
+    if (!element.parent) return nullptr;
+    
+    const HTML5Parser::Node* previous = nullptr;
+    for (const auto& child : element.parent->children) {
+        if (child.get() == &element) return previous;
+        if (child->type == HTML5Parser::NodeType::Element) previous = child.get();
+    }
+    return nullptr;
+}
+
+// StyleEngine implementation
+StyleEngine::StyleEngine(const ParsedDocument& document) : document_(document), rules_(&document.rule_set) {
+    // Documents assembled by hand have no rule set yet; match everything
+    if (document.rule_set.total_rules() == 0 && !document.stylesheets.empty()) {
+        unpruned_rules_ = RuleSet::build(document.stylesheets);
+        rules_ = &unpruned_rules_;
+    }
+    media_ = media_for(environment_);
+}
+
+void StyleEngine::set_environment(const CSS3Parser::MediaEnvironment& environment) {
+    media_ = media_for(environment);
+    environment_ = environment;
+}
+
+const MediaMatches& StyleEngine::media_for(const CSS3Parser::MediaEnvironment& environment) {
+    for (const auto& [cached, matches] : media_cache_) {
+        if (cached == environment) return matches;
+    }
+    media_cache_.emplace_back(environment, rules_->evaluate_media(environment));
+    return media_cache_.back().second;
+}
+
+StyleEngine::ComputedStyle StyleEngine::compute_style(const HTML5Parser::Node& element) {
+    if (element.parent && element.parent->type == HTML5Parser::NodeType::Element) {
+        ComputedStyle parent_style = compute_style(*element.parent);
+        return cascade(element, &parent_style);
+    }
+    return cascade(element, nullptr);
+}
+
+std::map<const HTML5Parser::Node*, StyleEngine::ComputedStyle> StyleEngine::compute_all_styles() {
+    std::map<const HTML5Parser::Node*, ComputedStyle> styles;
+    if (!document_.html_document) {
+        return styles;
+    }
+    
+    std::function<void(const HTML5Parser::Node&, const ComputedStyle*)> visit = 
+        [&](const HTML5Parser::Node& node, const ComputedStyle* parent_style) {
+            const ComputedStyle* style_for_children = parent_style;
+            if (node.type == HTML5Parser::NodeType::Element) {
+                auto inserted = styles.emplace(&node, cascade(node, parent_style));
+                style_for_children = &inserted.first->second;
+            }
+            for (const auto& child : node.children) {
+                visit(*child, style_for_children);
+            }
+        };
+    
+    visit(*document_.html_document, nullptr);
+    return styles;
+}
+
+std::vector<StyleEngine::SharedStyleMap> StyleEngine::compute_all_styles(
+    const std::vector<CSS3Parser::MediaEnvironment>& environments) {
+    const size_t count = environments.size();
+    std::vector<SharedStyleMap> styles(count);
+    if (!document_.html_document || count == 0) {
+        return styles;
+    }
+    
+    std::vector<MediaMatches> media;
+    media.reserve(count);
+    for (const auto& environment : environments) media.push_back(media_for(environment));
+    const auto& entries = rules_->entries();
+    
+    // Properties a descendant can read from its parent even though they are
+    // not inherited: those some rule sets to 'inherit', or to a var() that
+    // could substitute it. Shorthands stand for their longhands either way
+    std::vector<bool> read_by_children(CSS3Parser::property_count, false);
+    auto longhands_of = [](CSS3Parser::PropertyId id) {
+        const auto& info = CSS3Parser::property_info(id);
+        return info.is_shorthand() ? std::vector<CSS3Parser::PropertyId>(info.longhands, info.longhands + info.longhand_count)
+                                   : std::vector<CSS3Parser::PropertyId>{id};
+    };
+    for (const auto& entry : entries) {
+        for (const auto& decl : entry.rule->declarations) {
+            if (is_inherit_keyword(decl.value) || decl.pending_substitution || CSS3Parser::contains_var(decl.value)) {
+                read_by_children[static_cast<size_t>(decl.id)] = true;
+                for (auto id : longhands_of(decl.id)) read_by_children[static_cast<size_t>(id)] = true;
+            }
+        }
+    }
+    
+    // Conditional rules whose declarations reach descendants: inherited and
+    // custom properties, and the ones above. The others only ever change the
+    // element itself
+    std::vector<bool> reaches_children(entries.size(), false);
+    for (size_t index = 0; index < entries.size(); ++index) {
+        if (entries[index].media == 0) continue;
+        for (const auto& decl : entries[index].rule->declarations) {
+            if (decl.id == CSS3Parser::PropertyId::Custom || read_by_children[static_cast<size_t>(decl.id)]) {
+                reaches_children[index] = true;
+            }
+            for (auto id : longhands_of(decl.id)) {
+                if (CSS3Parser::property_info(id).inherited || read_by_children[static_cast<size_t>(id)]) {
+                    reaches_children[index] = true;
+                }
+            }
+            if (reaches_children[index]) break;
+        }
+    }
+    
+    // Environments share an element's cascade when they inherit from the same
+    // style and every matched conditional rule is in or out for both. When
+    // they only disagree on rules that stay with the element, the children
+    // still see the same inherited values and keep sharing below it
+    auto differ = [&](const std::vector<MatchedRule>& matched, size_t a, size_t b, bool children_only) {
+        for (const MatchedRule& match : matched) {
+            uint32_t condition = entries[match.entry].media;
+            if (condition != 0 && media[a].test(condition) != media[b].test(condition) &&
+                (!children_only || reaches_children[match.entry])) {
+                return true;
+            }
+        }
+        return false;
+    };
+    
+    std::vector<size_t> owner(count);
+    std::vector<std::shared_ptr<const ComputedStyle>> resolved(count); // the element's style, by owner
+    std::function<void(const HTML5Parser::Node&, const std::vector<const ComputedStyle*>&)> visit =
+        [&](const HTML5Parser::Node& node, const std::vector<const ComputedStyle*>& parents) {
+            std::vector<const ComputedStyle*> for_children = parents;
+            if (node.type == HTML5Parser::NodeType::Element) {
+                std::vector<MatchedRule> matched = match_rules(node, nullptr);
+                for (size_t e = 0; e < count; ++e) {
+                    owner[e] = e;
+                    for (size_t f = 0; f < e; ++f) {
+                        if (owner[f] == f && parents[f] == parents[e] && !differ(matched, e, f, false)) {
+                            owner[e] = f;
+                            break;
+                        }
+                    }
+                    if (owner[e] != e) {
+                        styles[e].emplace(&node, resolved[owner[e]]);
+                        for_children[e] = for_children[owner[e]];
+                        continue;
+                    }
+                    resolved[e] = std::make_shared<const ComputedStyle>(resolve(node, matched, media[e], parents[e]));
+                    styles[e].emplace(&node, resolved[e]);
+                    for_children[e] = resolved[e].get();
+                    for (size_t f = 0; f < e; ++f) {
+                        if (parents[f] == parents[e] && !differ(matched, e, f, true)) {
+                            for_children[e] = for_children[f];
+                            break;
+                        }
+                    }
+                }
+            }
+            for (const auto& child : node.children) {
+                visit(*child, for_children);
+            }
+        };
+    
+    visit(*document_.html_document, std::vector<const ComputedStyle*>(count, nullptr));
+    return styles;
+}
+
+StyleEngine::ComputedStyle StyleEngine::cascade(const HTML5Parser::Node& element, 
+                                                const ComputedStyle* parent_style) {
+    return resolve(element, match_rules(element, &media_), media_, parent_style);
+}
+
+std::vector<StyleEngine::MatchedRule> StyleEngine::match_rules(const HTML5Parser::Node& element,
+                                                               const MediaMatches* media) const {
+    std::vector<MatchedRule> matched;
+    const auto& entries = rules_->entries();
+    for (size_t index = 0; index < entries.size(); ++index) {
+        const auto& entry = entries[index];
+        if (media && !media->test(entry.media)) {
+            index = entry.block_end - 1; // the whole @media block is out
+            continue;
+        }
+        const auto* style_rule = entry.rule;
+        MatchedRule match;
+        match.entry = static_cast<uint32_t>(index);
+        for (uint32_t i : entry.selectors) {
+            const auto& compiled = style_rule->compiled_selectors[i];
+            uint32_t proximity = CSSMatcher::no_scope;
+            if ((!match.selector || compiled.specificity > match.specificity) &&
+                matches_entry(entry, compiled, element, proximity)) {
+                match.specificity = compiled.specificity;
+                match.selector = &style_rule->selectors.selectors[i];
+                match.proximity = proximity;
+            }
+        }
+        if (match.selector) matched.push_back(match);
+    }
+    return matched;
+}
+
+bool StyleEngine::matches_entry(const RuleSet::Entry& entry, const CSS3Parser::CompiledSelector& selector,
+                                const HTML5Parser::Node& element, uint32_t& proximity) const {
+    if (entry.scope == 0) return CSSMatcher::matches_compiled_selector(selector, element);
+    proximity = rules_->match_scope(entry, selector, element);
+    return proximity != CSSMatcher::no_scope;
+}
+
+StyleEngine::ComputedStyle StyleEngine::resolve(const HTML5Parser::Node& /* element */,
+                                                const std::vector<MatchedRule>& matched,
+                                                const MediaMatches& media, const ComputedStyle* parent_style) {
+    struct Candidate {
+        const CSS3Parser::CSSDeclaration* declaration = nullptr;
+        const CSS3Parser::ComplexSelector* selector = nullptr;
+        CSS3Parser::Specificity specificity;
+        uint64_t key = 0;
+        uint32_t proximity = CSSMatcher::no_scope;
+        
+        // Scope proximity sits between specificity and source order: the
+        // nearer @scope root wins, and unscoped rules are the farthest
+        bool outranks(const Candidate& other) const {
+            uint64_t rank = key >> CSS3Parser::CascadeKey::order_bits;
+            uint64_t other_rank = other.key >> CSS3Parser::CascadeKey::order_bits;
+            if (rank != other_rank) return rank > other_rank;
+            if (proximity != other.proximity) return proximity < other.proximity;
+            return key > other.key;
+        }
+    };
+    
+    // Collect declarations from every matched rule in play; the candidate
+    // that outranks the others wins each property. Known properties compete
+    // by id, so aliases and vendor-prefixed spellings share one slot
+    std::vector<Candidate> winners(CSS3Parser::property_count);
+    std::vector<CSS3Parser::PropertyId> seen;
+    std::map<std::string, Candidate> named_winners; // custom and unknown properties
+    const auto& entries = rules_->entries();
+    for (const MatchedRule& match : matched) {
+        const auto& entry = entries[match.entry];
+        if (!media.test(entry.media)) continue;
+        
+        for (const auto& decl : entry.rule->declarations) {
+            uint64_t key = CSS3Parser::CascadeKey::with_specificity(decl.cascade_key + entry.order_base,
+                                                                    match.specificity);
+            Candidate candidate{&decl, match.selector, match.specificity, key, match.proximity};
+            if (decl.id == CSS3Parser::PropertyId::Unknown || decl.id == CSS3Parser::PropertyId::Custom) {
+                auto [it, inserted] = named_winners.emplace(decl.property, candidate);
+                if (!inserted && candidate.outranks(it->second)) it->second = candidate;
+                continue;
+            }
+            Candidate& slot = winners[static_cast<size_t>(decl.id)];
+            if (!slot.declaration) {
+                seen.push_back(decl.id);
+                slot = candidate;
+            } else if (candidate.outranks(slot)) {
+                slot = candidate;
+            }
+        }
+    }
+    
+    // Custom properties resolve first, since any other value may refer to them
+    ComputedStyle style;
+    std::vector<const CSS3Parser::CSSDeclaration*> custom_declarations;
+    for (const auto& [property, candidate] : named_winners) {
+        if (candidate.declaration->id == CSS3Parser::PropertyId::Custom) {
+            custom_declarations.push_back(candidate.declaration);
+        }
+    }
+    style.variables = variables_.inherit(parent_style ? parent_style->variables : CSS3Parser::CustomPropertyMap(),
+                                         custom_declarations);
+    
+    auto apply = [&](const std::string& property, const Candidate& candidate) {
+        const CSS3Parser::CSSDeclaration& declaration = *candidate.declaration;
+        CSS3Parser::CSSValue value = declaration.value;
+        if (declaration.pending_substitution || CSS3Parser::contains_var(value)) {
+            // Invalid at computed-value time: the property behaves as unset
+            if (!variables_.substitute(style.variables, declaration, value)) {
+                if (is_inherited(property)) return;
+                value = CSS3Parser::initial_value(declaration.id);
+                if (value.empty()) return;
+            }
+        }
+        // 'inherit' takes the parent's computed value, so it follows whatever
+        // environment the parent was cascaded for; the root keeps the keyword
+        if (is_inherit_keyword(value) && parent_style) {
+            auto inherited = parent_style->properties.find(property);
+            value = inherited != parent_style->properties.end() ? inherited->second : CSS3Parser::CSSValue("initial");
+        }
+        style.properties[property] = value;
+        style.specificity[property] = candidate.specificity;
+        style.source[property] = candidate.selector->to_string();
+    };
+    for (CSS3Parser::PropertyId id : seen) {
+        apply(std::string(CSS3Parser::property_name(id)), winners[static_cast<size_t>(id)]);
+    }
+    for (const auto& [property, candidate] : named_winners) {
+        if (candidate.declaration->id != CSS3Parser::PropertyId::Custom) apply(property, candidate);
+    }
+    
+    // Inherited properties fall through from the parent
+    if (parent_style) {
+        for (const auto& [property, value] : parent_style->properties) {
+            if (!style.properties.count(property) && is_inherited(property)) {
+                style.properties[property] = value;
+                style.specificity[property] = CSS3Parser::Specificity();
+                style.source[property] = "inherited";
+            }
+        }
+    }
+    
+    return style;
+}
+
+CSS3Parser::CSSValue StyleEngine::resolve_property(const std::string& property, 
+                                                   const HTML5Parser::Node& element) {
+    auto declarations = get_matching_declarations(property, element);
+    if (declarations.empty()) {
+        if (is_inherited(property) && element.parent &&
+            element.parent->type == HTML5Parser::NodeType::Element) {
+            return inherit_property(property, element, *element.parent);
+        }
+        return CSS3Parser::CSSValue("initial");
+    }
+    
+    const auto* best = &declarations.front();
+    for (const auto& candidate : declarations) {
+        if (candidate.second > best->second) {
+            best = &candidate;
+        }
+    }
+    return compute_value(best->first.value, property, element);
+}
+
+CSS3Parser::CSSValue StyleEngine::inherit_property(const std::string& property,
+                                                   const HTML5Parser::Node& /* element */,
+                                                   const HTML5Parser::Node& parent) {
+    return resolve_property(property, parent);
+}
+
+CSS3Parser::CSSValue StyleEngine::compute_value(const CSS3Parser::CSSValue& specified_value,
+                                                const std::string& property,
+                                                const HTML5Parser::Node& element) {
+    if (is_inherit_keyword(specified_value) && element.parent && element.parent->type == HTML5Parser::NodeType::Element) {
+        return inherit_property(property, element, *element.parent);
+    }
+    return specified_value;
+}
+
+std::vector<std::pair<CSS3Parser::CSSDeclaration, uint64_t>> StyleEngine::get_matching_declarations(
+    const std::string& property, const HTML5Parser::Node& element) {
+    
+    std::vector<std::pair<CSS3Parser::CSSDeclaration, uint64_t>> declarations;
+    CSS3Parser::PropertyId id = CSS3Parser::property_id(property);
+    bool by_id = id != CSS3Parser::PropertyId::Unknown && id != CSS3Parser::PropertyId::Custom;
+    
+    const auto& entries = rules_->entries();
+    for (size_t index = 0; index < entries.size(); ++index) {
+        const auto& entry = entries[index];
+        if (!media_.test(entry.media)) {
+            index = entry.block_end - 1;
+            continue;
+        }
+        bool matched = false;
+        CSS3Parser::Specificity specificity;
+        for (uint32_t i : entry.selectors) {
+            const auto& compiled = entry.rule->compiled_selectors[i];
+            uint32_t proximity = CSSMatcher::no_scope;
+            if ((!matched || compiled.specificity > specificity) &&
+                matches_entry(entry, compiled, element, proximity)) {
+                matched = true;
+                specificity = compiled.specificity;
+            }
+        }
+        if (!matched) continue;
+        
+        for (const auto& decl : entry.rule->declarations) {
+            if (by_id ? decl.id == id : decl.property == property) {
+                uint64_t key = CSS3Parser::CascadeKey::with_specificity(decl.cascade_key + entry.order_base,
+                                                                        specificity);
+                declarations.emplace_back(decl, key);
+            }
+        }
+    }
+    
+    return declarations;
+}
+
 // HTMLCSSAnalyzer implementation
 HTMLCSSAnalyzer::AnalysisReport HTMLCSSAnalyzer::analyze(const ParsedDocument& document) {
     AnalysisReport report;
@@ -428,19 +1382,30 @@ HTMLCSSAnalyzer::AnalysisReport HTMLCSSAnalyzer::analyze(const ParsedDocument& d
     
     // Analyze HTML structure
     if (document.html_document) {
-        analyze_html_structure(*document.html_document, report);
+        std::unordered_map<Atom, size_t> class_counts;
+        analyze_html_structure(*document.html_document, report, class_counts);
+        for (const auto& [class_atom, count] : class_counts) {
+            report.class_usage[std::string(atom_name(class_atom))] += count;
+        }
     }
     
-    // Analyze CSS usage
+    // Analyze CSS usage; hand-built documents carry no rule set, so match everything
+    RuleSet unpruned_rules;
+    const RuleSet* rule_set = &document.rule_set;
+    if (document.rule_set.total_rules() == 0 && !document.stylesheets.empty()) {
+        unpruned_rules = RuleSet::build(document.stylesheets);
+        rule_set = &unpruned_rules;
+    }
     for (const auto& stylesheet : document.stylesheets) {
         if (document.html_document) {
-            analyze_css_usage(*stylesheet, *document.html_document, report);
+            analyze_css_usage(*stylesheet, *document.html_document, *rule_set, report);
         }
     }
     
     // Count inline styles
     report.inline_styles = document.inline_styles.size();
-    report.internal_stylesheets = document.stylesheets.size();
+    report.internal_stylesheets = document.stylesheets.size() - document.linked_stylesheets;
+    report.external_stylesheets = document.linked_stylesheets;
     
     auto end_time = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
@@ -449,7 +1414,8 @@ HTMLCSSAnalyzer::AnalysisReport HTMLCSSAnalyzer::analyze(const ParsedDocument& d
     return report;
 }
 
-void HTMLCSSAnalyzer::analyze_html_structure(const HTML5Parser::Node& node, AnalysisReport& report) {
+void HTMLCSSAnalyzer::analyze_html_structure(const HTML5Parser::Node& node, AnalysisReport& report,
+                                             std::unordered_map<Atom, size_t>& class_counts) {
     if (node.type == HTML5Parser::NodeType::Element) {
         report.total_elements++;
         report.element_counts[node.tag_name]++;
@@ -461,28 +1427,24 @@ void HTMLCSSAnalyzer::analyze_html_structure(const HTML5Parser::Node& node, Anal
             report.id_usage[id_attr->second]++;
         }
         
-        // Check for classes
-        auto class_attr = node.attributes.find("class");
-        if (class_attr != node.attributes.end()) {
+        // Check for classes (tokenized and interned by the HTML parser)
+        if (node.attributes.count("class")) {
             report.elements_with_classes++;
-            
-            // Split class names
-            std::istringstream class_stream(class_attr->second);
-            std::string class_name;
-            while (class_stream >> class_name) {
-                report.class_usage[class_name]++;
+            for (Atom class_atom : node.class_atoms) {
+                class_counts[class_atom]++;
             }
         }
     }
     
     // Recursively analyze children
     for (const auto& child : node.children) {
-        analyze_html_structure(*child, report);
+        analyze_html_structure(*child, report, class_counts);
     }
 }
 
 void HTMLCSSAnalyzer::analyze_css_usage(const CSS3Parser::CSSStyleSheet& stylesheet, 
                                        const HTML5Parser::Node& html_doc, 
+                                       const RuleSet& rule_set,
                                        AnalysisReport& report) {
     for (const auto& rule : stylesheet.rules) {
         if (rule->type == CSS3Parser::RuleType::Style) {
@@ -491,12 +1453,20 @@ void HTMLCSSAnalyzer::analyze_css_usage(const CSS3Parser::CSSStyleSheet& stylesh
             report.total_declarations += style_rule->declarations.size();
             
             // Analyze specificity
-            int max_specificity = style_rule->selectors.max_specificity();
+            CSS3Parser::Specificity max_specificity = style_rule->selectors.max_specificity();
             report.specificity_distribution[max_specificity]++;
             
-            // Check if selectors match any elements
-            auto matching_elements = CSSMatcher::find_matching_elements(style_rule->selectors, html_doc);
-            if (matching_elements.empty()) {
+            // Pruned rules are unused without matching; the rest try only their surviving selectors
+            bool used = false;
+            if (const RuleSet::Entry* entry = rule_set.find(style_rule)) {
+                for (uint32_t i : entry->selectors) {
+                    if (matches_any_element(style_rule->compiled_selectors[i], html_doc)) {
+                        used = true;
+                        break;
+                    }
+                }
+            }
+            if (!used) {
                 report.unused_selectors++;
                 report.unused_css_selectors.push_back(style_rule->selectors.to_string());
             }
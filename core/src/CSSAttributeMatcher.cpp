@@ -0,0 +1,175 @@
+#include "BrowserParser.h"
+#include <cstring>
+#include <string_view>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace BrowserParser {
+
+namespace {
+
+// Attribute values are compared in place; none of the operators below
+// allocate. The 'i' flag folds ASCII letters only, as the selectors spec asks.
+
+inline char fold_ascii(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+inline bool is_html_whitespace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+bool equal_range(const char* a, const char* b, size_t length, bool case_insensitive) {
+    if (!case_insensitive) {
+        return std::memcmp(a, b, length) == 0;
+    }
+    for (size_t i = 0; i < length; ++i) {
+        if (fold_ascii(a[i]) != fold_ascii(b[i])) return false;
+    }
+    return true;
+}
+
+bool equals(std::string_view value, std::string_view target, bool case_insensitive) {
+    return value.size() == target.size() &&
+           equal_range(value.data(), target.data(), value.size(), case_insensitive);
+}
+
+bool starts_with(std::string_view value, std::string_view prefix, bool case_insensitive) {
+    return value.size() >= prefix.size() &&
+           equal_range(value.data(), prefix.data(), prefix.size(), case_insensitive);
+}
+
+bool ends_with(std::string_view value, std::string_view suffix, bool case_insensitive) {
+    return value.size() >= suffix.size() &&
+           equal_range(value.data() + value.size() - suffix.size(), suffix.data(),
+                       suffix.size(), case_insensitive);
+}
+
+#if defined(__SSE2__)
+// Lowercases the ASCII letters of 16 bytes at once
+inline __m128i fold_block(__m128i block) {
+    const __m128i upper_a = _mm_set1_epi8('A' - 1);
+    const __m128i upper_z = _mm_set1_epi8('Z' + 1);
+    __m128i is_upper = _mm_and_si128(_mm_cmpgt_epi8(block, upper_a), _mm_cmplt_epi8(block, upper_z));
+    return _mm_add_epi8(block, _mm_and_si128(is_upper, _mm_set1_epi8('a' - 'A')));
+}
+#endif
+
+// Returns the offset of needle in haystack at or after from, or npos.
+// Candidate positions are filtered 16 at a time by comparing the first and
+// last needle bytes; only survivors are verified byte by byte.
+size_t find_substring(std::string_view haystack, std::string_view needle,
+                      size_t from, bool case_insensitive) {
+    if (needle.empty()) return from <= haystack.size() ? from : std::string_view::npos;
+    if (from >= haystack.size() || haystack.size() - from < needle.size()) {
+        return std::string_view::npos;
+    }
+
+    const char* data = haystack.data();
+    const size_t last = needle.size() - 1;
+    const size_t end = haystack.size() - needle.size(); // last valid start
+    const char first_byte = case_insensitive ? fold_ascii(needle.front()) : needle.front();
+    const char last_byte = case_insensitive ? fold_ascii(needle.back()) : needle.back();
+    size_t pos = from;
+
+#if defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(first_byte);
+    const __m128i final = _mm_set1_epi8(last_byte);
+
+    for (; pos + 16 <= end + 1; pos += 16) {
+        __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+        __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos + last));
+        if (case_insensitive) {
+            head = fold_block(head);
+            tail = fold_block(tail);
+        }
+
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, final))));
+        while (mask != 0) {
+            unsigned bit = static_cast<unsigned>(__builtin_ctz(mask));
+            if (equal_range(data + pos + bit + 1, needle.data() + 1,
+                            needle.size() > 1 ? needle.size() - 2 : 0, case_insensitive)) {
+                return pos + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for (; pos <= end; ++pos) {
+        char head = case_insensitive ? fold_ascii(data[pos]) : data[pos];
+        char tail = case_insensitive ? fold_ascii(data[pos + last]) : data[pos + last];
+        if (head == first_byte && tail == last_byte &&
+            equal_range(data + pos + 1, needle.data() + 1,
+                        needle.size() > 1 ? needle.size() - 2 : 0, case_insensitive)) {
+            return pos;
+        }
+    }
+    return std::string_view::npos;
+}
+
+// [attr~=word]: word must appear as a whole whitespace-separated item
+bool contains_word(std::string_view list, std::string_view word, bool case_insensitive) {
+    if (word.empty()) return false;
+    for (char c : word) {
+        if (is_html_whitespace(c)) return false;
+    }
+
+    size_t pos = 0;
+    while ((pos = find_substring(list, word, pos, case_insensitive)) != std::string_view::npos) {
+        size_t after = pos + word.size();
+        bool starts_item = pos == 0 || is_html_whitespace(list[pos - 1]);
+        bool ends_item = after == list.size() || is_html_whitespace(list[after]);
+        if (starts_item && ends_item) return true;
+        pos = after;
+    }
+    return false;
+}
+
+} // namespace
+
+bool CSSMatcher::matches_attribute_selector(const CSS3Parser::AttributeSelector& attr_sel,
+                                           const HTML5Parser::Node& element) {
+    auto attr_it = element.attributes.find(attr_sel.name);
+
+    if (attr_it == element.attributes.end()) {
+        return false;
+    }
+
+    std::string_view attr_value = attr_it->second;
+    std::string_view target = attr_sel.value;
+    bool case_insensitive = attr_sel.case_insensitive;
+
+    switch (attr_sel.match_type) {
+        case CSS3Parser::AttributeMatchType::Exists:
+            return true;
+
+        case CSS3Parser::AttributeMatchType::Exact:
+            return equals(attr_value, target, case_insensitive);
+
+        case CSS3Parser::AttributeMatchType::Include:
+            return contains_word(attr_value, target, case_insensitive);
+
+        case CSS3Parser::AttributeMatchType::Dash:
+            return starts_with(attr_value, target, case_insensitive) &&
+                   (attr_value.size() == target.size() || attr_value[target.size()] == '-');
+
+        // Per spec an empty value never matches the prefix/suffix/substring forms
+        case CSS3Parser::AttributeMatchType::Prefix:
+            return !target.empty() && starts_with(attr_value, target, case_insensitive);
+
+        case CSS3Parser::AttributeMatchType::Suffix:
+            return !target.empty() && ends_with(attr_value, target, case_insensitive);
+
+        case CSS3Parser::AttributeMatchType::Substring:
+            return !target.empty() &&
+                   find_substring(attr_value, target, 0, case_insensitive) != std::string_view::npos;
+    }
+
+    return false;
+}
+
+} // namespace BrowserParser
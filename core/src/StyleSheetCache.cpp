@@ -0,0 +1,228 @@
+#include "BrowserParser.h"
+#include <algorithm>
+#include <cstring>
+
+namespace BrowserParser {
+
+namespace {
+
+// XXH64, the 64-bit xxHash: four lanes of 8-byte reads, then a tail and an
+// avalanche. Reads are in host byte order; keys never leave the process.
+constexpr uint64_t prime1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t prime3 = 0x165667B19E3779F9ull;
+constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t prime5 = 0x27D4EB2F165667C5ull;
+
+inline uint64_t rotate_left(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+inline uint64_t read64(const char* data) {
+    uint64_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+inline uint32_t read32(const char* data) {
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+inline uint64_t hash_round(uint64_t accumulator, uint64_t input) {
+    return rotate_left(accumulator + input * prime2, 31) * prime1;
+}
+
+inline uint64_t merge_round(uint64_t hash, uint64_t lane) {
+    return (hash ^ hash_round(0, lane)) * prime1 + prime4;
+}
+
+uint64_t content_hash(std::string_view text, uint64_t seed = 0) {
+    const char* data = text.data();
+    const char* end = data + text.size();
+    uint64_t hash;
+
+    if (text.size() >= 32) {
+        uint64_t lanes[4] = {seed + prime1 + prime2, seed + prime2, seed, seed - prime1};
+        for (; data + 32 <= end; data += 32) {
+            for (int i = 0; i < 4; ++i) lanes[i] = hash_round(lanes[i], read64(data + 8 * i));
+        }
+        hash = rotate_left(lanes[0], 1) + rotate_left(lanes[1], 7) + rotate_left(lanes[2], 12) +
+               rotate_left(lanes[3], 18);
+        for (uint64_t lane : lanes) hash = merge_round(hash, lane);
+    } else {
+        hash = seed + prime5;
+    }
+    hash += text.size();
+
+    for (; data + 8 <= end; data += 8) hash = rotate_left(hash ^ hash_round(0, read64(data)), 27) * prime1 + prime4;
+    if (data + 4 <= end) {
+        hash = rotate_left(hash ^ (read32(data) * prime1), 23) * prime2 + prime3;
+        data += 4;
+    }
+    for (; data < end; ++data) hash = rotate_left(hash ^ (static_cast<unsigned char>(*data) * prime5), 11) * prime1;
+
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// The options that change what a sheet parses to; token_prepass and
+// parse_threads only change how it is parsed
+std::string spell_options(const CSS3Parser::CSSParser::ParseOptions& options) {
+    std::string spelled;
+    for (bool flag : {options.strict_mode, options.preserve_comments, options.validate_properties,
+                      options.allow_vendor_prefixes, options.expand_shorthands, options.validate_values}) {
+        spelled += flag ? '1' : '0';
+    }
+    spelled += static_cast<char>('0' + static_cast<int>(options.origin));
+
+    std::vector<std::string> at_rules(options.supported_at_rules.begin(), options.supported_at_rules.end());
+    std::sort(at_rules.begin(), at_rules.end());
+    for (const std::string& name : at_rules) {
+        spelled += ',';
+        spelled += name;
+    }
+    return spelled;
+}
+
+size_t estimate_rule_bytes(const std::vector<std::unique_ptr<CSS3Parser::CSSRule>>& rules) {
+    size_t bytes = rules.capacity() * sizeof(rules[0]);
+    for (const auto& rule : rules) {
+        if (rule->type == CSS3Parser::RuleType::Style) {
+            const auto& style_rule = static_cast<const CSS3Parser::StyleRule&>(*rule);
+            bytes += sizeof(style_rule) + style_rule.declarations.capacity() * sizeof(CSS3Parser::CSSDeclaration);
+            for (const auto& selector : style_rule.selectors.selectors) {
+                bytes += sizeof(selector);
+                for (const auto& component : selector.components) {
+                    bytes += sizeof(component) + component.selector.selectors.size() * sizeof(CSS3Parser::SimpleSelector);
+                }
+            }
+            for (const auto& compiled : style_rule.compiled_selectors) {
+                bytes += sizeof(compiled) + compiled.program.size() * sizeof(compiled.program[0]) +
+                         compiled.required_atoms.size() * sizeof(Atom);
+            }
+        } else if (rule->type == CSS3Parser::RuleType::AtRule) {
+            const auto& at_rule = static_cast<const CSS3Parser::AtRule&>(*rule);
+            bytes += sizeof(at_rule) + at_rule.prelude.size() +
+                     at_rule.declarations.capacity() * sizeof(CSS3Parser::CSSDeclaration) +
+                     estimate_rule_bytes(at_rule.rules);
+        } else {
+            bytes += sizeof(*rule);
+        }
+    }
+    return bytes;
+}
+
+// Approximate: container overhead and short strings are not counted
+size_t estimate_bytes(const StyleSheetCache::Entry& entry, const std::string& css) {
+    size_t bytes = sizeof(entry) + css.size() + estimate_rule_bytes(entry.stylesheet->rules);
+    for (const auto& arena : entry.stylesheet->arenas) bytes += arena->bytes_reserved();
+    for (const auto& rule : entry.rule_set.entries()) {
+        bytes += sizeof(rule) + rule.selectors.size() * sizeof(uint32_t);
+    }
+    for (const auto& error : entry.errors) bytes += sizeof(error) + error.message.size();
+    return bytes;
+}
+
+} // namespace
+
+StyleSheetCache& StyleSheetCache::shared() {
+    static StyleSheetCache cache;
+    return cache;
+}
+
+std::shared_ptr<const StyleSheetCache::Entry> StyleSheetCache::get(
+    const std::string& css, const CSS3Parser::CSSParser::ParseOptions& options) {
+    std::string spelled = spell_options(options);
+    uint64_t key = content_hash(css, content_hash(spelled));
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto slot = find(key, css, spelled);
+        if (slot != slots_.end()) {
+            stats_.hits++;
+            slots_.splice(slots_.begin(), slots_, slot);
+            return slot->entry;
+        }
+        stats_.misses++;
+    }
+
+    // Parse without the lock, so other documents are not held up
+    CSS3Parser::CSSParser parser(css, options);
+    auto entry = std::make_shared<Entry>();
+    entry->stylesheet = parser.parse_stylesheet();
+    entry->errors = parser.get_errors();
+    entry->rule_set = RuleSet::build({entry->stylesheet});
+    entry->bytes = estimate_bytes(*entry, css);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto slot = find(key, css, spelled);
+    if (slot != slots_.end()) {
+        // Another thread parsed the same text meanwhile
+        slots_.splice(slots_.begin(), slots_, slot);
+        return slot->entry;
+    }
+    if (entry->bytes > byte_budget_) return entry;
+
+    slots_.push_front(Slot{key, css, std::move(spelled), entry});
+    index_.emplace(key, slots_.begin());
+    stats_.bytes += entry->bytes;
+    evict();
+    return entry;
+}
+
+void StyleSheetCache::set_byte_budget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    byte_budget_ = bytes;
+    evict();
+}
+
+size_t StyleSheetCache::byte_budget() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return byte_budget_;
+}
+
+void StyleSheetCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    slots_.clear();
+    index_.clear();
+    stats_ = Stats();
+}
+
+StyleSheetCache::Stats StyleSheetCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats = stats_;
+    stats.entries = slots_.size();
+    return stats;
+}
+
+std::list<StyleSheetCache::Slot>::iterator StyleSheetCache::find(uint64_t key, const std::string& css,
+                                                                 const std::string& options) {
+    auto [first, last] = index_.equal_range(key);
+    for (auto it = first; it != last; ++it) {
+        if (it->second->css == css && it->second->options == options) return it->second;
+    }
+    return slots_.end();
+}
+
+void StyleSheetCache::evict() {
+    while (stats_.bytes > byte_budget_ && !slots_.empty()) {
+        auto victim = std::prev(slots_.end());
+        auto [first, last] = index_.equal_range(victim->key);
+        for (auto it = first; it != last; ++it) {
+            if (it->second == victim) {
+                index_.erase(it);
+                break;
+            }
+        }
+        stats_.bytes -= victim->entry->bytes;
+        stats_.evictions++;
+        slots_.erase(victim);
+    }
+}
+
+} // namespace BrowserParser
@@ -11,16 +11,29 @@
 #include <optional>
 #include <functional>
 #include <regex>
+#include <cstdint>
+#include <string_view>
+#include <deque>
+#include <array>
+#include <type_traits>
+#include <algorithm>
+#include "Atom.h"
+#include "LineIndex.h"
+#include "CSSProperties.h"
 
 namespace CSS3Parser {
 
+using BrowserParser::Atom;
+
 // Forward declarations
 class CSSValue;
 class CSSRule;
 class CSSStyleSheet;
+class SelectorList;
+class CompiledSelector;
 
 // CSS Token Types
-enum class TokenType {
+enum class TokenType : uint8_t {
     // Basic tokens
     Ident,          // identifiers
     Function,       // function(
@@ -61,25 +74,28 @@ enum class TokenType {
     BadComment      // unterminated comment
 };
 
+// Tokens do not own their text: value and unit view the tokenizer's input,
+// or its side buffer when escapes had to be decoded. They stay valid for the
+// lifetime of the tokenizer that produced them, and copying a token is cheap.
+// Positions are byte offsets; CSSTokenizer::location() turns them into lines.
 struct Token {
     TokenType type;
-    std::string value;
-    std::string unit;           // for dimensions (px, em, %, etc.)
+    std::string_view value;
+    std::string_view unit;      // for dimensions (px, em, %, etc.)
     double numeric_value = 0.0; // for numbers, percentages, dimensions
+    bool is_integer = false;    // css-syntax type flag: no '.' and no exponent in the lexeme
     size_t start_pos = 0;
     size_t end_pos = 0;
-    size_t line = 1;
-    size_t column = 1;
     
     Token(TokenType t = TokenType::EOF_TOKEN) : type(t) {}
-    Token(TokenType t, const std::string& v) : type(t), value(v) {}
+    Token(TokenType t, std::string_view v) : type(t), value(v) {}
     Token(TokenType t, double num) : type(t), numeric_value(num) {}
-    Token(TokenType t, const std::string& v, double num, const std::string& u = "") 
+    Token(TokenType t, std::string_view v, double num, std::string_view u = {}) 
         : type(t), value(v), unit(u), numeric_value(num) {}
 };
 
 // CSS Value Types
-enum class ValueType {
+enum class ValueType : uint8_t {
     Keyword,        // auto, inherit, initial
     Number,         // 123
     Percentage,     // 50%
@@ -91,17 +107,34 @@ enum class ValueType {
     Color,          // #fff, rgb(255,0,0), hsl(120,50%,50%)
     String,         // "Arial", 'Times'
     Url,            // url("image.png")
-    Function,       // calc(), var(), etc.
+    Function,       // var(), url(), etc.
     List,           // comma or space separated values
-    Custom          // CSS custom properties
+    Custom,         // CSS custom properties
+    Math            // calc(), min(), max(), clamp(), compiled to a CalcExpression
 };
 
+// Units are an enum so that a dimension fits inline in a CSSValue;
+// anything not listed keeps its text as an atom under Unknown
+enum class CSSUnit : uint8_t {
+    None, Percent,
+    Px, Em, Rem, Ex, Ch, Vw, Vh, Vmin, Vmax, Cm, Mm, Q, In, Pt, Pc, Fr,
+    Deg, Rad, Grad, Turn,
+    S, Ms,
+    Hz, Khz,
+    Dpi, Dpcm, Dppx, X,
+    Unknown
+};
+
+CSSUnit parse_unit(std::string_view unit); // ASCII case-insensitive
+std::string_view unit_name(CSSUnit unit);
+ValueType unit_value_type(CSSUnit unit);
+
 struct CSSColor {
     enum Type { RGB, HSL, HWB, LAB, LCH, Named, Hex, Current, Transparent };
     
     Type type = RGB;
     double values[4] = {0, 0, 0, 1}; // r,g,b,a or h,s,l,a etc.
-    std::string name; // for named colors
+    BrowserParser::Atom name = BrowserParser::null_atom; // for named colors
     
     CSSColor() = default;
     CSSColor(Type t, double v1, double v2, double v3, double alpha = 1.0) 
@@ -110,35 +143,182 @@ struct CSSColor {
     std::string to_string() const;
     static CSSColor from_hex(const std::string& hex);
     static CSSColor from_name(const std::string& name);
+    static bool is_color_keyword(std::string_view name); // named, system or currentcolor
+};
+
+// Math functions (CSSCalc.cpp)
+
+// What a math expression resolves to. Percentages keep their own type until
+// a property says what they are relative to.
+enum class CalcType : uint8_t {
+    Number, Length, Percentage, LengthPercentage, Angle, Time, Frequency, Resolution
+};
+
+// What relative units and percentages resolve against
+struct CalcContext {
+    double font_size = 16.0;       // em; ex and ch are taken as half of it
+    double root_font_size = 16.0;  // rem
+    double viewport_width = 0.0;   // vw, vmin, vmax
+    double viewport_height = 0.0;  // vh, vmin, vmax
+    double percentage_basis = 0.0; // what 100% is
 };
 
+enum class CalcOp : uint8_t {
+    Push,  // value times unit, resolved against the context
+    Scale, // multiplies the top of the stack by value
+    Sum,   // replaces the top count entries with their sum
+    Min,   // ... with their minimum
+    Max,   // ... with their maximum
+    Clamp  // replaces min, value, max with the clamped value
+};
+
+struct CalcInstruction {
+    double value = 0.0;
+    CalcOp op = CalcOp::Push;
+    CSSUnit unit = CSSUnit::None;
+    uint16_t count = 0;
+};
+
+// Stack code for one math function. Absolute units are converted to px, deg,
+// s, Hz and dppx at compile time and same-unit terms are folded, so
+// "calc(2 * (1in + 4px) - 50%)" is two pushes and a sum. Lives in a
+// CSSValueArena like the rest of a value.
+struct CalcExpression {
+    static constexpr size_t max_stack = 16;
+    
+    const CalcInstruction* code = nullptr;
+    uint32_t size = 0;
+    CalcType type = CalcType::Number;
+    
+    double evaluate(const CalcContext& context) const; // px, deg, s, Hz or dppx
+    std::string to_string() const;
+};
+
+// Bump allocator for the out-of-line parts of CSSValues: string text,
+// colors and list/function items. Everything stored is trivially
+// destructible, so dropping the arena frees it all at once. The arena also
+// holds the atoms interned by whoever fills it, so keywords and selector
+// names are released together with the values that use them.
+class CSSValueArena {
+public:
+    CSSValueArena() = default;
+    CSSValueArena(const CSSValueArena&) = delete;
+    CSSValueArena& operator=(const CSSValueArena&) = delete;
+    
+    void* allocate(size_t bytes, size_t alignment);
+    std::string_view store(std::string_view text);
+    
+    template <typename T>
+    const T* store(const T* items, size_t count) {
+        static_assert(std::is_trivially_copyable<T>::value, "arena items are never destroyed");
+        if (count == 0) return nullptr;
+        T* out = static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+        std::uninitialized_copy(items, items + count, out);
+        return out;
+    }
+    
+    size_t bytes_used() const { return used_; }
+    size_t bytes_reserved() const { return reserved_; }
+    
+    BrowserParser::AtomLease& atoms() { return atoms_; }
+    
+private:
+    static constexpr size_t chunk_size = 16 * 1024;
+    
+    BrowserParser::AtomLease atoms_;
+    
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    char* cursor_ = nullptr;
+    size_t remaining_ = 0;
+    size_t used_ = 0;
+    size_t reserved_ = 0;
+};
+
+// A component value in 16 bytes. Numbers and units are inline; keywords,
+// function names and unknown units are atoms; string text, colors and
+// list/function items live in the CSSValueArena of the parser or sheet
+// that built the value. Values copy as plain bytes and stay valid as long
+// as that arena does.
 class CSSValue {
 public:
-    ValueType type;
-    std::string string_value;
-    double numeric_value = 0.0;
-    std::string unit;
-    CSSColor color_value;
-    std::vector<CSSValue> list_values;
-    std::map<std::string, CSSValue> function_args;
+    ValueType type = ValueType::Keyword;
     
     CSSValue(ValueType t = ValueType::Keyword) : type(t) {}
-    CSSValue(const std::string& keyword) : type(ValueType::Keyword), string_value(keyword) {}
-    CSSValue(ValueType t, const std::string& value) : type(t), string_value(value) {}
-    CSSValue(double num, const std::string& u = "") 
-        : type(u.empty() ? ValueType::Number : ValueType::Length), 
-          numeric_value(num), unit(u) {}
-    CSSValue(const CSSColor& color) : type(ValueType::Color), color_value(color) {}
+    CSSValue(std::string_view keyword); // interned; "" is the empty value
+    
+    static CSSValue make_number(double value, CSSUnit unit = CSSUnit::None, bool is_integer = false);
+    static CSSValue make_dimension(double value, std::string_view unit, bool is_integer = false);
+    static CSSValue make_text(ValueType type, std::string_view text, CSSValueArena& arena); // String, Url, Custom
+    static CSSValue make_color(const CSSColor& color, CSSValueArena& arena);
+    static CSSValue make_list(const std::vector<CSSValue>& items, CSSValueArena& arena,
+                              bool comma_separated = false);
+    static CSSValue make_function(std::string_view name, const std::vector<CSSValue>& args,
+                                  CSSValueArena& arena);
+    static CSSValue make_math(const CalcExpression& expression, CSSValueArena& arena);
+    
+    // Keyword, function name, or String/Url/Custom text
+    std::string_view text() const;
+    BrowserParser::Atom atom() const; // keyword or function name, else null_atom
+    
+    double numeric_value() const { return is_numeric() ? number_ : 0.0; }
+    CSSUnit unit() const { return unit_; }
+    std::string_view unit_text() const;
+    bool is_integer() const { return (flags_ & integer_flag) != 0; } // lexed as <integer>
+    
+    const CSSColor& color() const;
+    const CalcExpression* math() const { return type == ValueType::Math ? math_ : nullptr; }
+    
+    // Items of a List, or arguments of a Function
+    size_t size() const;
+    const CSSValue* begin() const;
+    const CSSValue* end() const { return begin() + size(); }
+    const CSSValue& operator[](size_t index) const { return begin()[index]; }
+    bool is_comma_separated() const { return (flags_ & comma_flag) != 0; }
     
     std::string to_string() const;
+    bool empty() const { return type == ValueType::Keyword && aux_ == BrowserParser::null_atom; }
+    bool is_numeric() const {
+        return type == ValueType::Number || type == ValueType::Percentage || type == ValueType::Length ||
+               type == ValueType::Angle || type == ValueType::Time || type == ValueType::Frequency ||
+               type == ValueType::Resolution;
+    }
     bool is_length() const { return type == ValueType::Length; }
     bool is_percentage() const { return type == ValueType::Percentage; }
     bool is_number() const { return type == ValueType::Number; }
     bool is_color() const { return type == ValueType::Color; }
     bool is_keyword() const { return type == ValueType::Keyword; }
     bool is_function() const { return type == ValueType::Function; }
+    bool is_math() const { return type == ValueType::Math; }
+    
+private:
+    struct Items {
+        const CSSValue* data;
+        uint32_t size;
+    };
+    
+    static constexpr uint8_t integer_flag = 1;
+    static constexpr uint8_t comma_flag = 2;
+    
+    CSSUnit unit_ = CSSUnit::None;
+    uint8_t flags_ = 0;
+    uint32_t aux_ = 0; // atom, text length, or list size, depending on type
+    union {
+        double number_ = 0.0;
+        const char* chars_;
+        const CSSColor* color_;
+        const CSSValue* items_;    // List
+        const Items* arguments_;   // Function
+        const CalcExpression* math_;
+    };
 };
 
+// Compiles a calc(), min(), max() or clamp() Function value, as the parser
+// builds it, into a Math value. Operators are "+", "-", "*" and "/" keywords
+// and a parenthesized block is a nested calc(); operands may also be Math
+// values. Fails on var() and any other function, on syntax errors, and on
+// unit types that do not combine.
+bool compile_math(const CSSValue& function, CSSValueArena& arena, CSSValue& compiled);
+
 // CSS Selector Types
 enum class SelectorType {
     Universal,      // *
@@ -147,7 +327,8 @@ enum class SelectorType {
     Id,             // #idname
     Attribute,      // [attr], [attr=value]
     Pseudo,         // :hover, :first-child
-    PseudoElement   // ::before, ::after
+    PseudoElement,  // ::before, ::after
+    Nesting         // & in a nested rule; replaced by the parent's selectors when parsed
 };
 
 enum class SelectorCombinator {
@@ -179,6 +360,82 @@ struct PseudoSelector {
     std::string name;
     std::string argument;
     bool is_function = false; // :nth-child(2n+1)
+    std::shared_ptr<const SelectorList> selectors; // parsed argument of :is(), :where(), :not() and :has()
+};
+
+// :before, :after, :first-line and :first-letter name pseudo-elements even
+// with a single colon
+bool is_legacy_pseudo_element(std::string_view name);
+
+// Selector specificity (a,b,c) packed as a<<20 | b<<10 | c, so comparing two
+// specificities is one integer compare. Each component saturates at 1023.
+class Specificity {
+public:
+    static constexpr uint32_t component_max = 0x3FF;
+    
+    constexpr Specificity() = default;
+    constexpr Specificity(uint32_t ids, uint32_t classes, uint32_t types)
+        : packed_(clamp(ids) << 20 | clamp(classes) << 10 | clamp(types)) {}
+    
+    constexpr uint32_t ids() const { return packed_ >> 20; }
+    constexpr uint32_t classes() const { return (packed_ >> 10) & component_max; }
+    constexpr uint32_t types() const { return packed_ & component_max; }
+    constexpr uint32_t packed() const { return packed_; }
+    
+    Specificity& operator+=(Specificity other) {
+        *this = Specificity(ids() + other.ids(), classes() + other.classes(), types() + other.types());
+        return *this;
+    }
+    friend Specificity operator+(Specificity a, Specificity b) { return a += b; }
+    
+    friend constexpr bool operator==(Specificity a, Specificity b) { return a.packed_ == b.packed_; }
+    friend constexpr bool operator!=(Specificity a, Specificity b) { return a.packed_ != b.packed_; }
+    friend constexpr bool operator<(Specificity a, Specificity b) { return a.packed_ < b.packed_; }
+    friend constexpr bool operator>(Specificity a, Specificity b) { return a.packed_ > b.packed_; }
+    friend constexpr bool operator<=(Specificity a, Specificity b) { return a.packed_ <= b.packed_; }
+    friend constexpr bool operator>=(Specificity a, Specificity b) { return a.packed_ >= b.packed_; }
+    
+    std::string to_string() const; // "(a,b,c)"
+    
+private:
+    static constexpr uint32_t clamp(uint32_t n) { return n < component_max ? n : component_max; }
+    
+    uint32_t packed_ = 0;
+};
+
+enum class CascadeOrigin : uint8_t {
+    UserAgent,
+    User,
+    Author
+};
+
+// 64-bit cascade key: the declaration with the larger key wins. Layout, high
+// to low bits:
+//   [63:61] origin and importance tier (!important reverses origin order)
+//   [60:49] @layer rank (unlayered is highest for normal, lowest for !important)
+//   [48:25] specificity, 8 bits per component, filled in once a selector matches
+//   [24:0]  source order
+// Stylesheets precompute everything but specificity when they are loaded.
+struct CascadeKey {
+    static constexpr int order_bits = 25;
+    static constexpr int specificity_shift = 25;
+    static constexpr int layer_shift = 49;
+    static constexpr int tier_shift = 61;
+    static constexpr uint64_t order_mask = (uint64_t(1) << order_bits) - 1;
+    static constexpr uint32_t unlayered = 0xFFF;
+    
+    static constexpr uint64_t make(CascadeOrigin origin, bool important,
+                                   uint32_t layer_rank, uint32_t order) {
+        uint64_t tier = important ? 5 - static_cast<uint64_t>(origin) : static_cast<uint64_t>(origin);
+        uint64_t layer = important ? unlayered - layer_rank : layer_rank;
+        return tier << tier_shift | (layer & unlayered) << layer_shift | (order & order_mask);
+    }
+    
+    static constexpr uint64_t with_specificity(uint64_t key, Specificity specificity) {
+        auto byte = [](uint32_t n) -> uint64_t { return n < 0xFF ? n : 0xFF; };
+        return key | (byte(specificity.ids()) << 16 | byte(specificity.classes()) << 8 |
+                      byte(specificity.types())) << specificity_shift;
+    }
 };
 
 class SimpleSelector {
@@ -190,7 +447,7 @@ public:
     
     SimpleSelector(SelectorType t, const std::string& n = "") : type(t), name(n) {}
     std::string to_string() const;
-    int specificity() const;
+    Specificity specificity() const;
 };
 
 class CompoundSelector {
@@ -199,7 +456,7 @@ public:
     
     void add_selector(const SimpleSelector& selector) { selectors.push_back(selector); }
     std::string to_string() const;
-    int specificity() const;
+    Specificity specificity() const;
     bool empty() const { return selectors.empty(); }
 };
 
@@ -211,10 +468,11 @@ public:
     };
     
     std::vector<Component> components;
+    std::optional<Specificity> nested_specificity; // set when & was resolved: & counts as :is(parent)
     
     void add_component(const CompoundSelector& selector, SelectorCombinator combinator = SelectorCombinator::None);
     std::string to_string() const;
-    int specificity() const;
+    Specificity specificity() const;
     bool empty() const { return components.empty(); }
 };
 
@@ -224,23 +482,274 @@ public:
     
     void add_selector(const ComplexSelector& selector) { selectors.push_back(selector); }
     std::string to_string() const;
-    int max_specificity() const;
+    Specificity max_specificity() const;
     bool empty() const { return selectors.empty(); }
 };
 
+// Compiled selector bytecode. A complex selector is flattened once into a
+// right-to-left instruction stream, e.g. "#main .card p" becomes
+// TAG(p) CLASS(card) ANCESTOR ID(main) MATCH. Names are interned atoms so
+// matching compares integers; attribute and pseudo tests index side tables.
+enum class SelectorOp : uint8_t {
+    Universal,      // always true
+    Tag,            // operand: tag atom
+    Id,             // operand: id atom
+    Class,          // operand: class atom
+    Attribute,      // operand: index into attributes
+    Pseudo,         // operand: index into pseudos
+    PseudoElement,  // operand: index into pseudos
+    Scope,          // the scoping root (:scope); the root element outside @scope
+    Ancestor,       // move to any ancestor (descendant combinator)
+    Parent,         // move to the parent (child combinator)
+    Previous,       // move to the previous element sibling (+)
+    AnyPrevious,    // move to any previous element sibling (~)
+    Match           // end of program
+};
+
+struct SelectorInstruction {
+    SelectorOp op = SelectorOp::Match;
+    uint32_t operand = 0;
+};
+
+struct CompiledAttribute {
+    AttributeSelector selector;
+    Atom name_atom = BrowserParser::null_atom;
+};
+
+// A pseudo-class with what its argument compiles to: the selector list of
+// :is()/:where()/:not()/:has(), or the An+B of the :nth-*() family.
+// Relative :has() selectors start from a :scope bound to the subject
+struct CompiledPseudo {
+    PseudoSelector selector;
+    std::vector<CompiledSelector> arguments;
+    int32_t nth_step = 0;   // A
+    int32_t nth_offset = 0; // B
+};
+
+class CompiledSelector {
+public:
+    std::vector<SelectorInstruction> program;
+    std::vector<CompiledAttribute> attributes;
+    std::vector<CompiledPseudo> pseudos;
+    std::vector<Atom> required_atoms; // tags, ids, classes and attribute names
+    Specificity specificity;
+    bool uses_scope = false; // contains :scope, so it matches relative to an @scope root
+    
+    static CompiledSelector compile(const ComplexSelector& selector);
+    std::string to_string() const; // disassembly, for debugging
+    bool empty() const { return program.empty(); }
+    
+    // False when some required atom never occurs in the document
+    bool may_match(const BrowserParser::AtomSet& features) const;
+};
+
 // CSS Declaration
 struct CSSDeclaration {
     std::string property;
-    CSSValue value;
+    PropertyId id = PropertyId::Unknown; // resolved from property when parsed
+    PropertyId shorthand = PropertyId::Unknown; // set on longhands expanded from a shorthand
     bool important = false;
+    bool pending_substitution = false; // value is the whole shorthand value, split after var() substitution
+    bool implicit = false; // a part the shorthand omitted, holding the longhand's initial value
+    CSSValue value;
+    uint64_t cascade_key = 0; // see CascadeKey; assigned when the sheet is loaded
     
     CSSDeclaration() = default;
     CSSDeclaration(const std::string& prop, const CSSValue& val, bool imp = false)
-        : property(prop), value(val), important(imp) {}
+        : property(prop), id(property_id(prop)), important(imp), value(val) {}
     
     std::string to_string() const;
 };
 
+// Shorthand expansion (CSSShorthands.cpp)
+
+// A longhand's initial value, parsed once; empty for shorthands and unknown ids
+const CSSValue& initial_value(PropertyId id);
+
+bool contains_var(const CSSValue& value);
+
+// Appends the longhands of a shorthand declaration, in the order property_info
+// lists them; omitted parts get their initial values. Returns false when the
+// value does not match the shorthand's grammar. A value containing var() can
+// only be split once substituted: each longhand then carries the whole value
+// with pending_substitution set.
+bool expand_shorthand(const CSSDeclaration& declaration, CSSValueArena& arena,
+                      std::vector<CSSDeclaration>& longhands);
+
+// Value validation (CSSGrammar.cpp)
+
+// Matches a longhand's value against the syntax listed in CSSProperties.h in
+// one pass over its components. A valid value is rewritten with the types it
+// matched: a unitless 0 taken as a length becomes 0px, a named color becomes a
+// Color. Shorthands, unknown and custom properties, CSS-wide keywords and
+// values containing var(), env() or attr() are accepted unchecked.
+bool validate_value(PropertyId id, CSSValue& value, CSSValueArena& arena);
+
+// Custom properties (CSSVariables.cpp)
+
+// One element's computed custom properties, all var() references already
+// substituted. Maps are immutable and shared: an element that declares no
+// custom property holds its parent's map, and copying a map copies a pointer.
+class CustomPropertyMap {
+public:
+    const CSSValue* find(BrowserParser::Atom name) const;
+    size_t size() const { return data_ ? data_->values.size() : 0; }
+    bool empty() const { return size() == 0; }
+
+    // Distinct for every map a resolver builds; 0 for the empty map
+    uint64_t identity() const { return data_ ? data_->identity : 0; }
+
+    template <typename Visit>
+    void for_each(Visit&& visit) const {
+        if (!data_) return;
+        for (const auto& [name, value] : data_->values) visit(name, value);
+    }
+
+private:
+    friend class VariableResolver;
+
+    struct Data {
+        uint64_t identity = 0;
+        std::unordered_map<BrowserParser::Atom, CSSValue> values;
+    };
+
+    std::shared_ptr<const Data> data_;
+};
+
+// Substitutes var() during the cascade. Both steps are memoized, so
+// elements that match the same custom declarations under the same parent
+// share one map, and a declaration is substituted once per distinct map.
+// Values the resolver builds live in its arena and stay valid as long as
+// the resolver does.
+class VariableResolver {
+public:
+    struct Stats {
+        size_t maps_built = 0;
+        size_t map_hits = 0;
+        size_t substitutions = 0;
+        size_t substitution_hits = 0;
+        size_t cycles = 0; // custom properties dropped for being on a reference cycle
+    };
+
+    // The map of an element whose winning custom declarations are `declared`,
+    // in a stable order. Declarations that reference each other are resolved
+    // in dependency order; every property on a reference cycle, and every
+    // reference that fails without a fallback, leaves its property with the
+    // guaranteed-invalid value, i.e. absent from the map.
+    CustomPropertyMap inherit(const CustomPropertyMap& parent,
+                              const std::vector<const CSSDeclaration*>& declared);
+
+    // The computed value of a declaration that contains var(), or of a
+    // longhand pending substitution from its shorthand. Substituted math is
+    // recompiled and the result is checked against the property's grammar.
+    // Returns false when the declaration is invalid at computed-value time.
+    bool substitute(const CustomPropertyMap& variables, const CSSDeclaration& declaration, CSSValue& value);
+
+    const Stats& stats() const { return stats_; }
+    CSSValueArena& arena() { return arena_; }
+
+private:
+    struct MapKey {
+        uint64_t parent;
+        std::vector<const CSSDeclaration*> declared;
+        bool operator==(const MapKey& other) const {
+            return parent == other.parent && declared == other.declared;
+        }
+    };
+    struct MapKeyHash {
+        size_t operator()(const MapKey& key) const;
+    };
+    struct SubstitutionKey {
+        uint64_t variables;
+        const CSSDeclaration* declaration;
+        bool operator==(const SubstitutionKey& other) const {
+            return variables == other.variables && declaration == other.declaration;
+        }
+    };
+    struct SubstitutionKeyHash {
+        size_t operator()(const SubstitutionKey& key) const;
+    };
+    struct Substitution {
+        CSSValue value;
+        bool valid = false;
+    };
+
+    CSSValueArena arena_;
+    uint64_t next_identity_ = 1;
+    std::unordered_map<MapKey, CustomPropertyMap, MapKeyHash> maps_;
+    std::unordered_map<SubstitutionKey, Substitution, SubstitutionKeyHash> substitutions_;
+    Stats stats_;
+};
+
+// Media queries (CSSMedia.cpp)
+
+enum class MediaType : uint8_t { All, Screen, Print, Speech, Unknown };
+enum class PointerAccuracy : uint8_t { None, Coarse, Fine };
+enum class ColorScheme : uint8_t { Light, Dark };
+
+// The device a media query is evaluated against. Lengths are CSS px.
+struct MediaEnvironment {
+    MediaType type = MediaType::Screen;
+    double width = 1280.0;
+    double height = 720.0;
+    double resolution = 1.0;  // dppx
+    double font_size = 16.0;  // em and rem in a query
+    int color_bits = 8;       // per component; 0 on a monochrome device
+    int monochrome_bits = 0;
+    bool hover = true;
+    PointerAccuracy pointer = PointerAccuracy::Fine;
+    ColorScheme color_scheme = ColorScheme::Light;
+    bool reduced_motion = false;
+
+    bool operator==(const MediaEnvironment& other) const;
+    bool operator!=(const MediaEnvironment& other) const { return !(*this == other); }
+};
+
+enum class MediaFeature : uint8_t {
+    Width, Height, AspectRatio, Orientation, Resolution, Color, ColorIndex, Monochrome, Grid,
+    Hover, AnyHover, Pointer, AnyPointer, PrefersColorScheme, PrefersReducedMotion
+};
+
+enum class MediaComparison : uint8_t { Boolean, Equal, Less, LessEqual, Greater, GreaterEqual };
+
+enum class MediaOp : uint8_t {
+    Type,    // pushes whether the environment has this media type
+    Feature, // pushes the result of one feature test
+    Unknown, // pushes unknown: a feature or syntax this evaluator does not know
+    Not,     // negates the top; unknown stays unknown
+    And,     // replaces the top count entries with their conjunction
+    Or,      // ... with their disjunction
+    Query    // resolves unknown at the top to false, as a complete query does
+};
+
+struct MediaInstruction {
+    double value = 0.0; // length in its unit, dppx, ratio, integer or keyword index
+    MediaOp op = MediaOp::Unknown;
+    MediaFeature feature = MediaFeature::Width;
+    MediaComparison comparison = MediaComparison::Boolean;
+    MediaType type = MediaType::All; // Type
+    CSSUnit unit = CSSUnit::None;    // lengths keep theirs so em follows the environment
+    uint16_t count = 0;              // And, Or
+    uint16_t calc_size = 0;          // a math value: calc_size instructions of calc_code,
+    uint32_t calc_offset = 0;        // evaluated against the environment instead of value
+};
+
+// A media query list compiled to postfix code over three-valued logic:
+// "(400px <= width < 1000px)" becomes two feature tests and an And. A query
+// that does not parse becomes "not all"; an empty list matches everything.
+class MediaQueryList {
+public:
+    std::vector<MediaInstruction> program;
+    std::vector<CalcInstruction> calc_code; // math in feature values
+
+    static MediaQueryList compile(const std::vector<Token>& prelude); // whitespace tokens are skipped
+    static MediaQueryList compile(const std::string& text);
+
+    bool evaluate(const MediaEnvironment& environment) const;
+    bool empty() const { return program.empty(); }
+    std::string to_string() const; // disassembly, for debugging
+};
+
 // CSS Rule Types
 enum class RuleType {
     Style,          // selector { declarations }
@@ -263,27 +772,42 @@ public:
 class StyleRule : public CSSRule {
 public:
     SelectorList selectors;
+    std::vector<CompiledSelector> compiled_selectors; // parallel to selectors.selectors
     std::vector<CSSDeclaration> declarations;
     
     StyleRule() : CSSRule(RuleType::Style) {}
     
-    void add_declaration(const CSSDeclaration& decl) { declarations.push_back(decl); }
+    void add_declaration(CSSDeclaration decl) { declarations.push_back(std::move(decl)); }
+    void compile_selectors();
     std::string to_string() const override;
     std::unique_ptr<CSSRule> clone() const override;
 };
 
+// The prelude of @scope, "(roots) to (limits)"; either list may be empty.
+// An empty root list scopes to the root element
+struct ScopeBounds {
+    SelectorList roots;
+    SelectorList limits;
+    std::vector<CompiledSelector> compiled_roots;
+    std::vector<CompiledSelector> compiled_limits;
+};
+
 class AtRule : public CSSRule {
 public:
     std::string name;           // media, import, keyframes, etc.
     std::string prelude;        // everything before { or ;
     std::vector<std::unique_ptr<CSSRule>> rules; // nested rules (for @media, @supports, etc.)
     std::vector<CSSDeclaration> declarations;    // declarations (for @page, @font-face, etc.)
+    MediaQueryList media;       // compiled prelude of @media
+    ScopeBounds scope;          // compiled prelude of @scope
+    bool supported = true;      // false when the block can never apply (failed @supports, invalid
+                                // @scope prelude); such blocks keep no rules
     
     AtRule(const std::string& n) : CSSRule(RuleType::AtRule), name(n) {}
     
     std::string to_string() const override;
     std::unique_ptr<CSSRule> clone() const override;
-    bool is_conditional() const; // @media, @supports, @document
+    bool is_conditional() const; // blocks of rules: @media, @supports, @layer, @scope, ...
     bool is_descriptor() const;  // @font-face, @page, @viewport
     bool is_keyframes() const;   // @keyframes
 };
@@ -298,6 +822,34 @@ public:
     std::unique_ptr<CSSRule> clone() const override;
 };
 
+// The @layer tree of the sheets of one document. Layers are ordered by first
+// appearance, and a layer's sublayers come before the rules placed directly
+// in it. rank() numbers that order from 0, so a later layer outranks an
+// earlier one; rules outside any layer outrank them all.
+class CascadeLayers {
+public:
+    static constexpr uint32_t unlayered = 0;
+    
+    void add(const std::vector<std::unique_ptr<CSSRule>>& rules); // declares every layer named, in order
+    uint32_t find(uint32_t parent, const AtRule& block) const;    // the layer an @layer block opens
+    uint32_t rank(uint32_t layer) const { return layers_[layer].rank; }
+    size_t size() const { return layers_.size() - 1; }
+    
+private:
+    struct Layer {
+        std::vector<uint32_t> children;
+        uint32_t rank = CascadeKey::unlayered;
+    };
+    
+    std::vector<Layer> layers_{Layer()};
+    std::map<std::pair<uint32_t, std::string>, uint32_t> names_; // (parent, name) -> layer
+    std::unordered_map<const AtRule*, uint32_t> anonymous_;
+    
+    void add(const std::vector<std::unique_ptr<CSSRule>>& rules, uint32_t parent);
+    uint32_t declare(uint32_t parent, const std::string& name);
+    void assign_ranks();
+};
+
 // CSS Style Sheet
 class CSSStyleSheet {
 public:
@@ -306,8 +858,12 @@ public:
     std::string href;
     std::string media;
     bool disabled = false;
+    CascadeOrigin origin = CascadeOrigin::Author;
+    uint32_t cascade_order_count = 0; // declarations numbered by assign_cascade_keys
+    std::vector<std::shared_ptr<const CSSValueArena>> arenas; // back the declaration values
     
     void add_rule(std::unique_ptr<CSSRule> rule) { rules.push_back(std::move(rule)); }
+    void assign_cascade_keys(const CascadeLayers* layers = nullptr); // nullptr: this sheet's own layers
     std::string to_string() const;
     size_t rule_count() const { return rules.size(); }
     
@@ -335,30 +891,64 @@ struct CSSParseError {
 class CSSTokenizer {
 public:
     explicit CSSTokenizer(const std::string& input);
+    explicit CSSTokenizer(std::shared_ptr<const std::string> input); // shares the buffer instead of copying
+    
+    // Tokens view input_, so a copy would leave them dangling
+    CSSTokenizer(const CSSTokenizer&) = delete;
+    CSSTokenizer& operator=(const CSSTokenizer&) = delete;
+    
+    // The grammar never looks more than a few tokens ahead
+    static constexpr size_t lookahead_capacity = 8;
     
     Token next_token();
-    Token peek_token(size_t offset = 0);
-    bool at_end() const { return pos_ >= input_.length(); }
+    const Token& peek_token(size_t offset = 0); // valid until the next peek or consume; offset < lookahead_capacity
+    // No buffered tokens left and the input consumed; see input_exhausted()
+    // for the lexer's own end-of-input test
+    bool at_end() const {
+        return (lookahead_count_ == 0 || lookahead_[lookahead_head_].type == TokenType::EOF_TOKEN) &&
+               input_exhausted();
+    }
     size_t position() const { return pos_; }
+    size_t remaining() const { return input_.length() - pos_; }
+    std::string_view input() const { return input_; }
+    const std::shared_ptr<const std::string>& shared_input() const { return buffer_; }
+    std::string_view source(size_t start, size_t end) const {
+        return input_.substr(start, end - start);
+    }
     void reset(size_t position = 0);
     
+    // Line and column of a byte offset; the line index is built on first use
+    BrowserParser::LineIndex::Location location(size_t offset) const { return line_index_.locate(offset); }
+    
+    // Whitespace runs and comment bodies are scanned 16 bytes at a time where
+    // SSE2 is available. Turning this off, process-wide, makes every tokenizer
+    // use the byte loop, so benchmarks and tests can compare the two
+    static void set_vector_scanning(bool enabled);
+    static bool vector_scanning();
+    
     // Error handling
     const std::vector<CSSParseError>& get_errors() const { return errors_; }
     void add_error(const std::string& message);
     
 private:
-    std::string input_;
+    std::shared_ptr<const std::string> buffer_;
+    std::string_view input_; // views buffer_
     size_t pos_ = 0;
-    size_t line_ = 1;
-    size_t column_ = 1;
-    std::vector<Token> token_buffer_;
-    size_t buffer_pos_ = 0;
+    BrowserParser::LineIndex line_index_; // views input_
+    std::array<Token, lookahead_capacity> lookahead_; // ring buffer of peeked tokens
+    size_t lookahead_head_ = 0;
+    size_t lookahead_count_ = 0;
+    std::deque<std::string> decoded_; // escape-decoded text; deque keeps views stable
     std::vector<CSSParseError> errors_;
     
     char peek(size_t offset = 0) const;
     char consume();
     void skip_whitespace();
     void skip_comment();
+    std::string_view lexeme(size_t start) const;
+    std::string_view store_decoded(std::string text);
+    Token read_token();
+    Token single_char_token(TokenType type);
     
     Token read_identifier();
     Token read_string(char quote);
@@ -373,13 +963,54 @@ private:
     bool is_hex_digit(char c) const;
     bool is_whitespace(char c) const;
     bool is_newline(char c) const;
+    bool starts_escape(size_t offset = 0) const;
+    bool input_exhausted() const { return pos_ >= input_.length(); } // ignores the lookahead ring
     
-    std::string consume_identifier();
-    std::string consume_string(char quote);
-    double consume_number();
+    std::string_view consume_identifier();
+    std::string_view consume_string(char quote);
+    void consume_escape(std::string& out);
+    double consume_number(bool& is_integer);
     void consume_bad_url();
 };
 
+// Struct-of-arrays token stream filled by one linear pass over a tokenizer.
+// The parser indexes into it, so lookahead is unbounded and the token loop
+// runs without interleaved parsing. Views still point into the tokenizer,
+// which must outlive the array. The last entry is always EOF. A token's
+// value is derived from its offsets; only values that are not a fixed trim
+// of the source text (escape-decoded names, strings and urls, url() with
+// spacing) are kept, in a sparse side column.
+class CSSTokenArray {
+public:
+    void build(CSSTokenizer& tokenizer);
+    
+    size_t size() const { return types_.size(); }
+    TokenType type(size_t index) const { return types_[index]; }
+    size_t start(size_t index) const { return starts_[index]; }
+    size_t end(size_t index) const { return ends_[index]; }
+    std::string_view value(size_t index) const;
+    Token token(size_t index) const; // materializes one entry
+    size_t memory_usage() const;
+    
+private:
+    std::vector<TokenType> types_;
+    std::vector<uint32_t> starts_; // byte offsets; inputs are capped at 4 GiB
+    std::vector<uint32_t> ends_;
+    std::string_view source_;
+    
+    // Values that cannot be derived from the source, in token order
+    std::vector<bool> side_value_;
+    std::vector<uint32_t> side_indices_;
+    std::vector<std::string_view> side_values_;
+    
+    // Numbers, percentages and dimensions are a minority of tokens, so
+    // their fields live in dense side columns addressed through numeric_slot_
+    std::vector<uint32_t> numeric_slot_;
+    std::vector<double> numbers_;
+    std::vector<std::string_view> units_;
+    std::vector<bool> integers_;
+};
+
 // CSS Parser
 class CSSParser {
 public:
@@ -388,6 +1019,18 @@ public:
         bool preserve_comments = false;
         bool validate_properties = true;
         bool allow_vendor_prefixes = true;
+        bool token_prepass = false; // tokenize everything into a CSSTokenArray before parsing
+        // Rules hold longhand declarations only. Parsing pays for every longhand
+        // made and checked, about 2x on a shorthand-heavy sheet, but once per
+        // sheet (and once per process through StyleSheetCache); the cascade
+        // would otherwise split shorthands for every element they match
+        bool expand_shorthands = true;
+        bool validate_values = true; // drop declarations whose value does not match the grammar
+        // >1 splits sheets of 128 KB and up into chunks parsed in parallel; 0
+        // uses every core. Never more threads than available_cores(), so a
+        // single-core machine always parses serially
+        size_t parse_threads = 1;
+        CascadeOrigin origin = CascadeOrigin::Author;
         std::unordered_set<std::string> supported_at_rules;
         
         ParseOptions() {
@@ -402,6 +1045,18 @@ public:
     
     explicit CSSParser(const std::string& css, const ParseOptions& options = ParseOptions());
     
+    // Parses the top-level rules that start in [begin, end) of a buffer
+    // other parsers may share. Offsets, lines and columns stay relative to
+    // the whole buffer, and a rule that starts in range is read to its end.
+    CSSParser(std::shared_ptr<const std::string> css, size_t begin, size_t end,
+              const ParseOptions& options = ParseOptions());
+    
+    // Cores parse_threads may use, std::thread::hardware_concurrency() unless
+    // set (0 restores it). Process-wide; tests raise it to run the chunked
+    // path on machines with a single core
+    static size_t available_cores();
+    static void set_available_cores(size_t cores);
+    
     std::unique_ptr<CSSStyleSheet> parse_stylesheet();
     std::unique_ptr<CSSRule> parse_rule();
     SelectorList parse_selector_list();
@@ -416,7 +1071,7 @@ public:
     CSSColor parse_color();
     CSSValue parse_length();
     CSSValue parse_function();
-    CSSValue parse_calc_expression();
+    CSSValue parse_math_function(const std::string& func_name);
     CSSValue parse_color_function(const std::string& func_name);
     CSSValue parse_var_function();
     CSSValue parse_generic_function(const std::string& func_name);
@@ -425,34 +1080,74 @@ public:
     const std::vector<CSSParseError>& get_errors() const { return errors_; }
     bool has_errors() const { return !errors_.empty(); }
     
+    // Backs every value this parser returns; parse_stylesheet shares it with the sheet
+    const CSSValueArena& value_arena() const { return *arena_; }
+    
     // Utility methods
     static bool is_valid_property(const std::string& property);
     static bool is_valid_value_for_property(const std::string& property, const CSSValue& value);
+    static bool is_math_function(const std::string& name); // calc(), min(), max(), clamp()
+    
+    // An @supports condition, answered from this engine's own tables: a
+    // declaration holds when the value matches the property's grammar, and
+    // selector() when every pseudo in it is known (CSSSupports.cpp)
+    static bool supports_condition(std::string_view condition);
     static std::vector<std::string> get_vendor_prefixes();
     
 private:
     CSSTokenizer tokenizer_;
     ParseOptions options_;
     std::vector<CSSParseError> errors_;
+    std::shared_ptr<CSSValueArena> arena_ = std::make_shared<CSSValueArena>();
+    std::unordered_map<std::string, bool> supports_results_; // @supports prelude -> result
+    int scope_depth_ = 0; // inside @scope, selectors may start with a combinator
+    int argument_depth_ = 0; // inside the selector argument of :is(), :not(), :has() and the like
+    const SelectorList* nesting_parent_ = nullptr; // what & stands for inside a style block
+    size_t block_depth_ = 0; // blocks whose contents are being parsed; 0 at the top level
+    size_t end_ = SIZE_MAX; // parse_stylesheet leaves rules that start here or later
+    
+    // Front end used when options_.token_prepass is set
+    bool use_token_array_ = false;
+    CSSTokenArray tokens_;
+    size_t cursor_ = 0;
+    std::array<Token, CSSTokenizer::lookahead_capacity> window_; // materialized peeks
+    std::array<size_t, CSSTokenizer::lookahead_capacity> window_index_;
     
     // Parsing helpers
     Token consume_token();
-    Token peek_token(size_t offset = 0);
+    const Token& peek_token(size_t offset = 0);
+    bool at_end();
+    size_t position() const;
     bool consume_if_match(TokenType type);
     bool consume_if_match(const std::string& value);
     void skip_whitespace();
     void add_error(const std::string& message);
     
     // Parse specific constructs
-    std::unique_ptr<StyleRule> parse_style_rule();
+    enum class Recovery { Declaration, Rule, AtRule }; // what skip_invalid drops
+    
+    size_t parse_top_level(CSSStyleSheet& sheet, size_t end); // rules starting before end; returns where it stopped
+    bool parse_in_parallel(CSSStyleSheet& sheet); // CSSParallel.cpp
+    bool parse_style_rule(std::vector<std::unique_ptr<CSSRule>>& rules); // appends the rule, then its nested rules
+    void parse_style_block(StyleRule* own, std::vector<std::unique_ptr<CSSRule>>& rules);
+    bool at_nested_rule();
+    size_t checkpoint();
+    void rewind(size_t checkpoint);
     std::unique_ptr<AtRule> parse_at_rule();
     void parse_declaration_list(std::vector<CSSDeclaration>& declarations);
+    void parse_declaration_into(std::vector<CSSDeclaration>& declarations);
+    bool consume_declaration(CSSDeclaration& decl);
+    bool parse_block_custom_value(CSSValue& value);
+    void skip_invalid(Recovery recovery);
+    void skip_component_value();
     void parse_rule_list(std::vector<std::unique_ptr<CSSRule>>& rules);
     void parse_keyframes_rules(std::vector<std::unique_ptr<CSSRule>>& rules);
+    bool parse_scope_prelude(const std::vector<Token>& prelude, ScopeBounds& scope);
     
     // Selector parsing helpers
     AttributeSelector parse_attribute_selector();
     PseudoSelector parse_pseudo_selector();
+    bool parse_selector_argument(PseudoSelector& pseudo);
     SelectorCombinator parse_combinator();
     
     // Value parsing helpers
@@ -462,6 +1157,8 @@ private:
     CSSValue parse_string_value();
     CSSValue parse_url_value();
     CSSValue parse_list_value(char separator = ' ');
+    bool parse_comma_groups(std::vector<CSSValue>& groups);
+    CSSValue parse_math_arguments(const std::string& func_name);
     
     // CSS3 specific parsers
     CSSValue parse_gradient();
@@ -0,0 +1,276 @@
+#ifndef CSS_PROPERTIES_H
+#define CSS_PROPERTIES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace CSS3Parser {
+
+// Every property the engine knows, as
+// X(Id, "name", inherited, "initial", "value-definition syntax").
+// The syntax is compiled by CSSGrammar.cpp; CSS-wide keywords are implied.
+// Shorthands have an empty initial value and syntax: their longhands are
+// listed in CSSProperties.cpp and their grammar in CSSShorthands.cpp.
+#define CSS_PROPERTY_LIST(X) \
+    /* Layout */ \
+    X(Display, "display", false, "inline", "[ block | inline | run-in ] || [ flow | flow-root | table | flex | grid | ruby ] || list-item | inline-block | inline-table | inline-flex | inline-grid | inline-list-item | table-row-group | table-header-group | table-footer-group | table-row | table-cell | table-column-group | table-column | table-caption | ruby-base | ruby-text | ruby-base-container | ruby-text-container | contents | none | -webkit-box | -webkit-inline-box | -webkit-flex | -webkit-inline-flex | -ms-flexbox | -ms-inline-flexbox") \
+    X(Position, "position", false, "static", "static | relative | absolute | fixed | sticky | -webkit-sticky") \
+    X(Top, "top", false, "auto", "<length-percentage> | auto") \
+    X(Right, "right", false, "auto", "<length-percentage> | auto") \
+    X(Bottom, "bottom", false, "auto", "<length-percentage> | auto") \
+    X(Left, "left", false, "auto", "<length-percentage> | auto") \
+    X(ZIndex, "z-index", false, "auto", "auto | <integer>") \
+    X(Float, "float", false, "none", "left | right | none | inline-start | inline-end") \
+    X(Clear, "clear", false, "none", "none | left | right | both | inline-start | inline-end") \
+    X(Visibility, "visibility", true, "visible", "visible | hidden | collapse") \
+    X(Overflow, "overflow", false, "", "") \
+    X(OverflowX, "overflow-x", false, "visible", "<overflow>") \
+    X(OverflowY, "overflow-y", false, "visible", "<overflow>") \
+    X(Clip, "clip", false, "auto", "<function> | auto") \
+    X(ClipPath, "clip-path", false, "none", "none | <url> | <function> || <shape-box>") \
+    /* Box model */ \
+    X(Width, "width", false, "auto", "<size>") \
+    X(Height, "height", false, "auto", "<size>") \
+    X(MinWidth, "min-width", false, "auto", "<size>") \
+    X(MinHeight, "min-height", false, "auto", "<size>") \
+    X(MaxWidth, "max-width", false, "none", "none | <size>") \
+    X(MaxHeight, "max-height", false, "none", "none | <size>") \
+    X(Margin, "margin", false, "", "") \
+    X(MarginTop, "margin-top", false, "0", "<length-percentage> | auto") \
+    X(MarginRight, "margin-right", false, "0", "<length-percentage> | auto") \
+    X(MarginBottom, "margin-bottom", false, "0", "<length-percentage> | auto") \
+    X(MarginLeft, "margin-left", false, "0", "<length-percentage> | auto") \
+    X(Padding, "padding", false, "", "") \
+    X(PaddingTop, "padding-top", false, "0", "<length-percentage>") \
+    X(PaddingRight, "padding-right", false, "0", "<length-percentage>") \
+    X(PaddingBottom, "padding-bottom", false, "0", "<length-percentage>") \
+    X(PaddingLeft, "padding-left", false, "0", "<length-percentage>") \
+    X(Border, "border", false, "", "") \
+    X(BorderWidth, "border-width", false, "", "") \
+    X(BorderStyle, "border-style", false, "", "") \
+    X(BorderColor, "border-color", false, "", "") \
+    X(BorderTop, "border-top", false, "", "") \
+    X(BorderRight, "border-right", false, "", "") \
+    X(BorderBottom, "border-bottom", false, "", "") \
+    X(BorderLeft, "border-left", false, "", "") \
+    X(BorderTopWidth, "border-top-width", false, "medium", "<line-width>") \
+    X(BorderRightWidth, "border-right-width", false, "medium", "<line-width>") \
+    X(BorderBottomWidth, "border-bottom-width", false, "medium", "<line-width>") \
+    X(BorderLeftWidth, "border-left-width", false, "medium", "<line-width>") \
+    X(BorderTopStyle, "border-top-style", false, "none", "<line-style>") \
+    X(BorderRightStyle, "border-right-style", false, "none", "<line-style>") \
+    X(BorderBottomStyle, "border-bottom-style", false, "none", "<line-style>") \
+    X(BorderLeftStyle, "border-left-style", false, "none", "<line-style>") \
+    X(BorderTopColor, "border-top-color", false, "currentcolor", "<color>") \
+    X(BorderRightColor, "border-right-color", false, "currentcolor", "<color>") \
+    X(BorderBottomColor, "border-bottom-color", false, "currentcolor", "<color>") \
+    X(BorderLeftColor, "border-left-color", false, "currentcolor", "<color>") \
+    X(BorderRadius, "border-radius", false, "", "") \
+    X(BorderTopLeftRadius, "border-top-left-radius", false, "0", "<length-percentage>{1,2}") \
+    X(BorderTopRightRadius, "border-top-right-radius", false, "0", "<length-percentage>{1,2}") \
+    X(BorderBottomRightRadius, "border-bottom-right-radius", false, "0", "<length-percentage>{1,2}") \
+    X(BorderBottomLeftRadius, "border-bottom-left-radius", false, "0", "<length-percentage>{1,2}") \
+    X(BoxShadow, "box-shadow", false, "none", "none | [ inset? && <length>{2,4} && <color>? ]#") \
+    X(BoxSizing, "box-sizing", false, "content-box", "content-box | border-box") \
+    /* Background */ \
+    X(Background, "background", false, "", "") \
+    X(BackgroundColor, "background-color", false, "transparent", "<color>") \
+    X(BackgroundImage, "background-image", false, "none", "<bg-image>#") \
+    X(BackgroundRepeat, "background-repeat", false, "repeat", "<repeat-style>#") \
+    X(BackgroundPosition, "background-position", false, "0% 0%", "<position>#") \
+    X(BackgroundSize, "background-size", false, "auto", "<bg-size>#") \
+    X(BackgroundAttachment, "background-attachment", false, "scroll", "[ scroll | fixed | local ]#") \
+    X(BackgroundOrigin, "background-origin", false, "padding-box", "<box>#") \
+    X(BackgroundClip, "background-clip", false, "border-box", "[ <box> | text | border-area ]#") \
+    X(BackgroundBlendMode, "background-blend-mode", false, "normal", "<blend-mode>#") \
+    /* Typography */ \
+    X(Font, "font", true, "", "") \
+    X(FontFamily, "font-family", true, "serif", "[ <string> | <ident>+ ]#") \
+    X(FontSize, "font-size", true, "medium", "xx-small | x-small | small | medium | large | x-large | xx-large | xxx-large | larger | smaller | <length-percentage>") \
+    X(FontWeight, "font-weight", true, "normal", "normal | bold | bolder | lighter | <number>") \
+    X(FontStyle, "font-style", true, "normal", "normal | italic | oblique <angle>?") \
+    X(FontVariant, "font-variant", true, "normal", "normal | none | <ident>+") \
+    X(FontStretch, "font-stretch", true, "normal", "normal | <percentage> | ultra-condensed | extra-condensed | condensed | semi-condensed | semi-expanded | expanded | extra-expanded | ultra-expanded") \
+    X(LineHeight, "line-height", true, "normal", "normal | <number> | <length-percentage>") \
+    X(LetterSpacing, "letter-spacing", true, "normal", "normal | <length-percentage>") \
+    X(WordSpacing, "word-spacing", true, "normal", "normal | <length-percentage>") \
+    X(TextAlign, "text-align", true, "start", "start | end | left | right | center | justify | match-parent | justify-all | -webkit-center | -moz-center | -webkit-left | -webkit-right") \
+    X(TextDecoration, "text-decoration", false, "", "") \
+    X(TextDecorationLine, "text-decoration-line", false, "none", "none | underline || overline || line-through || blink") \
+    X(TextDecorationStyle, "text-decoration-style", false, "solid", "solid | double | dotted | dashed | wavy") \
+    X(TextDecorationColor, "text-decoration-color", false, "currentcolor", "<color>") \
+    X(TextTransform, "text-transform", true, "none", "none | [ capitalize | uppercase | lowercase ] || full-width || full-size-kana") \
+    X(TextIndent, "text-indent", true, "0", "<length-percentage> && hanging? && each-line?") \
+    X(TextShadow, "text-shadow", true, "none", "none | [ <length>{2,3} && <color>? ]#") \
+    X(WhiteSpace, "white-space", true, "normal", "normal | pre | nowrap | pre-wrap | pre-line | break-spaces") \
+    X(OverflowWrap, "overflow-wrap", true, "normal", "normal | break-word | anywhere") \
+    X(WordBreak, "word-break", true, "normal", "normal | break-all | keep-all | break-word | auto-phrase") \
+    X(TextOverflow, "text-overflow", false, "clip", "[ clip | ellipsis | <string> ]{1,2}") \
+    X(VerticalAlign, "vertical-align", false, "baseline", "baseline | sub | super | text-top | text-bottom | middle | top | bottom | <length-percentage>") \
+    X(Direction, "direction", true, "ltr", "ltr | rtl") \
+    X(UnicodeBidi, "unicode-bidi", false, "normal", "normal | embed | isolate | bidi-override | isolate-override | plaintext") \
+    X(WritingMode, "writing-mode", true, "horizontal-tb", "horizontal-tb | vertical-rl | vertical-lr | sideways-rl | sideways-lr | lr | lr-tb | rl | rl-tb | tb | tb-rl") \
+    /* Color */ \
+    X(Color, "color", true, "canvastext", "<color>") \
+    X(Opacity, "opacity", false, "1", "<number> | <percentage>") \
+    /* Flexbox */ \
+    X(Flex, "flex", false, "", "") \
+    X(FlexDirection, "flex-direction", false, "row", "row | row-reverse | column | column-reverse") \
+    X(FlexWrap, "flex-wrap", false, "nowrap", "nowrap | wrap | wrap-reverse") \
+    X(FlexFlow, "flex-flow", false, "", "") \
+    X(JustifyContent, "justify-content", false, "normal", "normal | stretch | space-between | space-around | space-evenly | [ safe | unsafe ]? [ center | start | end | flex-start | flex-end | left | right ]") \
+    X(AlignItems, "align-items", false, "normal", "normal | stretch | <baseline-position> | [ safe | unsafe ]? <self-position> | anchor-center") \
+    X(AlignContent, "align-content", false, "normal", "normal | stretch | space-between | space-around | space-evenly | <baseline-position> | [ safe | unsafe ]? [ center | start | end | flex-start | flex-end ]") \
+    X(AlignSelf, "align-self", false, "auto", "auto | normal | stretch | <baseline-position> | [ safe | unsafe ]? <self-position> | anchor-center") \
+    X(FlexGrow, "flex-grow", false, "0", "<number>") \
+    X(FlexShrink, "flex-shrink", false, "1", "<number>") \
+    X(FlexBasis, "flex-basis", false, "auto", "content | <size>") \
+    X(Order, "order", false, "0", "<integer>") \
+    /* Grid */ \
+    X(Grid, "grid", false, "", "") \
+    X(GridTemplate, "grid-template", false, "", "") \
+    X(GridTemplateRows, "grid-template-rows", false, "none", "none | <any>+") \
+    X(GridTemplateColumns, "grid-template-columns", false, "none", "none | <any>+") \
+    X(GridTemplateAreas, "grid-template-areas", false, "none", "none | <string>+") \
+    X(GridAutoRows, "grid-auto-rows", false, "auto", "<track-size>+") \
+    X(GridAutoColumns, "grid-auto-columns", false, "auto", "<track-size>+") \
+    X(GridAutoFlow, "grid-auto-flow", false, "row", "[ row | column ] || dense") \
+    X(GridRow, "grid-row", false, "", "") \
+    X(GridColumn, "grid-column", false, "", "") \
+    X(GridArea, "grid-area", false, "", "") \
+    X(GridRowStart, "grid-row-start", false, "auto", "<grid-line>") \
+    X(GridRowEnd, "grid-row-end", false, "auto", "<grid-line>") \
+    X(GridColumnStart, "grid-column-start", false, "auto", "<grid-line>") \
+    X(GridColumnEnd, "grid-column-end", false, "auto", "<grid-line>") \
+    X(Gap, "gap", false, "", "") \
+    X(RowGap, "row-gap", false, "normal", "normal | <length-percentage>") \
+    X(ColumnGap, "column-gap", false, "normal", "normal | <length-percentage>") \
+    /* Transforms */ \
+    X(Transform, "transform", false, "none", "none | <function>+") \
+    X(TransformOrigin, "transform-origin", false, "50% 50% 0", "[ left | center | right | top | bottom | <length-percentage> ]{1,2} <length>?") \
+    X(TransformStyle, "transform-style", false, "flat", "flat | preserve-3d") \
+    X(Perspective, "perspective", false, "none", "none | <length>") \
+    X(PerspectiveOrigin, "perspective-origin", false, "50% 50%", "<position>") \
+    X(BackfaceVisibility, "backface-visibility", false, "visible", "visible | hidden") \
+    /* Transitions and animations */ \
+    X(Transition, "transition", false, "", "") \
+    X(TransitionProperty, "transition-property", false, "all", "none | <custom-ident>#") \
+    X(TransitionDuration, "transition-duration", false, "0s", "<time>#") \
+    X(TransitionTimingFunction, "transition-timing-function", false, "ease", "<easing-function>#") \
+    X(TransitionDelay, "transition-delay", false, "0s", "<time>#") \
+    X(Animation, "animation", false, "", "") \
+    X(AnimationName, "animation-name", false, "none", "[ none | <custom-ident> | <string> ]#") \
+    X(AnimationDuration, "animation-duration", false, "0s", "[ auto | <time> ]#") \
+    X(AnimationTimingFunction, "animation-timing-function", false, "ease", "<easing-function>#") \
+    X(AnimationDelay, "animation-delay", false, "0s", "<time>#") \
+    X(AnimationIterationCount, "animation-iteration-count", false, "1", "[ infinite | <number> ]#") \
+    X(AnimationDirection, "animation-direction", false, "normal", "[ normal | reverse | alternate | alternate-reverse ]#") \
+    X(AnimationFillMode, "animation-fill-mode", false, "none", "[ none | forwards | backwards | both ]#") \
+    X(AnimationPlayState, "animation-play-state", false, "running", "[ running | paused ]#") \
+    /* Filters and effects */ \
+    X(Filter, "filter", false, "none", "none | [ <function> | <url> ]+") \
+    X(BackdropFilter, "backdrop-filter", false, "none", "none | [ <function> | <url> ]+") \
+    X(MixBlendMode, "mix-blend-mode", false, "normal", "<blend-mode> | plus-darker | plus-lighter") \
+    X(Isolation, "isolation", false, "auto", "auto | isolate") \
+    /* Table */ \
+    X(TableLayout, "table-layout", false, "auto", "auto | fixed") \
+    X(BorderCollapse, "border-collapse", true, "separate", "collapse | separate") \
+    X(BorderSpacing, "border-spacing", true, "0", "<length>{1,2}") \
+    X(CaptionSide, "caption-side", true, "top", "top | bottom | block-start | block-end | inline-start | inline-end") \
+    X(EmptyCells, "empty-cells", true, "show", "show | hide") \
+    /* Lists */ \
+    X(ListStyle, "list-style", true, "", "") \
+    X(ListStyleType, "list-style-type", true, "disc", "none | <custom-ident> | <string> | <function>") \
+    X(ListStylePosition, "list-style-position", true, "outside", "inside | outside") \
+    X(ListStyleImage, "list-style-image", true, "none", "none | <image>") \
+    /* Generated content */ \
+    X(Content, "content", false, "normal", "normal | none | [ <string> | <image> | <function> | open-quote | close-quote | no-open-quote | no-close-quote ]+ [ / [ <string> | <function> ]+ ]?") \
+    X(Quotes, "quotes", true, "auto", "auto | none | [ <string> <string> ]+") \
+    X(CounterReset, "counter-reset", false, "none", "none | [ <custom-ident> <integer>? ]+") \
+    X(CounterIncrement, "counter-increment", false, "none", "none | [ <custom-ident> <integer>? ]+") \
+    /* User interface */ \
+    X(Cursor, "cursor", true, "auto", "[ [ <url> | <function> ] [ <number> <number> ]? , ]* <cursor-keyword>") \
+    X(Outline, "outline", false, "", "") \
+    X(OutlineWidth, "outline-width", false, "medium", "<line-width>") \
+    X(OutlineStyle, "outline-style", false, "none", "auto | <line-style>") \
+    X(OutlineColor, "outline-color", false, "invert", "<color> | invert") \
+    X(OutlineOffset, "outline-offset", false, "0", "<length>") \
+    X(Resize, "resize", false, "none", "none | both | horizontal | vertical | block | inline") \
+    X(UserSelect, "user-select", false, "auto", "auto | text | none | contain | all") \
+    X(PointerEvents, "pointer-events", true, "auto", "auto | none | visiblePainted | visibleFill | visibleStroke | visible | painted | fill | stroke | all | bounding-box") \
+    /* Multi-column */ \
+    X(Columns, "columns", false, "", "") \
+    X(ColumnCount, "column-count", false, "auto", "auto | <integer>") \
+    X(ColumnWidth, "column-width", false, "auto", "auto | <length>") \
+    X(ColumnRule, "column-rule", false, "", "") \
+    X(ColumnRuleWidth, "column-rule-width", false, "medium", "<line-width>") \
+    X(ColumnRuleStyle, "column-rule-style", false, "none", "<line-style>") \
+    X(ColumnRuleColor, "column-rule-color", false, "currentcolor", "<color>") \
+    X(ColumnSpan, "column-span", false, "none", "none | all") \
+    X(ColumnFill, "column-fill", false, "balance", "auto | balance | balance-all") \
+    X(BreakBefore, "break-before", false, "auto", "<break-between>") \
+    X(BreakAfter, "break-after", false, "auto", "<break-between>") \
+    X(BreakInside, "break-inside", false, "auto", "auto | avoid | avoid-page | avoid-column | avoid-region") \
+    /* Images, masks and scrolling */ \
+    X(BorderImage, "border-image", false, "", "") \
+    X(BorderImageSource, "border-image-source", false, "none", "none | <image>") \
+    X(BorderImageSlice, "border-image-slice", false, "100%", "[ <number> | <percentage> ]{1,4} && fill?") \
+    X(BorderImageWidth, "border-image-width", false, "1", "[ <length-percentage> | <number> | auto ]{1,4}") \
+    X(BorderImageOutset, "border-image-outset", false, "0", "[ <length> | <number> ]{1,4}") \
+    X(BorderImageRepeat, "border-image-repeat", false, "stretch", "[ stretch | repeat | round | space ]{1,2}") \
+    X(Mask, "mask", false, "", "") \
+    X(MaskImage, "mask-image", false, "none", "<bg-image>#") \
+    X(MaskMode, "mask-mode", false, "match-source", "[ alpha | luminance | match-source ]#") \
+    X(MaskRepeat, "mask-repeat", false, "repeat", "<repeat-style>#") \
+    X(MaskPosition, "mask-position", false, "0% 0%", "<position>#") \
+    X(MaskClip, "mask-clip", false, "border-box", "[ <shape-box> | no-clip ]#") \
+    X(MaskOrigin, "mask-origin", false, "border-box", "<shape-box>#") \
+    X(MaskSize, "mask-size", false, "auto", "<bg-size>#") \
+    X(MaskComposite, "mask-composite", false, "add", "[ add | subtract | intersect | exclude ]#") \
+    X(ObjectFit, "object-fit", false, "fill", "fill | contain | cover | none | scale-down") \
+    X(ObjectPosition, "object-position", false, "50% 50%", "<position>") \
+    X(ImageRendering, "image-rendering", true, "auto", "auto | smooth | high-quality | crisp-edges | pixelated | optimizeSpeed | optimizeQuality | -webkit-optimize-contrast | -moz-crisp-edges") \
+    X(ShapeOutside, "shape-outside", false, "none", "none | <image> | <function> || <shape-box>") \
+    X(ShapeMargin, "shape-margin", false, "0", "<length-percentage>") \
+    X(ShapeImageThreshold, "shape-image-threshold", false, "0", "<number> | <percentage>") \
+    X(ScrollBehavior, "scroll-behavior", false, "auto", "auto | smooth") \
+    X(ScrollSnapType, "scroll-snap-type", false, "none", "none | [ x | y | block | inline | both ] [ mandatory | proximity ]?") \
+    X(ScrollSnapAlign, "scroll-snap-align", false, "none", "[ none | start | end | center ]{1,2}") \
+    X(OverscrollBehavior, "overscroll-behavior", false, "auto", "[ contain | none | auto ]{1,2}") \
+    X(TouchAction, "touch-action", false, "auto", "auto | none | manipulation | [ pan-x | pan-left | pan-right ] || [ pan-y | pan-up | pan-down ] || pinch-zoom")
+
+// Unknown and Custom come first so the table proper starts at index 2
+enum class PropertyId : uint16_t {
+    Unknown,
+    Custom, // --*
+#define CSS_PROPERTY_ENUM(id, name, inherited, initial, syntax) id,
+    CSS_PROPERTY_LIST(CSS_PROPERTY_ENUM)
+#undef CSS_PROPERTY_ENUM
+    Count
+};
+
+constexpr size_t property_count = static_cast<size_t>(PropertyId::Count);
+
+struct PropertyInfo {
+    std::string_view name;
+    bool inherited = false;
+    std::string_view initial;           // empty for shorthands
+    const PropertyId* longhands = nullptr;
+    size_t longhand_count = 0;          // non-zero for shorthands
+    std::string_view syntax;            // value-definition syntax; empty for shorthands
+
+    bool is_shorthand() const { return longhand_count > 0; }
+};
+
+// ASCII case-insensitive and allocation-free. Resolves -webkit-, -moz-,
+// -ms- and -o- prefixed names and legacy aliases (word-wrap, grid-gap) to
+// the standard property; "--*" is Custom, anything else Unknown.
+PropertyId property_id(std::string_view name);
+
+const PropertyInfo& property_info(PropertyId id);
+inline std::string_view property_name(PropertyId id) { return property_info(id).name; }
+
+} // namespace CSS3Parser
+
+#endif // CSS_PROPERTIES_H
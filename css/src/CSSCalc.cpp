@@ -0,0 +1,447 @@
+#include "CSSParser.h"
+#include <cmath>
+
+namespace CSS3Parser {
+
+namespace {
+
+bool equals_ignoring_case(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        char x = a[i], y = b[i];
+        if (x >= 'A' && x <= 'Z') x = static_cast<char>(x + ('a' - 'A'));
+        if (y >= 'A' && y <= 'Z') y = static_cast<char>(y + ('a' - 'A'));
+        if (x != y) return false;
+    }
+    return true;
+}
+
+constexpr double pi = 3.14159265358979323846;
+
+// Absolute units become px, deg, s, Hz or dppx; relative ones are kept
+bool canonicalize(CSSUnit unit, double& value, CSSUnit& canonical) {
+    canonical = unit;
+    switch (unit) {
+        case CSSUnit::Cm: value *= 96.0 / 2.54; canonical = CSSUnit::Px; return true;
+        case CSSUnit::Mm: value *= 96.0 / 25.4; canonical = CSSUnit::Px; return true;
+        case CSSUnit::Q: value *= 96.0 / 101.6; canonical = CSSUnit::Px; return true;
+        case CSSUnit::In: value *= 96.0; canonical = CSSUnit::Px; return true;
+        case CSSUnit::Pt: value *= 96.0 / 72.0; canonical = CSSUnit::Px; return true;
+        case CSSUnit::Pc: value *= 16.0; canonical = CSSUnit::Px; return true;
+        case CSSUnit::Rad: value *= 180.0 / pi; canonical = CSSUnit::Deg; return true;
+        case CSSUnit::Grad: value *= 0.9; canonical = CSSUnit::Deg; return true;
+        case CSSUnit::Turn: value *= 360.0; canonical = CSSUnit::Deg; return true;
+        case CSSUnit::Ms: value *= 0.001; canonical = CSSUnit::S; return true;
+        case CSSUnit::Khz: value *= 1000.0; canonical = CSSUnit::Hz; return true;
+        case CSSUnit::Dpi: value /= 96.0; canonical = CSSUnit::Dppx; return true;
+        case CSSUnit::Dpcm: value *= 2.54 / 96.0; canonical = CSSUnit::Dppx; return true;
+        case CSSUnit::X: canonical = CSSUnit::Dppx; return true;
+        case CSSUnit::Fr:
+        case CSSUnit::Unknown:
+            return false;
+        default:
+            return true;
+    }
+}
+
+CalcType type_of(CSSUnit canonical) {
+    switch (unit_value_type(canonical)) {
+        case ValueType::Number: return CalcType::Number;
+        case ValueType::Percentage: return CalcType::Percentage;
+        case ValueType::Angle: return CalcType::Angle;
+        case ValueType::Time: return CalcType::Time;
+        case ValueType::Frequency: return CalcType::Frequency;
+        case ValueType::Resolution: return CalcType::Resolution;
+        default: return CalcType::Length;
+    }
+}
+
+bool is_length_percentage(CalcType type) {
+    return type == CalcType::Length || type == CalcType::Percentage || type == CalcType::LengthPercentage;
+}
+
+// The type of a sum, or false when the operands cannot be added
+bool add_types(CalcType a, CalcType b, CalcType& sum) {
+    if (a == b) {
+        sum = a;
+        return true;
+    }
+    if (is_length_percentage(a) && is_length_percentage(b)) {
+        sum = CalcType::LengthPercentage;
+        return true;
+    }
+    return false;
+}
+
+// An operand after folding: one Push per canonical unit, plus scaled
+// min()/max()/clamp() programs whose arguments mix units
+struct Folded {
+    CalcType type = CalcType::Number;
+    std::vector<CalcInstruction> terms;
+    std::vector<std::pair<double, std::vector<CalcInstruction>>> others;
+
+    // Numbers never depend on the context, so a Number is a single term
+    double constant() const { return terms.empty() ? 0.0 : terms.front().value; }
+    bool single_term() const { return terms.size() == 1 && others.empty(); }
+};
+
+void scale(Folded& folded, double factor) {
+    for (CalcInstruction& term : folded.terms) term.value *= factor;
+    for (auto& other : folded.others) other.first *= factor;
+}
+
+bool add(Folded& sum, Folded&& operand) {
+    if (!add_types(sum.type, operand.type, sum.type)) return false;
+    for (const CalcInstruction& term : operand.terms) {
+        auto same = std::find_if(sum.terms.begin(), sum.terms.end(),
+                                 [&](const CalcInstruction& existing) { return existing.unit == term.unit; });
+        if (same != sum.terms.end()) {
+            same->value += term.value;
+        } else {
+            sum.terms.push_back(term);
+        }
+    }
+    for (auto& other : operand.others) sum.others.push_back(std::move(other));
+    return true;
+}
+
+void emit(const Folded& folded, std::vector<CalcInstruction>& code) {
+    // Terms that cancelled out are dropped unless nothing else is left
+    size_t parts = 0;
+    for (const CalcInstruction& term : folded.terms) {
+        if (term.value == 0.0 && folded.terms.size() + folded.others.size() > 1) continue;
+        code.push_back(term);
+        parts++;
+    }
+    if (parts == 0 && folded.others.empty() && !folded.terms.empty()) {
+        code.push_back(folded.terms.front());
+        parts++;
+    }
+    for (const auto& other : folded.others) {
+        code.insert(code.end(), other.second.begin(), other.second.end());
+        if (other.first != 1.0) code.push_back(CalcInstruction{other.first, CalcOp::Scale});
+        parts++;
+    }
+    if (parts > 1) code.push_back(CalcInstruction{0.0, CalcOp::Sum, CSSUnit::None, static_cast<uint16_t>(parts)});
+}
+
+size_t stack_depth(const std::vector<CalcInstruction>& code) {
+    size_t depth = 0, deepest = 0;
+    for (const CalcInstruction& instruction : code) {
+        switch (instruction.op) {
+            case CalcOp::Push: deepest = std::max(deepest, ++depth); break;
+            case CalcOp::Scale: break;
+            case CalcOp::Sum:
+            case CalcOp::Min:
+            case CalcOp::Max: depth -= instruction.count - 1; break;
+            case CalcOp::Clamp: depth -= 2; break;
+        }
+    }
+    return deepest;
+}
+
+// Recursive descent over the components the parser keeps for a math
+// function: each comma-separated argument is an operand or a space-separated
+// list of operands and "+", "-", "*", "/" keywords
+class MathFolder {
+public:
+    bool fold_function(const CSSValue& function, Folded& out) {
+        if (++depth_ > max_depth) return false;
+        std::string_view name = function.text();
+        size_t count = function.size();
+        bool folded = false;
+
+        if (equals_ignoring_case(name, "calc") || equals_ignoring_case(name, "-webkit-calc") ||
+            equals_ignoring_case(name, "-moz-calc")) {
+            folded = count == 1 && fold_argument(function[0], out);
+        } else if (equals_ignoring_case(name, "min")) {
+            folded = count >= 1 && fold_comparison(function, CalcOp::Min, out);
+        } else if (equals_ignoring_case(name, "max")) {
+            folded = count >= 1 && fold_comparison(function, CalcOp::Max, out);
+        } else if (equals_ignoring_case(name, "clamp")) {
+            folded = count == 3 && fold_comparison(function, CalcOp::Clamp, out);
+        }
+        depth_--;
+        return folded;
+    }
+
+private:
+    static constexpr int max_depth = 32;
+    int depth_ = 0;
+
+    bool fold_argument(const CSSValue& argument, Folded& out) {
+        if (argument.type == ValueType::List) {
+            if (argument.is_comma_separated()) return false;
+            size_t pos = 0;
+            return fold_sum(argument.begin(), argument.size(), pos, out) && pos == argument.size();
+        }
+        size_t pos = 0;
+        return fold_sum(&argument, 1, pos, out);
+    }
+
+    bool fold_sum(const CSSValue* items, size_t count, size_t& pos, Folded& out) {
+        if (!fold_product(items, count, pos, out)) return false;
+        while (pos < count) {
+            bool minus = is_operator(items[pos], minus_);
+            if (!minus && !is_operator(items[pos], plus_)) return false;
+            pos++;
+            Folded operand;
+            if (!fold_product(items, count, pos, operand)) return false;
+            if (minus) scale(operand, -1.0);
+            if (!add(out, std::move(operand))) return false;
+        }
+        return true;
+    }
+
+    bool fold_product(const CSSValue* items, size_t count, size_t& pos, Folded& out) {
+        if (pos >= count || !fold_operand(items[pos++], out)) return false;
+        while (pos < count) {
+            bool divide = is_operator(items[pos], divide_);
+            if (!divide && !is_operator(items[pos], multiply_)) return true;
+            pos++;
+            Folded operand;
+            if (pos >= count || !fold_operand(items[pos++], operand)) return false;
+            if (divide) {
+                if (operand.type != CalcType::Number) return false;
+                scale(out, 1.0 / operand.constant());
+            } else if (operand.type == CalcType::Number) {
+                scale(out, operand.constant());
+            } else if (out.type == CalcType::Number) {
+                scale(operand, out.constant());
+                out = std::move(operand);
+            } else {
+                return false; // px * px has no CSS type
+            }
+        }
+        return true;
+    }
+
+    bool fold_operand(const CSSValue& value, Folded& out) {
+        if (value.is_numeric()) {
+            double number = value.numeric_value();
+            CSSUnit unit;
+            if (!canonicalize(value.unit(), number, unit)) return false;
+            out.type = type_of(unit);
+            out.terms.push_back(CalcInstruction{number, CalcOp::Push, unit});
+            return true;
+        }
+        if (value.is_keyword()) {
+            std::string_view name = value.text();
+            double constant;
+            if (equals_ignoring_case(name, "pi")) {
+                constant = pi;
+            } else if (equals_ignoring_case(name, "e")) {
+                constant = 2.71828182845904523536;
+            } else if (equals_ignoring_case(name, "infinity")) {
+                constant = HUGE_VAL;
+            } else if (equals_ignoring_case(name, "-infinity")) {
+                constant = -HUGE_VAL;
+            } else {
+                return false;
+            }
+            out.type = CalcType::Number;
+            out.terms.push_back(CalcInstruction{constant, CalcOp::Push});
+            return true;
+        }
+        if (value.is_function()) return fold_function(value, out);
+        if (const CalcExpression* math = value.math()) return fold_compiled(*math, out);
+        return false;
+    }
+
+    // Compiled math reaches a calc() when var() substitution puts it there.
+    // A plain sum unfolds back into terms so that its units still merge
+    static bool fold_compiled(const CalcExpression& math, Folded& out) {
+        const CalcInstruction* code = math.code;
+        size_t pushes = std::count_if(code, code + math.size,
+                                      [](const CalcInstruction& instruction) { return instruction.op == CalcOp::Push; });
+        out.type = math.type;
+        if (pushes == math.size || (pushes + 1 == math.size && code[pushes].op == CalcOp::Sum)) {
+            out.terms.assign(code, code + pushes);
+        } else {
+            out.others.emplace_back(1.0, std::vector<CalcInstruction>(code, code + math.size));
+        }
+        return true;
+    }
+
+    bool fold_comparison(const CSSValue& function, CalcOp op, Folded& out) {
+        std::vector<Folded> arguments(function.size());
+        for (size_t i = 0; i < function.size(); ++i) {
+            if (!fold_argument(function[i], arguments[i])) return false;
+            if (i > 0 && !add_types(arguments[0].type, arguments[i].type, arguments[0].type)) return false;
+        }
+        out.type = arguments[0].type;
+
+        // Arguments in one unit compare now
+        bool constant = std::all_of(arguments.begin(), arguments.end(), [&](const Folded& argument) {
+            return argument.single_term() && argument.terms[0].unit == arguments[0].terms[0].unit;
+        });
+        if (constant) {
+            double result = arguments[0].terms[0].value;
+            if (op == CalcOp::Clamp) {
+                result = std::max(result, std::min(arguments[1].terms[0].value, arguments[2].terms[0].value));
+            }
+            for (size_t i = 1; op != CalcOp::Clamp && i < arguments.size(); ++i) {
+                double value = arguments[i].terms[0].value;
+                result = op == CalcOp::Min ? std::min(result, value) : std::max(result, value);
+            }
+            out.terms.push_back(CalcInstruction{result, CalcOp::Push, arguments[0].terms[0].unit});
+            return true;
+        }
+
+        std::vector<CalcInstruction> code;
+        for (const Folded& argument : arguments) emit(argument, code);
+        code.push_back(CalcInstruction{0.0, op, CSSUnit::None, static_cast<uint16_t>(arguments.size())});
+        out.others.emplace_back(1.0, std::move(code));
+        return true;
+    }
+
+    static bool is_operator(const CSSValue& value, BrowserParser::Atom op) {
+        return value.is_keyword() && value.atom() == op;
+    }
+
+    static inline const BrowserParser::Atom plus_ = BrowserParser::intern_permanent_atom("+");
+    static inline const BrowserParser::Atom minus_ = BrowserParser::intern_permanent_atom("-");
+    static inline const BrowserParser::Atom multiply_ = BrowserParser::intern_permanent_atom("*");
+    static inline const BrowserParser::Atom divide_ = BrowserParser::intern_permanent_atom("/");
+};
+
+double resolve(CSSUnit unit, const CalcContext& context) {
+    switch (unit) {
+        case CSSUnit::Percent: return context.percentage_basis / 100.0;
+        case CSSUnit::Em: return context.font_size;
+        case CSSUnit::Rem: return context.root_font_size;
+        case CSSUnit::Ex:
+        case CSSUnit::Ch: return context.font_size / 2.0;
+        case CSSUnit::Vw: return context.viewport_width / 100.0;
+        case CSSUnit::Vh: return context.viewport_height / 100.0;
+        case CSSUnit::Vmin: return std::min(context.viewport_width, context.viewport_height) / 100.0;
+        case CSSUnit::Vmax: return std::max(context.viewport_width, context.viewport_height) / 100.0;
+        default: return 1.0;
+    }
+}
+
+} // namespace
+
+bool compile_math(const CSSValue& function, CSSValueArena& arena, CSSValue& compiled) {
+    if (!function.is_function()) return false;
+
+    Folded folded;
+    MathFolder folder;
+    if (!folder.fold_function(function, folded)) return false;
+
+    std::vector<CalcInstruction> code;
+    emit(folded, code);
+    if (stack_depth(code) > CalcExpression::max_stack) return false;
+
+    CalcExpression expression;
+    expression.code = code.data();
+    expression.size = static_cast<uint32_t>(code.size());
+    expression.type = folded.type;
+    compiled = CSSValue::make_math(expression, arena);
+    return true;
+}
+
+double CalcExpression::evaluate(const CalcContext& context) const {
+    double stack[max_stack];
+    size_t top = 0;
+
+    for (const CalcInstruction* instruction = code; instruction != code + size; ++instruction) {
+        switch (instruction->op) {
+            case CalcOp::Push:
+                stack[top++] = instruction->value * resolve(instruction->unit, context);
+                break;
+            case CalcOp::Scale:
+                stack[top - 1] *= instruction->value;
+                break;
+            case CalcOp::Sum: {
+                top -= instruction->count;
+                double sum = stack[top];
+                for (size_t i = 1; i < instruction->count; ++i) sum += stack[top + i];
+                stack[top++] = sum;
+                break;
+            }
+            case CalcOp::Min:
+            case CalcOp::Max: {
+                top -= instruction->count;
+                double result = stack[top];
+                for (size_t i = 1; i < instruction->count; ++i) {
+                    result = instruction->op == CalcOp::Min ? std::min(result, stack[top + i])
+                                                            : std::max(result, stack[top + i]);
+                }
+                stack[top++] = result;
+                break;
+            }
+            case CalcOp::Clamp:
+                top -= 2;
+                stack[top - 1] = std::max(stack[top - 1], std::min(stack[top], stack[top + 1]));
+                break;
+        }
+    }
+    return top ? stack[0] : 0.0;
+}
+
+std::string CalcExpression::to_string() const {
+    std::vector<std::string> stack;
+
+    auto join = [&](size_t count, const char* separator) {
+        std::string joined;
+        for (size_t i = stack.size() - count; i < stack.size(); ++i) {
+            if (i > stack.size() - count) joined += separator;
+            joined += stack[i];
+        }
+        stack.resize(stack.size() - count);
+        return joined;
+    };
+
+    for (const CalcInstruction* instruction = code; instruction != code + size; ++instruction) {
+        switch (instruction->op) {
+            case CalcOp::Push:
+                if (std::isinf(instruction->value)) {
+                    std::string infinity = instruction->value < 0 ? "-infinity" : "infinity";
+                    if (instruction->unit != CSSUnit::None) {
+                        infinity += " * " + CSSValue::make_number(1.0, instruction->unit).to_string();
+                    }
+                    stack.push_back(infinity);
+                } else {
+                    stack.push_back(CSSValue::make_number(instruction->value, instruction->unit).to_string());
+                }
+                break;
+            case CalcOp::Scale:
+                stack.back() += " * " + CSSValue::make_number(instruction->value).to_string();
+                break;
+            case CalcOp::Sum: {
+                // "a + -b" reads as "a - b"
+                std::string sum;
+                for (size_t i = stack.size() - instruction->count; i < stack.size(); ++i) {
+                    const std::string& term = stack[i];
+                    if (sum.empty()) {
+                        sum = term;
+                    } else if (term[0] == '-') {
+                        sum += " - " + term.substr(1);
+                    } else {
+                        sum += " + " + term;
+                    }
+                }
+                stack.resize(stack.size() - instruction->count);
+                stack.push_back(sum);
+                break;
+            }
+            case CalcOp::Min:
+                stack.push_back("min(" + join(instruction->count, ", ") + ")");
+                break;
+            case CalcOp::Max:
+                stack.push_back("max(" + join(instruction->count, ", ") + ")");
+                break;
+            case CalcOp::Clamp:
+                stack.push_back("clamp(" + join(3, ", ") + ")");
+                break;
+        }
+    }
+
+    if (stack.empty()) return "calc(0)";
+    CalcOp last = code[size - 1].op;
+    bool function = last == CalcOp::Min || last == CalcOp::Max || last == CalcOp::Clamp;
+    return function ? stack.back() : "calc(" + stack.back() + ")";
+}
+
+} // namespace CSS3Parser
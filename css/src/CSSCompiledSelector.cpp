@@ -0,0 +1,246 @@
+#include "CSSParser.h"
+#include <sstream>
+#include <algorithm>
+#include <charconv>
+
+namespace CSS3Parser {
+
+namespace {
+
+// Cheapest and most selective tests run first inside a compound
+int instruction_cost(SelectorType type) {
+    switch (type) {
+        case SelectorType::Id:            return 0;
+        case SelectorType::Class:         return 1;
+        case SelectorType::Type:          return 2;
+        case SelectorType::Attribute:     return 3;
+        case SelectorType::Pseudo:        return 4;
+        case SelectorType::PseudoElement: return 5;
+        case SelectorType::Universal:
+        case SelectorType::Nesting:       return 6;
+    }
+    return 6;
+}
+
+int32_t parse_nth_integer(std::string_view text, bool& ok) {
+    bool negative = !text.empty() && text.front() == '-';
+    if (!text.empty() && (text.front() == '+' || text.front() == '-')) text.remove_prefix(1);
+    int32_t value = 0;
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    ok = ok && !text.empty() && error == std::errc() && end == text.data() + text.size();
+    return negative ? -value : value;
+}
+
+// An+B of :nth-child() and friends; "of S" is not supported. A malformed
+// argument leaves A = B = 0, which matches no element
+void parse_nth(std::string_view argument, CompiledPseudo& pseudo) {
+    std::string text;
+    for (char c : argument) {
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f') continue;
+        text += (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+    }
+    
+    int32_t step = 0, offset = 0;
+    bool ok = true;
+    if (text == "odd") {
+        step = 2;
+        offset = 1;
+    } else if (text == "even") {
+        step = 2;
+    } else if (size_t n = text.find('n'); n == std::string::npos) {
+        offset = parse_nth_integer(text, ok);
+    } else {
+        std::string_view a(text.data(), n);
+        std::string_view b(text.data() + n + 1, text.size() - n - 1);
+        step = a.empty() || a == "+" ? 1 : a == "-" ? -1 : parse_nth_integer(a, ok);
+        if (!b.empty()) {
+            ok = ok && (b.front() == '+' || b.front() == '-'); // "2n3" is not An+B
+            offset = parse_nth_integer(b, ok);
+        }
+    }
+    if (ok) {
+        pseudo.nth_step = step;
+        pseudo.nth_offset = offset;
+    }
+}
+
+bool is_nth_pseudo(const std::string& name) {
+    return name == ":nth-child" || name == ":nth-last-child" || name == ":nth-of-type" ||
+           name == ":nth-last-of-type";
+}
+
+SelectorOp combinator_op(SelectorCombinator combinator) {
+    switch (combinator) {
+        case SelectorCombinator::Child:           return SelectorOp::Parent;
+        case SelectorCombinator::AdjacentSibling: return SelectorOp::Previous;
+        case SelectorCombinator::GeneralSibling:  return SelectorOp::AnyPrevious;
+        case SelectorCombinator::None:
+        case SelectorCombinator::Descendant:      return SelectorOp::Ancestor;
+    }
+    return SelectorOp::Ancestor;
+}
+
+void compile_compound(const CompoundSelector& compound, CompiledSelector& compiled) {
+    std::vector<const SimpleSelector*> ordered;
+    ordered.reserve(compound.selectors.size());
+    for (const auto& simple : compound.selectors) {
+        ordered.push_back(&simple);
+    }
+    std::stable_sort(ordered.begin(), ordered.end(), [](const SimpleSelector* a, const SimpleSelector* b) {
+        return instruction_cost(a->type) < instruction_cost(b->type);
+    });
+
+    for (const SimpleSelector* simple : ordered) {
+        SelectorInstruction instruction;
+
+        switch (simple->type) {
+            case SelectorType::Universal:
+            case SelectorType::Nesting: // resolved by the parser; never reaches here
+                // A bare '*' only matters when it is the whole compound
+                if (compound.selectors.size() > 1) continue;
+                instruction.op = SelectorOp::Universal;
+                break;
+            case SelectorType::Type:
+                instruction.op = SelectorOp::Tag;
+                instruction.operand = BrowserParser::intern_atom(simple->name);
+                compiled.required_atoms.push_back(instruction.operand);
+                break;
+            case SelectorType::Id:
+                instruction.op = SelectorOp::Id;
+                instruction.operand = BrowserParser::intern_atom(simple->name);
+                compiled.required_atoms.push_back(instruction.operand);
+                break;
+            case SelectorType::Class:
+                instruction.op = SelectorOp::Class;
+                instruction.operand = BrowserParser::intern_atom(simple->name);
+                compiled.required_atoms.push_back(instruction.operand);
+                break;
+            case SelectorType::Attribute: {
+                CompiledAttribute attribute;
+                attribute.selector = simple->attribute;
+                attribute.name_atom = BrowserParser::intern_atom(simple->attribute.name);
+                instruction.op = SelectorOp::Attribute;
+                instruction.operand = static_cast<uint32_t>(compiled.attributes.size());
+                compiled.required_atoms.push_back(attribute.name_atom);
+                compiled.attributes.push_back(std::move(attribute));
+                break;
+            }
+            case SelectorType::Pseudo:
+            case SelectorType::PseudoElement:
+                if (simple->type == SelectorType::Pseudo && simple->pseudo.name == ":scope") {
+                    instruction.op = SelectorOp::Scope;
+                    compiled.uses_scope = true;
+                    break;
+                }
+                instruction.op = simple->type == SelectorType::Pseudo ?
+                                 SelectorOp::Pseudo : SelectorOp::PseudoElement;
+                instruction.operand = static_cast<uint32_t>(compiled.pseudos.size());
+                compiled.pseudos.emplace_back();
+                compiled.pseudos.back().selector = simple->pseudo;
+                if (simple->pseudo.selectors) {
+                    // :has() binds :scope to its own subject
+                    bool relative = simple->pseudo.name == ":has";
+                    for (const ComplexSelector& argument : simple->pseudo.selectors->selectors) {
+                        CompiledSelector nested = CompiledSelector::compile(argument);
+                        compiled.uses_scope |= !relative && nested.uses_scope;
+                        compiled.pseudos.back().arguments.push_back(std::move(nested));
+                    }
+                } else if (is_nth_pseudo(simple->pseudo.name)) {
+                    parse_nth(simple->pseudo.argument, compiled.pseudos.back());
+                }
+                break;
+        }
+
+        compiled.program.push_back(instruction);
+    }
+}
+
+const char* op_name(SelectorOp op) {
+    switch (op) {
+        case SelectorOp::Universal:     return "UNIVERSAL";
+        case SelectorOp::Tag:           return "TAG";
+        case SelectorOp::Id:            return "ID";
+        case SelectorOp::Class:         return "CLASS";
+        case SelectorOp::Attribute:     return "ATTR";
+        case SelectorOp::Pseudo:        return "PSEUDO";
+        case SelectorOp::PseudoElement: return "PSEUDO_ELEMENT";
+        case SelectorOp::Scope:         return "SCOPE";
+        case SelectorOp::Ancestor:      return "ANCESTOR";
+        case SelectorOp::Parent:        return "PARENT";
+        case SelectorOp::Previous:      return "PREVIOUS";
+        case SelectorOp::AnyPrevious:   return "ANY_PREVIOUS";
+        case SelectorOp::Match:         return "MATCH";
+    }
+    return "?";
+}
+
+} // namespace
+
+CompiledSelector CompiledSelector::compile(const ComplexSelector& selector) {
+    CompiledSelector compiled;
+    if (selector.empty()) {
+        return compiled;
+    }
+
+    // Matching starts at the subject (rightmost compound) and walks left
+    for (size_t i = selector.components.size(); i-- > 0;) {
+        const auto& component = selector.components[i];
+        compile_compound(component.selector, compiled);
+
+        if (i > 0) {
+            SelectorInstruction move;
+            move.op = combinator_op(component.combinator);
+            compiled.program.push_back(move);
+        }
+    }
+
+    compiled.program.push_back(SelectorInstruction{SelectorOp::Match, 0});
+    compiled.specificity = selector.specificity();
+    return compiled;
+}
+
+bool CompiledSelector::may_match(const BrowserParser::AtomSet& features) const {
+    for (Atom atom : required_atoms) {
+        if (!features.contains(atom)) return false;
+    }
+    return true;
+}
+
+std::string CompiledSelector::to_string() const {
+    std::ostringstream ss;
+
+    for (size_t i = 0; i < program.size(); ++i) {
+        const auto& instruction = program[i];
+        if (i > 0) ss << " ";
+        ss << op_name(instruction.op);
+
+        switch (instruction.op) {
+            case SelectorOp::Tag:
+            case SelectorOp::Id:
+            case SelectorOp::Class:
+                ss << "(" << instruction.operand << ")";
+                break;
+            case SelectorOp::Attribute:
+                ss << "(" << attributes[instruction.operand].name_atom << ")";
+                break;
+            case SelectorOp::Pseudo:
+            case SelectorOp::PseudoElement:
+                ss << "(" << pseudos[instruction.operand].selector.name << ")";
+                break;
+            default:
+                break;
+        }
+    }
+
+    return ss.str();
+}
+
+void StyleRule::compile_selectors() {
+    compiled_selectors.clear();
+    compiled_selectors.reserve(selectors.selectors.size());
+    for (const auto& selector : selectors.selectors) {
+        compiled_selectors.push_back(CompiledSelector::compile(selector));
+    }
+}
+
+} // namespace CSS3Parser
@@ -0,0 +1,696 @@
+#include "CSSParser.h"
+#include <cctype>
+#include <limits>
+
+namespace CSS3Parser {
+
+namespace {
+
+bool equals_ignoring_case(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        char x = a[i], y = b[i];
+        if (x >= 'A' && x <= 'Z') x = static_cast<char>(x + ('a' - 'A'));
+        if (y >= 'A' && y <= 'Z') y = static_cast<char>(y + ('a' - 'A'));
+        if (x != y) return false;
+    }
+    return true;
+}
+
+bool is_any_of(std::string_view text, std::initializer_list<std::string_view> names) {
+    for (std::string_view name : names) {
+        if (equals_ignoring_case(text, name)) return true;
+    }
+    return false;
+}
+
+bool ends_with_ignoring_case(std::string_view text, std::string_view suffix) {
+    return text.size() >= suffix.size() &&
+           equals_ignoring_case(text.substr(text.size() - suffix.size()), suffix);
+}
+
+// Data types a grammar can name with <...>
+enum class Primitive : uint8_t {
+    Length, Percentage, LengthPercentage, Number, Integer, Angle, Time, Flex,
+    Color, Image, Url, String, CustomIdent, Ident, Function, Any
+};
+
+struct PrimitiveName {
+    std::string_view name;
+    Primitive primitive;
+};
+
+constexpr PrimitiveName primitive_names[] = {
+    {"length", Primitive::Length},
+    {"percentage", Primitive::Percentage},
+    {"length-percentage", Primitive::LengthPercentage},
+    {"number", Primitive::Number},
+    {"integer", Primitive::Integer},
+    {"angle", Primitive::Angle},
+    {"time", Primitive::Time},
+    {"flex", Primitive::Flex},
+    {"color", Primitive::Color},
+    {"image", Primitive::Image},
+    {"url", Primitive::Url},
+    {"string", Primitive::String},
+    {"custom-ident", Primitive::CustomIdent},
+    {"ident", Primitive::Ident},
+    {"function", Primitive::Function}, // any function; its arguments are not checked
+    {"any", Primitive::Any},           // any single component
+};
+
+// Non-terminals shared by the property grammars in CSSProperties.h. A name()
+// term matches a function of that name without looking at its arguments.
+struct Production {
+    std::string_view name;
+    std::string_view syntax;
+};
+
+constexpr Production productions[] = {
+    {"overflow", "visible | hidden | clip | scroll | auto | overlay"},
+    {"size", "auto | <length-percentage> | min-content | max-content | fit-content | fit-content() | "
+             "stretch | -webkit-fill-available | -moz-available | -webkit-min-content | "
+             "-webkit-max-content | -webkit-fit-content | -moz-fit-content"},
+    {"box", "border-box | padding-box | content-box"},
+    {"shape-box", "<box> | margin-box | fill-box | stroke-box | view-box"},
+    {"line-width", "<length> | thin | medium | thick"},
+    {"line-style", "none | hidden | dotted | dashed | solid | double | groove | ridge | inset | outset"},
+    {"bg-image", "none | <image>"},
+    {"repeat-style", "repeat-x | repeat-y | [ repeat | space | round | no-repeat ]{1,2}"},
+    {"position", "[ left | center | right | top | bottom | <length-percentage> ]{1,4}"},
+    {"bg-size", "[ <length-percentage> | auto ]{1,2} | cover | contain"},
+    {"blend-mode", "normal | multiply | screen | overlay | darken | lighten | color-dodge | color-burn | "
+                   "hard-light | soft-light | difference | exclusion | hue | saturation | color | luminosity"},
+    {"baseline-position", "[ first | last ]? baseline"},
+    {"self-position", "center | start | end | self-start | self-end | flex-start | flex-end"},
+    {"track-size", "auto | min-content | max-content | <length-percentage> | <flex> | minmax() | "
+                   "fit-content()"},
+    {"grid-line", "auto | <custom-ident> | <integer> && <custom-ident>? | span && [ <integer> || <custom-ident> ]"},
+    {"easing-function", "linear | ease | ease-in | ease-out | ease-in-out | step-start | step-end | "
+                        "linear() | cubic-bezier() | steps()"},
+    {"break-between", "auto | avoid | always | all | avoid-page | page | left | right | recto | verso | "
+                      "avoid-column | column | avoid-region | region"},
+    {"cursor-keyword", "auto | default | none | context-menu | help | pointer | progress | wait | cell | "
+                       "crosshair | text | vertical-text | alias | copy | move | no-drop | not-allowed | "
+                       "grab | grabbing | all-scroll | col-resize | row-resize | n-resize | e-resize | "
+                       "s-resize | w-resize | ne-resize | nw-resize | se-resize | sw-resize | ew-resize | "
+                       "ns-resize | nesw-resize | nwse-resize | zoom-in | zoom-out | hand | "
+                       "-webkit-grab | -webkit-grabbing | -webkit-zoom-in | -webkit-zoom-out"},
+};
+
+enum class NodeKind : uint8_t {
+    Keyword,    // an identifier, compared ASCII case-insensitively
+    Function,   // name(): a function of that name
+    Primitive,
+    Slash,      // a literal '/'
+    Comma,      // a literal ','
+    Sequence,   // juxtaposition: every child, in order
+    OneOf,      // a | b: exactly one child
+    AllOf,      // a && b: every child, in any order
+    AnyOf       // a || b: one or more children, in any order
+};
+
+constexpr uint16_t unbounded = 0xFFFF;
+constexpr uint32_t no_node = std::numeric_limits<uint32_t>::max();
+constexpr size_t max_unordered_children = 32; // && and || track matched children in a bitmask
+
+// A node matches min..max repetitions of itself; children are a range of
+// Grammars::children
+struct Node {
+    NodeKind kind = NodeKind::Sequence;
+    Primitive primitive = Primitive::Any;
+    bool comma_separated = false; // '#': repetitions are separated by commas
+    uint16_t min = 1;
+    uint16_t max = 1;
+    uint32_t first_child = 0;
+    uint32_t child_count = 0;
+    std::string_view text;        // Keyword and Function
+};
+
+struct Grammars {
+    std::vector<Node> nodes;
+    std::vector<uint32_t> children;
+    std::array<uint32_t, property_count> roots; // no_node for shorthands, Unknown and Custom
+};
+
+// Recursive descent over the value definition syntax. Precedence, loosest
+// first: '|', '||', '&&', juxtaposition; multipliers bind to the term before them.
+class GrammarCompiler {
+public:
+    using ProductionCache = std::vector<std::pair<std::string_view, uint32_t>>;
+
+    GrammarCompiler(Grammars& out, ProductionCache& cache) : out_(out), cache_(cache) {}
+
+    // Root node, or no_node when the syntax is malformed
+    uint32_t compile(std::string_view syntax) {
+        input_ = syntax;
+        pos_ = 0;
+        failed_ = false;
+        uint32_t root = parse_one_of();
+        skip_spaces();
+        return failed_ || pos_ != input_.size() ? no_node : root;
+    }
+
+private:
+    Grammars& out_;
+    ProductionCache& cache_;
+    std::string_view input_;
+    size_t pos_ = 0;
+    bool failed_ = false;
+
+    void skip_spaces() {
+        while (pos_ < input_.size() && input_[pos_] == ' ') pos_++;
+    }
+
+    bool consume(std::string_view text) {
+        skip_spaces();
+        if (input_.substr(pos_, text.size()) != text) return false;
+        // '|' must not eat the first half of '||'
+        if (text == "|" && input_.substr(pos_, 2) == "||") return false;
+        pos_ += text.size();
+        return true;
+    }
+
+    bool at_term() {
+        skip_spaces();
+        if (pos_ >= input_.size()) return false;
+        char c = input_[pos_];
+        return c != '|' && c != '&' && c != ']';
+    }
+
+    uint32_t add(const Node& node) {
+        out_.nodes.push_back(node);
+        return static_cast<uint32_t>(out_.nodes.size() - 1);
+    }
+
+    uint32_t combine(NodeKind kind, const std::vector<uint32_t>& parts) {
+        if (parts.size() == 1) return parts.front();
+        if ((kind == NodeKind::AllOf || kind == NodeKind::AnyOf) && parts.size() > max_unordered_children) {
+            failed_ = true;
+        }
+        Node node;
+        node.kind = kind;
+        node.first_child = static_cast<uint32_t>(out_.children.size());
+        node.child_count = static_cast<uint32_t>(parts.size());
+        out_.children.insert(out_.children.end(), parts.begin(), parts.end());
+        return add(node);
+    }
+
+    uint32_t parse_one_of() {
+        std::vector<uint32_t> parts{parse_any_of()};
+        while (!failed_ && consume("|")) parts.push_back(parse_any_of());
+        return combine(NodeKind::OneOf, parts);
+    }
+
+    uint32_t parse_any_of() {
+        std::vector<uint32_t> parts{parse_all_of()};
+        while (!failed_ && consume("||")) parts.push_back(parse_all_of());
+        return combine(NodeKind::AnyOf, parts);
+    }
+
+    uint32_t parse_all_of() {
+        std::vector<uint32_t> parts{parse_sequence()};
+        while (!failed_ && consume("&&")) parts.push_back(parse_sequence());
+        return combine(NodeKind::AllOf, parts);
+    }
+
+    uint32_t parse_sequence() {
+        std::vector<uint32_t> parts;
+        while (!failed_ && at_term()) parts.push_back(parse_term());
+        if (parts.empty()) {
+            failed_ = true;
+            return no_node;
+        }
+        return combine(NodeKind::Sequence, parts);
+    }
+
+    uint32_t parse_term() {
+        bool shared = false;
+        uint32_t node = parse_atom(shared);
+
+        while (!failed_ && pos_ < input_.size()) {
+            uint16_t min = 1, max = 1;
+            bool comma_separated = false;
+            char c = input_[pos_];
+            if (c == '?') {
+                min = 0;
+            } else if (c == '*') {
+                min = 0;
+                max = unbounded;
+            } else if (c == '+') {
+                max = unbounded;
+            } else if (c == '#') {
+                max = unbounded;
+                comma_separated = true;
+            } else if (c == '{') {
+                if (!parse_range(min, max)) {
+                    failed_ = true;
+                    break;
+                }
+                pos_--; // parse_range stops past '}'; the increment below restores it
+            } else {
+                break;
+            }
+            pos_++;
+
+            // Productions are shared, and a node holds one multiplier, so
+            // anything else gets wrapped
+            const Node& target = out_.nodes[node];
+            if (shared || target.min != 1 || target.max != 1) {
+                Node wrapper;
+                wrapper.first_child = static_cast<uint32_t>(out_.children.size());
+                wrapper.child_count = 1;
+                out_.children.push_back(node);
+                node = add(wrapper);
+                shared = false;
+            }
+            Node& repeated = out_.nodes[node];
+            repeated.min = min;
+            repeated.max = max;
+            repeated.comma_separated = comma_separated;
+        }
+        return node;
+    }
+
+    // {A}, {A,B} or {A,}
+    bool parse_range(uint16_t& min, uint16_t& max) {
+        size_t close = input_.find('}', pos_);
+        if (close == std::string_view::npos) return false;
+        std::string_view body = input_.substr(pos_ + 1, close - pos_ - 1);
+        size_t comma = body.find(',');
+        auto number = [](std::string_view digits, uint16_t& out) {
+            if (digits.empty()) return false;
+            unsigned value = 0;
+            for (char c : digits) {
+                if (c < '0' || c > '9') return false;
+                value = value * 10 + static_cast<unsigned>(c - '0');
+            }
+            out = static_cast<uint16_t>(value < unbounded ? value : unbounded);
+            return true;
+        };
+        if (comma == std::string_view::npos) {
+            if (!number(body, min)) return false;
+            max = min;
+        } else {
+            if (!number(body.substr(0, comma), min)) return false;
+            std::string_view upper = body.substr(comma + 1);
+            if (upper.empty()) {
+                max = unbounded;
+            } else if (!number(upper, max)) {
+                return false;
+            }
+        }
+        pos_ = close + 1;
+        return max >= min && max > 0;
+    }
+
+    uint32_t parse_atom(bool& shared) {
+        skip_spaces();
+        if (pos_ >= input_.size()) {
+            failed_ = true;
+            return no_node;
+        }
+
+        char c = input_[pos_];
+        if (c == '[') {
+            pos_++;
+            uint32_t group = parse_one_of();
+            if (!consume("]")) failed_ = true;
+            return group;
+        }
+        if (c == '/' || c == ',') {
+            pos_++;
+            Node node;
+            node.kind = c == '/' ? NodeKind::Slash : NodeKind::Comma;
+            return add(node);
+        }
+        if (c == '<') {
+            size_t close = input_.find('>', pos_);
+            if (close == std::string_view::npos) {
+                failed_ = true;
+                return no_node;
+            }
+            std::string_view name = input_.substr(pos_ + 1, close - pos_ - 1);
+            pos_ = close + 1;
+            for (const PrimitiveName& entry : primitive_names) {
+                if (entry.name == name) {
+                    Node node;
+                    node.kind = NodeKind::Primitive;
+                    node.primitive = entry.primitive;
+                    return add(node);
+                }
+            }
+            shared = true;
+            return production(name);
+        }
+
+        size_t start = pos_;
+        while (pos_ < input_.size() && (std::isalnum(static_cast<unsigned char>(input_[pos_])) ||
+                                        input_[pos_] == '-' || input_[pos_] == '_')) {
+            pos_++;
+        }
+        if (pos_ == start) {
+            failed_ = true;
+            return no_node;
+        }
+        Node node;
+        node.kind = NodeKind::Keyword;
+        node.text = input_.substr(start, pos_ - start);
+        if (input_.substr(pos_, 2) == "()") {
+            node.kind = NodeKind::Function;
+            pos_ += 2;
+        }
+        return add(node);
+    }
+
+    uint32_t production(std::string_view name) {
+        for (const auto& entry : cache_) {
+            if (entry.first == name) return entry.second;
+        }
+        for (const Production& entry : productions) {
+            if (entry.name != name) continue;
+            GrammarCompiler nested(out_, cache_);
+            uint32_t root = nested.compile(entry.syntax);
+            if (root == no_node) break;
+            cache_.emplace_back(name, root);
+            return root;
+        }
+        failed_ = true;
+        return no_node;
+    }
+};
+
+Grammars compile_grammars() {
+    Grammars grammars;
+    grammars.roots.fill(no_node);
+    GrammarCompiler::ProductionCache cache;
+    for (size_t i = 0; i < property_count; ++i) {
+        std::string_view syntax = property_info(static_cast<PropertyId>(i)).syntax;
+        if (syntax.empty()) continue;
+        GrammarCompiler compiler(grammars, cache);
+        grammars.roots[i] = compiler.compile(syntax);
+    }
+    return grammars;
+}
+
+// Built when the library is loaded; the inputs are all constexpr tables
+const Grammars grammars = compile_grammars();
+
+// One component of the value being matched. Top-level comma lists and the
+// space-separated groups inside them are flattened, with a marker per comma.
+struct Item {
+    const CSSValue* value = nullptr; // null for a comma
+    std::string_view text;           // keyword or function name
+};
+
+// How a matched component is rewritten once the whole value is known valid
+enum class Typing : uint8_t {
+    None,
+    ZeroLength, // unitless 0 taken as <length>
+    NamedColor  // keyword taken as <color>
+};
+
+constexpr size_t no_match = std::numeric_limits<size_t>::max();
+
+bool is_color_function(std::string_view name) {
+    return is_any_of(name, {"rgb", "rgba", "hsl", "hsla", "hwb", "lab", "lch", "oklab", "oklch",
+                            "color", "color-mix", "light-dark"});
+}
+
+bool is_image_function(std::string_view name) {
+    return ends_with_ignoring_case(name, "gradient") ||
+           is_any_of(name, {"url", "image", "image-set", "-webkit-image-set", "cross-fade",
+                            "-webkit-cross-fade", "element", "-moz-element", "paint"});
+}
+
+bool is_css_wide_keyword(std::string_view text) {
+    return is_any_of(text, {"inherit", "initial", "unset", "revert", "revert-layer"});
+}
+
+// Delimiters other than ',' reach the value as one-character keywords
+bool is_ident_text(std::string_view text) {
+    if (text.empty()) return false;
+    unsigned char c = static_cast<unsigned char>(text[0] == '-' && text.size() > 1 ? text[1] : text[0]);
+    return std::isalpha(c) || c == '_' || c == '-' || c >= 0x80;
+}
+
+class Matcher {
+public:
+    Matcher(const std::vector<Item>& items, std::vector<Typing>& typing) : items_(items), typing_(typing) {}
+
+    // End of the longest match of node starting at pos, or no_match
+    size_t match(uint32_t index, size_t pos) const {
+        const Node& node = grammars.nodes[index];
+        if (node.min == 1 && node.max == 1) return match_once(node, pos);
+
+        size_t count = 0;
+        size_t end = pos;
+        while (count < node.max) {
+            size_t start = end;
+            if (count > 0 && node.comma_separated) {
+                if (start >= items_.size() || items_[start].value) break;
+                start++;
+            }
+            size_t next = match_once(node, start);
+            if (next == no_match) break;
+            if (next == start) {
+                // An empty repetition can be repeated as often as needed
+                if (start == end) count = std::max<size_t>(count, node.min);
+                break;
+            }
+            end = next;
+            count++;
+        }
+        return count >= node.min ? end : no_match;
+    }
+
+private:
+    const std::vector<Item>& items_;
+    std::vector<Typing>& typing_;
+
+    size_t match_once(const Node& node, size_t pos) const {
+        const uint32_t* children = grammars.children.data() + node.first_child;
+        const Item* item = pos < items_.size() ? &items_[pos] : nullptr;
+
+        switch (node.kind) {
+            case NodeKind::Keyword:
+                return item && item->value && item->value->is_keyword() &&
+                       equals_ignoring_case(item->text, node.text) ? pos + 1 : no_match;
+            case NodeKind::Function:
+                return item && item->value && item->value->is_function() &&
+                       equals_ignoring_case(item->text, node.text) ? pos + 1 : no_match;
+            case NodeKind::Slash:
+                return item && item->value && item->value->is_keyword() && item->text == "/" ? pos + 1 : no_match;
+            case NodeKind::Comma:
+                return item && !item->value ? pos + 1 : no_match;
+            case NodeKind::Primitive: {
+                Typing typing = Typing::None;
+                if (!item || !item->value || !matches(node.primitive, *item, typing)) return no_match;
+                typing_[pos] = typing;
+                return pos + 1;
+            }
+            case NodeKind::Sequence:
+                for (uint32_t i = 0; i < node.child_count && pos != no_match; ++i) {
+                    pos = match(children[i], pos);
+                }
+                return pos;
+            case NodeKind::OneOf: {
+                // Longest alternative wins; it is matched again at the end so that
+                // the typing it recorded is not left overwritten by a later attempt
+                size_t best = no_match;
+                uint32_t winner = 0;
+                for (uint32_t i = 0; i < node.child_count; ++i) {
+                    size_t end = match(children[i], pos);
+                    if (end != no_match && (best == no_match || end > best)) {
+                        best = end;
+                        winner = i;
+                    }
+                }
+                if (best != no_match && winner + 1 < node.child_count) match(children[winner], pos);
+                return best;
+            }
+            case NodeKind::AllOf:
+            case NodeKind::AnyOf: {
+                uint32_t matched = 0;
+                bool progress = true;
+                while (progress) {
+                    progress = false;
+                    for (uint32_t i = 0; i < node.child_count; ++i) {
+                        if (matched & (1u << i)) continue;
+                        size_t end = match(children[i], pos);
+                        if (end != no_match && end > pos) {
+                            matched |= 1u << i;
+                            pos = end;
+                            progress = true;
+                            break;
+                        }
+                    }
+                }
+                if (node.kind == NodeKind::AnyOf) return matched ? pos : no_match;
+                for (uint32_t i = 0; i < node.child_count; ++i) {
+                    if (!(matched & (1u << i)) && match(children[i], pos) != pos) return no_match;
+                }
+                return pos;
+            }
+        }
+        return no_match;
+    }
+
+    static bool matches(Primitive primitive, const Item& item, Typing& typing) {
+        const CSSValue& value = *item.value;
+        bool zero = value.is_number() && value.numeric_value() == 0.0;
+        // Math functions match by the type they were compiled to
+        auto math = [&](CalcType type) { return value.is_math() && value.math()->type == type; };
+
+        switch (primitive) {
+            case Primitive::Length:
+            case Primitive::LengthPercentage:
+                if (value.is_length()) return value.unit() != CSSUnit::Fr && value.unit() != CSSUnit::Unknown;
+                if (zero) {
+                    typing = Typing::ZeroLength;
+                    return true;
+                }
+                if (math(CalcType::Length)) return true;
+                return primitive == Primitive::LengthPercentage &&
+                       (value.is_percentage() || math(CalcType::Percentage) || math(CalcType::LengthPercentage));
+            case Primitive::Percentage:
+                return value.is_percentage() || math(CalcType::Percentage);
+            case Primitive::Number:
+                return value.is_number() || math(CalcType::Number);
+            case Primitive::Integer:
+                return (value.is_number() && value.is_integer()) || math(CalcType::Number);
+            case Primitive::Angle:
+                return value.type == ValueType::Angle || zero || math(CalcType::Angle);
+            case Primitive::Time:
+                return value.type == ValueType::Time || math(CalcType::Time);
+            case Primitive::Flex:
+                return value.is_length() && value.unit() == CSSUnit::Fr;
+            case Primitive::Color:
+                if (value.is_color()) return true;
+                if (value.is_function()) return is_color_function(item.text);
+                if (value.is_keyword() && CSSColor::is_color_keyword(item.text)) {
+                    typing = Typing::NamedColor;
+                    return true;
+                }
+                return false;
+            case Primitive::Image:
+                return value.type == ValueType::Url || (value.is_function() && is_image_function(item.text));
+            case Primitive::Url:
+                return value.type == ValueType::Url ||
+                       (value.is_function() && equals_ignoring_case(item.text, "url"));
+            case Primitive::String:
+                return value.type == ValueType::String;
+            case Primitive::CustomIdent:
+                return value.is_keyword() && is_ident_text(item.text) && !is_css_wide_keyword(item.text) &&
+                       !equals_ignoring_case(item.text, "default");
+            case Primitive::Ident:
+                return value.is_keyword() && is_ident_text(item.text);
+            case Primitive::Function:
+                return value.is_function();
+            case Primitive::Any:
+                return !value.empty();
+        }
+        return false;
+    }
+};
+
+void add_items(const CSSValue& group, std::vector<Item>& items) {
+    auto add = [&](const CSSValue& value) {
+        bool named = value.is_keyword() || value.is_function();
+        items.push_back(Item{&value, named ? value.text() : std::string_view()});
+    };
+    if (group.type == ValueType::List && !group.is_comma_separated()) {
+        for (const CSSValue& value : group) add(value);
+    } else {
+        add(group);
+    }
+}
+
+void flatten(const CSSValue& value, std::vector<Item>& items) {
+    if (value.type != ValueType::List || !value.is_comma_separated()) {
+        add_items(value, items);
+        return;
+    }
+    for (size_t i = 0; i < value.size(); ++i) {
+        if (i > 0) items.push_back(Item{});
+        add_items(value[i], items);
+    }
+}
+
+// var(), env() and attr() can only be checked once substituted
+bool has_substitution(const CSSValue& value) {
+    if (value.is_function() && is_any_of(value.text(), {"var", "env", "attr"})) return true;
+    if (value.type != ValueType::List && value.type != ValueType::Function) return false;
+    for (const CSSValue& item : value) {
+        if (has_substitution(item)) return true;
+    }
+    return false;
+}
+
+CSSValue typed(const Item& item, Typing typing, CSSValueArena& arena) {
+    switch (typing) {
+        case Typing::ZeroLength:
+            return CSSValue::make_number(0.0, CSSUnit::Px, item.value->is_integer());
+        case Typing::NamedColor: {
+            // currentcolor and system colors stay keywords
+            CSSColor color = CSSColor::from_name(std::string(item.text));
+            if (color.type != CSSColor::Named) return CSSValue::make_color(color, arena);
+            break;
+        }
+        case Typing::None:
+            break;
+    }
+    return *item.value;
+}
+
+// Rebuilds value in the shape flatten() walked, with typed components
+CSSValue retype(const CSSValue& value, const std::vector<Item>& items, const std::vector<Typing>& typing,
+                CSSValueArena& arena) {
+    size_t next = 0;
+    auto group_of = [&](const CSSValue& group) {
+        if (group.type != ValueType::List || group.is_comma_separated()) {
+            CSSValue result = typed(items[next], typing[next], arena);
+            next++;
+            return result;
+        }
+        std::vector<CSSValue> parts;
+        parts.reserve(group.size());
+        for (size_t i = 0; i < group.size(); ++i, ++next) parts.push_back(typed(items[next], typing[next], arena));
+        return CSSValue::make_list(parts, arena);
+    };
+
+    if (value.type != ValueType::List || !value.is_comma_separated()) return group_of(value);
+    std::vector<CSSValue> groups;
+    groups.reserve(value.size());
+    for (size_t i = 0; i < value.size(); ++i) {
+        if (i > 0) next++; // comma
+        groups.push_back(group_of(value[i]));
+    }
+    return CSSValue::make_list(groups, arena, true);
+}
+
+} // namespace
+
+bool validate_value(PropertyId id, CSSValue& value, CSSValueArena& arena) {
+    size_t index = static_cast<size_t>(id);
+    if (index >= property_count || grammars.roots[index] == no_node) return true;
+    if (value.empty()) return false;
+    if (has_substitution(value)) return true;
+
+    thread_local std::vector<Item> items;
+    thread_local std::vector<Typing> typing;
+    items.clear();
+    flatten(value, items);
+    if (items.size() == 1 && items[0].value->is_keyword() && is_css_wide_keyword(items[0].text)) return true;
+
+    typing.assign(items.size(), Typing::None);
+    Matcher matcher(items, typing);
+    if (matcher.match(grammars.roots[index], 0) != items.size()) return false;
+
+    if (std::any_of(typing.begin(), typing.end(), [](Typing t) { return t != Typing::None; })) {
+        value = retype(value, items, typing, arena);
+    }
+    return true;
+}
+
+} // namespace CSS3Parser
@@ -0,0 +1,650 @@
+#include "CSSParser.h"
+#include <cmath>
+#include <sstream>
+
+namespace CSS3Parser {
+
+namespace {
+
+bool equals_ignoring_case(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        char x = a[i], y = b[i];
+        if (x >= 'A' && x <= 'Z') x = static_cast<char>(x + ('a' - 'A'));
+        if (y >= 'A' && y <= 'Z') y = static_cast<char>(y + ('a' - 'A'));
+        if (x != y) return false;
+    }
+    return true;
+}
+
+enum class ValueKind : uint8_t { Length, Ratio, Resolution, Integer, Keyword };
+
+struct FeatureInfo {
+    std::string_view name;
+    MediaFeature feature;
+    ValueKind kind;
+    std::array<std::string_view, 3> keywords; // in the order the environment numbers them
+};
+
+using F = MediaFeature;
+using K = ValueKind;
+
+// device-* features are deprecated; the viewport stands in for the screen
+constexpr FeatureInfo feature_table[] = {
+    {"width", F::Width, K::Length, {}},
+    {"height", F::Height, K::Length, {}},
+    {"device-width", F::Width, K::Length, {}},
+    {"device-height", F::Height, K::Length, {}},
+    {"aspect-ratio", F::AspectRatio, K::Ratio, {}},
+    {"device-aspect-ratio", F::AspectRatio, K::Ratio, {}},
+    {"orientation", F::Orientation, K::Keyword, {"portrait", "landscape"}},
+    {"resolution", F::Resolution, K::Resolution, {}},
+    {"color", F::Color, K::Integer, {}},
+    {"color-index", F::ColorIndex, K::Integer, {}},
+    {"monochrome", F::Monochrome, K::Integer, {}},
+    {"grid", F::Grid, K::Integer, {}},
+    {"hover", F::Hover, K::Keyword, {"none", "hover"}},
+    {"any-hover", F::AnyHover, K::Keyword, {"none", "hover"}},
+    {"pointer", F::Pointer, K::Keyword, {"none", "coarse", "fine"}},
+    {"any-pointer", F::AnyPointer, K::Keyword, {"none", "coarse", "fine"}},
+    {"prefers-color-scheme", F::PrefersColorScheme, K::Keyword, {"light", "dark"}},
+    {"prefers-reduced-motion", F::PrefersReducedMotion, K::Keyword, {"no-preference", "reduce"}},
+};
+
+const FeatureInfo* find_feature(std::string_view name) {
+    for (const FeatureInfo& info : feature_table) {
+        if (equals_ignoring_case(info.name, name)) return &info;
+    }
+    return nullptr;
+}
+
+std::string_view feature_name(MediaFeature feature) {
+    for (const FeatureInfo& info : feature_table) {
+        if (info.feature == feature) return info.name;
+    }
+    return "";
+}
+
+bool is_length_unit(CSSUnit unit) {
+    switch (unit) {
+        case CSSUnit::Px: case CSSUnit::Em: case CSSUnit::Rem: case CSSUnit::Ex: case CSSUnit::Ch:
+        case CSSUnit::Vw: case CSSUnit::Vh: case CSSUnit::Vmin: case CSSUnit::Vmax:
+        case CSSUnit::Cm: case CSSUnit::Mm: case CSSUnit::Q: case CSSUnit::In: case CSSUnit::Pt: case CSSUnit::Pc:
+            return true;
+        default:
+            return false;
+    }
+}
+
+double to_px(double value, CSSUnit unit, const MediaEnvironment& environment) {
+    switch (unit) {
+        case CSSUnit::Em:
+        case CSSUnit::Rem: return value * environment.font_size;
+        case CSSUnit::Ex:
+        case CSSUnit::Ch: return value * environment.font_size / 2.0;
+        case CSSUnit::Vw: return value * environment.width / 100.0;
+        case CSSUnit::Vh: return value * environment.height / 100.0;
+        case CSSUnit::Vmin: return value * std::min(environment.width, environment.height) / 100.0;
+        case CSSUnit::Vmax: return value * std::max(environment.width, environment.height) / 100.0;
+        case CSSUnit::In: return value * 96.0;
+        case CSSUnit::Cm: return value * 96.0 / 2.54;
+        case CSSUnit::Mm: return value * 96.0 / 25.4;
+        case CSSUnit::Q: return value * 96.0 / 101.6;
+        case CSSUnit::Pt: return value * 96.0 / 72.0;
+        case CSSUnit::Pc: return value * 16.0;
+        default: return value;
+    }
+}
+
+// Recursive descent over the media query grammar of Media Queries 4. Parts
+// in parentheses that are not a known feature test are <general-enclosed>
+// and compile to Unknown; anything else off-grammar fails the whole query.
+class MediaCompiler {
+public:
+    explicit MediaCompiler(const std::vector<Token>& prelude) {
+        for (const Token& token : prelude) {
+            if (token.type != TokenType::Whitespace && token.type != TokenType::Comment) tokens_.push_back(token);
+        }
+    }
+
+    MediaQueryList compile() {
+        MediaQueryList list;
+        if (tokens_.empty()) return list;
+
+        size_t queries = 0, start = 0, depth = 0;
+        for (size_t i = 0; i <= tokens_.size(); ++i) {
+            if (i < tokens_.size()) {
+                TokenType type = tokens_[i].type;
+                if (type == TokenType::LeftParen || type == TokenType::Function || type == TokenType::LeftSquare) {
+                    depth++;
+                } else if ((type == TokenType::RightParen || type == TokenType::RightSquare) && depth > 0) {
+                    depth--;
+                }
+                if (type != TokenType::Comma || depth > 0) continue;
+            }
+            compile_query(start, i, list.program);
+            queries++;
+            start = i + 1;
+        }
+        if (queries > 1) list.program.push_back(instruction(MediaOp::Or, static_cast<uint16_t>(queries)));
+        list.calc_code = std::move(calc_code_);
+        return list;
+    }
+
+private:
+    std::vector<Token> tokens_;
+    size_t pos_ = 0;
+    size_t end_ = 0;
+    std::vector<CalcInstruction> calc_code_;
+
+    static MediaInstruction instruction(MediaOp op, uint16_t count = 0) {
+        MediaInstruction result;
+        result.op = op;
+        result.count = count;
+        return result;
+    }
+
+    void compile_query(size_t begin, size_t end, std::vector<MediaInstruction>& code) {
+        size_t mark = code.size();
+        pos_ = begin;
+        end_ = end;
+        if (!parse_query(code) || pos_ != end_) {
+            code.resize(mark);
+            MediaInstruction all = instruction(MediaOp::Type); // "not all"
+            code.push_back(all);
+            code.push_back(instruction(MediaOp::Not));
+        }
+        code.push_back(instruction(MediaOp::Query));
+    }
+
+    bool is_ident(size_t index, std::string_view word) const {
+        return index < end_ && tokens_[index].type == TokenType::Ident && equals_ignoring_case(tokens_[index].value, word);
+    }
+
+    bool is_delim(size_t index, char c) const {
+        return index < end_ && tokens_[index].type == TokenType::Delim && tokens_[index].value.size() == 1 &&
+               tokens_[index].value[0] == c;
+    }
+
+    size_t matching_paren(size_t open) const {
+        size_t depth = 0;
+        for (size_t i = open; i < end_; ++i) {
+            TokenType type = tokens_[i].type;
+            if (type == TokenType::LeftParen || type == TokenType::Function) {
+                depth++;
+            } else if (type == TokenType::RightParen && --depth == 0) {
+                return i;
+            }
+        }
+        return SIZE_MAX;
+    }
+
+    bool parse_query(std::vector<MediaInstruction>& code) {
+        if (pos_ >= end_) return false;
+        if (tokens_[pos_].type != TokenType::Ident) return parse_condition(code, true);
+
+        bool negated = false;
+        if (is_ident(pos_, "not") || is_ident(pos_, "only")) {
+            if (pos_ + 1 >= end_ || tokens_[pos_ + 1].type != TokenType::Ident) {
+                return is_ident(pos_, "not") && parse_condition(code, true); // "not (color)"
+            }
+            negated = is_ident(pos_, "not");
+            pos_++;
+        }
+
+        MediaInstruction type = instruction(MediaOp::Type);
+        if (!parse_media_type(tokens_[pos_].value, type.type)) return false;
+        pos_++;
+        code.push_back(type);
+        if (pos_ < end_) {
+            if (!is_ident(pos_, "and")) return false;
+            pos_++;
+            if (!parse_condition(code, false)) return false;
+            code.push_back(instruction(MediaOp::And, 2));
+        }
+        if (negated) code.push_back(instruction(MediaOp::Not));
+        return true;
+    }
+
+    static bool parse_media_type(std::string_view name, MediaType& type) {
+        static constexpr std::string_view reserved[] = {"not", "and", "or", "only", "layer"};
+        for (std::string_view word : reserved) {
+            if (equals_ignoring_case(name, word)) return false;
+        }
+        if (equals_ignoring_case(name, "all")) {
+            type = MediaType::All;
+        } else if (equals_ignoring_case(name, "screen")) {
+            type = MediaType::Screen;
+        } else if (equals_ignoring_case(name, "print")) {
+            type = MediaType::Print;
+        } else if (equals_ignoring_case(name, "speech")) {
+            type = MediaType::Speech;
+        } else {
+            type = MediaType::Unknown; // tv, handheld and other retired types match nothing
+        }
+        return true;
+    }
+
+    // <media-condition>, or <media-condition-without-or> when allow_or is false
+    bool parse_condition(std::vector<MediaInstruction>& code, bool allow_or) {
+        if (is_ident(pos_, "not")) {
+            pos_++;
+            if (!parse_in_parens(code)) return false;
+            code.push_back(instruction(MediaOp::Not));
+            return true;
+        }
+        if (!parse_in_parens(code)) return false;
+
+        uint16_t count = 1;
+        bool disjunction = false;
+        while (pos_ < end_ && tokens_[pos_].type == TokenType::Ident) {
+            bool is_and = is_ident(pos_, "and");
+            bool is_or = allow_or && is_ident(pos_, "or");
+            if (!is_and && !is_or) return false;
+            if (count > 1 && is_or != disjunction) return false; // mixing and/or needs parentheses
+            disjunction = is_or;
+            pos_++;
+            if (!parse_in_parens(code)) return false;
+            count++;
+        }
+        if (count > 1) code.push_back(instruction(disjunction ? MediaOp::Or : MediaOp::And, count));
+        return true;
+    }
+
+    bool parse_in_parens(std::vector<MediaInstruction>& code) {
+        if (pos_ >= end_) return false;
+        TokenType type = tokens_[pos_].type;
+        if (type != TokenType::LeftParen && type != TokenType::Function) return false;
+        size_t close = matching_paren(pos_);
+        if (close == SIZE_MAX) return false;
+
+        size_t mark = code.size();
+        bool parsed = false;
+        if (type == TokenType::LeftParen) {
+            size_t outer_end = end_;
+            pos_++;
+            end_ = close;
+            // A math function opens a range value, "(calc(..) < width)", not a condition
+            bool math = pos_ < end_ && tokens_[pos_].type == TokenType::Function &&
+                        CSSParser::is_math_function(std::string(tokens_[pos_].value));
+            if (pos_ < end_ && (tokens_[pos_].type == TokenType::LeftParen ||
+                                (tokens_[pos_].type == TokenType::Function && !math) || is_ident(pos_, "not"))) {
+                parsed = parse_condition(code, true) && pos_ == end_;
+            } else {
+                parsed = parse_feature(code) && pos_ == end_;
+            }
+            end_ = outer_end;
+        }
+        pos_ = close + 1;
+        if (!parsed) {
+            code.resize(mark);
+            code.push_back(instruction(MediaOp::Unknown));
+        }
+        return true;
+    }
+
+    // "<", "<=", ">", ">=" or "="; the tokenizer hands "<=" over as two delims
+    bool parse_comparison(MediaComparison& comparison) {
+        bool less = is_delim(pos_, '<'), greater = is_delim(pos_, '>');
+        if (!less && !greater) {
+            if (!is_delim(pos_, '=')) return false;
+            pos_++;
+            comparison = MediaComparison::Equal;
+            return true;
+        }
+        pos_++;
+        bool or_equal = is_delim(pos_, '=');
+        if (or_equal) pos_++;
+        if (less) {
+            comparison = or_equal ? MediaComparison::LessEqual : MediaComparison::Less;
+        } else {
+            comparison = or_equal ? MediaComparison::GreaterEqual : MediaComparison::Greater;
+        }
+        return true;
+    }
+
+    static MediaComparison mirror(MediaComparison comparison) {
+        switch (comparison) {
+            case MediaComparison::Less: return MediaComparison::Greater;
+            case MediaComparison::LessEqual: return MediaComparison::GreaterEqual;
+            case MediaComparison::Greater: return MediaComparison::Less;
+            case MediaComparison::GreaterEqual: return MediaComparison::LessEqual;
+            default: return comparison;
+        }
+    }
+
+    // A math function as a length or resolution. Its tokens are spelled out
+    // again for the CSSCalc compiler, and the code is kept with the list so
+    // that relative units follow the environment
+    bool parse_math_value(CalcType type, MediaInstruction& test) {
+        size_t close = matching_paren(pos_);
+        if (close == SIZE_MAX) return false;
+        std::string text;
+        for (size_t i = pos_; i <= close; ++i) {
+            const Token& token = tokens_[i];
+            switch (token.type) {
+                case TokenType::Function: text.append(token.value).append("("); break;
+                case TokenType::LeftParen: text += '('; break;
+                case TokenType::RightParen: text += ')'; break;
+                case TokenType::Comma: text += ','; break;
+                default: text.append(token.value); break;
+            }
+            text += ' ';
+        }
+        CSSParser parser(text);
+        CSSValue value = parser.parse_value();
+        const CalcExpression* math = value.math();
+        if (!math || math->type != type || math->size > UINT16_MAX) return false;
+        test.calc_offset = static_cast<uint32_t>(calc_code_.size());
+        test.calc_size = static_cast<uint16_t>(math->size);
+        calc_code_.insert(calc_code_.end(), math->code, math->code + math->size);
+        pos_ = close;
+        return true;
+    }
+
+    bool parse_value(const FeatureInfo& info, MediaInstruction& test) {
+        if (pos_ >= end_) return false;
+        const Token& token = tokens_[pos_];
+        if (token.type == TokenType::Function && CSSParser::is_math_function(std::string(token.value))) {
+            if (info.kind == ValueKind::Length) {
+                if (!parse_math_value(CalcType::Length, test)) return false;
+            } else if (info.kind == ValueKind::Resolution) {
+                if (!parse_math_value(CalcType::Resolution, test)) return false;
+            } else {
+                return false;
+            }
+            pos_++;
+            return true;
+        }
+        switch (info.kind) {
+            case ValueKind::Length:
+                if (token.type == TokenType::Number && token.numeric_value == 0.0) {
+                    test.unit = CSSUnit::Px;
+                } else if (token.type == TokenType::Dimension && is_length_unit(parse_unit(token.unit))) {
+                    test.unit = parse_unit(token.unit);
+                } else {
+                    return false;
+                }
+                test.value = token.numeric_value;
+                break;
+            case ValueKind::Resolution: {
+                if (token.type != TokenType::Dimension) return false;
+                CSSUnit unit = parse_unit(token.unit);
+                if (unit == CSSUnit::Dppx || unit == CSSUnit::X) {
+                    test.value = token.numeric_value;
+                } else if (unit == CSSUnit::Dpi) {
+                    test.value = token.numeric_value / 96.0;
+                } else if (unit == CSSUnit::Dpcm) {
+                    test.value = token.numeric_value * 2.54 / 96.0;
+                } else {
+                    return false;
+                }
+                break;
+            }
+            case ValueKind::Ratio:
+                if (token.type != TokenType::Number || token.numeric_value < 0.0) return false;
+                test.value = token.numeric_value;
+                if (is_delim(pos_ + 1, '/')) {
+                    if (pos_ + 2 >= end_ || tokens_[pos_ + 2].type != TokenType::Number ||
+                        tokens_[pos_ + 2].numeric_value < 0.0) {
+                        return false;
+                    }
+                    double denominator = tokens_[pos_ + 2].numeric_value;
+                    test.value = denominator > 0.0 ? test.value / denominator : HUGE_VAL;
+                    pos_ += 2;
+                }
+                break;
+            case ValueKind::Integer:
+                if (token.type != TokenType::Number || !token.is_integer || token.numeric_value < 0.0) return false;
+                test.value = token.numeric_value;
+                break;
+            case ValueKind::Keyword: {
+                if (token.type != TokenType::Ident) return false;
+                auto match = std::find_if(info.keywords.begin(), info.keywords.end(), [&](std::string_view keyword) {
+                    return !keyword.empty() && equals_ignoring_case(keyword, token.value);
+                });
+                if (match == info.keywords.end()) return false;
+                test.value = static_cast<double>(match - info.keywords.begin());
+                break;
+            }
+        }
+        pos_++;
+        return true;
+    }
+
+    bool parse_feature(std::vector<MediaInstruction>& code) {
+        if (pos_ >= end_) return false;
+        MediaInstruction test = instruction(MediaOp::Feature);
+
+        // <mf-boolean> and <mf-plain>
+        if (tokens_[pos_].type == TokenType::Ident && !is_delim(pos_ + 1, '<') && !is_delim(pos_ + 1, '>') &&
+            !is_delim(pos_ + 1, '=')) {
+            std::string_view name = tokens_[pos_].value;
+            pos_++;
+            if (pos_ == end_) {
+                const FeatureInfo* info = find_feature(name);
+                if (!info) return false;
+                test.feature = info->feature;
+                code.push_back(test);
+                return true;
+            }
+            if (tokens_[pos_].type != TokenType::Colon) return false;
+            pos_++;
+            test.comparison = MediaComparison::Equal;
+            if (name.size() > 4 && (equals_ignoring_case(name.substr(0, 4), "min-") ||
+                                    equals_ignoring_case(name.substr(0, 4), "max-"))) {
+                bool min = equals_ignoring_case(name.substr(0, 4), "min-");
+                test.comparison = min ? MediaComparison::GreaterEqual : MediaComparison::LessEqual;
+                name.remove_prefix(4);
+            }
+            const FeatureInfo* info = find_feature(name);
+            if (!info || (test.comparison != MediaComparison::Equal && info->kind == ValueKind::Keyword)) return false;
+            test.feature = info->feature;
+            if (!parse_value(*info, test)) return false;
+            code.push_back(test);
+            return true;
+        }
+
+        // <mf-range>: "name op value", "value op name" or "value op name op value"
+        if (tokens_[pos_].type == TokenType::Ident) {
+            const FeatureInfo* info = find_feature(tokens_[pos_].value);
+            pos_++;
+            if (!info || info->kind == ValueKind::Keyword) return false;
+            test.feature = info->feature;
+            if (!parse_comparison(test.comparison) || !parse_value(*info, test)) return false;
+            code.push_back(test);
+            return true;
+        }
+
+        size_t value_pos = pos_;
+        // The value is at most three tokens, or one math function
+        while (pos_ < end_ && tokens_[pos_].type != TokenType::Ident) {
+            pos_ = tokens_[pos_].type == TokenType::Function ? matching_paren(pos_) : pos_;
+            if (pos_ < end_) pos_++;
+        }
+        if (pos_ >= end_) return false;
+        const FeatureInfo* info = find_feature(tokens_[pos_].value);
+        if (!info || info->kind == ValueKind::Keyword) return false;
+        size_t name_pos = pos_;
+
+        // Re-read from the start: value, comparison, name
+        pos_ = value_pos;
+        MediaInstruction low = test;
+        low.feature = info->feature;
+        if (!parse_value(*info, low)) return false;
+        MediaComparison first;
+        if (!parse_comparison(first) || pos_ != name_pos) return false;
+        low.comparison = mirror(first);
+        pos_++;
+        code.push_back(low);
+        if (pos_ == end_) return true;
+
+        MediaInstruction high = test;
+        high.feature = info->feature;
+        if (!parse_comparison(high.comparison) || !parse_value(*info, high)) return false;
+        bool ascending = first == MediaComparison::Less || first == MediaComparison::LessEqual;
+        bool ascending_too = high.comparison == MediaComparison::Less || high.comparison == MediaComparison::LessEqual;
+        bool descending = first == MediaComparison::Greater || first == MediaComparison::GreaterEqual;
+        bool descending_too = high.comparison == MediaComparison::Greater ||
+                              high.comparison == MediaComparison::GreaterEqual;
+        if (!(ascending && ascending_too) && !(descending && descending_too)) return false;
+        code.push_back(high);
+        code.push_back(instruction(MediaOp::And, 2));
+        return true;
+    }
+};
+
+// Three-valued results; Unknown is what a feature this evaluator does not know yields
+enum class Truth : uint8_t { False, True, Unknown };
+
+Truth truth(bool value) { return value ? Truth::True : Truth::False; }
+
+Truth evaluate_feature(const MediaInstruction& test, const std::vector<CalcInstruction>& calc_code,
+                       const MediaEnvironment& environment) {
+    double actual = 0.0;
+    switch (test.feature) {
+        case F::Width: actual = environment.width; break;
+        case F::Height: actual = environment.height; break;
+        case F::AspectRatio:
+            actual = environment.height > 0.0 ? environment.width / environment.height : HUGE_VAL;
+            break;
+        case F::Orientation: actual = environment.height >= environment.width ? 0.0 : 1.0; break;
+        case F::Resolution: actual = environment.resolution; break;
+        case F::Color: actual = environment.color_bits; break;
+        case F::ColorIndex: actual = 0.0; break;
+        case F::Monochrome: actual = environment.monochrome_bits; break;
+        case F::Grid: actual = 0.0; break;
+        case F::Hover:
+        case F::AnyHover: actual = environment.hover ? 1.0 : 0.0; break;
+        case F::Pointer:
+        case F::AnyPointer: actual = static_cast<double>(environment.pointer); break;
+        case F::PrefersColorScheme: actual = static_cast<double>(environment.color_scheme); break;
+        case F::PrefersReducedMotion: actual = environment.reduced_motion ? 1.0 : 0.0; break;
+    }
+
+    double expected = test.value;
+    if (test.calc_size > 0) {
+        CalcExpression math;
+        math.code = calc_code.data() + test.calc_offset;
+        math.size = test.calc_size;
+        CalcContext context;
+        context.font_size = environment.font_size;
+        context.root_font_size = environment.font_size;
+        context.viewport_width = environment.width;
+        context.viewport_height = environment.height;
+        expected = math.evaluate(context); // px or dppx
+    } else if (test.feature == F::Width || test.feature == F::Height) {
+        expected = to_px(test.value, test.unit, environment);
+    }
+
+    switch (test.comparison) {
+        case MediaComparison::Boolean:
+            // Every orientation and color scheme is a value other than none
+            return truth(test.feature == F::Orientation || test.feature == F::PrefersColorScheme || actual != 0.0);
+        case MediaComparison::Equal: return truth(actual == expected);
+        case MediaComparison::Less: return truth(actual < expected);
+        case MediaComparison::LessEqual: return truth(actual <= expected);
+        case MediaComparison::Greater: return truth(actual > expected);
+        case MediaComparison::GreaterEqual: return truth(actual >= expected);
+    }
+    return Truth::Unknown;
+}
+
+} // namespace
+
+bool MediaEnvironment::operator==(const MediaEnvironment& other) const {
+    return type == other.type && width == other.width && height == other.height &&
+           resolution == other.resolution && font_size == other.font_size && color_bits == other.color_bits &&
+           monochrome_bits == other.monochrome_bits && hover == other.hover && pointer == other.pointer &&
+           color_scheme == other.color_scheme && reduced_motion == other.reduced_motion;
+}
+
+MediaQueryList MediaQueryList::compile(const std::vector<Token>& prelude) {
+    return MediaCompiler(prelude).compile();
+}
+
+MediaQueryList MediaQueryList::compile(const std::string& text) {
+    CSSTokenizer tokenizer(text);
+    std::vector<Token> tokens;
+    for (Token token = tokenizer.next_token(); token.type != TokenType::EOF_TOKEN; token = tokenizer.next_token()) {
+        tokens.push_back(token);
+    }
+    return compile(tokens);
+}
+
+bool MediaQueryList::evaluate(const MediaEnvironment& environment) const {
+    if (program.empty()) return true;
+
+    std::vector<Truth> stack;
+    stack.reserve(8);
+    for (const MediaInstruction& instruction : program) {
+        switch (instruction.op) {
+            case MediaOp::Type:
+                stack.push_back(truth(instruction.type == MediaType::All || instruction.type == environment.type));
+                break;
+            case MediaOp::Feature:
+                stack.push_back(evaluate_feature(instruction, calc_code, environment));
+                break;
+            case MediaOp::Unknown:
+                stack.push_back(Truth::Unknown);
+                break;
+            case MediaOp::Not:
+                if (stack.back() != Truth::Unknown) stack.back() = stack.back() == Truth::True ? Truth::False : Truth::True;
+                break;
+            case MediaOp::And:
+            case MediaOp::Or: {
+                // False decides a conjunction and True a disjunction; otherwise any Unknown wins
+                Truth decisive = instruction.op == MediaOp::And ? Truth::False : Truth::True;
+                Truth result = instruction.op == MediaOp::And ? Truth::True : Truth::False;
+                for (size_t i = stack.size() - instruction.count; i < stack.size(); ++i) {
+                    if (stack[i] == decisive) {
+                        result = decisive;
+                        break;
+                    }
+                    if (stack[i] == Truth::Unknown) result = Truth::Unknown;
+                }
+                stack.resize(stack.size() - instruction.count);
+                stack.push_back(result);
+                break;
+            }
+            case MediaOp::Query:
+                if (stack.back() == Truth::Unknown) stack.back() = Truth::False;
+                break;
+        }
+    }
+    return !stack.empty() && stack.back() == Truth::True;
+}
+
+std::string MediaQueryList::to_string() const {
+    static constexpr std::string_view comparisons[] = {"", "=", "<", "<=", ">", ">="};
+    static constexpr std::string_view types[] = {"all", "screen", "print", "speech", "unknown"};
+    std::ostringstream out;
+    for (const MediaInstruction& instruction : program) {
+        switch (instruction.op) {
+            case MediaOp::Type: out << "type " << types[static_cast<size_t>(instruction.type)]; break;
+            case MediaOp::Feature:
+                out << "feature " << feature_name(instruction.feature);
+                if (instruction.comparison != MediaComparison::Boolean) {
+                    out << " " << comparisons[static_cast<size_t>(instruction.comparison)] << " ";
+                    if (instruction.calc_size > 0) {
+                        CalcExpression math;
+                        math.code = calc_code.data() + instruction.calc_offset;
+                        math.size = instruction.calc_size;
+                        out << math.to_string();
+                    } else {
+                        out << instruction.value << (instruction.unit != CSSUnit::None ? unit_name(instruction.unit) : "");
+                    }
+                }
+                break;
+            case MediaOp::Unknown: out << "unknown"; break;
+            case MediaOp::Not: out << "not"; break;
+            case MediaOp::And: out << "and " << instruction.count; break;
+            case MediaOp::Or: out << "or " << instruction.count; break;
+            case MediaOp::Query: out << "query"; break;
+        }
+        out << "\n";
+    }
+    return out.str();
+}
+
+} // namespace CSS3Parser
@@ -0,0 +1,233 @@
+#include "CSSParser.h"
+#include <atomic>
+#include <exception>
+#include <thread>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace CSS3Parser {
+
+namespace {
+
+// Below this a chunk costs more in thread start-up than it saves
+constexpr size_t min_chunk_size = 64 * 1024;
+
+std::atomic<size_t> cores_override{0};
+
+// Bytes the boundary scan has to look at; everything else is skipped in bulk
+constexpr std::string_view structural_bytes = "{}()[]\"'/\\;";
+
+// Offset of the first structural byte at or after pos, or size
+size_t find_structural(const char* data, size_t pos, size_t size) {
+#if defined(__SSE2__)
+    for (; pos + 16 <= size; pos += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+        __m128i hits = _mm_setzero_si128();
+        for (char c : structural_bytes) hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, _mm_set1_epi8(c)));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hits));
+        if (mask != 0) return pos + static_cast<size_t>(__builtin_ctz(mask));
+    }
+#endif
+    while (pos < size && structural_bytes.find(data[pos]) == std::string_view::npos) ++pos;
+    return pos;
+}
+
+bool is_whitespace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+bool is_name_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_' ||
+           static_cast<unsigned char>(c) >= 0x80;
+}
+
+// Offset just past the string whose opening quote is at pos - 1. Like the
+// tokenizer, an unescaped newline ends a bad string before the newline.
+size_t skip_string(const char* data, size_t pos, size_t size, char quote) {
+    while (pos < size) {
+        char c = data[pos];
+        if (c == quote) return pos + 1;
+        if (c == '\n' || c == '\r' || c == '\f') return pos;
+        pos += c == '\\' ? 2 : 1;
+    }
+    return size;
+}
+
+// For the '(' at open: the offset past an unquoted url(...), or open + 1
+// when it opens an ordinary block or function
+size_t skip_url(const char* data, size_t open, size_t size) {
+    bool url = open >= 3 && (data[open - 3] | 0x20) == 'u' && (data[open - 2] | 0x20) == 'r' &&
+               (data[open - 1] | 0x20) == 'l' && (open == 3 || !is_name_char(data[open - 4]));
+    if (!url) return open + 1;
+    size_t pos = open + 1;
+    while (pos < size && is_whitespace(data[pos])) ++pos;
+    if (pos < size && (data[pos] == '"' || data[pos] == '\'')) return open + 1; // url("...") is a function
+    while (pos < size && data[pos] != ')') pos += data[pos] == '\\' ? 2 : 1;
+    return std::min(pos + 1, size);
+}
+
+// Whether the top-level item at pos is an at-rule, which a ';' can end
+bool starts_at_rule(std::string_view css, size_t pos) {
+    while (pos < css.size()) {
+        if (is_whitespace(css[pos])) {
+            ++pos;
+        } else if (css.compare(pos, 2, "/*") == 0) {
+            size_t end = css.find("*/", pos + 2);
+            pos = end == std::string_view::npos ? css.size() : end + 2;
+        } else {
+            return css[pos] == '@';
+        }
+    }
+    return false;
+}
+
+// Where each chunk's rules start: 0, then the end of the first top-level
+// rule past each even share of the input. Blocks are matched the way error
+// recovery matches them, skipping strings, comments, escapes and url()s. A
+// split that still lands inside a rule is caught when the chunks are stitched.
+std::vector<size_t> chunk_starts(std::string_view css, size_t chunks) {
+    const char* data = css.data();
+    size_t size = css.size();
+    std::vector<size_t> starts{0};
+    std::vector<char> closers;
+    bool at_rule = starts_at_rule(css, 0);
+    size_t target = size / chunks;
+
+    size_t pos = find_structural(data, 0, size);
+    while (pos < size && starts.size() < chunks) {
+        char c = data[pos++];
+        bool boundary = false;
+        switch (c) {
+            case '"':
+            case '\'':
+                pos = skip_string(data, pos, size, c);
+                break;
+            case '\\':
+                pos = std::min(pos + 1, size);
+                break;
+            case '/':
+                if (pos < size && data[pos] == '*') {
+                    size_t end = css.find("*/", pos + 1);
+                    pos = end == std::string_view::npos ? size : end + 2;
+                }
+                break;
+            case '(': {
+                size_t next = skip_url(data, pos - 1, size);
+                if (next == pos) closers.push_back(')');
+                pos = next;
+                break;
+            }
+            case '[':
+                closers.push_back(']');
+                break;
+            case '{':
+                closers.push_back('}');
+                break;
+            case ')':
+            case ']':
+            case '}':
+                if (!closers.empty() && closers.back() == c) {
+                    closers.pop_back();
+                    boundary = c == '}' && closers.empty();
+                }
+                break;
+            case ';':
+                boundary = at_rule && closers.empty();
+                break;
+        }
+        if (boundary) {
+            if (pos >= target) {
+                starts.push_back(pos);
+                target = starts.size() * size / chunks;
+            }
+            at_rule = starts_at_rule(css, pos);
+        }
+        pos = find_structural(data, pos, size);
+    }
+    return starts;
+}
+
+} // namespace
+
+size_t CSSParser::available_cores() {
+    size_t cores = cores_override.load(std::memory_order_relaxed);
+    return cores != 0 ? cores : std::thread::hardware_concurrency();
+}
+
+void CSSParser::set_available_cores(size_t cores) {
+    cores_override.store(cores, std::memory_order_relaxed);
+}
+
+// Each chunk gets its own parser over a view of the whole input, so offsets, lines and
+// columns come out as one parser would report them, and its own arena. A
+// chunk parses the top-level rules that start in its range and notes the
+// first token it left over; the next chunk is only kept when it began at that
+// very token, and is otherwise parsed again from there, which keeps the
+// result identical to parsing the sheet in one go.
+bool CSSParser::parse_in_parallel(CSSStyleSheet& sheet) {
+    // A count the platform cannot tell (0) trusts the request
+    size_t cores = available_cores();
+    size_t threads = options_.parse_threads != 0 ? options_.parse_threads : cores;
+    if (cores != 0) threads = std::min(threads, cores);
+    std::string_view input = tokenizer_.input();
+    size_t chunks = std::min(threads, input.size() / min_chunk_size);
+    if (chunks < 2 || use_token_array_ || position() != 0) return false;
+
+    std::vector<size_t> starts = chunk_starts(input, chunks);
+    if (starts.size() < 2) return false;
+
+    struct Chunk {
+        std::unique_ptr<CSSParser> parser;
+        std::unique_ptr<CSSStyleSheet> sheet;
+        size_t end = SIZE_MAX; // rules starting here or later belong to the next chunk
+        size_t first = 0; // first token parsed
+        size_t stop = 0; // first token left for the next chunk
+        std::exception_ptr failure; // rethrown in source order, as one parser would have thrown it
+    };
+    std::vector<Chunk> parts(starts.size());
+    for (size_t i = 0; i + 1 < parts.size(); ++i) parts[i].end = starts[i + 1];
+
+    // A fresh parser each time: one that threw may be left mid-block. They
+    // all view this parser's buffer rather than copying it
+    auto parse = [&](Chunk& part, size_t begin) {
+        part.parser = std::make_unique<CSSParser>(tokenizer_.shared_input(), begin, part.end, options_);
+        CSSParser& parser = *part.parser;
+        BrowserParser::AtomScope atoms(&parser.arena_->atoms());
+        part.sheet = std::make_unique<CSSStyleSheet>();
+        part.first = parser.peek_token().start_pos;
+        part.stop = parser.parse_top_level(*part.sheet, parser.end_);
+    };
+    auto run = [&](size_t i) {
+        try {
+            parse(parts[i], starts[i]);
+        } catch (...) {
+            parts[i].failure = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(parts.size() - 1);
+    for (size_t i = 1; i < parts.size(); ++i) workers.emplace_back(run, i);
+    run(0);
+    for (std::thread& worker : workers) worker.join();
+
+    for (size_t i = 0; i < parts.size(); ++i) {
+        Chunk& part = parts[i];
+        // The previous chunk's last rule ran past the split
+        if (i > 0 && part.first != parts[i - 1].stop) {
+            part.failure = nullptr;
+            parse(part, parts[i - 1].stop);
+        }
+        if (part.failure) std::rethrow_exception(part.failure);
+
+        for (auto& rule : part.sheet->rules) sheet.rules.push_back(std::move(rule));
+        for (auto& url : part.sheet->imports) sheet.imports.push_back(std::move(url));
+        errors_.insert(errors_.end(), part.parser->errors_.begin(), part.parser->errors_.end());
+        sheet.arenas.push_back(part.parser->arena_);
+    }
+    return true;
+}
+
+} // namespace CSS3Parser
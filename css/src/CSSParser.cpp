@@ -6,115 +6,175 @@
 
 namespace CSS3Parser {
 
-// Known CSS properties for validation
-static const std::unordered_set<std::string> valid_properties = {
-    // Layout properties
-    "display", "position", "top", "right", "bottom", "left", "z-index",
-    "float", "clear", "visibility", "overflow", "overflow-x", "overflow-y",
-    "clip", "clip-path",
-    
-    // Box model
-    "width", "height", "min-width", "min-height", "max-width", "max-height",
-    "margin", "margin-top", "margin-right", "margin-bottom", "margin-left",
-    "padding", "padding-top", "padding-right", "padding-bottom", "padding-left",
-    "border", "border-width", "border-style", "border-color",
-    "border-top", "border-right", "border-bottom", "border-left",
-    "border-top-width", "border-right-width", "border-bottom-width", "border-left-width",
-    "border-top-style", "border-right-style", "border-bottom-style", "border-left-style",
-    "border-top-color", "border-right-color", "border-bottom-color", "border-left-color",
-    "border-radius", "border-top-left-radius", "border-top-right-radius",
-    "border-bottom-left-radius", "border-bottom-right-radius",
-    "box-shadow", "box-sizing",
-    
-    // Background
-    "background", "background-color", "background-image", "background-repeat",
-    "background-position", "background-size", "background-attachment",
-    "background-origin", "background-clip", "background-blend-mode",
-    
-    // Typography
-    "font", "font-family", "font-size", "font-weight", "font-style",
-    "font-variant", "font-stretch", "line-height", "letter-spacing",
-    "word-spacing", "text-align", "text-decoration", "text-transform",
-    "text-indent", "text-shadow", "white-space", "word-wrap", "word-break",
-    "text-overflow", "vertical-align",
-    
-    // Color
-    "color", "opacity",
-    
-    // Flexbox
-    "flex", "flex-direction", "flex-wrap", "flex-flow", "justify-content",
-    "align-items", "align-content", "align-self", "flex-grow", "flex-shrink",
-    "flex-basis", "order",
-    
-    // Grid
-    "grid", "grid-template", "grid-template-rows", "grid-template-columns",
-    "grid-template-areas", "grid-auto-rows", "grid-auto-columns", "grid-auto-flow",
-    "grid-row", "grid-column", "grid-area", "grid-row-start", "grid-row-end",
-    "grid-column-start", "grid-column-end", "gap", "row-gap", "column-gap",
-    "grid-gap", "grid-row-gap", "grid-column-gap",
-    
-    // Transforms
-    "transform", "transform-origin", "transform-style", "perspective",
-    "perspective-origin", "backface-visibility",
-    
-    // Transitions & Animations
-    "transition", "transition-property", "transition-duration", "transition-timing-function",
-    "transition-delay", "animation", "animation-name", "animation-duration",
-    "animation-timing-function", "animation-delay", "animation-iteration-count",
-    "animation-direction", "animation-fill-mode", "animation-play-state",
-    
-    // Filters & Effects
-    "filter", "backdrop-filter", "mix-blend-mode", "isolation",
-    
-    // Table
-    "table-layout", "border-collapse", "border-spacing", "caption-side",
-    "empty-cells",
-    
-    // Lists
-    "list-style", "list-style-type", "list-style-position", "list-style-image",
-    
-    // Content
-    "content", "quotes", "counter-reset", "counter-increment",
-    
-    // User Interface
-    "cursor", "outline", "outline-width", "outline-style", "outline-color",
-    "outline-offset", "resize", "user-select", "pointer-events",
-    
-    // Multi-column
-    "columns", "column-count", "column-width", "column-gap", "column-rule",
-    "column-rule-width", "column-rule-style", "column-rule-color",
-    "column-span", "column-fill", "break-before", "break-after", "break-inside",
-    
-    // CSS3 additions
-    "border-image", "border-image-source", "border-image-slice", "border-image-width",
-    "border-image-outset", "border-image-repeat", "mask", "mask-image", "mask-mode",
-    "mask-repeat", "mask-position", "mask-clip", "mask-origin", "mask-size",
-    "mask-composite", "object-fit", "object-position", "image-rendering",
-    "shape-outside", "shape-margin", "shape-image-threshold", "scroll-behavior",
-    "scroll-snap-type", "scroll-snap-align", "overscroll-behavior", "touch-action",
-    
-    // Custom properties
-    "--*"
-};
+namespace {
 
-static const std::unordered_set<std::string> vendor_prefixes = {
-    "-webkit-", "-moz-", "-ms-", "-o-"
-};
+// More than this many selectors from one nested rule is a runaway cross product
+constexpr size_t max_nested_selectors = 1024;
+
+bool is_nesting(const SimpleSelector& simple) { return simple.type == SelectorType::Nesting; }
+
+size_t count_nesting(const ComplexSelector& complex) {
+    size_t count = 0;
+    for (const auto& component : complex.components) {
+        count += std::count_if(component.selector.selectors.begin(), component.selector.selectors.end(), is_nesting);
+    }
+    return count;
+}
+
+// Appends complex with the first compound holding & rewritten once per parent
+// selector: the parent's components take its place and its last compound
+// absorbs the rest of the compound, so "&.active > a" under ".nav li" becomes
+// ".nav li.active > a". Later compounds with & are rewritten recursively
+void substitute_nesting(const ComplexSelector& complex, const SelectorList& parent, std::vector<ComplexSelector>& out) {
+    for (size_t i = 0; i < complex.components.size(); ++i) {
+        const auto& compound = complex.components[i].selector.selectors;
+        if (std::none_of(compound.begin(), compound.end(), is_nesting)) continue;
+        
+        for (const ComplexSelector& replacement : parent.selectors) {
+            ComplexSelector result;
+            result.components.assign(complex.components.begin(), complex.components.begin() + i);
+            for (size_t j = 0; j < replacement.components.size(); ++j) {
+                result.components.push_back(replacement.components[j]);
+                if (j == 0) result.components.back().combinator = complex.components[i].combinator;
+            }
+            auto& merged = result.components.back().selector.selectors;
+            for (const SimpleSelector& simple : compound) {
+                if (!is_nesting(simple)) merged.push_back(simple);
+            }
+            result.components.insert(result.components.end(), complex.components.begin() + i + 1,
+                                     complex.components.end());
+            substitute_nesting(result, parent, out);
+        }
+        return;
+    }
+    out.push_back(complex);
+}
+
+// Replaces & inside the selector arguments of :is(), :not() and the like
+// with :is(parent), or :scope outside any style rule. Returns whether there
+// was any
+bool resolve_argument_nesting(ComplexSelector& complex, const SelectorList* parent) {
+    bool found = false;
+    for (auto& component : complex.components) {
+        for (SimpleSelector& simple : component.selector.selectors) {
+            if (simple.type != SelectorType::Pseudo || !simple.pseudo.selectors) continue;
+            SelectorList arguments = *simple.pseudo.selectors;
+            bool nested = false;
+            for (ComplexSelector& argument : arguments.selectors) {
+                nested |= resolve_argument_nesting(argument, parent);
+                for (auto& part : argument.components) {
+                    for (SimpleSelector& inner : part.selector.selectors) {
+                        if (!is_nesting(inner)) continue;
+                        nested = true;
+                        inner = SimpleSelector(SelectorType::Pseudo);
+                        if (parent) {
+                            inner.pseudo.name = ":is";
+                            inner.pseudo.is_function = true;
+                            inner.pseudo.argument = parent->to_string();
+                            inner.pseudo.selectors = std::make_shared<const SelectorList>(*parent);
+                        } else {
+                            inner.pseudo.name = ":scope";
+                        }
+                    }
+                }
+            }
+            if (!nested) continue;
+            found = true;
+            simple.pseudo.argument = arguments.to_string();
+            simple.pseudo.selectors = std::make_shared<const SelectorList>(std::move(arguments));
+        }
+    }
+    return found;
+}
+
+// Turns a nested rule's selectors into flat ones. A selector without & is
+// relative to the parent, as if it began with "& ". Each & counts as
+// :is(parent), the most specific parent selector, whichever one replaced it.
+// Outside any style rule & is :scope
+bool resolve_nesting(SelectorList& selectors, const SelectorList* parent) {
+    if (!parent) {
+        for (auto& complex : selectors.selectors) {
+            resolve_argument_nesting(complex, nullptr);
+            for (auto& component : complex.components) {
+                for (SimpleSelector& simple : component.selector.selectors) {
+                    if (!is_nesting(simple)) continue;
+                    simple = SimpleSelector(SelectorType::Pseudo);
+                    simple.pseudo.name = ":scope";
+                }
+            }
+        }
+        return true;
+    }
+    
+    SelectorList resolved;
+    for (ComplexSelector& complex : selectors.selectors) {
+        bool argument_nesting = resolve_argument_nesting(complex, parent);
+        size_t nesting = count_nesting(complex);
+        if (nesting == 0 && !argument_nesting) {
+            CompoundSelector anchor;
+            anchor.add_selector(SimpleSelector(SelectorType::Nesting));
+            complex.components.front().combinator = SelectorCombinator::Descendant;
+            complex.components.insert(complex.components.begin(), ComplexSelector::Component{anchor});
+            nesting = 1;
+        }
+        
+        size_t expanded = 1;
+        for (size_t i = 0; i < nesting && expanded <= max_nested_selectors; ++i) expanded *= parent->selectors.size();
+        if (resolved.selectors.size() + expanded > max_nested_selectors) return false;
+        
+        Specificity specificity = complex.specificity();
+        Specificity parent_specificity = parent->max_specificity();
+        for (size_t i = 0; i < nesting; ++i) specificity += parent_specificity;
+        
+        size_t first = resolved.selectors.size();
+        substitute_nesting(complex, *parent, resolved.selectors);
+        for (size_t i = first; i < resolved.selectors.size(); ++i) {
+            resolved.selectors[i].nested_specificity = specificity;
+        }
+    }
+    selectors = std::move(resolved);
+    return true;
+}
+
+} // namespace
 
 CSSParser::CSSParser(const std::string& css, const ParseOptions& options)
-    : tokenizer_(css), options_(options) {}
+    : tokenizer_(css), options_(options) {
+    // Parallel parsing tokenizes each chunk on its own thread instead
+    if (options_.token_prepass && options_.parse_threads == 1 && css.size() <= UINT32_MAX) {
+        use_token_array_ = true;
+        tokens_.build(tokenizer_);
+        window_index_.fill(SIZE_MAX);
+    }
+}
+
+CSSParser::CSSParser(std::shared_ptr<const std::string> css, size_t begin, size_t end, const ParseOptions& options)
+    : tokenizer_(std::move(css)), options_(options), end_(end) {
+    // A range is one chunk of a parse already split across threads
+    options_.parse_threads = 1;
+    options_.token_prepass = false;
+    tokenizer_.reset(begin);
+}
 
 std::unique_ptr<CSSStyleSheet> CSSParser::parse_stylesheet() {
+    BrowserParser::AtomScope atoms(&arena_->atoms());
     auto stylesheet = std::make_unique<CSSStyleSheet>();
+    if (!parse_in_parallel(*stylesheet)) parse_top_level(*stylesheet, end_);
     
-    while (!tokenizer_.at_end()) {
-        skip_whitespace();
-        
-        if (tokenizer_.at_end()) break;
-        
-        Token token = peek_token();
+    stylesheet->origin = options_.origin;
+    stylesheet->arenas.push_back(arena_);
+    stylesheet->assign_cascade_keys();
+    return stylesheet;
+}
+
+size_t CSSParser::parse_top_level(CSSStyleSheet& sheet, size_t end) {
+    // Each branch consumes at least one token
+    while (peek_token().type != TokenType::EOF_TOKEN && peek_token().start_pos < end) {
+        const Token& token = peek_token();
         
-        if (token.type == TokenType::AtKeyword) {
+        if (token.type == TokenType::Whitespace || token.type == TokenType::CDO || token.type == TokenType::CDC) {
+            consume_token();
+        } else if (token.type == TokenType::AtKeyword) {
             if (token.value == "import") {
                 // Handle @import specially
                 consume_token(); // consume @import
@@ -124,95 +184,179 @@ std::unique_ptr<CSSStyleSheet> CSSParser::parse_stylesheet() {
                 std::string import_url;
                 
                 if (url_token.type == TokenType::Url || url_token.type == TokenType::String) {
-                    import_url = url_token.value;
-                } else if ((url_token.type == TokenType::Ident || url_token.type == TokenType::Function) && url_token.value == "url") {
-                    // Parse url() function: url("...")
-                    if (peek_token().type == TokenType::LeftParen) {
-                        consume_token(); // consume (
-                        Token string_token = consume_token();
-                        if (string_token.type == TokenType::String) {
-                            import_url = string_token.value;
-                        }
-                        if (peek_token().type == TokenType::RightParen) {
-                            consume_token(); // consume )
-                        }
+                    import_url = std::string(url_token.value);
+                } else if (url_token.type == TokenType::Function && url_token.value == "url") {
+                    // Quoted url("...") arrives as a function token
+                    skip_whitespace();
+                    Token string_token = consume_token();
+                    if (string_token.type == TokenType::String) {
+                        import_url = std::string(string_token.value);
+                    }
+                    skip_whitespace();
+                    if (peek_token().type == TokenType::RightParen) {
+                        consume_token(); // consume )
                     }
                 }
                 
                 if (!import_url.empty()) {
-                    stylesheet->imports.push_back(import_url);
+                    sheet.imports.push_back(import_url);
                 }
                 
-                // Consume until semicolon (with safety)
-                int import_safety = 0;
-                while (!tokenizer_.at_end() && peek_token().type != TokenType::Semicolon && import_safety++ < 100) {
-                    consume_token();
-                }
-                if (peek_token().type == TokenType::Semicolon) {
-                    consume_token();
-                }
+                // Media and layer conditions are not modelled; skip to the end of the statement
+                skip_invalid(Recovery::AtRule);
             } else {
                 auto rule = parse_at_rule();
                 if (rule) {
-                    stylesheet->add_rule(std::move(rule));
+                    sheet.add_rule(std::move(rule));
                 }
             }
         } else if (token.type == TokenType::Comment && options_.preserve_comments) {
-            auto comment_rule = std::make_unique<CommentRule>(token.value);
-            stylesheet->add_rule(std::move(comment_rule));
+            auto comment_rule = std::make_unique<CommentRule>(std::string(token.value));
+            sheet.add_rule(std::move(comment_rule));
             consume_token();
         } else if (token.type == TokenType::Comment) {
             consume_token(); // Skip comments
-        } else {
-            auto rule = parse_style_rule();
-            if (rule) {
-                stylesheet->add_rule(std::move(rule));
-            }
+        } else if (!parse_style_rule(sheet.rules)) {
+            skip_invalid(Recovery::Rule);
         }
     }
-    
-    return stylesheet;
+    return peek_token().start_pos;
 }
 
 std::unique_ptr<CSSRule> CSSParser::parse_rule() {
+    BrowserParser::AtomScope atoms(&arena_->atoms());
     skip_whitespace();
     
     Token token = peek_token();
     if (token.type == TokenType::AtKeyword) {
         return parse_at_rule();
-    } else {
-        return parse_style_rule();
     }
+    
+    // Nested rules are flattened into the rule lists; a lone rule drops them
+    std::vector<std::unique_ptr<CSSRule>> rules;
+    if (!parse_style_rule(rules)) return nullptr;
+    return std::move(rules.front());
 }
 
-std::unique_ptr<StyleRule> CSSParser::parse_style_rule() {
+bool CSSParser::parse_style_rule(std::vector<std::unique_ptr<CSSRule>>& rules) {
     auto rule = std::make_unique<StyleRule>();
-    rule->start_pos = tokenizer_.position();
+    rule->start_pos = position();
     
-    // Parse selector list
+    // Parse selector list; one that reported errors invalidates the rule
+    size_t errors = errors_.size();
     rule->selectors = parse_selector_list();
     
+    if (errors_.size() != errors) return false;
     if (rule->selectors.empty()) {
         add_error("Expected selector before '{'");
-        return nullptr;
+        return false;
+    }
+    if (!resolve_nesting(rule->selectors, nesting_parent_)) {
+        add_error("Nested selector expands to too many selectors");
+        return false;
     }
     
     skip_whitespace();
     
     if (!consume_if_match(TokenType::LeftBrace)) {
         add_error("Expected '{' after selector");
-        return nullptr;
+        return false;
     }
     
-    // Parse declarations
-    parse_declaration_list(rule->declarations);
+    // The rule comes first; rules nested in it follow in source order
+    StyleRule* own = rule.get();
+    rules.push_back(std::move(rule));
+    parse_style_block(own, rules);
     
     if (!consume_if_match(TokenType::RightBrace)) {
         add_error("Expected '}' after declarations");
     }
     
-    rule->end_pos = tokenizer_.position();
-    return rule;
+    own->compile_selectors();
+    own->end_pos = position();
+    return true;
+}
+
+// Declarations and nested rules. Declarations before the first nested rule
+// belong to own; later ones, and all of them when own is null (a conditional
+// rule nested in a style rule), go to a rule with the parent's selectors so
+// they keep their place in the cascade
+void CSSParser::parse_style_block(StyleRule* own, std::vector<std::unique_ptr<CSSRule>>& rules) {
+    const SelectorList* outer = nesting_parent_;
+    if (own) nesting_parent_ = &own->selectors;
+    StyleRule* declarations = own;
+    block_depth_++;
+    
+    // Each branch consumes at least one token
+    while (true) {
+        skip_whitespace();
+        TokenType type = peek_token().type;
+        if (type == TokenType::RightBrace || type == TokenType::EOF_TOKEN) break;
+        
+        if (type == TokenType::Semicolon) {
+            consume_token();
+        } else if (type == TokenType::AtKeyword) {
+            auto rule = parse_at_rule();
+            if (rule) {
+                rules.push_back(std::move(rule));
+                declarations = nullptr;
+            }
+        } else if (at_nested_rule()) {
+            if (parse_style_rule(rules)) {
+                declarations = nullptr;
+            } else {
+                skip_invalid(Recovery::Rule);
+            }
+        } else {
+            if (!declarations) {
+                auto rule = std::make_unique<StyleRule>();
+                rule->start_pos = position();
+                rule->selectors = *nesting_parent_;
+                rule->compile_selectors();
+                declarations = rule.get();
+                rules.push_back(std::move(rule));
+            }
+            parse_declaration_into(declarations->declarations);
+            if (declarations != own) declarations->end_pos = position();
+        }
+    }
+    
+    block_depth_--;
+    nesting_parent_ = outer;
+}
+
+// Declarations start with "name:", and so does a nested rule like
+// "a:hover {"; the two are told apart by whether '{' comes before ';' or '}'
+bool CSSParser::at_nested_rule() {
+    const Token& first = peek_token();
+    if (first.type != TokenType::Ident) return true;
+    if (first.value.substr(0, 2) == "--") return false; // custom properties may hold {}
+    
+    size_t offset = 1;
+    if (peek_token(offset).type == TokenType::Whitespace) offset++;
+    if (peek_token(offset).type != TokenType::Colon) return true;
+    
+    // A pseudo-class follows its colon directly; a value rarely starts so
+    TokenType after = peek_token(++offset).type;
+    if (after != TokenType::Ident && after != TokenType::Function && after != TokenType::Colon) return false;
+    
+    for (++offset; offset < CSSTokenizer::lookahead_capacity; ++offset) {
+        TokenType type = peek_token(offset).type;
+        if (type == TokenType::LeftBrace) return true;
+        if (type == TokenType::Semicolon || type == TokenType::RightBrace || type == TokenType::EOF_TOKEN) {
+            return false;
+        }
+    }
+    
+    // Longer than the peek window: scan ahead, then come back
+    size_t start = checkpoint();
+    TokenType end = TokenType::EOF_TOKEN;
+    while (!at_end()) {
+        end = consume_token().type;
+        if (end == TokenType::LeftBrace || end == TokenType::Semicolon || end == TokenType::RightBrace) break;
+    }
+    rewind(start);
+    return end == TokenType::LeftBrace;
 }
 
 std::unique_ptr<AtRule> CSSParser::parse_at_rule() {
@@ -223,34 +367,69 @@ std::unique_ptr<AtRule> CSSParser::parse_at_rule() {
         return nullptr;
     }
     
-    auto rule = std::make_unique<AtRule>(at_token.value);
-    rule->start_pos = tokenizer_.position();
+    auto rule = std::make_unique<AtRule>(std::string(at_token.value));
+    rule->start_pos = position();
     
-    if (!is_supported_at_rule(at_token.value)) {
-        add_error("Unsupported at-rule: @" + at_token.value);
+    if (!is_supported_at_rule(rule->name)) {
+        add_error("Unsupported at-rule: @" + rule->name);
     }
     
-    // Parse prelude (everything before { or ;)
+    // Parse prelude (everything before { or ;, or a } closing the enclosing block)
     std::ostringstream prelude;
-    while (!tokenizer_.at_end()) {
-        Token token = peek_token();
-        if (token.type == TokenType::LeftBrace || token.type == TokenType::Semicolon) {
+    std::vector<Token> prelude_tokens;
+    while (true) {
+        const Token& token = peek_token();
+        if (token.type == TokenType::EOF_TOKEN || token.type == TokenType::LeftBrace ||
+            token.type == TokenType::Semicolon ||
+            (token.type == TokenType::RightBrace && block_depth_ > 0)) {
             break;
         }
-        prelude << consume_token().value << " ";
+        if (token.type == TokenType::Whitespace) {
+            consume_token(); // tokens are already space-separated
+            continue;
+        }
+        prelude_tokens.push_back(consume_token());
+        prelude << prelude_tokens.back().value << " ";
     }
     rule->prelude = prelude.str();
     
     // Trim trailing whitespace
-    rule->prelude.erase(rule->prelude.find_last_not_of(" \\t\\n\\r") + 1);
+    rule->prelude.erase(rule->prelude.find_last_not_of(" \t\n\r") + 1);
+    
+    if (rule->name == "media") {
+        rule->media = MediaQueryList::compile(prelude_tokens);
+    } else if (rule->name == "supports" && !prelude_tokens.empty()) {
+        // Sheets repeat the same few feature queries
+        auto [it, inserted] = supports_results_.emplace(rule->prelude, false);
+        if (inserted) {
+            it->second = supports_condition(tokenizer_.source(prelude_tokens.front().start_pos,
+                                                              prelude_tokens.back().end_pos));
+        }
+        rule->supported = it->second;
+    } else if (rule->name == "supports") {
+        rule->supported = false;
+    } else if (rule->name == "scope") {
+        rule->supported = parse_scope_prelude(prelude_tokens, rule->scope);
+        if (!rule->supported) add_error("Invalid @scope prelude: " + rule->prelude);
+    }
     
-    Token next = peek_token();
-    if (next.type == TokenType::LeftBrace) {
+    TokenType next = peek_token().type;
+    if (next == TokenType::LeftBrace && !rule->supported) {
+        // The block can never apply, so its rules are not even built
+        skip_component_value();
+    } else if (next == TokenType::LeftBrace) {
         consume_token(); // consume {
         
         if (rule->is_conditional()) {
-            // Parse nested rules
-            parse_rule_list(rule->rules);
+            // Parse nested rules; inside a style rule, bare declarations apply to it
+            bool scoped = rule->name == "scope";
+            scope_depth_ += scoped;
+            if (nesting_parent_) {
+                parse_style_block(nullptr, rule->rules);
+            } else {
+                parse_rule_list(rule->rules);
+            }
+            scope_depth_ -= scoped;
         } else if (rule->is_descriptor()) {
             // Parse declarations
             parse_declaration_list(rule->declarations);
@@ -258,177 +437,257 @@ std::unique_ptr<AtRule> CSSParser::parse_at_rule() {
             // Parse keyframes rules (0% { ... }, 50% { ... }, etc.)
             parse_keyframes_rules(rule->rules);
         } else {
-            // Generic block parsing - could be rules or declarations (WITH SAFETY)
-            int generic_safety_counter = 0;
-            size_t generic_last_position = 0;
-            
-            while (!tokenizer_.at_end() && peek_token().type != TokenType::RightBrace && generic_safety_counter++ < 100) {
-                size_t generic_current_position = tokenizer_.position();
-                if (generic_current_position == generic_last_position) {
-                    // No progress made, skip token to avoid infinite loop
-                    consume_token();
-                    continue;
-                }
-                generic_last_position = generic_current_position;
+            // Unknown at-rules keep their declarations and nested at-rules unchecked
+            block_depth_++;
+            while (true) {
+                skip_whitespace();
+                TokenType type = peek_token().type;
+                if (type == TokenType::RightBrace || type == TokenType::EOF_TOKEN) break;
                 
-                Token token = peek_token();
-                if (token.type == TokenType::AtKeyword) {
-                    // Looks like a rule
-                    auto nested_rule = parse_rule();
-                    if (nested_rule) {
-                        rule->rules.push_back(std::move(nested_rule));
-                    }
+                if (type == TokenType::Semicolon) {
+                    consume_token();
+                } else if (type == TokenType::AtKeyword) {
+                    auto nested_rule = parse_at_rule();
+                    if (nested_rule) rule->rules.push_back(std::move(nested_rule));
                 } else {
-                    // Looks like a declaration
-                    auto decl = parse_declaration();
-                    if (!decl.property.empty()) {
-                        rule->declarations.push_back(decl);
-                    }
-                    
-                    if (peek_token().type == TokenType::Semicolon) {
-                        consume_token();
-                    }
+                    CSSDeclaration decl;
+                    if (consume_declaration(decl)) rule->declarations.push_back(std::move(decl));
                 }
-                skip_whitespace();
             }
+            block_depth_--;
         }
         
         if (!consume_if_match(TokenType::RightBrace)) {
             add_error("Expected '}' after at-rule block");
         }
-    } else if (next.type == TokenType::Semicolon) {
+    } else if (next == TokenType::Semicolon) {
         consume_token(); // consume ;
     }
     
-    rule->end_pos = tokenizer_.position();
+    rule->end_pos = position();
     return rule;
 }
 
+bool CSSParser::parse_scope_prelude(const std::vector<Token>& prelude, ScopeBounds& scope) {
+    // Parses the selector list between the parentheses opening at prelude[i]
+    auto parse_list = [&](size_t& i, SelectorList& list, std::vector<CompiledSelector>& compiled) {
+        if (i >= prelude.size() || prelude[i].type != TokenType::LeftParen) return false;
+        size_t depth = 0, close = i;
+        for (; close < prelude.size(); ++close) {
+            TokenType type = prelude[close].type;
+            if (type == TokenType::LeftParen || type == TokenType::Function) depth++;
+            if (type == TokenType::RightParen && --depth == 0) break;
+        }
+        if (close == prelude.size() || close == i + 1) return false;
+        
+        CSSParser parser(std::string(tokenizer_.source(prelude[i + 1].start_pos, prelude[close].start_pos)));
+        parser.skip_whitespace();
+        list = parser.parse_selector_list();
+        parser.skip_whitespace();
+        if (list.empty() || !parser.at_end() || parser.has_errors()) return false;
+        for (const auto& selector : list.selectors) compiled.push_back(CompiledSelector::compile(selector));
+        i = close + 1;
+        return true;
+    };
+    
+    size_t i = 0;
+    if (i < prelude.size() && prelude[i].type == TokenType::LeftParen &&
+        !parse_list(i, scope.roots, scope.compiled_roots)) {
+        return false;
+    }
+    if (i < prelude.size() && prelude[i].type == TokenType::Ident && prelude[i].value == "to") {
+        ++i;
+        if (!parse_list(i, scope.limits, scope.compiled_limits)) return false;
+    }
+    return i == prelude.size();
+}
+
 void CSSParser::parse_declaration_list(std::vector<CSSDeclaration>& declarations) {
-    int safety_counter = 0;
-    size_t last_position = 0;
+    block_depth_++;
     
-    while (!tokenizer_.at_end() && peek_token().type != TokenType::RightBrace && safety_counter++ < 10000) {
+    // Each branch consumes at least one token
+    while (true) {
         skip_whitespace();
+        TokenType type = peek_token().type;
+        if (type == TokenType::RightBrace || type == TokenType::EOF_TOKEN) break;
         
-        if (peek_token().type == TokenType::RightBrace) break;
-        
-        size_t current_position = tokenizer_.position();
-        if (current_position == last_position) {
-            // No progress made, skip token to avoid infinite loop
+        if (type == TokenType::Semicolon) {
             consume_token();
-            continue;
+        } else if (type == TokenType::AtKeyword) {
+            parse_at_rule(); // e.g. @page margin boxes, which are not modelled
+        } else {
+            parse_declaration_into(declarations);
         }
-        last_position = current_position;
-        
-        auto decl = parse_declaration();
-        if (!decl.property.empty()) {
-            if (options_.validate_properties && !is_valid_property(decl.property)) {
-                add_error("Unknown property: " + decl.property);
-            }
-            
-            declarations.push_back(decl);
+    }
+    
+    block_depth_--;
+}
+
+// A declaration and its terminating ';'. One with anything left over after
+// its value is dropped, skipping to the next ';' or the end of the block
+bool CSSParser::consume_declaration(CSSDeclaration& decl) {
+    size_t errors = errors_.size();
+    decl = parse_declaration();
+    skip_whitespace();
+    
+    TokenType next = peek_token().type;
+    if (next == TokenType::Semicolon) {
+        consume_token();
+    } else if (next != TokenType::RightBrace && next != TokenType::EOF_TOKEN) {
+        if (errors_.size() == errors) add_error("Unexpected token in declaration: " + decl.property);
+        skip_invalid(Recovery::Declaration);
+        return false;
+    }
+    return !decl.property.empty();
+}
+
+// Parses one declaration, expanding and validating it as the options ask
+void CSSParser::parse_declaration_into(std::vector<CSSDeclaration>& declarations) {
+    CSSDeclaration decl;
+    if (consume_declaration(decl)) {
+        if (options_.validate_properties && !is_valid_property(decl.property)) {
+            add_error("Unknown property: " + decl.property);
         }
-        
-        // Consume semicolon if present
-        if (peek_token().type == TokenType::Semicolon) {
-            consume_token();
+
+        if (options_.expand_shorthands && property_info(decl.id).is_shorthand()) {
+            // The shorthand is dropped as a whole when any longhand is invalid.
+            // Initial values filled in for omitted parts need no checking
+            size_t first = declarations.size();
+            bool valid = expand_shorthand(decl, *arena_, declarations);
+            for (size_t i = first; valid && options_.validate_values && i < declarations.size(); ++i) {
+                valid = declarations[i].implicit || validate_value(declarations[i].id, declarations[i].value, *arena_);
+            }
+            if (!valid) {
+                declarations.erase(declarations.begin() + first, declarations.end());
+                add_error("Invalid value for shorthand: " + decl.property);
+            }
+        } else if (options_.validate_values && !validate_value(decl.id, decl.value, *arena_)) {
+            add_error("Invalid value for property: " + decl.property);
+        } else {
+            declarations.push_back(std::move(decl));
         }
-        
-        skip_whitespace();
     }
 }
 
 void CSSParser::parse_rule_list(std::vector<std::unique_ptr<CSSRule>>& rules) {
-    int safety_counter = 0;
-    size_t last_position = 0;
+    block_depth_++;
     
-    while (!tokenizer_.at_end() && peek_token().type != TokenType::RightBrace && safety_counter++ < 10000) {
+    // Each branch consumes at least one token
+    while (true) {
         skip_whitespace();
+        TokenType type = peek_token().type;
+        if (type == TokenType::RightBrace || type == TokenType::EOF_TOKEN) break;
         
-        if (peek_token().type == TokenType::RightBrace) break;
-        
-        size_t current_position = tokenizer_.position();
-        if (current_position == last_position) {
-            // No progress made, skip token to avoid infinite loop
-            consume_token();
-            continue;
-        }
-        last_position = current_position;
-        
-        auto rule = parse_rule();
-        if (rule) {
-            rules.push_back(std::move(rule));
+        if (type == TokenType::AtKeyword) {
+            auto rule = parse_at_rule();
+            if (rule) rules.push_back(std::move(rule));
+        } else if (!parse_style_rule(rules)) {
+            skip_invalid(Recovery::Rule);
         }
     }
+    
+    block_depth_--;
 }
 
 void CSSParser::parse_keyframes_rules(std::vector<std::unique_ptr<CSSRule>>& rules) {
-    int safety_counter = 0;
-    size_t last_position = 0;
+    block_depth_++;
     
-    while (!tokenizer_.at_end() && peek_token().type != TokenType::RightBrace && safety_counter++ < 100) {
+    // Each branch consumes at least one token
+    while (true) {
         skip_whitespace();
+        TokenType type = peek_token().type;
+        if (type == TokenType::RightBrace || type == TokenType::EOF_TOKEN) break;
         
-        if (peek_token().type == TokenType::RightBrace) break;
-        
-        size_t current_position = tokenizer_.position();
-        if (current_position == last_position) {
-            // No progress made, skip token to avoid infinite loop
-            consume_token();
-            continue;
-        }
-        last_position = current_position;
-        
-        // Parse keyframe rule: "0%" or "from" or "to" { declarations }
-        Token selector_token = peek_token();
-        
-        if (selector_token.type == TokenType::Percentage || 
-            (selector_token.type == TokenType::Ident && 
-             (selector_token.value == "from" || selector_token.value == "to"))) {
-            
-            // Create a style rule for this keyframe
-            auto keyframe_rule = std::make_unique<StyleRule>();
+        // Keyframe selectors: "0%", "from" or "to", comma-separated
+        auto keyframe_rule = std::make_unique<StyleRule>();
+        keyframe_rule->start_pos = position();
+        bool valid = true;
+        do {
+            skip_whitespace();
+            const Token& selector_token = peek_token();
+            if (selector_token.type != TokenType::Percentage &&
+                !(selector_token.type == TokenType::Ident &&
+                  (selector_token.value == "from" || selector_token.value == "to"))) {
+                valid = false;
+                break;
+            }
             
-            // Parse the keyframe selector (0%, 50%, from, to)
             ComplexSelector complex_selector;
             CompoundSelector compound_selector;
-            SimpleSelector simple_selector(SelectorType::Type, selector_token.value);
-            compound_selector.add_selector(simple_selector);
+            compound_selector.add_selector(SimpleSelector(SelectorType::Type, std::string(selector_token.value)));
             complex_selector.add_component(compound_selector);
             keyframe_rule->selectors.add_selector(complex_selector);
-            
             consume_token(); // consume the selector
             skip_whitespace();
-            
-            if (consume_if_match(TokenType::LeftBrace)) {
-                parse_declaration_list(keyframe_rule->declarations);
-                
-                if (!consume_if_match(TokenType::RightBrace)) {
-                    add_error("Expected '}' after keyframe declarations");
-                }
-            }
-            
-            rules.push_back(std::move(keyframe_rule));
-        } else {
-            // Skip unknown token
+        } while (consume_if_match(TokenType::Comma));
+        
+        if (!valid || peek_token().type != TokenType::LeftBrace) {
+            add_error("Invalid keyframe selector");
+            skip_invalid(Recovery::Rule);
+            continue;
+        }
+        
+        consume_token(); // consume {
+        parse_declaration_list(keyframe_rule->declarations);
+        if (!consume_if_match(TokenType::RightBrace)) {
+            add_error("Expected '}' after keyframe declarations");
+        }
+        keyframe_rule->end_pos = position();
+        rules.push_back(std::move(keyframe_rule));
+    }
+    
+    block_depth_--;
+}
+
+// Error recovery by component values, so a skipped block takes its nested
+// blocks with it. Skipping stops after a ';' (not for a rule's prelude at
+// the top level, where ';' is an ordinary token) or after a rule's {} block,
+// and before a '}' that closes the enclosing block
+void CSSParser::skip_invalid(Recovery recovery) {
+    bool nested = block_depth_ > 0;
+    while (true) {
+        TokenType type = peek_token().type;
+        if (type == TokenType::EOF_TOKEN) return;
+        if (type == TokenType::RightBrace && nested) return;
+        if (type == TokenType::Semicolon && (nested || recovery != Recovery::Rule)) {
             consume_token();
+            return;
         }
+        skip_component_value();
+        if (type == TokenType::LeftBrace && recovery != Recovery::Declaration) return;
     }
 }
 
+// Consumes one token, or a whole {}, [] or () block or function with
+// everything nested in it. Only the matching closer ends a block
+void CSSParser::skip_component_value() {
+    std::vector<TokenType> closers;
+    do {
+        TokenType type = consume_token().type;
+        if (type == TokenType::LeftBrace) {
+            closers.push_back(TokenType::RightBrace);
+        } else if (type == TokenType::LeftSquare) {
+            closers.push_back(TokenType::RightSquare);
+        } else if (type == TokenType::LeftParen || type == TokenType::Function) {
+            closers.push_back(TokenType::RightParen);
+        } else if (!closers.empty() && type == closers.back()) {
+            closers.pop_back();
+        }
+    } while (!closers.empty() && !at_end());
+}
+
 CSSDeclaration CSSParser::parse_declaration() {
+    BrowserParser::AtomScope atoms(&arena_->atoms());
     CSSDeclaration decl;
     
     skip_whitespace();
     
-    Token property_token = consume_token();
-    if (property_token.type != TokenType::Ident) {
+    // Tokens that do not fit are left for the caller's recovery
+    if (peek_token().type != TokenType::Ident) {
         add_error("Expected property name");
         return decl;
     }
-    
-    decl.property = property_token.value;
+    Token property_token = consume_token();
     
     skip_whitespace();
     
@@ -437,17 +696,24 @@ CSSDeclaration CSSParser::parse_declaration() {
         return decl;
     }
     
+    decl.property = std::string(property_token.value);
+    decl.id = property_id(decl.property);
+    
     skip_whitespace();
     
-    decl.value = parse_value();
+    if (decl.property.compare(0, 2, "--") != 0 || !parse_block_custom_value(decl.value)) {
+        decl.value = parse_value();
+    }
     
     // Check for !important
     skip_whitespace();
-    Token next = peek_token();
+    const Token& next = peek_token();
     if (next.type == TokenType::Delim && next.value == "!") {
         consume_token(); // consume !
-        Token important = consume_token();
+        skip_whitespace();
+        const Token& important = peek_token();
         if (important.type == TokenType::Ident && important.value == "important") {
+            consume_token();
             decl.important = true;
         } else {
             add_error("Expected 'important' after '!'");
@@ -457,6 +723,33 @@ CSSDeclaration CSSParser::parse_declaration() {
     return decl;
 }
 
+// A custom property's value is any run of component values, {} blocks
+// included. A value holding a top-level block has no typed form, so it is
+// kept as its source text; any other value is left for parse_value()
+bool CSSParser::parse_block_custom_value(CSSValue& value) {
+    size_t start = checkpoint();
+    size_t begin = peek_token().start_pos;
+    size_t end = begin;
+    bool has_block = false;
+    while (true) {
+        const Token& token = peek_token();
+        TokenType type = token.type;
+        if (type == TokenType::Semicolon || type == TokenType::RightBrace || type == TokenType::EOF_TOKEN ||
+            (type == TokenType::Delim && token.value == "!")) {
+            break;
+        }
+        has_block |= type == TokenType::LeftBrace;
+        skip_component_value();
+        if (type != TokenType::Whitespace) end = peek_token().start_pos;
+    }
+    if (!has_block) {
+        rewind(start);
+        return false;
+    }
+    value = CSSValue::make_text(ValueType::Custom, tokenizer_.source(begin, end), *arena_);
+    return true;
+}
+
 SelectorList CSSParser::parse_selector_list() {
     SelectorList list;
     
@@ -476,7 +769,7 @@ SelectorList CSSParser::parse_selector_list() {
         } else {
             break;
         }
-    } while (!tokenizer_.at_end());
+    } while (!at_end());
     
     return list;
 }
@@ -485,7 +778,27 @@ ComplexSelector CSSParser::parse_complex_selector() {
     ComplexSelector complex;
     SelectorCombinator combinator = SelectorCombinator::None;
     
-    while (!tokenizer_.at_end()) {
+    // Inside @scope or a style rule a selector may open with a combinator,
+    // relative to :scope or to the enclosing rule's &. Within a selector
+    // argument only :has() allows one, relative to its :scope anchor
+    bool in_argument = argument_depth_ > 0;
+    if (scope_depth_ > 0 || (nesting_parent_ && !in_argument)) {
+        SelectorCombinator leading = parse_combinator();
+        if (leading != SelectorCombinator::None) {
+            SimpleSelector scope(SelectorType::Nesting);
+            if (!nesting_parent_ || in_argument) {
+                scope = SimpleSelector(SelectorType::Pseudo);
+                scope.pseudo.name = ":scope";
+            }
+            CompoundSelector anchor;
+            anchor.add_selector(scope);
+            complex.add_component(anchor);
+            combinator = leading;
+            skip_whitespace();
+        }
+    }
+    
+    while (!at_end()) {
         auto compound = parse_compound_selector();
         if (compound.empty()) {
             break;
@@ -498,7 +811,7 @@ ComplexSelector CSSParser::parse_complex_selector() {
         
         if (combinator == SelectorCombinator::None) {
             // Check if there's a following selector without explicit combinator
-            Token next = peek_token();
+            const Token& next = peek_token();
             if (next.type == TokenType::Ident || next.type == TokenType::Hash ||
                 next.type == TokenType::Delim || next.type == TokenType::LeftSquare ||
                 next.type == TokenType::Colon) {
@@ -517,7 +830,7 @@ ComplexSelector CSSParser::parse_complex_selector() {
 CompoundSelector CSSParser::parse_compound_selector() {
     CompoundSelector compound;
     
-    while (!tokenizer_.at_end()) {
+    while (!at_end()) {
         auto simple = parse_simple_selector();
         if (simple.type == SelectorType::Universal && simple.name.empty()) {
             break; // No valid selector found
@@ -526,7 +839,7 @@ CompoundSelector CSSParser::parse_compound_selector() {
         compound.add_selector(simple);
         
         // Check if next token can be part of compound selector
-        Token next = peek_token();
+        const Token& next = peek_token();
         if (next.type != TokenType::Hash && next.type != TokenType::Delim &&
             next.type != TokenType::LeftSquare && next.type != TokenType::Colon) {
             break;
@@ -544,11 +857,13 @@ SimpleSelector CSSParser::parse_simple_selector() {
             if (token.value == "*") {
                 consume_token();
                 return SimpleSelector(SelectorType::Universal, "*");
+            } else if (token.value == "&") {
+                consume_token();
+                return SimpleSelector(SelectorType::Nesting);
             } else if (token.value == ".") {
                 consume_token(); // consume .
-                Token class_name = consume_token();
-                if (class_name.type == TokenType::Ident) {
-                    return SimpleSelector(SelectorType::Class, class_name.value);
+                if (peek_token().type == TokenType::Ident) {
+                    return SimpleSelector(SelectorType::Class, std::string(consume_token().value));
                 }
                 add_error("Expected class name after '.'");
             }
@@ -556,11 +871,11 @@ SimpleSelector CSSParser::parse_simple_selector() {
             
         case TokenType::Hash:
             consume_token();
-            return SimpleSelector(SelectorType::Id, token.value.substr(1)); // Remove #
+            return SimpleSelector(SelectorType::Id, std::string(token.value.substr(1))); // Remove #
             
         case TokenType::Ident:
             consume_token();
-            return SimpleSelector(SelectorType::Type, token.value);
+            return SimpleSelector(SelectorType::Type, std::string(token.value));
             
         case TokenType::LeftSquare: {
             auto attr = parse_attribute_selector();
@@ -571,7 +886,7 @@ SimpleSelector CSSParser::parse_simple_selector() {
         
         case TokenType::Colon: {
             auto pseudo = parse_pseudo_selector();
-            SelectorType type = pseudo.name.find("::") == 0 ? 
+            SelectorType type = pseudo.name.find("::") == 0 || is_legacy_pseudo_element(pseudo.name) ?
                               SelectorType::PseudoElement : SelectorType::Pseudo;
             SimpleSelector selector(type);
             selector.pseudo = pseudo;
@@ -595,19 +910,19 @@ AttributeSelector CSSParser::parse_attribute_selector() {
     
     skip_whitespace();
     
-    Token name_token = consume_token();
-    if (name_token.type != TokenType::Ident) {
+    if (peek_token().type != TokenType::Ident) {
         add_error("Expected attribute name");
         return attr;
     }
+    Token name_token = consume_token();
     
-    attr.name = name_token.value;
+    attr.name = std::string(name_token.value);
     attr.match_type = AttributeMatchType::Exists;
     
     skip_whitespace();
     
     // Check for attribute matching operator
-    Token op = peek_token();
+    const Token& op = peek_token();
     if (op.type == TokenType::Delim && op.value == "=") {
         consume_token();
         attr.match_type = AttributeMatchType::Exact;
@@ -631,14 +946,14 @@ AttributeSelector CSSParser::parse_attribute_selector() {
     if (attr.match_type != AttributeMatchType::Exists) {
         skip_whitespace();
         
-        Token value_token = consume_token();
+        const Token& value_token = peek_token();
         if (value_token.type == TokenType::String || value_token.type == TokenType::Ident) {
-            attr.value = value_token.value;
+            attr.value = std::string(consume_token().value);
             
             skip_whitespace();
             
             // Check for case-insensitive flag
-            Token flag = peek_token();
+            const Token& flag = peek_token();
             if (flag.type == TokenType::Ident && (flag.value == "i" || flag.value == "I")) {
                 consume_token();
                 attr.case_insensitive = true;
@@ -673,26 +988,28 @@ PseudoSelector CSSParser::parse_pseudo_selector() {
         pseudo.name = ":";
     }
     
-    Token name_token = consume_token();
-    if (name_token.type == TokenType::Ident) {
-        pseudo.name += name_token.value;
-    } else if (name_token.type == TokenType::Function) {
-        pseudo.name += name_token.value;
+    TokenType name_type = peek_token().type;
+    if (name_type == TokenType::Ident) {
+        pseudo.name += consume_token().value;
+    } else if (name_type == TokenType::Function) {
+        pseudo.name += consume_token().value;
         pseudo.is_function = true;
+        if (parse_selector_argument(pseudo)) return pseudo;
         
         // Parse function argument
         std::ostringstream arg;
         int paren_depth = 1;
         
-        while (!tokenizer_.at_end() && paren_depth > 0) {
+        while (!at_end() && paren_depth > 0) {
             Token token = consume_token();
-            if (token.type == TokenType::LeftParen) {
+            if (token.type == TokenType::LeftParen || token.type == TokenType::Function) {
                 paren_depth++;
             } else if (token.type == TokenType::RightParen) {
                 paren_depth--;
                 if (paren_depth == 0) break;
             }
             arg << token.value;
+            if (token.type == TokenType::Function) arg << "(";
         }
         
         pseudo.argument = arg.str();
@@ -703,8 +1020,58 @@ PseudoSelector CSSParser::parse_pseudo_selector() {
     return pseudo;
 }
 
+// :is(), :where(), :not() and :has() hold a selector list. An argument that
+// does not parse as one is kept as text only, and the pseudo never matches.
+// :has() selectors are relative: each gets a :scope anchor for its subject,
+// joined by the combinator it opens with or a descendant one
+bool CSSParser::parse_selector_argument(PseudoSelector& pseudo) {
+    const std::string& name = pseudo.name;
+    bool relative = name == ":has";
+    if (!relative && name != ":is" && name != ":where" && name != ":not" && name != ":matches") {
+        return false;
+    }
+    
+    size_t start = checkpoint();
+    size_t error_count = errors_.size();
+    // & keeps standing for the enclosing rule; resolve_nesting replaces it
+    argument_depth_++;
+    scope_depth_ += relative;
+    skip_whitespace();
+    size_t argument_start = peek_token().start_pos;
+    SelectorList list = parse_selector_list();
+    scope_depth_ -= relative;
+    argument_depth_--;
+    skip_whitespace();
+    
+    if (list.empty() || peek_token().type != TokenType::RightParen || errors_.size() != error_count) {
+        errors_.erase(errors_.begin() + error_count, errors_.end());
+        rewind(start);
+        return false;
+    }
+    pseudo.argument = std::string(tokenizer_.source(argument_start, peek_token().start_pos));
+    consume_token(); // )
+    
+    if (relative) {
+        for (ComplexSelector& complex : list.selectors) {
+            const auto& first = complex.components.front().selector.selectors;
+            if (complex.components.size() > 1 && first.size() == 1 &&
+                first.front().type == SelectorType::Pseudo && first.front().pseudo.name == ":scope") {
+                continue; // opened with a combinator
+            }
+            SimpleSelector scope(SelectorType::Pseudo);
+            scope.pseudo.name = ":scope";
+            CompoundSelector anchor;
+            anchor.add_selector(scope);
+            complex.components.front().combinator = SelectorCombinator::Descendant;
+            complex.components.insert(complex.components.begin(), ComplexSelector::Component{anchor});
+        }
+    }
+    pseudo.selectors = std::make_shared<const SelectorList>(std::move(list));
+    return true;
+}
+
 SelectorCombinator CSSParser::parse_combinator() {
-    Token token = peek_token();
+    const Token& token = peek_token();
     
     if (token.type == TokenType::Delim) {
         if (token.value == ">") {
@@ -723,19 +1090,52 @@ SelectorCombinator CSSParser::parse_combinator() {
 }
 
 CSSValue CSSParser::parse_value() {
+    BrowserParser::AtomScope atoms(&arena_->atoms());
+    std::vector<CSSValue> groups;
+    bool comma_separated = parse_comma_groups(groups);
+    
+    if (!comma_separated) {
+        return groups.front();
+    }
+    return CSSValue::make_list(groups, *arena_, true);
+}
+
+// Splits a value at top-level commas: each group is a single component or
+// a space-separated list. Returns whether any comma was seen.
+bool CSSParser::parse_comma_groups(std::vector<CSSValue>& groups) {
     std::vector<CSSValue> values;
+    bool comma_separated = false;
     
-    while (!tokenizer_.at_end()) {
-        Token token = peek_token();
+    auto close_group = [&]() {
+        if (values.empty()) {
+            groups.push_back(CSSValue("")); // Empty value
+        } else if (values.size() == 1) {
+            groups.push_back(values.front());
+        } else {
+            groups.push_back(CSSValue::make_list(values, *arena_));
+        }
+        values.clear();
+    };
+    
+    while (!at_end()) {
+        const Token& token = peek_token();
         
         if (token.type == TokenType::Semicolon || token.type == TokenType::RightBrace ||
-            token.type == TokenType::RightParen || token.type == TokenType::Comma ||
+            token.type == TokenType::RightParen || token.type == TokenType::LeftBrace ||
             (token.type == TokenType::Delim && token.value == "!")) {
             break;
         }
         
+        if (token.type == TokenType::Comma) {
+            consume_token();
+            close_group();
+            comma_separated = true;
+            skip_whitespace();
+            continue;
+        }
+        
         auto component = parse_component_value();
-        if (component.type != ValueType::Keyword || !component.string_value.empty()) {
+        if (!component.empty()) {
             values.push_back(component);
         } else {
             break;
@@ -744,15 +1144,8 @@ CSSValue CSSParser::parse_value() {
         skip_whitespace();
     }
     
-    if (values.empty()) {
-        return CSSValue(""); // Empty value
-    } else if (values.size() == 1) {
-        return values[0];
-    } else {
-        CSSValue list_value(ValueType::List);
-        list_value.list_values = values;
-        return list_value;
-    }
+    close_group();
+    return comma_separated;
 }
 
 CSSValue CSSParser::parse_component_value() {
@@ -764,33 +1157,36 @@ CSSValue CSSParser::parse_component_value() {
             return CSSValue(token.value);
             
         case TokenType::Number:
-            consume_token();
-            return CSSValue(token.numeric_value);
-            
         case TokenType::Percentage:
             consume_token();
-            return CSSValue(token.numeric_value, "%");
+            return CSSValue::make_number(token.numeric_value,
+                                         token.type == TokenType::Number ? CSSUnit::None : CSSUnit::Percent,
+                                         token.is_integer);
             
         case TokenType::Dimension:
             consume_token();
-            return CSSValue(token.numeric_value, token.unit);
+            return CSSValue::make_dimension(token.numeric_value, token.unit, token.is_integer);
             
         case TokenType::String:
             consume_token();
-            return CSSValue(ValueType::String, token.value);
+            return CSSValue::make_text(ValueType::String, token.value, *arena_);
             
         case TokenType::Url:
             consume_token();
-            return CSSValue(ValueType::Url, token.value);
+            return CSSValue::make_text(ValueType::Url, token.value, *arena_);
             
         case TokenType::Hash:
-            return parse_color();
+            return CSSValue::make_color(parse_color(), *arena_);
             
         case TokenType::Function:
             return parse_function();
             
+        case TokenType::Delim:
+            consume_token();
+            return CSSValue(token.value); // '/' in font and grid shorthands
+            
         default:
-            consume_token(); // Skip unknown token
+            skip_component_value(); // Skip unknown tokens, with any block they open
             return CSSValue("");
     }
 }
@@ -799,14 +1195,19 @@ CSSColor CSSParser::parse_color() {
     Token token = consume_token();
     
     if (token.type == TokenType::Hash) {
-        return CSSColor::from_hex(token.value);
+        return CSSColor::from_hex(std::string(token.value));
     } else if (token.type == TokenType::Ident) {
-        return CSSColor::from_name(token.value);
+        return CSSColor::from_name(std::string(token.value));
     }
     
     return CSSColor(); // Default color (transparent)
 }
 
+bool CSSParser::is_math_function(const std::string& name) {
+    return name == "calc" || name == "min" || name == "max" || name == "clamp" ||
+           name == "-webkit-calc" || name == "-moz-calc";
+}
+
 CSSValue CSSParser::parse_function() {
     Token func_token = consume_token();
     
@@ -815,15 +1216,15 @@ CSSValue CSSParser::parse_function() {
         return CSSValue("");
     }
     
-    std::string func_name = func_token.value;
+    std::string func_name(func_token.value);
     
     // Handle specific function types
     if (func_name == "rgb" || func_name == "rgba" || 
         func_name == "hsl" || func_name == "hsla" ||
         func_name == "hwb" || func_name == "lab" || func_name == "lch") {
         return parse_color_function(func_name);
-    } else if (func_name == "calc") {
-        return parse_calc_expression();
+    } else if (is_math_function(func_name)) {
+        return parse_math_function(func_name);
     } else if (func_name == "var") {
         return parse_var_function();
     } else {
@@ -835,8 +1236,9 @@ CSSValue CSSParser::parse_color_function(const std::string& func_name) {
     std::vector<double> values;
     
     // Parse function arguments
-    while (!tokenizer_.at_end() && peek_token().type != TokenType::RightParen) {
+    while (!at_end() && peek_token().type != TokenType::RightParen) {
         skip_whitespace();
+        if (peek_token().type == TokenType::RightParen) break;
         
         Token token = consume_token();
         if (token.type == TokenType::Number) {
@@ -877,19 +1279,18 @@ CSSValue CSSParser::parse_color_function(const std::string& func_name) {
         }
     }
     
-    return CSSValue(color);
+    return CSSValue::make_color(color, *arena_);
 }
 
 CSSValue CSSParser::parse_var_function() {
-    CSSValue var_value(ValueType::Function);
-    var_value.string_value = "var";
+    std::vector<CSSValue> args;
     
     skip_whitespace();
     
     // Parse custom property name
     Token name_token = consume_token();
     if (name_token.type == TokenType::Ident) {
-        var_value.function_args["name"] = CSSValue(name_token.value);
+        args.push_back(CSSValue(name_token.value));
         
         skip_whitespace();
         
@@ -898,8 +1299,7 @@ CSSValue CSSParser::parse_var_function() {
             consume_token(); // consume comma
             skip_whitespace();
             
-            auto fallback = parse_value();
-            var_value.function_args["fallback"] = fallback;
+            args.push_back(parse_value());
         }
     }
     
@@ -907,25 +1307,25 @@ CSSValue CSSParser::parse_var_function() {
         consume_token(); // consume )
     }
     
-    return var_value;
+    return CSSValue::make_function("var", args, *arena_);
 }
 
 CSSValue CSSParser::parse_generic_function(const std::string& func_name) {
-    CSSValue func_value(ValueType::Function);
-    func_value.string_value = func_name;
-    
     std::vector<CSSValue> args;
     
-    while (!tokenizer_.at_end() && peek_token().type != TokenType::RightParen) {
-        skip_whitespace();
-        
-        auto arg = parse_component_value();
-        args.push_back(arg);
-        
-        skip_whitespace();
-        
-        if (peek_token().type == TokenType::Comma) {
-            consume_token();
+    skip_whitespace();
+    if (peek_token().type != TokenType::RightParen) {
+        parse_comma_groups(args);
+    }
+    
+    // Skip whatever the value grammar could not use, keeping nested parens balanced
+    int depth = 0;
+    while (!at_end() && !(depth == 0 && peek_token().type == TokenType::RightParen)) {
+        Token token = consume_token();
+        if (token.type == TokenType::LeftParen || token.type == TokenType::Function) {
+            depth++;
+        } else if (token.type == TokenType::RightParen) {
+            depth--;
         }
     }
     
@@ -933,42 +1333,107 @@ CSSValue CSSParser::parse_generic_function(const std::string& func_name) {
         consume_token(); // consume )
     }
     
-    // Store arguments as list
-    CSSValue args_list(ValueType::List);
-    args_list.list_values = args;
-    func_value.function_args["args"] = args_list;
-    
-    return func_value;
+    return CSSValue::make_function(func_name, args, *arena_);
 }
 
-CSSValue CSSParser::parse_calc_expression() {
-    CSSValue calc_value(ValueType::Function);
-    calc_value.string_value = "calc";
-    
-    std::ostringstream expr;
-    int paren_depth = 1;
+// The outermost math function is compiled once all of it has been read;
+// one that cannot be (var() inside, or a type error) stays a plain Function
+CSSValue CSSParser::parse_math_function(const std::string& func_name) {
+    CSSValue function = parse_math_arguments(func_name);
+    CSSValue compiled;
+    return compile_math(function, *arena_, compiled) ? compiled : function;
+}
+
+// Arguments of a math function as comma groups of operands and operator
+// keywords. Nested math functions and parenthesized blocks, which act as
+// calc(), become Function values for compile_math to walk.
+CSSValue CSSParser::parse_math_arguments(const std::string& func_name) {
+    std::vector<CSSValue> groups;
+    std::vector<CSSValue> terms;
+    
+    auto close_group = [&]() {
+        if (terms.size() == 1) {
+            groups.push_back(terms.front());
+        } else {
+            groups.push_back(CSSValue::make_list(terms, *arena_));
+        }
+        terms.clear();
+    };
     
-    while (!tokenizer_.at_end() && paren_depth > 0) {
-        Token token = consume_token();
-        if (token.type == TokenType::LeftParen) {
-            paren_depth++;
-        } else if (token.type == TokenType::RightParen) {
-            paren_depth--;
-            if (paren_depth == 0) break;
+    while (!at_end()) {
+        const Token& token = peek_token();
+        if (token.type == TokenType::RightParen) {
+            consume_token();
+            break;
+        }
+        if (token.type == TokenType::Semicolon || token.type == TokenType::RightBrace) {
+            break; // unterminated; leave the declaration end to the caller
+        }
+        
+        if (token.type == TokenType::Whitespace) {
+            consume_token();
+        } else if (token.type == TokenType::Comma) {
+            consume_token();
+            close_group();
+        } else if (token.type == TokenType::LeftParen) {
+            consume_token();
+            terms.push_back(parse_math_arguments("calc"));
+        } else if (token.type == TokenType::Function && is_math_function(std::string(token.value))) {
+            std::string name(consume_token().value);
+            terms.push_back(parse_math_arguments(name));
+        } else {
+            terms.push_back(parse_component_value());
         }
-        expr << token.value << " ";
     }
     
-    calc_value.function_args["expression"] = CSSValue(expr.str());
-    return calc_value;
+    if (!terms.empty() || !groups.empty()) close_group();
+    return CSSValue::make_function(func_name, groups, *arena_);
 }
 
 Token CSSParser::consume_token() {
-    return tokenizer_.next_token();
+    if (!use_token_array_) return tokenizer_.next_token();
+    
+    Token token = tokens_.token(cursor_);
+    if (cursor_ + 1 < tokens_.size()) cursor_++; // EOF stays current
+    return token;
 }
 
-Token CSSParser::peek_token(size_t offset) {
-    return tokenizer_.peek_token(offset);
+const Token& CSSParser::peek_token(size_t offset) {
+    if (!use_token_array_) return tokenizer_.peek_token(offset);
+    
+    // Same contract as the tokenizer's ring: offset < lookahead_capacity,
+    // and the reference stays valid until the next peek or consume
+    size_t index = std::min(cursor_ + offset, tokens_.size() - 1);
+    size_t slot = index % window_.size();
+    if (window_index_[slot] != index) {
+        window_[slot] = tokens_.token(index);
+        window_index_[slot] = index;
+    }
+    return window_[slot];
+}
+
+bool CSSParser::at_end() {
+    if (!use_token_array_) return tokenizer_.at_end();
+    return tokens_.type(cursor_) == TokenType::EOF_TOKEN;
+}
+
+// Byte offset used for rule bounds and progress checks
+size_t CSSParser::position() const {
+    if (!use_token_array_) return tokenizer_.position();
+    return tokens_.start(cursor_);
+}
+
+// Backtracking, for lookahead that outgrows the peek window
+size_t CSSParser::checkpoint() {
+    return use_token_array_ ? cursor_ : peek_token().start_pos;
+}
+
+void CSSParser::rewind(size_t checkpoint) {
+    if (use_token_array_) {
+        cursor_ = checkpoint;
+    } else {
+        tokenizer_.reset(checkpoint);
+    }
 }
 
 bool CSSParser::consume_if_match(TokenType type) {
@@ -994,29 +1459,31 @@ void CSSParser::skip_whitespace() {
 }
 
 void CSSParser::add_error(const std::string& message) {
-    errors_.emplace_back(message, tokenizer_.position());
+    // Report at the token the parser is looking at, not past the lookahead
+    size_t position = peek_token().start_pos;
+    auto where = tokenizer_.location(position);
+    errors_.emplace_back(message, position, where.line, where.column);
 }
 
 bool CSSParser::is_valid_property(const std::string& property) {
-    // Check for custom properties
-    if (property.substr(0, 2) == "--") {
-        return true;
-    }
-    
-    // Check for vendor prefixes
-    for (const auto& prefix : vendor_prefixes) {
-        if (property.substr(0, prefix.length()) == prefix) {
-            std::string unprefixed = property.substr(prefix.length());
-            return valid_properties.count(unprefixed) > 0 || valid_properties.count(property) > 0;
-        }
-    }
-    
-    return valid_properties.count(property) > 0;
+    // Custom properties, vendor prefixes and legacy aliases are resolved by the lookup
+    return property_id(property) != PropertyId::Unknown;
 }
 
 bool CSSParser::is_valid_value_for_property(const std::string& property, const CSSValue& value) {
-    // This is a simplified validation - a complete implementation would be much more complex
-    return true;
+    // Typing may rebuild the value, so this works on copies backed by a scratch arena
+    PropertyId id = property_id(property);
+    CSSValueArena scratch;
+    if (property_info(id).is_shorthand()) {
+        std::vector<CSSDeclaration> longhands;
+        if (!expand_shorthand(CSSDeclaration(property, value), scratch, longhands)) return false;
+        for (CSSDeclaration& longhand : longhands) {
+            if (!validate_value(longhand.id, longhand.value, scratch)) return false;
+        }
+        return true;
+    }
+    CSSValue copy = value;
+    return validate_value(id, copy, scratch);
 }
 
 std::vector<std::string> CSSParser::get_vendor_prefixes() {
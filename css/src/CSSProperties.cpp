@@ -0,0 +1,286 @@
+#include "CSSProperties.h"
+
+namespace CSS3Parser {
+
+namespace {
+
+using P = PropertyId;
+
+// Longhands in the order the shorthand grammar assigns them
+constexpr P margin_longhands[] = {P::MarginTop, P::MarginRight, P::MarginBottom, P::MarginLeft};
+constexpr P padding_longhands[] = {P::PaddingTop, P::PaddingRight, P::PaddingBottom, P::PaddingLeft};
+constexpr P border_width_longhands[] = {P::BorderTopWidth, P::BorderRightWidth, P::BorderBottomWidth,
+                                        P::BorderLeftWidth};
+constexpr P border_style_longhands[] = {P::BorderTopStyle, P::BorderRightStyle, P::BorderBottomStyle,
+                                        P::BorderLeftStyle};
+constexpr P border_color_longhands[] = {P::BorderTopColor, P::BorderRightColor, P::BorderBottomColor,
+                                        P::BorderLeftColor};
+constexpr P border_longhands[] = {
+    P::BorderTopWidth, P::BorderRightWidth, P::BorderBottomWidth, P::BorderLeftWidth,
+    P::BorderTopStyle, P::BorderRightStyle, P::BorderBottomStyle, P::BorderLeftStyle,
+    P::BorderTopColor, P::BorderRightColor, P::BorderBottomColor, P::BorderLeftColor};
+constexpr P border_top_longhands[] = {P::BorderTopWidth, P::BorderTopStyle, P::BorderTopColor};
+constexpr P border_right_longhands[] = {P::BorderRightWidth, P::BorderRightStyle, P::BorderRightColor};
+constexpr P border_bottom_longhands[] = {P::BorderBottomWidth, P::BorderBottomStyle, P::BorderBottomColor};
+constexpr P border_left_longhands[] = {P::BorderLeftWidth, P::BorderLeftStyle, P::BorderLeftColor};
+constexpr P border_radius_longhands[] = {P::BorderTopLeftRadius, P::BorderTopRightRadius,
+                                         P::BorderBottomRightRadius, P::BorderBottomLeftRadius};
+constexpr P border_image_longhands[] = {P::BorderImageSource, P::BorderImageSlice, P::BorderImageWidth,
+                                        P::BorderImageOutset, P::BorderImageRepeat};
+constexpr P background_longhands[] = {
+    P::BackgroundImage, P::BackgroundPosition, P::BackgroundSize, P::BackgroundRepeat,
+    P::BackgroundAttachment, P::BackgroundOrigin, P::BackgroundClip, P::BackgroundColor};
+constexpr P font_longhands[] = {P::FontStyle, P::FontVariant, P::FontWeight, P::FontStretch,
+                                P::FontSize, P::LineHeight, P::FontFamily};
+constexpr P text_decoration_longhands[] = {P::TextDecorationLine, P::TextDecorationStyle,
+                                           P::TextDecorationColor};
+constexpr P flex_longhands[] = {P::FlexGrow, P::FlexShrink, P::FlexBasis};
+constexpr P flex_flow_longhands[] = {P::FlexDirection, P::FlexWrap};
+constexpr P grid_template_longhands[] = {P::GridTemplateRows, P::GridTemplateColumns, P::GridTemplateAreas};
+constexpr P grid_longhands[] = {P::GridTemplateRows, P::GridTemplateColumns, P::GridTemplateAreas,
+                                P::GridAutoRows, P::GridAutoColumns, P::GridAutoFlow};
+constexpr P grid_row_longhands[] = {P::GridRowStart, P::GridRowEnd};
+constexpr P grid_column_longhands[] = {P::GridColumnStart, P::GridColumnEnd};
+constexpr P grid_area_longhands[] = {P::GridRowStart, P::GridColumnStart, P::GridRowEnd, P::GridColumnEnd};
+constexpr P gap_longhands[] = {P::RowGap, P::ColumnGap};
+constexpr P transition_longhands[] = {P::TransitionProperty, P::TransitionDuration,
+                                      P::TransitionTimingFunction, P::TransitionDelay};
+constexpr P animation_longhands[] = {
+    P::AnimationName, P::AnimationDuration, P::AnimationTimingFunction, P::AnimationDelay,
+    P::AnimationIterationCount, P::AnimationDirection, P::AnimationFillMode, P::AnimationPlayState};
+constexpr P list_style_longhands[] = {P::ListStyleType, P::ListStylePosition, P::ListStyleImage};
+constexpr P outline_longhands[] = {P::OutlineColor, P::OutlineStyle, P::OutlineWidth};
+constexpr P columns_longhands[] = {P::ColumnWidth, P::ColumnCount};
+constexpr P column_rule_longhands[] = {P::ColumnRuleWidth, P::ColumnRuleStyle, P::ColumnRuleColor};
+constexpr P overflow_longhands[] = {P::OverflowX, P::OverflowY};
+constexpr P mask_longhands[] = {P::MaskImage, P::MaskMode, P::MaskPosition, P::MaskSize,
+                                P::MaskRepeat, P::MaskOrigin, P::MaskClip, P::MaskComposite};
+
+struct Longhands {
+    const P* data = nullptr;
+    size_t size = 0;
+};
+
+template <size_t N>
+constexpr Longhands list(const P (&longhands)[N]) { return {longhands, N}; }
+
+constexpr Longhands longhands_of(P id) {
+    switch (id) {
+        case P::Margin: return list(margin_longhands);
+        case P::Padding: return list(padding_longhands);
+        case P::Border: return list(border_longhands);
+        case P::BorderWidth: return list(border_width_longhands);
+        case P::BorderStyle: return list(border_style_longhands);
+        case P::BorderColor: return list(border_color_longhands);
+        case P::BorderTop: return list(border_top_longhands);
+        case P::BorderRight: return list(border_right_longhands);
+        case P::BorderBottom: return list(border_bottom_longhands);
+        case P::BorderLeft: return list(border_left_longhands);
+        case P::BorderRadius: return list(border_radius_longhands);
+        case P::BorderImage: return list(border_image_longhands);
+        case P::Background: return list(background_longhands);
+        case P::Font: return list(font_longhands);
+        case P::TextDecoration: return list(text_decoration_longhands);
+        case P::Flex: return list(flex_longhands);
+        case P::FlexFlow: return list(flex_flow_longhands);
+        case P::Grid: return list(grid_longhands);
+        case P::GridTemplate: return list(grid_template_longhands);
+        case P::GridRow: return list(grid_row_longhands);
+        case P::GridColumn: return list(grid_column_longhands);
+        case P::GridArea: return list(grid_area_longhands);
+        case P::Gap: return list(gap_longhands);
+        case P::Transition: return list(transition_longhands);
+        case P::Animation: return list(animation_longhands);
+        case P::ListStyle: return list(list_style_longhands);
+        case P::Outline: return list(outline_longhands);
+        case P::Columns: return list(columns_longhands);
+        case P::ColumnRule: return list(column_rule_longhands);
+        case P::Overflow: return list(overflow_longhands);
+        case P::Mask: return list(mask_longhands);
+        default: return {};
+    }
+}
+
+constexpr PropertyInfo make_info(P id, std::string_view name, bool inherited, std::string_view initial,
+                                 std::string_view syntax) {
+    Longhands longhands = longhands_of(id);
+    return PropertyInfo{name, inherited, initial, longhands.data, longhands.size, syntax};
+}
+
+// Indexed by PropertyId
+constexpr PropertyInfo property_table[] = {
+    PropertyInfo{"", false, "", nullptr, 0, ""},
+    PropertyInfo{"--*", true, "", nullptr, 0, ""}, // custom properties always inherit
+#define CSS_PROPERTY_INFO(id, name, inherited, initial, syntax) make_info(P::id, name, inherited, initial, syntax),
+    CSS_PROPERTY_LIST(CSS_PROPERTY_INFO)
+#undef CSS_PROPERTY_INFO
+};
+
+static_assert(sizeof(property_table) / sizeof(property_table[0]) == property_count,
+              "property_table must have one entry per PropertyId");
+
+// Names the standard keeps working for compatibility
+struct Alias {
+    std::string_view name;
+    P id;
+};
+
+constexpr Alias legacy_aliases[] = {
+    {"word-wrap", P::OverflowWrap},
+    {"grid-gap", P::Gap},
+    {"grid-row-gap", P::RowGap},
+    {"grid-column-gap", P::ColumnGap},
+};
+
+// Perfect hash over every property name and legacy alias, built at compile
+// time with hash-and-displace: keys are split into buckets by one hash, and
+// each bucket gets the first seed that sends all its keys to free slots.
+// A lookup is one pass over the name, two mixes and one comparison.
+
+constexpr size_t first_named = 2; // skip Unknown and Custom
+constexpr size_t alias_count = sizeof(legacy_aliases) / sizeof(legacy_aliases[0]);
+constexpr size_t key_count = property_count - first_named + alias_count;
+constexpr size_t bucket_count = 128;
+constexpr size_t slot_count = 512;
+constexpr size_t max_bucket_size = 16;
+
+static_assert(key_count < slot_count, "the slot table must have room for every key");
+
+constexpr char fold(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+// FNV-1a over ASCII-folded bytes; the name is only read once per lookup
+constexpr uint32_t hash_name(std::string_view name) {
+    uint32_t h = 2166136261u;
+    for (char c : name) {
+        h ^= static_cast<uint8_t>(fold(c));
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// murmur3 finalizer, so each seed scatters the same name hash differently
+constexpr uint32_t mix(uint32_t hash, uint32_t seed) {
+    uint32_t h = hash ^ (seed * 0x9E3779B9u);
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
+}
+
+constexpr std::string_view key_name(size_t key) {
+    return key < property_count - first_named ? property_table[key + first_named].name
+                                              : legacy_aliases[key - (property_count - first_named)].name;
+}
+
+constexpr P key_id(size_t key) {
+    return key < property_count - first_named ? static_cast<P>(key + first_named)
+                                              : legacy_aliases[key - (property_count - first_named)].id;
+}
+
+struct PerfectHash {
+    uint16_t seeds[bucket_count] = {};
+    uint16_t slots[slot_count] = {}; // key + 1; 0 is an empty slot
+    bool complete = true;
+};
+
+constexpr PerfectHash build_perfect_hash() {
+    PerfectHash table;
+    uint32_t hashes[key_count] = {};
+    size_t members[bucket_count][max_bucket_size] = {};
+    size_t sizes[bucket_count] = {};
+
+    for (size_t key = 0; key < key_count; ++key) {
+        hashes[key] = hash_name(key_name(key));
+        size_t bucket = mix(hashes[key], 0) & (bucket_count - 1);
+        if (sizes[bucket] == max_bucket_size) {
+            table.complete = false;
+            return table;
+        }
+        members[bucket][sizes[bucket]++] = key;
+    }
+
+    // Crowded buckets are placed first, while most slots are still free
+    for (size_t size = max_bucket_size; size > 0; --size) {
+        for (size_t bucket = 0; bucket < bucket_count; ++bucket) {
+            if (sizes[bucket] != size) continue;
+
+            bool placed = false;
+            for (uint32_t seed = 1; seed < 65536 && !placed; ++seed) {
+                size_t chosen[max_bucket_size] = {};
+                bool fits = true;
+                for (size_t i = 0; i < size && fits; ++i) {
+                    size_t slot = mix(hashes[members[bucket][i]], seed) & (slot_count - 1);
+                    fits = table.slots[slot] == 0;
+                    for (size_t j = 0; j < i && fits; ++j) {
+                        fits = chosen[j] != slot;
+                    }
+                    chosen[i] = slot;
+                }
+                if (!fits) continue;
+
+                for (size_t i = 0; i < size; ++i) {
+                    table.slots[chosen[i]] = static_cast<uint16_t>(members[bucket][i] + 1);
+                }
+                table.seeds[bucket] = static_cast<uint16_t>(seed);
+                placed = true;
+            }
+            if (!placed) table.complete = false;
+        }
+    }
+    return table;
+}
+
+constexpr PerfectHash perfect_hash = build_perfect_hash();
+
+static_assert(perfect_hash.complete, "no collision-free seed found; grow slot_count or bucket_count");
+
+bool equals_folded(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (fold(a[i]) != fold(b[i])) return false;
+    }
+    return true;
+}
+
+P lookup(std::string_view name) {
+    uint32_t hash = hash_name(name);
+    uint32_t bucket = mix(hash, 0) & (bucket_count - 1);
+    uint32_t slot = mix(hash, perfect_hash.seeds[bucket]) & (slot_count - 1);
+    uint16_t entry = perfect_hash.slots[slot];
+    if (entry == 0) return P::Unknown;
+    size_t key = entry - 1u;
+    return equals_folded(key_name(key), name) ? key_id(key) : P::Unknown;
+}
+
+constexpr std::string_view vendor_prefixes[] = {"-webkit-", "-moz-", "-ms-", "-o-"};
+
+} // namespace
+
+PropertyId property_id(std::string_view name) {
+    if (name.size() > 2 && name[0] == '-' && name[1] == '-') {
+        return P::Custom;
+    }
+
+    P id = lookup(name);
+    if (id != P::Unknown || name.empty() || name[0] != '-') {
+        return id;
+    }
+
+    for (std::string_view prefix : vendor_prefixes) {
+        if (name.size() > prefix.size() && equals_folded(name.substr(0, prefix.size()), prefix)) {
+            return lookup(name.substr(prefix.size()));
+        }
+    }
+    return P::Unknown;
+}
+
+const PropertyInfo& property_info(PropertyId id) {
+    size_t index = static_cast<size_t>(id);
+    return property_table[index < property_count ? index : 0];
+}
+
+} // namespace CSS3Parser
@@ -4,6 +4,10 @@
 
 namespace CSS3Parser {
 
+bool is_legacy_pseudo_element(std::string_view name) {
+    return name == ":before" || name == ":after" || name == ":first-line" || name == ":first-letter";
+}
+
 // SimpleSelector implementation
 std::string SimpleSelector::to_string() const {
     std::ostringstream ss;
@@ -13,6 +17,10 @@ std::string SimpleSelector::to_string() const {
             ss << "*";
             break;
             
+        case SelectorType::Nesting:
+            ss << "&";
+            break;
+            
         case SelectorType::Type:
             ss << name;
             break;
@@ -56,14 +64,14 @@ std::string SimpleSelector::to_string() const {
             break;
             
         case SelectorType::Pseudo:
-            ss << ":" << pseudo.name;
+            ss << pseudo.name; // names keep their colons
             if (pseudo.is_function) {
                 ss << "(" << pseudo.argument << ")";
             }
             break;
             
         case SelectorType::PseudoElement:
-            ss << "::" << pseudo.name;
+            ss << pseudo.name;
             if (pseudo.is_function) {
                 ss << "(" << pseudo.argument << ")";
             }
@@ -73,21 +81,45 @@ std::string SimpleSelector::to_string() const {
     return ss.str();
 }
 
-int SimpleSelector::specificity() const {
+// :where() counts nothing; :is(), :not() and :has() count as the most
+// specific selector in their argument. A :has() argument starts with the
+// :scope anchor the parser added, which is not part of what was written
+Specificity SimpleSelector::specificity() const {
     switch (type) {
         case SelectorType::Universal:
-            return 0;
+        case SelectorType::Nesting:
+            return Specificity();
         case SelectorType::Type:
         case SelectorType::PseudoElement:
-            return 1;
+            return Specificity(0, 0, 1);
+        case SelectorType::Pseudo:
+            if (is_legacy_pseudo_element(pseudo.name)) return Specificity(0, 0, 1);
+            if (!pseudo.selectors) return Specificity(0, 1, 0);
+            if (pseudo.name == ":where") return Specificity();
+            if (pseudo.name == ":has") {
+                Specificity max_spec;
+                for (const auto& selector : pseudo.selectors->selectors) {
+                    Specificity total;
+                    for (size_t i = 1; i < selector.components.size(); ++i) {
+                        total += selector.components[i].selector.specificity();
+                    }
+                    max_spec = std::max(max_spec, total);
+                }
+                return max_spec;
+            }
+            return pseudo.selectors->max_specificity();
         case SelectorType::Class:
         case SelectorType::Attribute:
-        case SelectorType::Pseudo:
-            return 10;
+            return Specificity(0, 1, 0);
         case SelectorType::Id:
-            return 100;
+            return Specificity(1, 0, 0);
     }
-    return 0;
+    return Specificity();
+}
+
+std::string Specificity::to_string() const {
+    return "(" + std::to_string(ids()) + "," + std::to_string(classes()) + "," +
+           std::to_string(types()) + ")";
 }
 
 // CompoundSelector implementation
@@ -99,8 +131,8 @@ std::string CompoundSelector::to_string() const {
     return ss.str();
 }
 
-int CompoundSelector::specificity() const {
-    int total = 0;
+Specificity CompoundSelector::specificity() const {
+    Specificity total;
     for (const auto& selector : selectors) {
         total += selector.specificity();
     }
@@ -124,7 +156,8 @@ std::string ComplexSelector::to_string() const {
         ss << component.selector.to_string();
         
         if (i < components.size() - 1) {
-            switch (component.combinator) {
+            // A component records the combinator that links it to the previous one
+            switch (components[i + 1].combinator) {
                 case SelectorCombinator::None:
                 case SelectorCombinator::Descendant:
                     ss << " ";
@@ -145,8 +178,9 @@ std::string ComplexSelector::to_string() const {
     return ss.str();
 }
 
-int ComplexSelector::specificity() const {
-    int total = 0;
+Specificity ComplexSelector::specificity() const {
+    if (nested_specificity) return *nested_specificity;
+    Specificity total;
     for (const auto& component : components) {
         total += component.selector.specificity();
     }
@@ -163,8 +197,8 @@ std::string SelectorList::to_string() const {
     return ss.str();
 }
 
-int SelectorList::max_specificity() const {
-    int max_spec = 0;
+Specificity SelectorList::max_specificity() const {
+    Specificity max_spec;
     for (const auto& selector : selectors) {
         max_spec = std::max(max_spec, selector.specificity());
     }
@@ -197,6 +231,7 @@ std::string StyleRule::to_string() const {
 std::unique_ptr<CSSRule> StyleRule::clone() const {
     auto cloned = std::make_unique<StyleRule>();
     cloned->selectors = selectors;
+    cloned->compiled_selectors = compiled_selectors;
     cloned->declarations = declarations;
     cloned->start_pos = start_pos;
     cloned->end_pos = end_pos;
@@ -206,7 +241,7 @@ std::unique_ptr<CSSRule> StyleRule::clone() const {
 // AtRule implementation
 bool AtRule::is_conditional() const {
     return name == "media" || name == "supports" || name == "document" || 
-           name == "container" || name == "layer";
+           name == "container" || name == "layer" || name == "scope";
 }
 
 bool AtRule::is_descriptor() const {
@@ -250,6 +285,9 @@ std::unique_ptr<CSSRule> AtRule::clone() const {
     auto cloned = std::make_unique<AtRule>(name);
     cloned->prelude = prelude;
     cloned->declarations = declarations;
+    cloned->media = media;
+    cloned->scope = scope;
+    cloned->supported = supported;
     cloned->start_pos = start_pos;
     cloned->end_pos = end_pos;
     
@@ -305,6 +343,131 @@ void CSSStyleSheet::delete_rule(size_t index) {
     }
 }
 
+namespace {
+
+// "a.b , c" -> {"a.b", "c"}; the parser keeps preludes as spaced tokens
+std::vector<std::string> layer_names(const std::string& prelude) {
+    std::vector<std::string> names(1);
+    for (char c : prelude) {
+        if (c == ',') {
+            names.emplace_back();
+        } else if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+            names.back() += c;
+        }
+    }
+    if (names.back().empty()) names.pop_back();
+    return names;
+}
+
+void assign_rule_keys(const std::vector<std::unique_ptr<CSSRule>>& rules, CascadeOrigin origin,
+                      const CascadeLayers& layers, uint32_t layer, uint32_t& order) {
+    uint32_t rank = layers.rank(layer);
+    for (const auto& rule : rules) {
+        if (rule->type == RuleType::Style) {
+            for (auto& decl : static_cast<StyleRule*>(rule.get())->declarations) {
+                decl.cascade_key = CascadeKey::make(origin, decl.important, rank, order++);
+            }
+        } else if (rule->type == RuleType::AtRule) {
+            const auto* at_rule = static_cast<AtRule*>(rule.get());
+            uint32_t inner = at_rule->name == "layer" ? layers.find(layer, *at_rule) : layer;
+            assign_rule_keys(at_rule->rules, origin, layers, inner, order);
+        }
+    }
+}
+
+} // namespace
+
+void CascadeLayers::add(const std::vector<std::unique_ptr<CSSRule>>& rules) {
+    add(rules, unlayered);
+    assign_ranks();
+}
+
+void CascadeLayers::add(const std::vector<std::unique_ptr<CSSRule>>& rules, uint32_t parent) {
+    for (const auto& rule : rules) {
+        if (rule->type != RuleType::AtRule) continue;
+        const auto* at_rule = static_cast<const AtRule*>(rule.get());
+        if (at_rule->name != "layer") {
+            add(at_rule->rules, parent);
+            continue;
+        }
+        
+        std::vector<std::string> names = layer_names(at_rule->prelude);
+        if (names.empty()) {
+            // Every anonymous block is a layer of its own
+            auto [it, inserted] = anonymous_.emplace(at_rule, 0);
+            if (inserted) {
+                it->second = static_cast<uint32_t>(layers_.size());
+                layers_.emplace_back();
+                layers_[parent].children.push_back(it->second);
+            }
+            add(at_rule->rules, it->second);
+            continue;
+        }
+        // A statement declares each name; a block opens its only one
+        for (const std::string& name : names) declare(parent, name);
+        add(at_rule->rules, find(parent, *at_rule));
+    }
+}
+
+uint32_t CascadeLayers::declare(uint32_t parent, const std::string& name) {
+    uint32_t layer = parent;
+    size_t start = 0;
+    while (start <= name.size()) {
+        size_t dot = std::min(name.find('.', start), name.size());
+        auto key = std::make_pair(layer, name.substr(start, dot - start));
+        auto [it, inserted] = names_.emplace(key, 0);
+        if (inserted) {
+            it->second = static_cast<uint32_t>(layers_.size());
+            layers_.emplace_back();
+            layers_[layer].children.push_back(it->second);
+        }
+        layer = it->second;
+        start = dot + 1;
+    }
+    return layer;
+}
+
+uint32_t CascadeLayers::find(uint32_t parent, const AtRule& block) const {
+    std::vector<std::string> names = layer_names(block.prelude);
+    if (names.empty()) {
+        auto it = anonymous_.find(&block);
+        return it != anonymous_.end() ? it->second : parent;
+    }
+    uint32_t layer = parent;
+    const std::string& name = names.front();
+    size_t start = 0;
+    while (start <= name.size()) {
+        size_t dot = std::min(name.find('.', start), name.size());
+        auto it = names_.find(std::make_pair(layer, name.substr(start, dot - start)));
+        if (it == names_.end()) return parent;
+        layer = it->second;
+        start = dot + 1;
+    }
+    return layer;
+}
+
+void CascadeLayers::assign_ranks() {
+    // Post-order: sublayers first, then the layer's own rules
+    uint32_t next = 0;
+    std::function<void(uint32_t)> visit = [&](uint32_t layer) {
+        for (uint32_t child : layers_[layer].children) visit(child);
+        if (layer != unlayered) layers_[layer].rank = std::min(next++, CascadeKey::unlayered - 1);
+    };
+    visit(unlayered);
+}
+
+// Numbers declarations in document order, nested rules included, and packs
+// origin, importance and layer around the number
+void CSSStyleSheet::assign_cascade_keys(const CascadeLayers* layers) {
+    CascadeLayers own;
+    if (!layers) {
+        own.add(rules);
+        layers = &own;
+    }
+    cascade_order_count = 0;
+    assign_rule_keys(rules, origin, *layers, CascadeLayers::unlayered, cascade_order_count);
+}
+
 std::vector<StyleRule*> CSSStyleSheet::get_style_rules() const {
     std::vector<StyleRule*> style_rules;
     for (const auto& rule : rules) {
@@ -0,0 +1,899 @@
+#include "CSSParser.h"
+
+namespace CSS3Parser {
+
+namespace {
+
+using P = PropertyId;
+
+bool equals_ignoring_case(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        char x = a[i], y = b[i];
+        if (x >= 'A' && x <= 'Z') x = static_cast<char>(x + ('a' - 'A'));
+        if (y >= 'A' && y <= 'Z') y = static_cast<char>(y + ('a' - 'A'));
+        if (x != y) return false;
+    }
+    return true;
+}
+
+// text() resolves the atom under the table's lock, so it is read once per test
+bool is_one_of(const CSSValue& value, std::initializer_list<std::string_view> keywords) {
+    if (!value.is_keyword()) return false;
+    std::string_view text = value.text();
+    for (std::string_view keyword : keywords) {
+        if (equals_ignoring_case(text, keyword)) return true;
+    }
+    return false;
+}
+
+bool is_function_named(const CSSValue& value, std::initializer_list<std::string_view> names) {
+    if (!value.is_function()) return false;
+    std::string_view text = value.text();
+    for (std::string_view name : names) {
+        if (equals_ignoring_case(text, name)) return true;
+    }
+    return false;
+}
+
+const CSSValue& auto_keyword() {
+    static const CSSValue value = [] {
+        BrowserParser::AtomScope permanent(nullptr);
+        return CSSValue("auto");
+    }();
+    return value;
+}
+
+bool is_css_wide_keyword(const CSSValue& value) {
+    return is_one_of(value, {"inherit", "initial", "unset", "revert", "revert-layer"});
+}
+
+bool is_slash(const CSSValue& value) {
+    static const BrowserParser::Atom slash = BrowserParser::intern_permanent_atom("/");
+    return value.is_keyword() && value.atom() == slash;
+}
+
+bool is_length_percentage(const CSSValue& value) {
+    return value.is_length() || value.is_percentage() || value.is_math() ||
+           (value.is_number() && value.numeric_value() == 0.0);
+}
+
+bool is_custom_ident(const CSSValue& value) {
+    return value.is_keyword() && !value.empty() && !is_slash(value) && !is_css_wide_keyword(value);
+}
+
+constexpr size_t max_longhands = 12;
+
+// What one component of a shorthand accepts
+enum class Matcher : uint8_t {
+    LineWidth, LineStyle, OutlineStyle, Color, Image,
+    Position, BackgroundSize, RepeatStyle, Attachment, VisualBox, MaskMode, Composite,
+    Time, Easing, IterationCount, AnimationDirection, FillMode, PlayState, Ident,
+    ListStylePosition, ListStyleType, DecorationLine, DecorationStyle,
+    FlexDirection, FlexWrap, ColumnWidth, ColumnCount,
+    ImageSlice, ImageWidth, ImageOutset, ImageRepeat,
+    Margin, Padding, Radius, Overflow, Gap
+};
+
+bool matches(Matcher matcher, const CSSValue& value) {
+    if (is_slash(value)) return false;
+    switch (matcher) {
+        case Matcher::LineWidth:
+            return is_length_percentage(value) || is_one_of(value, {"thin", "medium", "thick"});
+        case Matcher::LineStyle:
+            return is_one_of(value, {"none", "hidden", "dotted", "dashed", "solid", "double",
+                                     "groove", "ridge", "inset", "outset"});
+        case Matcher::OutlineStyle:
+            return is_one_of(value, {"auto"}) || matches(Matcher::LineStyle, value);
+        case Matcher::Color:
+            // Named colors are plain keywords, so any keyword left over is taken as one
+            return value.is_color() || is_custom_ident(value) ||
+                   is_function_named(value, {"rgb", "rgba", "hsl", "hsla", "hwb", "lab", "lch",
+                                             "oklab", "oklch", "color", "color-mix", "light-dark"});
+        case Matcher::Image:
+            return value.type == ValueType::Url || is_one_of(value, {"none"}) ||
+                   is_function_named(value, {"linear-gradient", "radial-gradient", "conic-gradient",
+                                             "repeating-linear-gradient", "repeating-radial-gradient",
+                                             "repeating-conic-gradient", "image", "image-set",
+                                             "-webkit-image-set", "cross-fade", "element", "url"});
+        case Matcher::Position:
+            return is_length_percentage(value) || is_one_of(value, {"left", "right", "top", "bottom", "center"});
+        case Matcher::BackgroundSize:
+            return is_length_percentage(value) || is_one_of(value, {"auto", "cover", "contain"});
+        case Matcher::RepeatStyle:
+            return is_one_of(value, {"repeat-x", "repeat-y", "repeat", "space", "round", "no-repeat"});
+        case Matcher::Attachment:
+            return is_one_of(value, {"scroll", "fixed", "local"});
+        case Matcher::VisualBox:
+            return is_one_of(value, {"border-box", "padding-box", "content-box", "fill-box", "stroke-box",
+                                     "view-box", "text", "no-clip"});
+        case Matcher::MaskMode:
+            return is_one_of(value, {"alpha", "luminance", "match-source"});
+        case Matcher::Composite:
+            return is_one_of(value, {"add", "subtract", "intersect", "exclude"});
+        case Matcher::Time:
+            return value.type == ValueType::Time || value.is_math();
+        case Matcher::Easing:
+            return is_one_of(value, {"linear", "ease", "ease-in", "ease-out", "ease-in-out",
+                                     "step-start", "step-end"}) ||
+                   is_function_named(value, {"cubic-bezier", "steps", "linear"});
+        case Matcher::IterationCount:
+            return value.is_number() || is_one_of(value, {"infinite"});
+        case Matcher::AnimationDirection:
+            return is_one_of(value, {"normal", "reverse", "alternate", "alternate-reverse"});
+        case Matcher::FillMode:
+            return is_one_of(value, {"none", "forwards", "backwards", "both"});
+        case Matcher::PlayState:
+            return is_one_of(value, {"running", "paused"});
+        case Matcher::Ident:
+            return is_custom_ident(value) || value.type == ValueType::String;
+        case Matcher::ListStylePosition:
+            return is_one_of(value, {"inside", "outside"});
+        case Matcher::ListStyleType:
+            return is_custom_ident(value) || value.type == ValueType::String ||
+                   is_function_named(value, {"symbols"});
+        case Matcher::DecorationLine:
+            return is_one_of(value, {"none", "underline", "overline", "line-through", "blink"});
+        case Matcher::DecorationStyle:
+            return is_one_of(value, {"solid", "double", "dotted", "dashed", "wavy"});
+        case Matcher::FlexDirection:
+            return is_one_of(value, {"row", "row-reverse", "column", "column-reverse"});
+        case Matcher::FlexWrap:
+            return is_one_of(value, {"nowrap", "wrap", "wrap-reverse"});
+        case Matcher::ColumnWidth:
+            return (is_length_percentage(value) && !value.is_percentage()) || is_one_of(value, {"auto"});
+        case Matcher::ColumnCount:
+            return (value.is_number() && value.is_integer()) || is_one_of(value, {"auto"});
+        case Matcher::ImageSlice:
+            return value.is_number() || value.is_percentage() || is_one_of(value, {"fill"});
+        case Matcher::ImageWidth:
+            return is_length_percentage(value) || value.is_number() || is_one_of(value, {"auto"});
+        case Matcher::ImageOutset:
+            return value.is_length() || value.is_number() || value.is_math();
+        case Matcher::ImageRepeat:
+            return is_one_of(value, {"stretch", "repeat", "round", "space"});
+        case Matcher::Margin:
+            return is_length_percentage(value) || is_one_of(value, {"auto"});
+        case Matcher::Padding:
+        case Matcher::Radius:
+            return is_length_percentage(value);
+        case Matcher::Overflow:
+            return is_one_of(value, {"visible", "hidden", "clip", "scroll", "auto", "overlay"});
+        case Matcher::Gap:
+            return is_length_percentage(value) || is_one_of(value, {"normal"});
+    }
+    return false;
+}
+
+// How a shorthand's value maps onto its longhands
+enum class Form : uint8_t {
+    Box,          // 1-4 values: top, right, bottom, left
+    Radius,       // Box, optionally followed by '/' and vertical radii
+    Pair,         // 1-2 values; the second defaults to the first
+    AnyOrder,     // each item goes to the first open component that accepts it
+    Sides,        // AnyOrder, then every component is copied to all four sides
+    Layers,       // comma-separated AnyOrder layers; longhands become comma lists
+    GridLines,    // up to four lines separated by '/'
+    Font,
+    Flex,
+    GridTemplate,
+    Grid
+};
+
+// One part of an AnyOrder grammar. Components are tried in table order.
+struct Component {
+    P longhand;
+    Matcher matcher;
+    uint8_t max_items = 1;     // consecutive items the component may take
+    int8_t after_slash = -1;   // component that a '/' following this one introduces
+    bool needs_slash = false;  // only reachable through '/'
+    int8_t copy_of = -1;       // when omitted, copies this component if it was given
+    bool final_layer = false;  // only allowed in the last comma-separated layer
+};
+
+struct Grammar {
+    P shorthand;
+    Form form;
+    const Component* components;
+    size_t component_count;
+};
+
+constexpr Component margin_grammar[] = {{P::Margin, Matcher::Margin}};
+constexpr Component padding_grammar[] = {{P::Padding, Matcher::Padding}};
+constexpr Component border_width_grammar[] = {{P::BorderWidth, Matcher::LineWidth}};
+constexpr Component border_style_grammar[] = {{P::BorderStyle, Matcher::LineStyle}};
+constexpr Component border_color_grammar[] = {{P::BorderColor, Matcher::Color}};
+constexpr Component border_radius_grammar[] = {{P::BorderRadius, Matcher::Radius}};
+constexpr Component overflow_grammar[] = {{P::Overflow, Matcher::Overflow}};
+constexpr Component gap_grammar[] = {{P::Gap, Matcher::Gap}};
+
+// Sides: component i fills longhands [4i, 4i + 4)
+constexpr Component border_grammar[] = {
+    {P::BorderTopWidth, Matcher::LineWidth},
+    {P::BorderTopStyle, Matcher::LineStyle},
+    {P::BorderTopColor, Matcher::Color},
+};
+constexpr Component border_top_grammar[] = {
+    {P::BorderTopWidth, Matcher::LineWidth},
+    {P::BorderTopStyle, Matcher::LineStyle},
+    {P::BorderTopColor, Matcher::Color},
+};
+constexpr Component border_right_grammar[] = {
+    {P::BorderRightWidth, Matcher::LineWidth},
+    {P::BorderRightStyle, Matcher::LineStyle},
+    {P::BorderRightColor, Matcher::Color},
+};
+constexpr Component border_bottom_grammar[] = {
+    {P::BorderBottomWidth, Matcher::LineWidth},
+    {P::BorderBottomStyle, Matcher::LineStyle},
+    {P::BorderBottomColor, Matcher::Color},
+};
+constexpr Component border_left_grammar[] = {
+    {P::BorderLeftWidth, Matcher::LineWidth},
+    {P::BorderLeftStyle, Matcher::LineStyle},
+    {P::BorderLeftColor, Matcher::Color},
+};
+constexpr Component outline_grammar[] = {
+    {P::OutlineStyle, Matcher::OutlineStyle},
+    {P::OutlineWidth, Matcher::LineWidth},
+    {P::OutlineColor, Matcher::Color},
+};
+constexpr Component column_rule_grammar[] = {
+    {P::ColumnRuleWidth, Matcher::LineWidth},
+    {P::ColumnRuleStyle, Matcher::LineStyle},
+    {P::ColumnRuleColor, Matcher::Color},
+};
+constexpr Component border_image_grammar[] = {
+    {P::BorderImageSource, Matcher::Image},
+    {P::BorderImageSlice, Matcher::ImageSlice, 5, 2},
+    {P::BorderImageWidth, Matcher::ImageWidth, 4, 3, true},
+    {P::BorderImageOutset, Matcher::ImageOutset, 4, -1, true},
+    {P::BorderImageRepeat, Matcher::ImageRepeat, 2},
+};
+constexpr Component background_grammar[] = {
+    {P::BackgroundImage, Matcher::Image},
+    {P::BackgroundPosition, Matcher::Position, 4, 2},
+    {P::BackgroundSize, Matcher::BackgroundSize, 2, -1, true},
+    {P::BackgroundRepeat, Matcher::RepeatStyle, 2},
+    {P::BackgroundAttachment, Matcher::Attachment},
+    {P::BackgroundOrigin, Matcher::VisualBox},
+    {P::BackgroundClip, Matcher::VisualBox, 1, -1, false, 5},
+    {P::BackgroundColor, Matcher::Color, 1, -1, false, -1, true},
+};
+constexpr Component mask_grammar[] = {
+    {P::MaskImage, Matcher::Image},
+    {P::MaskPosition, Matcher::Position, 4, 2},
+    {P::MaskSize, Matcher::BackgroundSize, 2, -1, true},
+    {P::MaskRepeat, Matcher::RepeatStyle, 2},
+    {P::MaskOrigin, Matcher::VisualBox},
+    {P::MaskClip, Matcher::VisualBox, 1, -1, false, 4},
+    {P::MaskComposite, Matcher::Composite},
+    {P::MaskMode, Matcher::MaskMode},
+};
+constexpr Component transition_grammar[] = {
+    {P::TransitionTimingFunction, Matcher::Easing},
+    {P::TransitionDuration, Matcher::Time},
+    {P::TransitionDelay, Matcher::Time},
+    {P::TransitionProperty, Matcher::Ident},
+};
+// Keywords are claimed before the name, as the spec requires
+constexpr Component animation_grammar[] = {
+    {P::AnimationTimingFunction, Matcher::Easing},
+    {P::AnimationIterationCount, Matcher::IterationCount},
+    {P::AnimationDirection, Matcher::AnimationDirection},
+    {P::AnimationFillMode, Matcher::FillMode},
+    {P::AnimationPlayState, Matcher::PlayState},
+    {P::AnimationDuration, Matcher::Time},
+    {P::AnimationDelay, Matcher::Time},
+    {P::AnimationName, Matcher::Ident},
+};
+// "none" sets the type; the image is none by default anyway
+constexpr Component list_style_grammar[] = {
+    {P::ListStylePosition, Matcher::ListStylePosition},
+    {P::ListStyleType, Matcher::ListStyleType},
+    {P::ListStyleImage, Matcher::Image},
+};
+constexpr Component text_decoration_grammar[] = {
+    {P::TextDecorationLine, Matcher::DecorationLine, 4},
+    {P::TextDecorationStyle, Matcher::DecorationStyle},
+    {P::TextDecorationColor, Matcher::Color},
+};
+constexpr Component flex_flow_grammar[] = {
+    {P::FlexDirection, Matcher::FlexDirection},
+    {P::FlexWrap, Matcher::FlexWrap},
+};
+constexpr Component columns_grammar[] = {
+    {P::ColumnWidth, Matcher::ColumnWidth},
+    {P::ColumnCount, Matcher::ColumnCount},
+};
+
+template <size_t N>
+constexpr Grammar grammar(P shorthand, Form form, const Component (&components)[N]) {
+    return {shorthand, form, components, N};
+}
+
+constexpr Grammar no_components(P shorthand, Form form) {
+    return {shorthand, form, nullptr, 0};
+}
+
+constexpr Grammar grammars[] = {
+    grammar(P::Margin, Form::Box, margin_grammar),
+    grammar(P::Padding, Form::Box, padding_grammar),
+    grammar(P::BorderWidth, Form::Box, border_width_grammar),
+    grammar(P::BorderStyle, Form::Box, border_style_grammar),
+    grammar(P::BorderColor, Form::Box, border_color_grammar),
+    grammar(P::BorderRadius, Form::Radius, border_radius_grammar),
+    grammar(P::Border, Form::Sides, border_grammar),
+    grammar(P::BorderTop, Form::AnyOrder, border_top_grammar),
+    grammar(P::BorderRight, Form::AnyOrder, border_right_grammar),
+    grammar(P::BorderBottom, Form::AnyOrder, border_bottom_grammar),
+    grammar(P::BorderLeft, Form::AnyOrder, border_left_grammar),
+    grammar(P::BorderImage, Form::AnyOrder, border_image_grammar),
+    grammar(P::Outline, Form::AnyOrder, outline_grammar),
+    grammar(P::ColumnRule, Form::AnyOrder, column_rule_grammar),
+    grammar(P::Background, Form::Layers, background_grammar),
+    grammar(P::Mask, Form::Layers, mask_grammar),
+    grammar(P::Transition, Form::Layers, transition_grammar),
+    grammar(P::Animation, Form::Layers, animation_grammar),
+    grammar(P::ListStyle, Form::AnyOrder, list_style_grammar),
+    grammar(P::TextDecoration, Form::AnyOrder, text_decoration_grammar),
+    grammar(P::FlexFlow, Form::AnyOrder, flex_flow_grammar),
+    grammar(P::Columns, Form::AnyOrder, columns_grammar),
+    grammar(P::Overflow, Form::Pair, overflow_grammar),
+    grammar(P::Gap, Form::Pair, gap_grammar),
+    no_components(P::GridRow, Form::GridLines),
+    no_components(P::GridColumn, Form::GridLines),
+    no_components(P::GridArea, Form::GridLines),
+    no_components(P::Font, Form::Font),
+    no_components(P::Flex, Form::Flex),
+    no_components(P::GridTemplate, Form::GridTemplate),
+    no_components(P::Grid, Form::Grid),
+};
+
+const Grammar* find_grammar(P shorthand) {
+    for (const Grammar& grammar : grammars) {
+        if (grammar.shorthand == shorthand) return &grammar;
+    }
+    return nullptr;
+}
+
+// A view of the space-separated items of one value or layer
+struct Items {
+    const CSSValue* data = nullptr;
+    size_t size = 0;
+
+    const CSSValue& operator[](size_t index) const { return data[index]; }
+    Items slice(size_t from, size_t to) const { return {data + from, to - from}; }
+};
+
+Items items_of(const CSSValue& value) {
+    if (value.type == ValueType::List && !value.is_comma_separated()) {
+        return {value.begin(), value.size()};
+    }
+    if (value.empty()) return {};
+    return {&value, 1};
+}
+
+size_t find_slash(Items items, size_t from = 0) {
+    for (size_t i = from; i < items.size; ++i) {
+        if (is_slash(items[i])) return i;
+    }
+    return items.size;
+}
+
+CSSValue join(Items items, CSSValueArena& arena) {
+    if (items.size == 1) return items[0];
+    return CSSValue::make_list(std::vector<CSSValue>(items.data, items.data + items.size), arena);
+}
+
+// Output slots, parallel to property_info(shorthand).longhands; empty means initial
+struct Expansion {
+    const PropertyInfo& info;
+    CSSValue values[max_longhands];
+
+    explicit Expansion(const PropertyInfo& shorthand_info) : info(shorthand_info) {}
+
+    CSSValue& operator[](P longhand) {
+        for (size_t i = 0; i < info.longhand_count; ++i) {
+            if (info.longhands[i] == longhand) return values[i];
+        }
+        return values[0]; // grammar tables only name their own longhands
+    }
+};
+
+bool expand_box(Items items, Matcher matcher, CSSValue* out) {
+    if (items.size < 1 || items.size > 4) return false;
+    for (size_t i = 0; i < items.size; ++i) {
+        if (!matches(matcher, items[i])) return false;
+    }
+    size_t right = items.size > 1 ? 1 : 0;
+    size_t bottom = items.size > 2 ? 2 : 0;
+    size_t left = items.size > 3 ? 3 : right;
+    out[0] = items[0];
+    out[1] = items[right];
+    out[2] = items[bottom];
+    out[3] = items[left];
+    return true;
+}
+
+bool expand_radius(Items items, Matcher matcher, Expansion& out, CSSValueArena& arena) {
+    size_t slash = find_slash(items);
+    CSSValue horizontal[4], vertical[4];
+    if (!expand_box(items.slice(0, slash), matcher, horizontal)) return false;
+    if (slash == items.size) {
+        std::copy(horizontal, horizontal + 4, out.values);
+        return true;
+    }
+    if (!expand_box(items.slice(slash + 1, items.size), matcher, vertical)) return false;
+    for (size_t i = 0; i < 4; ++i) {
+        out.values[i] = CSSValue::make_list({horizontal[i], vertical[i]}, arena);
+    }
+    return true;
+}
+
+// Matches one AnyOrder layer; values are indexed by component
+bool match_any_order(const Grammar& grammar, Items items, bool final_layer, CSSValue* values,
+                     CSSValueArena& arena) {
+    constexpr size_t max_components = 8;
+    size_t begin[max_components] = {};
+    size_t count[max_components] = {};
+    int last = -1;
+
+    auto take = [&](size_t component, size_t& i) {
+        const Component& c = grammar.components[component];
+        begin[component] = i;
+        while (i < items.size && count[component] < c.max_items && matches(c.matcher, items[i])) {
+            ++count[component];
+            ++i;
+        }
+        last = static_cast<int>(component);
+        return count[component] > 0;
+    };
+
+    for (size_t i = 0; i < items.size;) {
+        if (is_slash(items[i])) {
+            if (last < 0 || grammar.components[last].after_slash < 0) return false;
+            size_t next = static_cast<size_t>(grammar.components[last].after_slash);
+            ++i;
+            if (count[next] > 0 || !take(next, i)) return false;
+            continue;
+        }
+
+        bool taken = false;
+        for (size_t c = 0; c < grammar.component_count && !taken; ++c) {
+            const Component& component = grammar.components[c];
+            if (count[c] > 0 || component.needs_slash || (component.final_layer && !final_layer) ||
+                !matches(component.matcher, items[i])) {
+                continue;
+            }
+            taken = take(c, i);
+        }
+        if (!taken) return false;
+    }
+
+    for (size_t c = 0; c < grammar.component_count; ++c) {
+        int source = grammar.components[c].copy_of;
+        if (count[c] > 0) {
+            values[c] = join(items.slice(begin[c], begin[c] + count[c]), arena);
+        } else if (source >= 0 && count[source] > 0) {
+            values[c] = join(items.slice(begin[source], begin[source] + count[source]), arena);
+        }
+    }
+    return true;
+}
+
+bool expand_any_order(const Grammar& grammar, Items items, Expansion& out, CSSValueArena& arena) {
+    CSSValue values[8];
+    if (items.size == 0 || !match_any_order(grammar, items, true, values, arena)) return false;
+    for (size_t c = 0; c < grammar.component_count; ++c) {
+        out[grammar.components[c].longhand] = values[c];
+    }
+    return true;
+}
+
+bool expand_sides(const Grammar& grammar, Items items, Expansion& out, CSSValueArena& arena) {
+    CSSValue values[8];
+    if (items.size == 0 || !match_any_order(grammar, items, true, values, arena)) return false;
+    for (size_t c = 0; c < grammar.component_count; ++c) {
+        for (size_t side = 0; side < 4; ++side) {
+            out.values[c * 4 + side] = values[c];
+        }
+    }
+    return true;
+}
+
+bool expand_layers(const Grammar& grammar, const CSSValue& value, Expansion& out, CSSValueArena& arena) {
+    std::vector<CSSValue> layers;
+    if (value.type == ValueType::List && value.is_comma_separated()) {
+        layers.assign(value.begin(), value.end());
+    } else {
+        layers.push_back(value);
+    }
+
+    // per_layer[c][layer]; an omitted component is initial in that layer
+    std::vector<std::vector<CSSValue>> per_layer(grammar.component_count, std::vector<CSSValue>(layers.size()));
+    for (size_t layer = 0; layer < layers.size(); ++layer) {
+        CSSValue values[8];
+        Items items = items_of(layers[layer]);
+        if (items.size == 0 || !match_any_order(grammar, items, layer + 1 == layers.size(), values, arena)) {
+            return false;
+        }
+        for (size_t c = 0; c < grammar.component_count; ++c) {
+            per_layer[c][layer] = values[c].empty() ? initial_value(grammar.components[c].longhand) : values[c];
+        }
+    }
+
+    for (size_t c = 0; c < grammar.component_count; ++c) {
+        const Component& component = grammar.components[c];
+        if (component.final_layer || layers.size() == 1) {
+            out[component.longhand] = per_layer[c].back();
+        } else {
+            out[component.longhand] = CSSValue::make_list(per_layer[c], arena, true);
+        }
+    }
+    return true;
+}
+
+bool is_grid_line(Items part) {
+    if (part.size == 0 || part.size > 3) return false;
+    for (size_t i = 0; i < part.size; ++i) {
+        const CSSValue& item = part[i];
+        if (!(item.is_number() && item.is_integer()) && !is_custom_ident(item)) return false;
+    }
+    return true;
+}
+
+// grid-row, grid-column and grid-area; an omitted line copies its
+// counterpart when that is a bare name, and is auto otherwise
+bool expand_grid_lines(Items items, Expansion& out, CSSValueArena& arena) {
+    const size_t lines = out.info.longhand_count;
+    std::vector<CSSValue> given;
+    for (size_t from = 0; from <= items.size;) {
+        size_t slash = find_slash(items, from);
+        Items part = items.slice(from, slash);
+        if (!is_grid_line(part) || given.size() == lines) return false;
+        given.push_back(join(part, arena));
+        from = slash + 1;
+    }
+
+    const size_t half = lines / 2;
+    for (size_t i = 0; i < lines; ++i) {
+        if (i < given.size()) {
+            out.values[i] = given[i];
+            continue;
+        }
+        const CSSValue& counterpart = out.values[i >= half ? i - half : 0];
+        bool bare_name = is_custom_ident(counterpart) && !is_one_of(counterpart, {"auto", "span"});
+        out.values[i] = bare_name ? counterpart : auto_keyword();
+    }
+    return true;
+}
+
+// [style || variant || weight || stretch]? size [/ line-height]? family#
+bool expand_font(const CSSValue& value, Expansion& out, CSSValueArena& arena) {
+    std::vector<CSSValue> families;
+    Items items;
+    if (value.type == ValueType::List && value.is_comma_separated()) {
+        items = items_of(value[0]);
+        families.assign(value.begin() + 1, value.end());
+    } else {
+        items = items_of(value);
+    }
+
+    size_t i = 0;
+    for (; i < items.size && i < 4; ++i) {
+        const CSSValue& item = items[i];
+        if (is_one_of(item, {"normal"})) continue;
+        if (is_one_of(item, {"italic", "oblique"}) && out[P::FontStyle].empty()) {
+            out[P::FontStyle] = item;
+        } else if (is_one_of(item, {"small-caps"}) && out[P::FontVariant].empty()) {
+            out[P::FontVariant] = item;
+        } else if ((is_one_of(item, {"bold", "bolder", "lighter"}) ||
+                    (item.is_number() && item.numeric_value() >= 1 && item.numeric_value() <= 1000)) &&
+                   out[P::FontWeight].empty()) {
+            out[P::FontWeight] = item;
+        } else if (is_one_of(item, {"ultra-condensed", "extra-condensed", "condensed", "semi-condensed",
+                                    "semi-expanded", "expanded", "extra-expanded", "ultra-expanded"}) &&
+                   out[P::FontStretch].empty()) {
+            out[P::FontStretch] = item;
+        } else {
+            break;
+        }
+    }
+
+    if (i == items.size) return false;
+    const CSSValue& size = items[i++];
+    if (!is_length_percentage(size) &&
+        !is_one_of(size, {"xx-small", "x-small", "small", "medium", "large", "x-large", "xx-large",
+                          "xxx-large", "larger", "smaller"})) {
+        return false;
+    }
+    out[P::FontSize] = size;
+
+    if (i < items.size && is_slash(items[i])) {
+        if (++i == items.size) return false;
+        const CSSValue& line_height = items[i++];
+        if (!line_height.is_number() && !is_length_percentage(line_height) && !is_one_of(line_height, {"normal"})) {
+            return false;
+        }
+        out[P::LineHeight] = line_height;
+    }
+
+    // The first family may be several unquoted words
+    if (i == items.size) return false;
+    families.insert(families.begin(), join(items.slice(i, items.size), arena));
+    out[P::FontFamily] = families.size() == 1 ? families.front() : CSSValue::make_list(families, arena, true);
+    return true;
+}
+
+bool is_flex_basis(const CSSValue& value) {
+    return is_length_percentage(value) || is_one_of(value, {"auto", "content"});
+}
+
+bool expand_flex(Items items, Expansion& out) {
+    CSSValue zero_percent = CSSValue::make_number(0, CSSUnit::Percent, true);
+    CSSValue one = CSSValue::make_number(1, CSSUnit::None, true);
+
+    if (items.size == 1 && is_one_of(items[0], {"none", "auto"})) {
+        bool none = is_one_of(items[0], {"none"});
+        CSSValue factor = none ? CSSValue::make_number(0, CSSUnit::None, true) : one;
+        out[P::FlexGrow] = factor;
+        out[P::FlexShrink] = factor;
+        out[P::FlexBasis] = auto_keyword();
+        return true;
+    }
+
+    // <grow> <shrink>? || <basis>; a unitless 0 is read as a factor
+    if (items.size == 0 || items.size > 3) return false;
+    size_t i = 0;
+    CSSValue basis;
+    if (!items[0].is_number()) {
+        if (!is_flex_basis(items[0])) return false;
+        basis = items[i++];
+    }
+    std::vector<CSSValue> factors;
+    while (i < items.size && items[i].is_number() && factors.size() < 2) {
+        factors.push_back(items[i++]);
+    }
+    if (i < items.size && basis.empty() && is_flex_basis(items[i])) {
+        basis = items[i++];
+    }
+    if (i < items.size || (factors.empty() && items.size > 1)) return false;
+
+    out[P::FlexGrow] = factors.empty() ? one : factors[0];
+    out[P::FlexShrink] = factors.size() > 1 ? factors[1] : one;
+    out[P::FlexBasis] = basis.empty() ? zero_percent : basis;
+    return true;
+}
+
+// none | <rows> / <columns> | [<string> <track-size>?]+ [/ <columns>]?
+bool expand_grid_template(Items items, Expansion& out, CSSValueArena& arena) {
+    if (items.size == 1 && is_one_of(items[0], {"none"})) {
+        out[P::GridTemplateRows] = items[0];
+        out[P::GridTemplateColumns] = items[0];
+        out[P::GridTemplateAreas] = items[0];
+        return true;
+    }
+
+    size_t slash = find_slash(items);
+    if (find_slash(items, slash + 1) < items.size) return false;
+    Items rows = items.slice(0, slash);
+    Items columns = slash < items.size ? items.slice(slash + 1, items.size) : Items{};
+
+    bool has_areas = false;
+    for (size_t i = 0; i < rows.size; ++i) {
+        has_areas = has_areas || rows[i].type == ValueType::String;
+    }
+
+    if (!has_areas) {
+        if (rows.size == 0 || columns.size == 0) return false;
+        out[P::GridTemplateRows] = join(rows, arena);
+        out[P::GridTemplateColumns] = join(columns, arena);
+        return true;
+    }
+
+    // Each area string is a row; its size follows it or defaults to auto
+    if (rows[0].type != ValueType::String) return false;
+    std::vector<CSSValue> areas, sizes;
+    for (size_t i = 0; i < rows.size; ++i) {
+        if (rows[i].type == ValueType::String) {
+            areas.push_back(rows[i]);
+            sizes.push_back(auto_keyword());
+        } else if (rows[i - 1].type == ValueType::String) {
+            sizes.back() = rows[i];
+        } else {
+            return false;
+        }
+    }
+    out[P::GridTemplateAreas] = join({areas.data(), areas.size()}, arena);
+    out[P::GridTemplateRows] = join({sizes.data(), sizes.size()}, arena);
+    if (columns.size > 0) out[P::GridTemplateColumns] = join(columns, arena);
+    return true;
+}
+
+// <grid-template> | <rows> / auto-flow dense? <auto-columns>? | auto-flow dense? <auto-rows>? / <columns>
+bool expand_grid(Items items, Expansion& out, CSSValueArena& arena) {
+    size_t slash = find_slash(items);
+    size_t flow = items.size;
+    for (size_t i = 0; i < items.size; ++i) {
+        if (is_one_of(items[i], {"auto-flow"})) flow = i;
+    }
+    if (flow == items.size) return expand_grid_template(items, out, arena);
+    if (slash == items.size) return false;
+
+    bool flow_is_rows = flow < slash;
+    size_t from = flow + 1;
+    size_t to = flow_is_rows ? slash : items.size;
+    bool dense = from < to && is_one_of(items[from], {"dense"});
+    if (dense) ++from;
+    if (flow_is_rows && flow != 0) return false;
+    if (!flow_is_rows && flow != slash + 1) return false;
+
+    CSSValue direction(flow_is_rows ? "row" : "column");
+    out[P::GridAutoFlow] = dense ? CSSValue::make_list({direction, CSSValue("dense")}, arena) : direction;
+
+    Items auto_tracks = items.slice(from, to);
+    Items template_tracks = flow_is_rows ? items.slice(slash + 1, items.size) : items.slice(0, slash);
+    if (template_tracks.size == 0) return false;
+    if (flow_is_rows) {
+        if (auto_tracks.size > 0) out[P::GridAutoRows] = join(auto_tracks, arena);
+        out[P::GridTemplateColumns] = join(template_tracks, arena);
+    } else {
+        if (auto_tracks.size > 0) out[P::GridAutoColumns] = join(auto_tracks, arena);
+        out[P::GridTemplateRows] = join(template_tracks, arena);
+    }
+    return true;
+}
+
+CSSValue parse_initial_value(std::string_view text, CSSValueArena& arena) {
+    CSSTokenizer tokenizer{std::string(text)};
+    std::vector<CSSValue> parts;
+    for (Token token = tokenizer.next_token(); token.type != TokenType::EOF_TOKEN; token = tokenizer.next_token()) {
+        switch (token.type) {
+            case TokenType::Ident:
+                parts.push_back(CSSValue(token.value));
+                break;
+            case TokenType::Number:
+                parts.push_back(CSSValue::make_number(token.numeric_value, CSSUnit::None, token.is_integer));
+                break;
+            case TokenType::Percentage:
+                parts.push_back(CSSValue::make_number(token.numeric_value, CSSUnit::Percent, token.is_integer));
+                break;
+            case TokenType::Dimension:
+                parts.push_back(CSSValue::make_dimension(token.numeric_value, token.unit, token.is_integer));
+                break;
+            default:
+                break;
+        }
+    }
+    if (parts.empty()) return CSSValue("");
+    if (parts.size() == 1) return parts.front();
+    return CSSValue::make_list(parts, arena);
+}
+
+} // namespace
+
+const CSSValue& initial_value(PropertyId id) {
+    // Values point into an arena that lives as long as the process
+    static CSSValueArena* arena = new CSSValueArena();
+    static const std::vector<CSSValue> values = [] {
+        BrowserParser::AtomScope permanent(nullptr); // and so do their atoms
+        std::vector<CSSValue> table(property_count);
+        for (size_t i = 0; i < property_count; ++i) {
+            table[i] = parse_initial_value(property_info(static_cast<PropertyId>(i)).initial, *arena);
+        }
+        return table;
+    }();
+    size_t index = static_cast<size_t>(id);
+    return values[index < property_count ? index : 0];
+}
+
+bool contains_var(const CSSValue& value) {
+    if (value.is_function() && equals_ignoring_case(value.text(), "var")) return true;
+    if (value.type != ValueType::List && value.type != ValueType::Function) return false;
+    for (const CSSValue& item : value) {
+        if (contains_var(item)) return true;
+    }
+    return false;
+}
+
+bool expand_shorthand(const CSSDeclaration& declaration, CSSValueArena& arena,
+                      std::vector<CSSDeclaration>& longhands) {
+    const PropertyInfo& info = property_info(declaration.id);
+    const Grammar* grammar = find_grammar(declaration.id);
+    if (!info.is_shorthand() || !grammar || info.longhand_count > max_longhands) return false;
+
+    auto emit = [&](PropertyId longhand, const CSSValue& value, bool pending, bool implicit = false) {
+        CSSDeclaration decl;
+        decl.property = std::string(property_name(longhand));
+        decl.id = longhand;
+        decl.value = value;
+        decl.important = declaration.important;
+        decl.shorthand = declaration.id;
+        decl.pending_substitution = pending;
+        decl.implicit = implicit;
+        longhands.push_back(std::move(decl));
+    };
+
+    const CSSValue& value = declaration.value;
+    Items items = items_of(value);
+
+    // Which longhand gets which part is only known after substitution
+    if (contains_var(value)) {
+        for (size_t i = 0; i < info.longhand_count; ++i) {
+            emit(info.longhands[i], value, true);
+        }
+        return true;
+    }
+
+    if (items.size == 1 && is_css_wide_keyword(items[0])) {
+        for (size_t i = 0; i < info.longhand_count; ++i) {
+            emit(info.longhands[i], items[0], false);
+        }
+        return true;
+    }
+
+    // System fonts name a whole font at once and have no longhand spelling
+    if (declaration.id == P::Font && items.size == 1 &&
+        is_one_of(items[0], {"caption", "icon", "menu", "message-box", "small-caption", "status-bar"})) {
+        longhands.push_back(declaration);
+        return true;
+    }
+
+    Expansion out(info);
+    bool comma_list = value.type == ValueType::List && value.is_comma_separated();
+    bool matched = false;
+    switch (grammar->form) {
+        case Form::Box:
+            matched = !comma_list && expand_box(items, grammar->components[0].matcher, out.values);
+            break;
+        case Form::Radius:
+            matched = !comma_list && expand_radius(items, grammar->components[0].matcher, out, arena);
+            break;
+        case Form::Pair:
+            matched = !comma_list && items.size >= 1 && items.size <= 2 &&
+                      matches(grammar->components[0].matcher, items[0]) &&
+                      matches(grammar->components[0].matcher, items[items.size - 1]);
+            if (matched) {
+                out.values[0] = items[0];
+                out.values[1] = items[items.size - 1];
+            }
+            break;
+        case Form::AnyOrder:
+            matched = !comma_list && expand_any_order(*grammar, items, out, arena);
+            break;
+        case Form::Sides:
+            matched = !comma_list && expand_sides(*grammar, items, out, arena);
+            break;
+        case Form::Layers:
+            matched = expand_layers(*grammar, value, out, arena);
+            break;
+        case Form::GridLines:
+            matched = !comma_list && expand_grid_lines(items, out, arena);
+            break;
+        case Form::Font:
+            matched = expand_font(value, out, arena);
+            break;
+        case Form::Flex:
+            matched = !comma_list && expand_flex(items, out);
+            break;
+        case Form::GridTemplate:
+            matched = !comma_list && expand_grid_template(items, out, arena);
+            break;
+        case Form::Grid:
+            matched = !comma_list && expand_grid(items, out, arena);
+            break;
+    }
+    if (!matched) return false;
+
+    for (size_t i = 0; i < info.longhand_count; ++i) {
+        if (out.values[i].empty()) {
+            emit(info.longhands[i], initial_value(info.longhands[i]), false, true);
+        } else {
+            emit(info.longhands[i], out.values[i], false);
+        }
+    }
+    return true;
+}
+
+} // namespace CSS3Parser
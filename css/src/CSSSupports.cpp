@@ -0,0 +1,210 @@
+#include "CSSParser.h"
+#include <functional>
+
+namespace CSS3Parser {
+
+namespace {
+
+bool equals_ignoring_case(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        char x = a[i], y = b[i];
+        if (x >= 'A' && x <= 'Z') x = static_cast<char>(x + ('a' - 'A'));
+        if (y >= 'A' && y <= 'Z') y = static_cast<char>(y + ('a' - 'A'));
+        if (x != y) return false;
+    }
+    return true;
+}
+
+std::string to_lower(std::string_view text) {
+    std::string lower(text);
+    for (char& c : lower) {
+        if (c >= 'A' && c <= 'Z') c = static_cast<char>(c + ('a' - 'A'));
+    }
+    return lower;
+}
+
+struct PseudoInfo {
+    std::string_view name; // with its colons, as the parser keeps it
+    bool function;
+    bool selector_argument; // :is(), :not() and friends take selectors
+};
+
+// Pseudo-classes and pseudo-elements this engine understands
+constexpr PseudoInfo known_pseudos[] = {
+    {":root", false, false}, {":empty", false, false}, {":first-child", false, false},
+    {":last-child", false, false}, {":only-child", false, false}, {":first-of-type", false, false},
+    {":last-of-type", false, false}, {":only-of-type", false, false}, {":nth-child", true, false},
+    {":nth-last-child", true, false}, {":nth-of-type", true, false}, {":nth-last-of-type", true, false},
+    {":not", true, true}, {":is", true, true}, {":where", true, true}, {":has", true, true},
+    {":lang", true, false}, {":dir", true, false}, {":hover", false, false}, {":active", false, false},
+    {":focus", false, false}, {":focus-within", false, false}, {":focus-visible", false, false},
+    {":link", false, false}, {":visited", false, false}, {":any-link", false, false},
+    {":target", false, false}, {":scope", false, false}, {":checked", false, false},
+    {":disabled", false, false}, {":enabled", false, false}, {":required", false, false},
+    {":optional", false, false}, {":read-only", false, false}, {":read-write", false, false},
+    {":placeholder-shown", false, false}, {":default", false, false}, {":indeterminate", false, false},
+    {":valid", false, false}, {":invalid", false, false}, {":in-range", false, false},
+    {":out-of-range", false, false}, {":defined", false, false},
+    // Pseudo-elements, including the legacy single-colon spellings
+    {"::before", false, false}, {"::after", false, false}, {"::first-line", false, false},
+    {"::first-letter", false, false}, {"::placeholder", false, false}, {"::selection", false, false},
+    {"::marker", false, false}, {"::backdrop", false, false}, {"::file-selector-button", false, false},
+    {":before", false, false}, {":after", false, false}, {":first-line", false, false},
+    {":first-letter", false, false},
+};
+
+const PseudoInfo* find_pseudo(std::string_view name) {
+    for (const PseudoInfo& info : known_pseudos) {
+        if (equals_ignoring_case(info.name, name)) return &info;
+    }
+    return nullptr;
+}
+
+// Recursive descent over the condition's tokens (css-conditional-4):
+//   condition   = not <in-parens> | <in-parens> [and <in-parens>]* | <in-parens> [or <in-parens>]*
+//   in-parens   = ( <condition> ) | ( <declaration> ) | selector( ... ) | <general-enclosed>
+// General-enclosed parts are false. Mixing and with or without parentheses,
+// or anything else that breaks the grammar, makes the whole condition false.
+class SupportsEvaluator {
+public:
+    using DeclarationTest = std::function<bool(std::string_view property, std::string_view value)>;
+    using SelectorTest = std::function<bool(std::string_view selector)>;
+
+    SupportsEvaluator(std::string_view condition, DeclarationTest declaration, SelectorTest selector)
+        : tokenizer_(std::string(condition)), declaration_(std::move(declaration)), selector_(std::move(selector)) {
+        for (Token token = tokenizer_.next_token(); token.type != TokenType::EOF_TOKEN;
+             token = tokenizer_.next_token()) {
+            if (token.type != TokenType::Whitespace && token.type != TokenType::Comment) tokens_.push_back(token);
+        }
+    }
+
+    bool run() {
+        bool result = false;
+        return parse_condition(result) && cursor_ == tokens_.size() && result;
+    }
+
+private:
+    static constexpr size_t npos = SIZE_MAX;
+
+    CSSTokenizer tokenizer_; // tokens view its copy of the condition
+    std::vector<Token> tokens_;
+    size_t cursor_ = 0;
+    DeclarationTest declaration_;
+    SelectorTest selector_;
+
+    bool is_keyword(std::string_view keyword) const {
+        return cursor_ < tokens_.size() && tokens_[cursor_].type == TokenType::Ident &&
+               equals_ignoring_case(tokens_[cursor_].value, keyword);
+    }
+
+    // The ')' closing the '(' or function token at open
+    size_t closing_paren(size_t open) const {
+        size_t depth = 0;
+        for (size_t i = open; i < tokens_.size(); ++i) {
+            TokenType type = tokens_[i].type;
+            if (type == TokenType::LeftParen || type == TokenType::Function) depth++;
+            if (type == TokenType::RightParen && --depth == 0) return i;
+        }
+        return npos;
+    }
+
+    // Source text from token first up to, not including, token end
+    std::string_view text(size_t first, size_t end) const {
+        if (first >= end) return {};
+        return tokenizer_.source(tokens_[first].start_pos, tokens_[end].start_pos);
+    }
+
+    bool parse_condition(bool& result) {
+        if (is_keyword("not")) {
+            cursor_++;
+            if (!parse_in_parens(result)) return false;
+            result = !result;
+            return true;
+        }
+        if (!parse_in_parens(result)) return false;
+
+        bool conjunction = is_keyword("and");
+        if (!conjunction && !is_keyword("or")) return true;
+        std::string_view op = conjunction ? "and" : "or";
+        while (is_keyword(op)) {
+            cursor_++;
+            bool next = false;
+            if (!parse_in_parens(next)) return false;
+            result = conjunction ? result && next : result || next;
+        }
+        return !is_keyword("and") && !is_keyword("or");
+    }
+
+    bool parse_in_parens(bool& result) {
+        if (cursor_ >= tokens_.size()) return false;
+        const Token& open = tokens_[cursor_];
+        if (open.type != TokenType::LeftParen && open.type != TokenType::Function) return false;
+        size_t close = closing_paren(cursor_);
+        if (close == npos) return false;
+
+        if (open.type == TokenType::Function) {
+            result = equals_ignoring_case(open.value, "selector") && selector_(text(cursor_ + 1, close));
+        } else if (cursor_ + 2 <= close && tokens_[cursor_ + 1].type == TokenType::Ident &&
+                   tokens_[cursor_ + 2].type == TokenType::Colon) {
+            result = declaration_(tokens_[cursor_ + 1].value, text(cursor_ + 3, close));
+        } else {
+            // A nested condition, or general-enclosed when it is not one
+            cursor_++;
+            bool nested = false;
+            result = parse_condition(nested) && cursor_ == close && nested;
+        }
+        cursor_ = close + 1;
+        return true;
+    }
+};
+
+} // namespace
+
+bool CSSParser::supports_condition(std::string_view condition) {
+    auto declaration = [](std::string_view name, std::string_view value) {
+        std::string property = name.substr(0, 2) == "--" ? std::string(name) : to_lower(name);
+        if (!is_valid_property(property)) return false;
+        if (property_id(property) == PropertyId::Custom) return true;
+
+        CSSParser parser{std::string(value)};
+        parser.skip_whitespace();
+        if (parser.at_end()) return false;
+        CSSValue parsed = parser.parse_value();
+        parser.skip_whitespace();
+        return parser.at_end() && !parser.has_errors() && is_valid_value_for_property(property, parsed);
+    };
+
+    std::function<bool(std::string_view)> selector = [&selector](std::string_view text) {
+        CSSParser parser{std::string(text)};
+        parser.skip_whitespace();
+        SelectorList list = parser.parse_selector_list();
+        parser.skip_whitespace();
+        if (list.empty() || !parser.at_end() || parser.has_errors()) return false;
+        for (const ComplexSelector& complex : list.selectors) {
+            for (const auto& component : complex.components) {
+                for (const SimpleSelector& simple : component.selector.selectors) {
+                    if (simple.type != SelectorType::Pseudo && simple.type != SelectorType::PseudoElement) continue;
+                    const PseudoInfo* info = find_pseudo(simple.pseudo.name);
+                    if (!info || info->function != simple.pseudo.is_function) return false;
+                    if (!info->selector_argument) continue;
+                    std::string_view argument = simple.pseudo.argument;
+                    if (equals_ignoring_case(info->name, ":has")) {
+                        // Relative selectors may open with a combinator
+                        size_t start = argument.find_first_not_of(" \t\n");
+                        if (start != std::string_view::npos && std::string_view(">+~").find(argument[start]) !=
+                                                                    std::string_view::npos) {
+                            argument.remove_prefix(start + 1);
+                        }
+                    }
+                    if (!selector(argument)) return false;
+                }
+            }
+        }
+        return true;
+    };
+
+    return SupportsEvaluator(condition, declaration, selector).run();
+}
+
+} // namespace CSS3Parser
@@ -2,44 +2,151 @@
 #include <cctype>
 #include <algorithm>
 #include <sstream>
+#include <charconv>
+#include <atomic>
+#include <limits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace CSS3Parser {
 
-CSSTokenizer::CSSTokenizer(const std::string& input) : input_(input) {}
+namespace {
+
+std::atomic<bool> vector_scanning_enabled{true};
+
+// Offset of the first byte at or after pos that is not CSS whitespace
+size_t find_non_whitespace(const char* data, size_t pos, size_t size) {
+#if defined(__SSE2__)
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i ff = _mm_set1_epi8('\f');
+    const size_t vector_end = vector_scanning_enabled.load(std::memory_order_relaxed) ? size : 0;
+    for (; pos + 16 <= vector_end; pos += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+        __m128i white = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(block, space), _mm_cmpeq_epi8(block, tab)),
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, lf), _mm_cmpeq_epi8(block, cr)),
+                         _mm_cmpeq_epi8(block, ff)));
+        unsigned other = ~static_cast<unsigned>(_mm_movemask_epi8(white)) & 0xFFFFu;
+        if (other != 0) return pos + static_cast<size_t>(__builtin_ctz(other));
+    }
+#endif
+    while (pos < size) {
+        char c = data[pos];
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r' && c != '\f') break;
+        ++pos;
+    }
+    return pos;
+}
+
+// Offset just past the "*/" closing a comment whose body starts at pos,
+// or size when the comment is unterminated
+size_t find_comment_end(const char* data, size_t pos, size_t size) {
+#if defined(__SSE2__)
+    const __m128i star = _mm_set1_epi8('*');
+    const __m128i slash = _mm_set1_epi8('/');
+    const size_t vector_end = vector_scanning_enabled.load(std::memory_order_relaxed) ? size : 0;
+    for (; pos + 17 <= vector_end; pos += 16) {
+        __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+        __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos + 1));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(head, star), _mm_cmpeq_epi8(next, slash))));
+        if (mask != 0) return pos + static_cast<size_t>(__builtin_ctz(mask)) + 2;
+    }
+#endif
+    for (; pos + 1 < size; ++pos) {
+        if (data[pos] == '*' && data[pos + 1] == '/') return pos + 2;
+    }
+    return size;
+}
+
+// For a number lexeme outside double's range: whether it is too large
+// rather than too small, from where its first significant digit sits
+bool exceeds_double(std::string_view text) {
+    size_t exponent_at = text.find_first_of("eE");
+    long long scale = 0;
+    if (exponent_at != std::string_view::npos) {
+        std::string_view digits = text.substr(exponent_at + 1);
+        bool negative = !digits.empty() && digits.front() == '-';
+        if (!digits.empty() && (digits.front() == '+' || digits.front() == '-')) digits.remove_prefix(1);
+        if (std::from_chars(digits.data(), digits.data() + digits.size(), scale).ec != std::errc()) {
+            scale = std::numeric_limits<int>::max(); // any mantissa is dwarfed
+        }
+        if (negative) scale = -scale;
+        text = text.substr(0, exponent_at);
+    }
+    // Digits before the point, or minus the zeros after it
+    size_t point = std::min(text.find('.'), text.size());
+    size_t first = text.find_first_not_of("+-0.");
+    if (first == std::string_view::npos) return false;
+    scale += first < point ? static_cast<long long>(point - first) : -static_cast<long long>(first - point - 1);
+    return scale > 0;
+}
+
+} // namespace
+
+void CSSTokenizer::set_vector_scanning(bool enabled) {
+    vector_scanning_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool CSSTokenizer::vector_scanning() {
+    return vector_scanning_enabled.load(std::memory_order_relaxed);
+}
+
+CSSTokenizer::CSSTokenizer(const std::string& input)
+    : CSSTokenizer(std::make_shared<const std::string>(input)) {}
+
+CSSTokenizer::CSSTokenizer(std::shared_ptr<const std::string> input)
+    : buffer_(std::move(input)), input_(*buffer_), line_index_(input_) {}
 
 Token CSSTokenizer::next_token() {
-    if (buffer_pos_ < token_buffer_.size()) {
-        return token_buffer_[buffer_pos_++];
+    if (lookahead_count_ > 0) {
+        Token token = lookahead_[lookahead_head_];
+        lookahead_head_ = (lookahead_head_ + 1) % lookahead_capacity;
+        lookahead_count_--;
+        return token;
+    }
+    return read_token();
+}
+
+Token CSSTokenizer::read_token() {
+    // Comments produce no token
+    while (peek() == '/' && peek(1) == '*') {
+        skip_comment();
     }
     
-    skip_whitespace();
-    
-    if (at_end()) {
-        return Token(TokenType::EOF_TOKEN);
+    // Not at_end(): while the ring is being filled it still holds tokens
+    if (input_exhausted()) {
+        Token eof(TokenType::EOF_TOKEN);
+        eof.start_pos = eof.end_pos = input_.length();
+        return eof;
     }
     
     size_t start_pos = pos_;
-    size_t start_line = line_;
-    size_t start_column = column_;
     
     char c = peek();
     Token token;
     
     switch (c) {
-        case '/':
-            if (peek(1) == '*') {
-                skip_comment();
-                return next_token(); // Skip comments by default
-            }
-            token = Token(TokenType::Delim, std::string(1, consume()));
+        case ' ':
+        case '\t':
+        case '\n':
+        case '\r':
+        case '\f':
+            skip_whitespace();
+            token = Token(TokenType::Whitespace, lexeme(start_pos));
             break;
             
         case '@':
-            consume(); // consume '@'
-            if (is_identifier_start(peek())) {
+            if (is_identifier_start(peek(1)) || starts_escape(1)) {
+                consume(); // consume '@'
                 token = Token(TokenType::AtKeyword, consume_identifier());
             } else {
-                token = Token(TokenType::Delim, "@");
+                token = single_char_token(TokenType::Delim);
             }
             break;
             
@@ -53,108 +160,108 @@ Token CSSTokenizer::next_token() {
             break;
             
         case '(':
-            token = Token(TokenType::LeftParen, std::string(1, consume()));
+            token = single_char_token(TokenType::LeftParen);
             break;
             
         case ')':
-            token = Token(TokenType::RightParen, std::string(1, consume()));
+            token = single_char_token(TokenType::RightParen);
             break;
             
         case '[':
-            token = Token(TokenType::LeftSquare, std::string(1, consume()));
+            token = single_char_token(TokenType::LeftSquare);
             break;
             
         case ']':
-            token = Token(TokenType::RightSquare, std::string(1, consume()));
+            token = single_char_token(TokenType::RightSquare);
             break;
             
         case '{':
-            token = Token(TokenType::LeftBrace, std::string(1, consume()));
+            token = single_char_token(TokenType::LeftBrace);
             break;
             
         case '}':
-            token = Token(TokenType::RightBrace, std::string(1, consume()));
+            token = single_char_token(TokenType::RightBrace);
             break;
             
         case ':':
-            token = Token(TokenType::Colon, std::string(1, consume()));
+            token = single_char_token(TokenType::Colon);
             break;
             
         case ';':
-            token = Token(TokenType::Semicolon, std::string(1, consume()));
+            token = single_char_token(TokenType::Semicolon);
             break;
             
         case ',':
-            token = Token(TokenType::Comma, std::string(1, consume()));
+            token = single_char_token(TokenType::Comma);
             break;
             
         case '~':
             if (peek(1) == '=') {
                 consume(); consume();
-                token = Token(TokenType::IncludeMatch, "~=");
+                token = Token(TokenType::IncludeMatch, lexeme(start_pos));
             } else {
-                token = Token(TokenType::Delim, std::string(1, consume()));
+                token = single_char_token(TokenType::Delim);
             }
             break;
             
         case '|':
             if (peek(1) == '=') {
                 consume(); consume();
-                token = Token(TokenType::DashMatch, "|=");
+                token = Token(TokenType::DashMatch, lexeme(start_pos));
             } else if (peek(1) == '|') {
                 consume(); consume();
-                token = Token(TokenType::Column, "||");
+                token = Token(TokenType::Column, lexeme(start_pos));
             } else {
-                token = Token(TokenType::Delim, std::string(1, consume()));
+                token = single_char_token(TokenType::Delim);
             }
             break;
             
         case '^':
             if (peek(1) == '=') {
                 consume(); consume();
-                token = Token(TokenType::PrefixMatch, "^=");
+                token = Token(TokenType::PrefixMatch, lexeme(start_pos));
             } else {
-                token = Token(TokenType::Delim, std::string(1, consume()));
+                token = single_char_token(TokenType::Delim);
             }
             break;
             
         case '$':
             if (peek(1) == '=') {
                 consume(); consume();
-                token = Token(TokenType::SuffixMatch, "$=");
+                token = Token(TokenType::SuffixMatch, lexeme(start_pos));
             } else {
-                token = Token(TokenType::Delim, std::string(1, consume()));
+                token = single_char_token(TokenType::Delim);
             }
             break;
             
         case '*':
             if (peek(1) == '=') {
                 consume(); consume();
-                token = Token(TokenType::SubstringMatch, "*=");
+                token = Token(TokenType::SubstringMatch, lexeme(start_pos));
             } else {
-                token = Token(TokenType::Delim, std::string(1, consume()));
+                token = single_char_token(TokenType::Delim);
             }
             break;
             
         case '<':
             if (peek(1) == '!' && peek(2) == '-' && peek(3) == '-') {
                 consume(); consume(); consume(); consume();
-                token = Token(TokenType::CDO, "<!--");
+                token = Token(TokenType::CDO, lexeme(start_pos));
             } else {
-                token = Token(TokenType::Delim, std::string(1, consume()));
+                token = single_char_token(TokenType::Delim);
             }
             break;
             
         case '-':
             if (peek(1) == '-' && peek(2) == '>') {
                 consume(); consume(); consume();
-                token = Token(TokenType::CDC, "-->");
+                token = Token(TokenType::CDC, lexeme(start_pos));
             } else if (is_digit(peek(1)) || (peek(1) == '.' && is_digit(peek(2)))) {
                 token = read_number();
             } else if (is_identifier_start(c)) {
                 token = read_identifier();
             } else {
-                token = Token(TokenType::Delim, std::string(1, consume()));
+                token = single_char_token(TokenType::Delim);
             }
             break;
             
@@ -162,7 +269,7 @@ Token CSSTokenizer::next_token() {
             if (is_digit(peek(1))) {
                 token = read_number();
             } else {
-                token = Token(TokenType::Delim, std::string(1, consume()));
+                token = single_char_token(TokenType::Delim);
             }
             break;
             
@@ -170,7 +277,7 @@ Token CSSTokenizer::next_token() {
             if (is_digit(peek(1)) || (peek(1) == '.' && is_digit(peek(2)))) {
                 token = read_number();
             } else {
-                token = Token(TokenType::Delim, std::string(1, consume()));
+                token = single_char_token(TokenType::Delim);
             }
             break;
             
@@ -183,60 +290,56 @@ Token CSSTokenizer::next_token() {
             }
             break;
             
+        case '\\':
+            if (starts_escape()) {
+                token = read_identifier();
+            } else {
+                add_error("Invalid escape");
+                token = single_char_token(TokenType::Delim);
+            }
+            break;
+            
         default:
             if (is_digit(c)) {
                 token = read_number();
             } else if (is_identifier_start(c)) {
                 token = read_identifier();
             } else {
-                token = Token(TokenType::Delim, std::string(1, consume()));
+                token = single_char_token(TokenType::Delim);
             }
             break;
     }
     
     token.start_pos = start_pos;
     token.end_pos = pos_;
-    token.line = start_line;
-    token.column = start_column;
     
     return token;
 }
 
-Token CSSTokenizer::peek_token(size_t offset) {
-    // Build token buffer if needed
-    while (buffer_pos_ + offset >= token_buffer_.size()) {
-        Token token = next_token();
-        token_buffer_.push_back(token);
-        
-        // If we hit EOF, stop buffering
-        if (token.type == TokenType::EOF_TOKEN) {
-            break;
-        }
+const Token& CSSTokenizer::peek_token(size_t offset) {
+    static const Token eof_token(TokenType::EOF_TOKEN);
+    
+    if (offset >= lookahead_capacity) {
+        return eof_token;
     }
     
-    if (buffer_pos_ + offset < token_buffer_.size()) {
-        return token_buffer_[buffer_pos_ + offset];
+    // Fill the ring up to the requested slot, stopping at EOF
+    while (lookahead_count_ <= offset) {
+        if (lookahead_count_ > 0 &&
+            lookahead_[(lookahead_head_ + lookahead_count_ - 1) % lookahead_capacity].type == TokenType::EOF_TOKEN) {
+            return eof_token;
+        }
+        lookahead_[(lookahead_head_ + lookahead_count_) % lookahead_capacity] = read_token();
+        lookahead_count_++;
     }
     
-    return Token(TokenType::EOF_TOKEN);
+    return lookahead_[(lookahead_head_ + offset) % lookahead_capacity];
 }
 
 void CSSTokenizer::reset(size_t position) {
     pos_ = position;
-    line_ = 1;
-    column_ = 1;
-    token_buffer_.clear();
-    buffer_pos_ = 0;
-    
-    // Recalculate line and column
-    for (size_t i = 0; i < position && i < input_.length(); ++i) {
-        if (input_[i] == '\n') {
-            line_++;
-            column_ = 1;
-        } else {
-            column_++;
-        }
-    }
+    lookahead_head_ = 0;
+    lookahead_count_ = 0;
 }
 
 char CSSTokenizer::peek(size_t offset) const {
@@ -247,43 +350,51 @@ char CSSTokenizer::peek(size_t offset) const {
 char CSSTokenizer::consume() {
     if (pos_ >= input_.length()) return '\0';
     
-    char c = input_[pos_++];
-    if (c == '\n') {
-        line_++;
-        column_ = 1;
-    } else {
-        column_++;
-    }
-    return c;
+    return input_[pos_++];
 }
 
 void CSSTokenizer::skip_whitespace() {
-    while (!at_end() && is_whitespace(peek())) {
-        consume();
-    }
+    pos_ = find_non_whitespace(input_.data(), pos_, input_.length());
 }
 
 void CSSTokenizer::skip_comment() {
     if (peek() == '/' && peek(1) == '*') {
-        consume(); // '/'
-        consume(); // '*'
-        
-        while (!at_end()) {
-            if (peek() == '*' && peek(1) == '/') {
-                consume(); // '*'
-                consume(); // '/'
-                break;
-            }
-            consume();
-        }
+        pos_ = find_comment_end(input_.data(), pos_ + 2, input_.length());
     }
 }
 
+std::string_view CSSTokenizer::lexeme(size_t start) const {
+    return input_.substr(start, pos_ - start);
+}
+
+// Only text that differs from the source because of escapes is copied
+std::string_view CSSTokenizer::store_decoded(std::string text) {
+    decoded_.push_back(std::move(text));
+    return decoded_.back();
+}
+
+Token CSSTokenizer::single_char_token(TokenType type) {
+    Token token(type, input_.substr(pos_, 1));
+    consume();
+    return token;
+}
+
 Token CSSTokenizer::read_identifier() {
-    std::string value = consume_identifier();
+    std::string_view value = consume_identifier();
     
-    // Check if it's a function
+    // A function token includes its opening parenthesis
     if (peek() == '(') {
+        consume();
+        
+        // url( followed by anything but a quote is a url token
+        if (value.size() == 3 && (value[0] | 0x20) == 'u' && (value[1] | 0x20) == 'r' &&
+            (value[2] | 0x20) == 'l') {
+            size_t ahead = 0;
+            while (is_whitespace(peek(ahead))) ahead++;
+            if (peek(ahead) != '"' && peek(ahead) != '\'') {
+                return read_url();
+            }
+        }
         return Token(TokenType::Function, value);
     }
     
@@ -292,9 +403,9 @@ Token CSSTokenizer::read_identifier() {
 
 Token CSSTokenizer::read_string(char quote) {
     consume(); // consume opening quote
-    std::string value = consume_string(quote);
+    std::string_view value = consume_string(quote);
     
-    if (at_end() || peek() != quote) {
+    if (input_exhausted() || peek() != quote) {
         add_error("Unterminated string literal");
         return Token(TokenType::BadString, value);
     }
@@ -304,72 +415,72 @@ Token CSSTokenizer::read_string(char quote) {
 }
 
 Token CSSTokenizer::read_number() {
-    double number = consume_number();
-    std::string repr = std::to_string(number);
+    size_t start = pos_;
+    bool is_integer = false;
+    double number = consume_number(is_integer);
+    Token token;
     
-    // Check for percentage
     if (peek() == '%') {
         consume();
-        return Token(TokenType::Percentage, repr + "%", number, "%");
-    }
-    
-    // Check for dimension (unit)
-    if (is_identifier_start(peek())) {
-        std::string unit = consume_identifier();
-        return Token(TokenType::Dimension, repr + unit, number, unit);
+        token = Token(TokenType::Percentage, lexeme(start), number, lexeme(pos_ - 1));
+    } else if (is_identifier_start(peek()) || starts_escape()) {
+        std::string_view unit = consume_identifier();
+        token = Token(TokenType::Dimension, lexeme(start), number, unit);
+    } else {
+        token = Token(TokenType::Number, lexeme(start), number);
     }
     
-    return Token(TokenType::Number, repr, number);
+    token.is_integer = is_integer;
+    return token;
 }
 
 Token CSSTokenizer::read_hash() {
+    size_t start = pos_;
     consume(); // consume '#'
     
-    if (is_identifier_char(peek()) || is_hex_digit(peek())) {
-        std::string value = consume_identifier();
-        return Token(TokenType::Hash, "#" + value);
+    if (is_identifier_char(peek()) || starts_escape()) {
+        std::string_view name = consume_identifier();
+        std::string_view raw = lexeme(start);
+        if (raw.size() == name.size() + 1 && raw.substr(1) == name) {
+            return Token(TokenType::Hash, raw);
+        }
+        return Token(TokenType::Hash, store_decoded("#" + std::string(name)));
     }
     
-    return Token(TokenType::Delim, "#");
+    return Token(TokenType::Delim, lexeme(start));
 }
 
+// Called after "url(" when the argument is unquoted
 Token CSSTokenizer::read_url() {
-    std::string function_name = consume_identifier(); // "url"
-    consume(); // consume '('
-    
     skip_whitespace();
     
-    std::string url_value;
+    size_t start = pos_;
+    std::string decoded;
+    bool escaped = false;
     
-    // Check if quoted string
-    if (peek() == '"' || peek() == '\'') {
-        char quote = peek();
-        consume(); // consume quote
-        url_value = consume_string(quote);
-        if (peek() == quote) {
-            consume(); // consume closing quote
-        } else {
-            consume_bad_url();
-            return Token(TokenType::BadUrl, url_value);
-        }
-    } else {
-        // Unquoted URL
-        while (!at_end() && peek() != ')' && !is_whitespace(peek())) {
-            if (peek() == '\\') {
-                consume(); // backslash
-                if (!at_end()) {
-                    url_value += consume();
-                }
-            } else if (peek() == '(' || peek() == '"' || peek() == '\'' || 
-                      is_whitespace(peek()) || peek() == '\t' || peek() == '\n') {
+    while (!input_exhausted() && peek() != ')' && !is_whitespace(peek())) {
+        if (peek() == '\\') {
+            if (!starts_escape()) {
                 consume_bad_url();
-                return Token(TokenType::BadUrl, url_value);
-            } else {
-                url_value += consume();
+                return Token(TokenType::BadUrl, lexeme(start));
+            }
+            if (!escaped) {
+                decoded.assign(input_, start, pos_ - start);
+                escaped = true;
             }
+            consume_escape(decoded);
+        } else if (peek() == '(' || peek() == '"' || peek() == '\'') {
+            consume_bad_url();
+            return Token(TokenType::BadUrl, lexeme(start));
+        } else if (escaped) {
+            decoded += consume();
+        } else {
+            consume();
         }
     }
     
+    std::string_view url_value = escaped ? store_decoded(std::move(decoded)) : lexeme(start);
+    
     skip_whitespace();
     
     if (peek() == ')') {
@@ -382,25 +493,24 @@ Token CSSTokenizer::read_url() {
 }
 
 Token CSSTokenizer::read_unicode_range() {
+    size_t start = pos_;
     consume(); // 'U' or 'u'
     consume(); // '+'
     
-    std::string range;
-    
     // Read hex digits or '?' wildcards
-    while (!at_end() && (is_hex_digit(peek()) || peek() == '?')) {
-        range += consume();
+    while (!input_exhausted() && (is_hex_digit(peek()) || peek() == '?')) {
+        consume();
     }
     
     // Check for range separator
-    if (peek() == '-') {
-        range += consume(); // '-'
-        while (!at_end() && is_hex_digit(peek())) {
-            range += consume();
+    if (peek() == '-' && is_hex_digit(peek(1))) {
+        consume(); // '-'
+        while (!input_exhausted() && is_hex_digit(peek())) {
+            consume();
         }
     }
     
-    return Token(TokenType::UnicodeRange, "U+" + range);
+    return Token(TokenType::UnicodeRange, lexeme(start));
 }
 
 bool CSSTokenizer::is_identifier_start(char c) const {
@@ -427,105 +537,157 @@ bool CSSTokenizer::is_newline(char c) const {
     return c == '\n' || c == '\r' || c == '\f';
 }
 
-std::string CSSTokenizer::consume_identifier() {
-    std::string result;
+bool CSSTokenizer::starts_escape(size_t offset) const {
+    return peek(offset) == '\\' && !is_newline(peek(offset + 1)) && pos_ + offset + 1 < input_.length();
+}
+
+// Decodes one escape sequence (the backslash is at pos_) and appends it as UTF-8
+void CSSTokenizer::consume_escape(std::string& out) {
+    consume(); // backslash
     
-    while (!at_end() && is_identifier_char(peek())) {
-        if (peek() == '\\') {
-            consume(); // backslash
-            if (!at_end()) {
-                // Handle escape sequence
-                char escaped = consume();
-                if (is_hex_digit(escaped)) {
-                    // Unicode escape sequence
-                    std::string hex_digits(1, escaped);
-                    for (int i = 0; i < 5 && !at_end() && is_hex_digit(peek()); ++i) {
-                        hex_digits += consume();
-                    }
-                    if (!at_end() && is_whitespace(peek())) {
-                        consume(); // consume optional whitespace
-                    }
-                    // Convert hex to character
-                    unsigned int code_point = std::stoul(hex_digits, nullptr, 16);
-                    if (code_point <= 0x10FFFF) {
-                        // Convert Unicode code point to UTF-8
-                        if (code_point < 0x80) {
-                            result += static_cast<char>(code_point);
-                        } else {
-                            // Simplified UTF-8 encoding for demonstration
-                            result += '?'; // Placeholder for non-ASCII
-                        }
-                    }
-                } else {
-                    result += escaped;
-                }
-            }
-        } else {
+    if (!is_hex_digit(peek())) {
+        out += consume();
+        return;
+    }
+    
+    uint32_t code_point = 0;
+    for (int i = 0; i < 6 && is_hex_digit(peek()); ++i) {
+        char digit = consume();
+        code_point = code_point * 16 + (is_digit(digit) ? digit - '0' : (digit | 0x20) - 'a' + 10);
+    }
+    if (is_whitespace(peek())) {
+        consume(); // a single whitespace terminates the escape
+    }
+    
+    if (code_point == 0 || code_point > 0x10FFFF || (code_point >= 0xD800 && code_point <= 0xDFFF)) {
+        code_point = 0xFFFD; // replacement character
+    }
+    
+    if (code_point < 0x80) {
+        out += static_cast<char>(code_point);
+    } else if (code_point < 0x800) {
+        out += static_cast<char>(0xC0 | (code_point >> 6));
+        out += static_cast<char>(0x80 | (code_point & 0x3F));
+    } else if (code_point < 0x10000) {
+        out += static_cast<char>(0xE0 | (code_point >> 12));
+        out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code_point & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (code_point >> 18));
+        out += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code_point & 0x3F));
+    }
+}
+
+std::string_view CSSTokenizer::consume_identifier() {
+    size_t start = pos_;
+    
+    // Fast path: a plain identifier is a view of the input
+    while (!input_exhausted() && is_identifier_char(peek())) {
+        consume();
+    }
+    if (!starts_escape()) {
+        return lexeme(start);
+    }
+    
+    std::string result(input_, start, pos_ - start);
+    while (!input_exhausted()) {
+        if (is_identifier_char(peek())) {
             result += consume();
+        } else if (starts_escape()) {
+            consume_escape(result);
+        } else {
+            break;
         }
     }
     
-    return result;
+    return store_decoded(std::move(result));
 }
 
-std::string CSSTokenizer::consume_string(char quote) {
-    std::string result;
+std::string_view CSSTokenizer::consume_string(char quote) {
+    size_t start = pos_;
+    
+    while (!input_exhausted() && peek() != quote && !is_newline(peek()) && peek() != '\\') {
+        consume();
+    }
+    if (peek() != '\\') {
+        return lexeme(start);
+    }
     
-    while (!at_end() && peek() != quote && !is_newline(peek())) {
+    std::string result(input_, start, pos_ - start);
+    while (!input_exhausted() && peek() != quote && !is_newline(peek())) {
         if (peek() == '\\') {
-            consume(); // backslash
-            if (!at_end()) {
-                if (is_newline(peek())) {
-                    consume(); // consume newline (escaped)
-                } else {
-                    result += consume(); // escaped character
-                }
+            if (is_newline(peek(1))) {
+                consume(); // backslash
+                consume(); // escaped newline is dropped
+            } else if (pos_ + 1 < input_.length()) {
+                consume_escape(result);
+            } else {
+                consume(); // backslash at end of input
             }
         } else {
             result += consume();
         }
     }
     
-    return result;
+    return store_decoded(std::move(result));
 }
 
-double CSSTokenizer::consume_number() {
-    std::string number_str;
+// Scans a number per css-syntax and converts the lexeme in place; 'e' only
+// starts an exponent when digits follow, so "1.5em" stays a dimension
+double CSSTokenizer::consume_number(bool& is_integer) {
+    size_t start = pos_;
+    is_integer = true;
     
     if (peek() == '+' || peek() == '-') {
-        number_str += consume();
+        consume();
     }
     
-    while (!at_end() && is_digit(peek())) {
-        number_str += consume();
+    while (is_digit(peek())) {
+        consume();
     }
     
-    if (peek() == '.') {
-        number_str += consume();
-        while (!at_end() && is_digit(peek())) {
-            number_str += consume();
+    if (peek() == '.' && is_digit(peek(1))) {
+        is_integer = false;
+        consume();
+        while (is_digit(peek())) {
+            consume();
         }
     }
     
-    // Scientific notation
-    if (peek() == 'e' || peek() == 'E') {
-        number_str += consume();
+    if ((peek() == 'e' || peek() == 'E') &&
+        (is_digit(peek(1)) || ((peek(1) == '+' || peek(1) == '-') && is_digit(peek(2))))) {
+        is_integer = false;
+        consume();
         if (peek() == '+' || peek() == '-') {
-            number_str += consume();
+            consume();
         }
-        while (!at_end() && is_digit(peek())) {
-            number_str += consume();
+        while (is_digit(peek())) {
+            consume();
         }
     }
     
-    return std::stod(number_str);
+    // from_chars takes no leading '+'
+    std::string_view text = lexeme(start);
+    if (!text.empty() && text.front() == '+') {
+        text.remove_prefix(1);
+    }
+    
+    double number = 0.0;
+    if (std::from_chars(text.data(), text.data() + text.size(), number).ec == std::errc::result_out_of_range) {
+        // Clamped to the nearest value a double holds, as css-values asks
+        number = exceeds_double(text) ? std::numeric_limits<double>::max() : 0.0;
+        if (text.front() == '-') number = -number;
+    }
+    return number;
 }
 
 void CSSTokenizer::consume_bad_url() {
-    while (!at_end() && peek() != ')') {
+    while (!input_exhausted() && peek() != ')') {
         if (peek() == '\\') {
             consume(); // backslash
-            if (!at_end()) {
+            if (!input_exhausted()) {
                 consume(); // escaped character
             }
         } else {
@@ -539,7 +701,91 @@ void CSSTokenizer::consume_bad_url() {
 }
 
 void CSSTokenizer::add_error(const std::string& message) {
-    errors_.emplace_back(message, pos_, line_, column_);
+    auto where = location(pos_);
+    errors_.emplace_back(message, pos_, where.line, where.column);
+}
+
+namespace {
+
+// The text a token's value leaves out at each end of its lexeme
+std::pair<size_t, size_t> value_trim(TokenType type) {
+    switch (type) {
+        case TokenType::Function: return {0, 1};  // "name("
+        case TokenType::AtKeyword: return {1, 0}; // "@name"
+        case TokenType::String: return {1, 1};    // "'text'"
+        default: return {0, 0};
+    }
+}
+
+std::string_view derived_value(std::string_view source, TokenType type, size_t start, size_t end) {
+    auto [lead, trail] = value_trim(type);
+    if (end - start < lead + trail) return {};
+    return source.substr(start + lead, end - start - lead - trail);
+}
+
+} // namespace
+
+void CSSTokenArray::build(CSSTokenizer& tokenizer) {
+    // Framework CSS averages a little over two bytes per token
+    size_t estimate = (tokenizer.remaining() / 2) + 1;
+    types_.reserve(estimate);
+    starts_.reserve(estimate);
+    ends_.reserve(estimate);
+    side_value_.reserve(estimate);
+    numeric_slot_.reserve(estimate);
+    source_ = tokenizer.input();
+    
+    while (true) {
+        Token token = tokenizer.next_token();
+        types_.push_back(token.type);
+        starts_.push_back(static_cast<uint32_t>(token.start_pos));
+        ends_.push_back(static_cast<uint32_t>(token.end_pos));
+        
+        std::string_view derived = derived_value(source_, token.type, token.start_pos, token.end_pos);
+        bool same = derived.size() == token.value.size() && (derived.empty() || derived.data() == token.value.data());
+        side_value_.push_back(!same);
+        if (!same) {
+            side_indices_.push_back(static_cast<uint32_t>(types_.size() - 1));
+            side_values_.push_back(token.value);
+        }
+        
+        bool numeric = token.type == TokenType::Number || token.type == TokenType::Percentage ||
+                       token.type == TokenType::Dimension;
+        numeric_slot_.push_back(numeric ? static_cast<uint32_t>(numbers_.size()) : UINT32_MAX);
+        if (numeric) {
+            numbers_.push_back(token.numeric_value);
+            units_.push_back(token.unit);
+            integers_.push_back(token.is_integer);
+        }
+        if (token.type == TokenType::EOF_TOKEN) break;
+    }
+}
+
+std::string_view CSSTokenArray::value(size_t index) const {
+    if (!side_value_[index]) return derived_value(source_, types_[index], starts_[index], ends_[index]);
+    auto found = std::lower_bound(side_indices_.begin(), side_indices_.end(), static_cast<uint32_t>(index));
+    return side_values_[found - side_indices_.begin()];
+}
+
+Token CSSTokenArray::token(size_t index) const {
+    Token token(types_[index], value(index));
+    uint32_t slot = numeric_slot_[index];
+    if (slot != UINT32_MAX) {
+        token.numeric_value = numbers_[slot];
+        token.unit = units_[slot];
+        token.is_integer = integers_[slot];
+    }
+    token.start_pos = starts_[index];
+    token.end_pos = ends_[index];
+    return token;
+}
+
+size_t CSSTokenArray::memory_usage() const {
+    return types_.capacity() * sizeof(TokenType) +
+           (starts_.capacity() + ends_.capacity() + numeric_slot_.capacity() + side_indices_.capacity()) *
+               sizeof(uint32_t) +
+           (side_values_.capacity() + units_.capacity()) * sizeof(std::string_view) +
+           numbers_.capacity() * sizeof(double) + (integers_.capacity() + side_value_.capacity()) / 8;
 }
 
-} // namespace CSS3Parser
\ No newline at end of file
+} // namespace CSS3Parser
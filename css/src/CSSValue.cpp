@@ -3,6 +3,8 @@
 #include <iomanip>
 #include <algorithm>
 #include <unordered_map>
+#include <unordered_set>
+#include <charconv>
 
 namespace CSS3Parser {
 
@@ -149,11 +151,25 @@ static const std::unordered_map<std::string, CSSColor> named_colors = {
     {"violet", CSSColor(CSSColor::RGB, 238, 130, 238, 1)},
     {"wheat", CSSColor(CSSColor::RGB, 245, 222, 179, 1)},
     {"whitesmoke", CSSColor(CSSColor::RGB, 245, 245, 245, 1)},
-    {"yellowgreen", CSSColor(CSSColor::RGB, 154, 205, 50, 1)}
+    {"yellowgreen", CSSColor(CSSColor::RGB, 154, 205, 50, 1)},
+    // CSS Color 4 additions and "grey" spellings
+    {"rebeccapurple", CSSColor(CSSColor::RGB, 102, 51, 153, 1)},
+    {"grey", CSSColor(CSSColor::RGB, 128, 128, 128, 1)},
+    {"darkgrey", CSSColor(CSSColor::RGB, 169, 169, 169, 1)},
+    {"darkslategrey", CSSColor(CSSColor::RGB, 47, 79, 79, 1)},
+    {"dimgrey", CSSColor(CSSColor::RGB, 105, 105, 105, 1)},
+    {"lightgrey", CSSColor(CSSColor::RGB, 211, 211, 211, 1)},
+    {"lightslategrey", CSSColor(CSSColor::RGB, 119, 136, 153, 1)},
+    {"slategrey", CSSColor(CSSColor::RGB, 112, 128, 144, 1)}
 };
 
 // CSSColor implementation
 std::string CSSColor::to_string() const {
+    // Named colors serialize as written
+    if (name != BrowserParser::null_atom) {
+        return std::string(BrowserParser::atom_name(name));
+    }
+    
     std::ostringstream ss;
     
     switch (type) {
@@ -212,7 +228,7 @@ std::string CSSColor::to_string() const {
             break;
             
         case Named:
-            ss << name;
+            ss << BrowserParser::atom_name(name);
             break;
             
         case Hex:
@@ -276,6 +292,27 @@ CSSColor CSSColor::from_hex(const std::string& hex) {
     return color;
 }
 
+bool CSSColor::is_color_keyword(std::string_view name) {
+    std::string lower_name(name);
+    std::transform(lower_name.begin(), lower_name.end(), lower_name.begin(), ::tolower);
+    if (named_colors.count(lower_name) || lower_name == "currentcolor") {
+        return true;
+    }
+    
+    // System colors, including the deprecated CSS2 ones
+    static const std::unordered_set<std::string> system_colors = {
+        "canvas", "canvastext", "linktext", "visitedtext", "activetext", "buttonface", "buttontext",
+        "buttonborder", "field", "fieldtext", "highlight", "highlighttext", "selecteditem",
+        "selecteditemtext", "mark", "marktext", "graytext", "accentcolor", "accentcolortext",
+        "activeborder", "activecaption", "appworkspace", "background", "buttonhighlight",
+        "buttonshadow", "captiontext", "inactiveborder", "inactivecaption", "inactivecaptiontext",
+        "infobackground", "infotext", "menu", "menutext", "scrollbar", "threeddarkshadow",
+        "threedface", "threedhighlight", "threedlightshadow", "threedshadow", "window",
+        "windowframe", "windowtext"
+    };
+    return system_colors.count(lower_name) > 0;
+}
+
 CSSColor CSSColor::from_name(const std::string& name) {
     std::string lower_name = name;
     std::transform(lower_name.begin(), lower_name.end(), lower_name.begin(), ::tolower);
@@ -283,79 +320,272 @@ CSSColor CSSColor::from_name(const std::string& name) {
     auto it = named_colors.find(lower_name);
     if (it != named_colors.end()) {
         CSSColor color = it->second;
-        color.name = name;
+        color.name = BrowserParser::intern_atom(name);
         return color;
     }
     
     // Return transparent if name not found
     CSSColor color(Named, 0, 0, 0, 0);
-    color.name = name;
+    color.name = BrowserParser::intern_atom(name);
     return color;
 }
 
+// Units
+namespace {
+
+struct UnitEntry {
+    std::string_view name;
+    CSSUnit unit;
+};
+
+// Indexed by CSSUnit
+constexpr UnitEntry unit_table[] = {
+    {"", CSSUnit::None}, {"%", CSSUnit::Percent},
+    {"px", CSSUnit::Px}, {"em", CSSUnit::Em}, {"rem", CSSUnit::Rem}, {"ex", CSSUnit::Ex},
+    {"ch", CSSUnit::Ch}, {"vw", CSSUnit::Vw}, {"vh", CSSUnit::Vh}, {"vmin", CSSUnit::Vmin},
+    {"vmax", CSSUnit::Vmax}, {"cm", CSSUnit::Cm}, {"mm", CSSUnit::Mm}, {"q", CSSUnit::Q},
+    {"in", CSSUnit::In}, {"pt", CSSUnit::Pt}, {"pc", CSSUnit::Pc}, {"fr", CSSUnit::Fr},
+    {"deg", CSSUnit::Deg}, {"rad", CSSUnit::Rad}, {"grad", CSSUnit::Grad}, {"turn", CSSUnit::Turn},
+    {"s", CSSUnit::S}, {"ms", CSSUnit::Ms},
+    {"hz", CSSUnit::Hz}, {"khz", CSSUnit::Khz},
+    {"dpi", CSSUnit::Dpi}, {"dpcm", CSSUnit::Dpcm}, {"dppx", CSSUnit::Dppx}, {"x", CSSUnit::X},
+};
+
+static_assert(sizeof(unit_table) / sizeof(unit_table[0]) == static_cast<size_t>(CSSUnit::Unknown),
+              "unit_table must list every named unit in enum order");
+
+bool equals_ignoring_ascii_case(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        char c = a[i];
+        if (c >= 'A' && c <= 'Z') c = static_cast<char>(c + ('a' - 'A'));
+        if (c != b[i]) return false;
+    }
+    return true;
+}
+
+} // namespace
+
+CSSUnit parse_unit(std::string_view unit) {
+    for (const auto& entry : unit_table) {
+        if (equals_ignoring_ascii_case(unit, entry.name)) return entry.unit;
+    }
+    return CSSUnit::Unknown;
+}
+
+std::string_view unit_name(CSSUnit unit) {
+    return unit < CSSUnit::Unknown ? unit_table[static_cast<size_t>(unit)].name : std::string_view();
+}
+
+ValueType unit_value_type(CSSUnit unit) {
+    switch (unit) {
+        case CSSUnit::None: return ValueType::Number;
+        case CSSUnit::Percent: return ValueType::Percentage;
+        case CSSUnit::Deg: case CSSUnit::Rad: case CSSUnit::Grad: case CSSUnit::Turn:
+            return ValueType::Angle;
+        case CSSUnit::S: case CSSUnit::Ms:
+            return ValueType::Time;
+        case CSSUnit::Hz: case CSSUnit::Khz:
+            return ValueType::Frequency;
+        case CSSUnit::Dpi: case CSSUnit::Dpcm: case CSSUnit::Dppx: case CSSUnit::X:
+            return ValueType::Resolution;
+        default:
+            return ValueType::Length; // lengths, fr, and unknown dimensions
+    }
+}
+
+// CSSValueArena implementation
+void* CSSValueArena::allocate(size_t bytes, size_t alignment) {
+    size_t padding = cursor_ ? (alignment - reinterpret_cast<uintptr_t>(cursor_) % alignment) % alignment : 0;
+    if (cursor_ == nullptr || padding + bytes > remaining_) {
+        // Oversized requests get a chunk of their own
+        size_t size = std::max(chunk_size, bytes + alignment);
+        chunks_.push_back(std::make_unique<char[]>(size));
+        reserved_ += size;
+        cursor_ = chunks_.back().get();
+        remaining_ = size;
+        padding = (alignment - reinterpret_cast<uintptr_t>(cursor_) % alignment) % alignment;
+    }
+    char* out = cursor_ + padding;
+    cursor_ = out + bytes;
+    remaining_ -= padding + bytes;
+    used_ += bytes;
+    return out;
+}
+
+std::string_view CSSValueArena::store(std::string_view text) {
+    if (text.empty()) return {};
+    char* out = static_cast<char*>(allocate(text.size(), 1));
+    std::copy(text.begin(), text.end(), out);
+    return std::string_view(out, text.size());
+}
+
+namespace {
+
+// Shortest text that reads back as the same double: 10 -> "10", 0.1 -> "0.1"
+std::string format_number(double number) {
+    char buffer[32];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), number);
+    return std::string(buffer, result.ptr);
+}
+
+} // namespace
+
 // CSSValue implementation
+static_assert(sizeof(CSSValue) == 16, "CSSValue is meant to stay two words");
+static_assert(std::is_trivially_copyable<CSSValue>::value, "CSSValues are copied as bytes");
+
+CSSValue::CSSValue(std::string_view keyword)
+    : type(ValueType::Keyword), aux_(BrowserParser::intern_atom(keyword)) {}
+
+CSSValue CSSValue::make_number(double value, CSSUnit unit, bool is_integer) {
+    CSSValue result(unit_value_type(unit));
+    result.unit_ = unit;
+    result.flags_ = is_integer ? integer_flag : 0;
+    result.number_ = value;
+    return result;
+}
+
+CSSValue CSSValue::make_dimension(double value, std::string_view unit, bool is_integer) {
+    CSSUnit parsed = parse_unit(unit);
+    CSSValue result = make_number(value, parsed, is_integer);
+    if (parsed == CSSUnit::Unknown) {
+        result.aux_ = BrowserParser::intern_atom(unit);
+    }
+    return result;
+}
+
+CSSValue CSSValue::make_text(ValueType type, std::string_view text, CSSValueArena& arena) {
+    CSSValue result(type);
+    std::string_view stored = arena.store(text);
+    result.chars_ = stored.data();
+    result.aux_ = static_cast<uint32_t>(stored.size());
+    return result;
+}
+
+CSSValue CSSValue::make_color(const CSSColor& color, CSSValueArena& arena) {
+    CSSValue result(ValueType::Color);
+    result.color_ = arena.store(&color, 1);
+    return result;
+}
+
+CSSValue CSSValue::make_list(const std::vector<CSSValue>& items, CSSValueArena& arena, bool comma_separated) {
+    CSSValue result(ValueType::List);
+    result.flags_ = comma_separated ? comma_flag : 0;
+    result.items_ = arena.store(items.data(), items.size());
+    result.aux_ = static_cast<uint32_t>(items.size());
+    return result;
+}
+
+CSSValue CSSValue::make_function(std::string_view name, const std::vector<CSSValue>& args, CSSValueArena& arena) {
+    CSSValue result(ValueType::Function);
+    result.aux_ = BrowserParser::intern_atom(name);
+    Items items{arena.store(args.data(), args.size()), static_cast<uint32_t>(args.size())};
+    result.arguments_ = arena.store(&items, 1);
+    return result;
+}
+
+CSSValue CSSValue::make_math(const CalcExpression& expression, CSSValueArena& arena) {
+    CSSValue result(ValueType::Math);
+    CalcExpression stored = expression;
+    stored.code = arena.store(expression.code, expression.size);
+    result.math_ = arena.store(&stored, 1);
+    return result;
+}
+
+std::string_view CSSValue::text() const {
+    switch (type) {
+        case ValueType::Keyword:
+        case ValueType::Function:
+            return BrowserParser::atom_name(aux_);
+        case ValueType::String:
+        case ValueType::Url:
+        case ValueType::Custom:
+            return std::string_view(chars_, aux_);
+        default:
+            return {};
+    }
+}
+
+BrowserParser::Atom CSSValue::atom() const {
+    return type == ValueType::Keyword || type == ValueType::Function ? aux_ : BrowserParser::null_atom;
+}
+
+std::string_view CSSValue::unit_text() const {
+    if (!is_numeric()) return {};
+    return unit_ == CSSUnit::Unknown ? BrowserParser::atom_name(aux_) : unit_name(unit_);
+}
+
+const CSSColor& CSSValue::color() const {
+    static const CSSColor transparent(CSSColor::Transparent, 0, 0, 0, 0);
+    return type == ValueType::Color ? *color_ : transparent;
+}
+
+size_t CSSValue::size() const {
+    if (type == ValueType::List) return aux_;
+    if (type == ValueType::Function) return arguments_->size;
+    return 0;
+}
+
+const CSSValue* CSSValue::begin() const {
+    if (type == ValueType::List) return items_;
+    if (type == ValueType::Function) return arguments_->data;
+    return nullptr;
+}
+
 std::string CSSValue::to_string() const {
     std::ostringstream ss;
     
     switch (type) {
         case ValueType::Keyword:
-            ss << string_value;
+        case ValueType::Custom:
+            ss << text();
             break;
             
         case ValueType::Number:
-            ss << numeric_value;
-            break;
-            
         case ValueType::Percentage:
-            ss << numeric_value << "%";
-            break;
-            
         case ValueType::Length:
         case ValueType::Angle:
         case ValueType::Time:
         case ValueType::Frequency:
         case ValueType::Resolution:
-            ss << numeric_value << unit;
+            ss << format_number(number_) << unit_text();
             break;
             
         case ValueType::Color:
-            ss << color_value.to_string();
+            ss << color_->to_string();
             break;
             
         case ValueType::String:
-            ss << "\"" << string_value << "\"";
+            ss << "\"" << text() << "\"";
             break;
             
         case ValueType::Url:
-            ss << "url(" << string_value << ")";
+            ss << "url(" << text() << ")";
             break;
             
-        case ValueType::Function: {
-            ss << string_value << "(";
-            bool first = true;
-            for (const auto& [key, value] : function_args) {
-                if (!first) ss << ", ";
-                if (!key.empty()) ss << key << ": ";
-                ss << value.to_string();
-                first = false;
+        case ValueType::Function:
+            ss << text() << "(";
+            for (size_t i = 0; i < size(); ++i) {
+                if (i > 0) ss << ", ";
+                ss << (*this)[i].to_string();
             }
             ss << ")";
             break;
-        }
             
-        case ValueType::List:
-            for (size_t i = 0; i < list_values.size(); ++i) {
-                if (i > 0) ss << " ";
-                ss << list_values[i].to_string();
-            }
+        case ValueType::Math:
+            ss << math_->to_string();
             break;
             
-        case ValueType::Custom:
-            ss << string_value;
+        case ValueType::List:
+            for (size_t i = 0; i < size(); ++i) {
+                if (i > 0) ss << (is_comma_separated() ? ", " : " ");
+                ss << (*this)[i].to_string();
+            }
             break;
     }
     
     return ss.str();
 }
 
-} // namespace CSS3Parser
\ No newline at end of file
+} // namespace CSS3Parser
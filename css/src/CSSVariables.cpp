@@ -0,0 +1,297 @@
+#include "CSSParser.h"
+
+namespace CSS3Parser {
+
+namespace {
+
+using Values = std::unordered_map<Atom, CSSValue>;
+
+bool is_var(const CSSValue& value) {
+    static const Atom var_atom = BrowserParser::intern_permanent_atom("var");
+    return value.is_function() && value.atom() == var_atom && value.size() > 0;
+}
+
+bool equals_ignoring_case(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        char x = a[i], y = b[i];
+        if (x >= 'A' && x <= 'Z') x = static_cast<char>(x + ('a' - 'A'));
+        if (y >= 'A' && y <= 'Z') y = static_cast<char>(y + ('a' - 'A'));
+        if (x != y) return false;
+    }
+    return true;
+}
+
+bool is_keyword(const CSSValue& value, std::string_view keyword) {
+    return value.is_keyword() && equals_ignoring_case(value.text(), keyword);
+}
+
+// The custom properties a value refers to, fallbacks included
+void collect_references(const CSSValue& value, std::vector<Atom>& names) {
+    if (value.type != ValueType::List && value.type != ValueType::Function) return;
+    if (is_var(value)) names.push_back(value[0].atom());
+    for (const CSSValue& item : value) collect_references(item, names);
+}
+
+// Rebuilds a value with every var() replaced by the variable's value, or by
+// its fallback when the variable is missing. Values are kept as groups of
+// space-separated components, split at commas, so a variable holding a list
+// splices into the surrounding value the way its tokens would have: a space
+// list joins the current group and a comma list ends it.
+class Substituter {
+public:
+    Substituter(const Values* variables, CSSValueArena& arena) : variables_(variables), arena_(arena) {}
+
+    bool run(const CSSValue& value, CSSValue& out) {
+        Groups groups(1);
+        if (!append(value, groups)) return false;
+        if (groups.size() == 1) {
+            out = join(groups[0]);
+            return true;
+        }
+        std::vector<CSSValue> items;
+        items.reserve(groups.size());
+        for (const Group& group : groups) items.push_back(join(group));
+        out = CSSValue::make_list(items, arena_, true);
+        return true;
+    }
+
+private:
+    using Group = std::vector<CSSValue>;
+    using Groups = std::vector<Group>;
+
+    const Values* variables_;
+    CSSValueArena& arena_;
+
+    CSSValue join(const Group& group) {
+        if (group.empty()) return CSSValue("");
+        if (group.size() == 1) return group[0];
+        return CSSValue::make_list(group, arena_);
+    }
+
+    bool append(const CSSValue& value, Groups& groups) {
+        if (is_var(value)) {
+            if (variables_) {
+                auto found = variables_->find(value[0].atom());
+                if (found != variables_->end()) return append(found->second, groups);
+            }
+            return value.size() > 1 && append(value[1], groups);
+        }
+        if (value.type == ValueType::List) {
+            for (size_t i = 0; i < value.size(); ++i) {
+                if (i > 0 && value.is_comma_separated()) groups.emplace_back();
+                if (!append(value[i], groups)) return false;
+            }
+            return true;
+        }
+        if (value.is_function() && contains_var(value)) return append_function(value, groups);
+        if (!value.empty()) groups.back().push_back(value);
+        return true;
+    }
+
+    bool append_function(const CSSValue& function, Groups& groups) {
+        Groups arguments(1);
+        for (size_t i = 0; i < function.size(); ++i) {
+            if (i > 0) arguments.emplace_back();
+            if (!append(function[i], arguments)) return false;
+        }
+        std::vector<CSSValue> args;
+        args.reserve(arguments.size());
+        for (const Group& argument : arguments) args.push_back(join(argument));
+
+        CSSValue result = CSSValue::make_function(function.text(), args, arena_);
+        if (CSSParser::is_math_function(std::string(function.text()))) {
+            CSSValue compiled;
+            if (!compile_math(result, arena_, compiled)) return false;
+            result = compiled;
+        }
+        groups.back().push_back(result);
+        return true;
+    }
+};
+
+// Tarjan's strongly connected components over the custom properties one
+// element declares. Components come out dependencies first, so each can be
+// resolved against a map that already holds everything it refers to.
+class DependencyGraph {
+public:
+    explicit DependencyGraph(const std::vector<const CSSDeclaration*>& declared) : nodes_(declared.size()) {
+        std::unordered_map<Atom, size_t> index;
+        for (size_t i = 0; i < declared.size(); ++i) {
+            nodes_[i].name = BrowserParser::intern_atom(declared[i]->property);
+            index.emplace(nodes_[i].name, i);
+        }
+        std::vector<Atom> references;
+        for (size_t i = 0; i < declared.size(); ++i) {
+            references.clear();
+            collect_references(declared[i]->value, references);
+            for (Atom name : references) {
+                // References to undeclared names read the inherited, already resolved map
+                auto found = index.find(name);
+                if (found != index.end()) nodes_[i].edges.push_back(found->second);
+            }
+        }
+    }
+
+    Atom name(size_t node) const { return nodes_[node].name; }
+
+    // Calls visit(members, cyclic) once per component
+    template <typename Visit>
+    void for_each_component(Visit&& visit) {
+        for (size_t i = 0; i < nodes_.size(); ++i) {
+            if (nodes_[i].index == unvisited) connect(i, visit);
+        }
+    }
+
+private:
+    static constexpr size_t unvisited = SIZE_MAX;
+
+    struct Node {
+        Atom name = BrowserParser::null_atom;
+        std::vector<size_t> edges;
+        size_t index = unvisited;
+        size_t low_link = 0;
+        bool on_stack = false;
+    };
+
+    std::vector<Node> nodes_;
+    std::vector<size_t> stack_;
+    size_t next_index_ = 0;
+
+    template <typename Visit>
+    void connect(size_t v, Visit& visit) {
+        Node& node = nodes_[v];
+        node.index = node.low_link = next_index_++;
+        stack_.push_back(v);
+        node.on_stack = true;
+
+        bool self_reference = false;
+        for (size_t w : node.edges) {
+            if (w == v) self_reference = true;
+            if (nodes_[w].index == unvisited) {
+                connect(w, visit);
+                nodes_[v].low_link = std::min(nodes_[v].low_link, nodes_[w].low_link);
+            } else if (nodes_[w].on_stack) {
+                nodes_[v].low_link = std::min(nodes_[v].low_link, nodes_[w].index);
+            }
+        }
+
+        if (nodes_[v].low_link != nodes_[v].index) return;
+        std::vector<size_t> members;
+        size_t w;
+        do {
+            w = stack_.back();
+            stack_.pop_back();
+            nodes_[w].on_stack = false;
+            members.push_back(w);
+        } while (w != v);
+        visit(members, members.size() > 1 || self_reference);
+    }
+};
+
+} // namespace
+
+const CSSValue* CustomPropertyMap::find(Atom name) const {
+    if (!data_) return nullptr;
+    auto found = data_->values.find(name);
+    return found != data_->values.end() ? &found->second : nullptr;
+}
+
+size_t VariableResolver::MapKeyHash::operator()(const MapKey& key) const {
+    size_t hash = std::hash<uint64_t>()(key.parent);
+    for (const CSSDeclaration* declaration : key.declared) {
+        hash = hash * 31 + std::hash<const CSSDeclaration*>()(declaration);
+    }
+    return hash;
+}
+
+size_t VariableResolver::SubstitutionKeyHash::operator()(const SubstitutionKey& key) const {
+    return std::hash<uint64_t>()(key.variables) * 31 + std::hash<const CSSDeclaration*>()(key.declaration);
+}
+
+CustomPropertyMap VariableResolver::inherit(const CustomPropertyMap& parent,
+                                            const std::vector<const CSSDeclaration*>& declared) {
+    if (declared.empty()) return parent;
+    BrowserParser::AtomScope atoms(&arena_.atoms());
+
+    MapKey key{parent.identity(), declared};
+    auto found = maps_.find(key);
+    if (found != maps_.end()) {
+        stats_.map_hits++;
+        return found->second;
+    }
+    stats_.maps_built++;
+
+    // Copy on write: the parent's map is shared until a declaration lands here
+    auto data = std::make_shared<CustomPropertyMap::Data>();
+    data->identity = next_identity_++;
+    if (parent.data_) data->values = parent.data_->values;
+
+    DependencyGraph graph(declared);
+    for (size_t i = 0; i < declared.size(); ++i) data->values.erase(graph.name(i));
+
+    Substituter substituter(&data->values, arena_);
+    graph.for_each_component([&](const std::vector<size_t>& members, bool cyclic) {
+        if (cyclic) {
+            stats_.cycles += members.size();
+            return;
+        }
+        size_t node = members.front();
+        const CSSValue& value = declared[node]->value;
+        if (is_keyword(value, "initial")) return;
+        if (is_keyword(value, "inherit") || is_keyword(value, "unset") || is_keyword(value, "revert") ||
+            is_keyword(value, "revert-layer")) {
+            if (const CSSValue* inherited = parent.find(graph.name(node))) {
+                data->values.emplace(graph.name(node), *inherited);
+            }
+            return;
+        }
+        CSSValue resolved;
+        if (!contains_var(value)) {
+            data->values.emplace(graph.name(node), value);
+        } else if (substituter.run(value, resolved)) {
+            data->values.emplace(graph.name(node), resolved);
+        }
+    });
+
+    CustomPropertyMap map;
+    map.data_ = std::move(data);
+    maps_.emplace(std::move(key), map);
+    return map;
+}
+
+bool VariableResolver::substitute(const CustomPropertyMap& variables, const CSSDeclaration& declaration,
+                                  CSSValue& value) {
+    BrowserParser::AtomScope atoms(&arena_.atoms());
+    SubstitutionKey key{variables.identity(), &declaration};
+    auto found = substitutions_.find(key);
+    if (found != substitutions_.end()) {
+        stats_.substitution_hits++;
+        value = found->second.value;
+        return found->second.valid;
+    }
+    stats_.substitutions++;
+
+    Substitution result;
+    Substituter substituter(variables.data_ ? &variables.data_->values : nullptr, arena_);
+    result.valid = substituter.run(declaration.value, result.value);
+
+    // A longhand pending substitution carries its whole shorthand value
+    if (result.valid && declaration.pending_substitution) {
+        CSSDeclaration shorthand(std::string(property_name(declaration.shorthand)), result.value,
+                                 declaration.important);
+        std::vector<CSSDeclaration> longhands;
+        result.valid = expand_shorthand(shorthand, arena_, longhands);
+        auto longhand = std::find_if(longhands.begin(), longhands.end(),
+                                     [&](const CSSDeclaration& decl) { return decl.id == declaration.id; });
+        result.valid = result.valid && longhand != longhands.end();
+        if (result.valid) result.value = longhand->value;
+    }
+    if (result.valid) result.valid = validate_value(declaration.id, result.value, arena_);
+
+    substitutions_.emplace(key, result);
+    value = result.value;
+    return result.valid;
+}
+
+} // namespace CSS3Parser
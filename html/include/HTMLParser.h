@@ -9,6 +9,8 @@
 #include <optional>
 #include <stdexcept>
 #include <functional>
+#include "Atom.h"
+#include "LineIndex.h"
 
 namespace HTML5Parser {
 
@@ -30,6 +32,8 @@ enum class ElementCategory {
 
 struct ParseError : public std::runtime_error {
     size_t position;
+    size_t line = 0;   // filled in from the parser's line index when recorded
+    size_t column = 0;
     ParseError(const std::string& message, size_t pos) 
         : std::runtime_error(message), position(pos) {}
 };
@@ -43,6 +47,18 @@ struct Node {
     size_t start_pos = 0;
     size_t end_pos = 0;
     
+    // Filled in by the parser so selector matching can walk the tree
+    // and compare interned names instead of strings
+    Node* parent = nullptr;
+    BrowserParser::Atom tag_atom = BrowserParser::null_atom;
+    BrowserParser::Atom id_atom = BrowserParser::null_atom;
+    std::vector<BrowserParser::Atom> class_atoms; // tokenized "class" attribute
+    uint64_t class_signature = 0;                 // OR of atom_signature_bit()
+    
+    // Set on the Document node: holds the atoms of the whole tree, which
+    // stay valid while the document does
+    std::shared_ptr<const BrowserParser::AtomLease> atoms;
+    
     Node() = default;
     Node(NodeType t) : type(t) {}
     Node(const Node&) = delete;
@@ -54,6 +70,11 @@ struct Node {
 class Parser {
 public:
     explicit Parser(const std::string& html, bool strict_mode = false);
+    
+    // The line index views html_
+    Parser(const Parser&) = delete;
+    Parser& operator=(const Parser&) = delete;
+    
     std::unique_ptr<Node> parse();
     
     struct ParseOptions {
@@ -66,11 +87,19 @@ public:
     void set_options(const ParseOptions& options) { options_ = options; }
     const std::vector<ParseError>& get_errors() const { return errors_; }
     
+    // Line and column of a byte offset; the line index is built on first use
+    BrowserParser::LineIndex::Location location(size_t offset) const { return line_index_.locate(offset); }
+    
+    // Tag, id, class and attribute-name atoms seen by the last parse()
+    const BrowserParser::AtomSet& get_document_features() const { return features_; }
+    
 private:
     std::string html_;
     size_t pos_ = 0;
     ParseOptions options_;
     std::vector<ParseError> errors_;
+    BrowserParser::LineIndex line_index_;
+    BrowserParser::AtomSet features_;
     
     static const std::unordered_set<std::string> void_elements_;
     static const std::unordered_set<std::string> raw_text_elements_;
@@ -87,6 +116,8 @@ private:
     std::unique_ptr<Node> parse_raw_text(const std::string& end_tag);
     
     void parse_attributes(std::map<std::string, std::string>& attributes);
+    void tokenize_class_list(Node& node) const;
+    void record_features(const Node& node);
     std::string parse_attribute_value();
     std::string consume_while(const std::function<bool(char)>& predicate);
     void consume_whitespace();
@@ -98,6 +129,7 @@ private:
     bool is_valid_tag_name(const std::string& name) const;
     bool is_valid_child(const std::string& parent, const std::string& child) const;
     void add_error(const std::string& message);
+    void record_error(ParseError error);
     std::string normalize_tag_name(const std::string& name) const;
     std::string decode_html_entities(const std::string& text) const;
 };
@@ -35,12 +35,17 @@ const std::map<std::string, std::unordered_set<std::string>> Parser::valid_child
 };
 
 Parser::Parser(const std::string& html, bool strict_mode) 
-    : html_(html), options_{strict_mode} {}
+    : html_(html), options_{strict_mode}, line_index_(html_) {}
 
 std::unique_ptr<Node> Parser::parse() {
     pos_ = 0;
     errors_.clear();
-    return parse_document();
+    features_.clear();
+    auto atoms = std::make_shared<BrowserParser::AtomLease>();
+    BrowserParser::AtomScope scope(atoms.get());
+    auto document = parse_document();
+    document->atoms = std::move(atoms);
+    return document;
 }
 
 std::unique_ptr<Node> Parser::parse_document() {
@@ -50,10 +55,11 @@ std::unique_ptr<Node> Parser::parse_document() {
         try {
             auto node = parse_node();
             if (node) {
+                node->parent = document.get();
                 document->children.push_back(std::move(node));
             }
         } catch (const ParseError& e) {
-            errors_.push_back(e);
+            record_error(e);
             if (options_.strict_mode) {
                 throw;
             }
@@ -122,6 +128,13 @@ std::unique_ptr<Node> Parser::parse_element() {
     node->start_pos = start_pos;
     
     parse_attributes(node->attributes);
+    node->tag_atom = BrowserParser::intern_atom(tag_name);
+    auto id_attr = node->attributes.find("id");
+    if (id_attr != node->attributes.end()) {
+        node->id_atom = BrowserParser::intern_atom(id_attr->second);
+    }
+    tokenize_class_list(*node);
+    record_features(*node);
     
     bool self_closing = consume_string("/");
     
@@ -140,6 +153,7 @@ std::unique_ptr<Node> Parser::parse_element() {
     if (category == ElementCategory::RawText || category == ElementCategory::EscapableRawText) {
         auto text_node = parse_raw_text("</" + tag_name + ">");
         if (text_node) {
+            text_node->parent = node.get();
             node->children.push_back(std::move(text_node));
         }
     } else {
@@ -162,6 +176,7 @@ std::unique_ptr<Node> Parser::parse_element() {
                     !is_valid_child(tag_name, child->tag_name)) {
                     add_error("Invalid child '" + child->tag_name + "' in '" + tag_name + "'");
                 }
+                child->parent = node.get();
                 node->children.push_back(std::move(child));
             }
             
@@ -311,6 +326,38 @@ void Parser::parse_attributes(std::map<std::string, std::string>& attributes) {
     }
 }
 
+void Parser::tokenize_class_list(Node& node) const {
+    auto class_attr = node.attributes.find("class");
+    if (class_attr == node.attributes.end()) return;
+    
+    std::string_view classes = class_attr->second;
+    size_t pos = 0;
+    while (pos < classes.size()) {
+        size_t start = classes.find_first_not_of(" \t\n\r\f", pos);
+        if (start == std::string_view::npos) break;
+        size_t end = classes.find_first_of(" \t\n\r\f", start);
+        if (end == std::string_view::npos) end = classes.size();
+        
+        BrowserParser::Atom atom = BrowserParser::intern_atom(classes.substr(start, end - start));
+        if (std::find(node.class_atoms.begin(), node.class_atoms.end(), atom) == node.class_atoms.end()) {
+            node.class_atoms.push_back(atom);
+            node.class_signature |= BrowserParser::atom_signature_bit(atom);
+        }
+        pos = end;
+    }
+}
+
+void Parser::record_features(const Node& node) {
+    features_.insert(node.tag_atom);
+    features_.insert(node.id_atom);
+    for (BrowserParser::Atom class_atom : node.class_atoms) {
+        features_.insert(class_atom);
+    }
+    for (const auto& attribute : node.attributes) {
+        features_.insert(BrowserParser::intern_atom(attribute.first));
+    }
+}
+
 std::string Parser::parse_attribute_value() {
     consume_whitespace();
     
@@ -416,7 +463,14 @@ bool Parser::is_valid_child(const std::string& parent, const std::string& child)
 }
 
 void Parser::add_error(const std::string& message) {
-    errors_.emplace_back(message, pos_);
+    record_error(ParseError(message, pos_));
+}
+
+void Parser::record_error(ParseError error) {
+    auto where = line_index_.locate(error.position);
+    error.line = where.line;
+    error.column = where.column;
+    errors_.push_back(std::move(error));
 }
 
 std::string Parser::normalize_tag_name(const std::string& name) const {
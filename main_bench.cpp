@@ -0,0 +1,1552 @@
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <functional>
+#include <cctype>
+#include <charconv>
+#include <atomic>
+#include <unordered_set>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#include "BrowserParser.h"
+
+using namespace BrowserParser;
+
+// Counts heap allocations so benchmarks can report allocations per operation,
+// and live heap bytes where the allocator can report block sizes
+static std::atomic<size_t> allocation_count{0};
+static std::atomic<size_t> live_bytes{0};
+
+inline size_t block_size(void* ptr) {
+#if defined(__GLIBC__)
+    return ptr ? malloc_usable_size(ptr) : 0;
+#else
+    (void)ptr;
+    return 0;
+#endif
+}
+
+static void* counted_malloc(std::size_t size) noexcept {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    void* ptr = std::malloc(size ? size : 1);
+    live_bytes.fetch_add(block_size(ptr), std::memory_order_relaxed);
+    return ptr;
+}
+
+static void counted_free(void* ptr) noexcept {
+    live_bytes.fetch_sub(block_size(ptr), std::memory_order_relaxed);
+    std::free(ptr);
+}
+
+// Every throwing, nothrow, array and sized form is replaced, so no block is
+// allocated by the library's operator new and released by ours (std::stable_sort
+// uses the nothrow form). Over-aligned forms keep the library pair.
+void* operator new(std::size_t size) {
+    if (void* ptr = counted_malloc(size)) return ptr;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) {
+    if (void* ptr = counted_malloc(size)) return ptr;
+    throw std::bad_alloc();
+}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return counted_malloc(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return counted_malloc(size); }
+
+// GCC cannot see that operator new above is malloc-backed
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* ptr) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { counted_free(ptr); }
+
+// Microbenchmarks for the parser and matcher hot paths. Inputs are generated
+// so runs are reproducible without fixture files.
+namespace {
+
+struct BenchResult {
+    std::string name;
+    double total_ms = 0.0;
+    size_t operations = 0;
+};
+
+BenchResult run_bench(const std::string& name, size_t iterations, const std::function<size_t()>& body) {
+    BenchResult result;
+    result.name = name;
+
+    body(); // warm-up
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        result.operations += body();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    result.total_ms = std::chrono::duration<double, std::milli>(end - start).count();
+    return result;
+}
+
+// Times several bodies against each other: each is warmed up, then they run
+// in rounds with the order rotated every round, so none always runs first on
+// cold caches or after the allocator was primed by another
+std::vector<BenchResult> run_bench_rounds(const std::vector<std::pair<std::string, std::function<size_t()>>>& bodies,
+                                          size_t rounds) {
+    std::vector<BenchResult> results(bodies.size());
+    for (size_t i = 0; i < bodies.size(); ++i) {
+        results[i].name = bodies[i].first;
+        bodies[i].second(); // warm-up
+    }
+    for (size_t round = 0; round < rounds; ++round) {
+        for (size_t k = 0; k < bodies.size(); ++k) {
+            size_t i = (round + k) % bodies.size();
+            auto start = std::chrono::high_resolution_clock::now();
+            results[i].operations += bodies[i].second();
+            auto end = std::chrono::high_resolution_clock::now();
+            results[i].total_ms += std::chrono::duration<double, std::milli>(end - start).count();
+        }
+    }
+    return results;
+}
+
+void print_result(const BenchResult& result) {
+    double ns_per_op = result.operations ? result.total_ms * 1e6 / result.operations : 0.0;
+    std::cout << "  " << std::left << std::setw(40) << result.name << std::right
+              << std::fixed << std::setprecision(2) << std::setw(10) << result.total_ms << " ms"
+              << std::setw(12) << ns_per_op << " ns/op" << std::endl;
+}
+
+void print_speedup(const BenchResult& baseline, const BenchResult& candidate) {
+    if (candidate.total_ms > 0.0) {
+        std::cout << "  speedup: " << std::fixed << std::setprecision(2)
+                  << baseline.total_ms / candidate.total_ms << "x" << std::endl;
+    }
+}
+
+std::string generate_document(size_t sections, size_t items_per_section) {
+    std::ostringstream html;
+    html << "<!DOCTYPE html><html><head><title>bench</title></head><body>";
+    for (size_t s = 0; s < sections; ++s) {
+        html << "<div id=\"section-" << s << "\" class=\"section row theme-" << (s % 4) << "\">";
+        html << "<ul class=\"list\">";
+        for (size_t i = 0; i < items_per_section; ++i) {
+            html << "<li class=\"item col-" << (i % 12) << (i % 3 == 0 ? " active" : "")
+                 << "\" data-index=\"" << i << "\"><a href=\"#item-" << i << "\" class=\"link\">"
+                 << "<span class=\"label\">Item " << i << "</span></a></li>";
+        }
+        html << "</ul></div>";
+    }
+    html << "</body></html>";
+    return html.str();
+}
+
+std::string generate_stylesheet(size_t rules) {
+    std::ostringstream css;
+    for (size_t i = 0; i < rules; ++i) {
+        switch (i % 6) {
+            case 0: css << ".col-" << (i % 12) << " { width: " << (i % 100) << "px; }\n"; break;
+            case 1: css << "#section-" << (i % 50) << " .item { color: red; }\n"; break;
+            case 2: css << ".list > li.active a { margin: 0; }\n"; break;
+            case 3: css << "div.section ul li span.label { padding: 2px; }\n"; break;
+            case 4: css << ".theme-" << (i % 4) << " .link + .label { display: block; }\n"; break;
+            case 5: css << "[data-index=\"" << (i % 20) << "\"] { border: 0; }\n"; break;
+        }
+    }
+    return css.str();
+}
+
+void collect_elements(const HTML5Parser::Node& node, std::vector<const HTML5Parser::Node*>& elements) {
+    if (node.type == HTML5Parser::NodeType::Element) {
+        elements.push_back(&node);
+    }
+    for (const auto& child : node.children) {
+        collect_elements(*child, elements);
+    }
+}
+
+void bench_selector_matching() {
+    std::cout << "\nSelector matching (object walk vs compiled bytecode)" << std::endl;
+
+    WebPageParser parser;
+    auto document = parser.parse_html(generate_document(40, 25));
+    auto stylesheet = parser.parse_css(generate_stylesheet(300));
+
+    std::vector<const HTML5Parser::Node*> elements;
+    collect_elements(*document, elements);
+    auto rules = stylesheet->get_style_rules();
+
+    auto object_walk = run_bench("ComplexSelector walk", 5, [&]() {
+        size_t operations = 0;
+        for (const auto* element : elements) {
+            for (const auto* rule : rules) {
+                for (const auto& selector : rule->selectors.selectors) {
+                    CSSMatcher::matches_selector(selector, *element, *document);
+                    ++operations;
+                }
+            }
+        }
+        return operations;
+    });
+
+    auto compiled = run_bench("CompiledSelector program", 5, [&]() {
+        size_t operations = 0;
+        for (const auto* element : elements) {
+            for (const auto* rule : rules) {
+                for (const auto& selector : rule->compiled_selectors) {
+                    CSSMatcher::matches_compiled_selector(selector, *element);
+                    ++operations;
+                }
+            }
+        }
+        return operations;
+    });
+
+    print_result(object_walk);
+    print_result(compiled);
+    print_speedup(object_walk, compiled);
+}
+
+void bench_class_matching() {
+    std::cout << "\nClass selector test (string concat + find vs atom signature)" << std::endl;
+
+    WebPageParser parser;
+    auto document = parser.parse_html(generate_document(40, 25));
+
+    std::vector<const HTML5Parser::Node*> elements;
+    collect_elements(*document, elements);
+
+    std::vector<std::string> class_names;
+    for (int i = 0; i < 12; ++i) class_names.push_back("col-" + std::to_string(i));
+    class_names.push_back("active");
+    class_names.push_back("missing");
+
+    auto string_search = run_bench("\" \" + class + \" \" find", 20, [&]() {
+        size_t operations = 0;
+        for (const auto* element : elements) {
+            auto class_attr = element->attributes.find("class");
+            for (const auto& name : class_names) {
+                if (class_attr != element->attributes.end()) {
+                    std::string class_list = " " + class_attr->second + " ";
+                    std::string target_class = " " + name + " ";
+                    volatile bool found = class_list.find(target_class) != std::string::npos;
+                    (void)found;
+                }
+                ++operations;
+            }
+        }
+        return operations;
+    });
+
+    std::vector<CSS3Parser::CompiledSelector> selectors;
+    for (const auto& name : class_names) {
+        CSS3Parser::CompoundSelector compound;
+        compound.add_selector(CSS3Parser::SimpleSelector(CSS3Parser::SelectorType::Class, name));
+        CSS3Parser::ComplexSelector complex;
+        complex.add_component(compound);
+        selectors.push_back(CSS3Parser::CompiledSelector::compile(complex));
+    }
+
+    auto atom_search = run_bench("class atoms + signature", 20, [&]() {
+        size_t operations = 0;
+        for (const auto* element : elements) {
+            for (const auto& selector : selectors) {
+                CSSMatcher::matches_compiled_selector(selector, *element);
+                ++operations;
+            }
+        }
+        return operations;
+    });
+
+    print_result(string_search);
+    print_result(atom_search);
+    print_speedup(string_search, atom_search);
+}
+
+// The string-building attribute test the matcher used before it went
+// allocation-free; kept here only as the baseline
+bool legacy_matches_attribute(const CSS3Parser::AttributeSelector& attr_sel, const HTML5Parser::Node& element) {
+    auto attr_it = element.attributes.find(attr_sel.name);
+    if (attr_it == element.attributes.end()) return false;
+    const std::string& attr_value = attr_it->second;
+
+    switch (attr_sel.match_type) {
+        case CSS3Parser::AttributeMatchType::Exists:
+            return true;
+        case CSS3Parser::AttributeMatchType::Exact:
+            return attr_value == attr_sel.value;
+        case CSS3Parser::AttributeMatchType::Include:
+            return (" " + attr_value + " ").find(" " + attr_sel.value + " ") != std::string::npos;
+        case CSS3Parser::AttributeMatchType::Dash:
+            return attr_value == attr_sel.value ||
+                   attr_value.substr(0, attr_sel.value.length() + 1) == attr_sel.value + "-";
+        case CSS3Parser::AttributeMatchType::Prefix:
+            return attr_value.substr(0, attr_sel.value.length()) == attr_sel.value;
+        case CSS3Parser::AttributeMatchType::Suffix:
+            return attr_value.length() >= attr_sel.value.length() &&
+                   attr_value.substr(attr_value.length() - attr_sel.value.length()) == attr_sel.value;
+        case CSS3Parser::AttributeMatchType::Substring:
+            return attr_value.find(attr_sel.value) != std::string::npos;
+    }
+    return false;
+}
+
+void bench_attribute_matching() {
+    std::cout << "\nAttribute selectors on a large grid (string building vs in-place SIMD)" << std::endl;
+
+    WebPageParser parser;
+    auto document = parser.parse_html(generate_document(80, 50));
+    auto stylesheet = parser.parse_css(
+        "[class*=\"col-\"] { float: left; }\n"
+        "[class*=\"theme-\"] { color: red; }\n"
+        "[class~=\"active\"] { font-weight: bold; }\n"
+        "[class^=\"item\"] { margin: 0; }\n"
+        "[href$=\"-7\"] { color: blue; }\n"
+        "[data-index|=\"1\"] { padding: 0; }\n");
+
+    std::vector<const HTML5Parser::Node*> elements;
+    collect_elements(*document, elements);
+
+    std::vector<CSS3Parser::AttributeSelector> attributes;
+    for (const auto* rule : stylesheet->get_style_rules()) {
+        for (const auto& compiled : rule->compiled_selectors) {
+            for (const auto& attribute : compiled.attributes) {
+                attributes.push_back(attribute.selector);
+            }
+        }
+    }
+
+    // Folded twin of the case-sensitive rules; the old matcher ignored the flag
+    std::vector<CSS3Parser::AttributeSelector> folded = attributes;
+    for (auto& attribute : folded) {
+        for (auto& c : attribute.value) c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+        attribute.case_insensitive = true;
+    }
+
+    size_t legacy_hits = 0, hits = 0, folded_hits = 0;
+    auto count_matches = [&](const std::vector<CSS3Parser::AttributeSelector>& selectors, size_t& matched,
+                             bool (*matches)(const CSS3Parser::AttributeSelector&, const HTML5Parser::Node&)) {
+        size_t operations = 0;
+        matched = 0;
+        for (const auto* element : elements) {
+            for (const auto& attribute : selectors) {
+                matched += matches(attribute, *element);
+                ++operations;
+            }
+        }
+        return operations;
+    };
+    auto results = run_bench_rounds({
+        {"substr / concat + find", [&]() { return count_matches(attributes, legacy_hits, legacy_matches_attribute); }},
+        {"in-place SIMD", [&]() {
+            return count_matches(attributes, hits, CSSMatcher::matches_attribute_selector);
+        }},
+        {"in-place SIMD, 'i' flag", [&]() {
+            return count_matches(folded, folded_hits, CSSMatcher::matches_attribute_selector);
+        }},
+    }, 20);
+    const BenchResult& legacy = results[0];
+    const BenchResult& in_place = results[1];
+    const BenchResult& case_folded = results[2];
+
+    print_result(legacy);
+    print_result(in_place);
+    print_result(case_folded);
+    print_speedup(legacy, in_place);
+    std::cout << "  matches: " << legacy_hits << " / " << hits << " / " << folded_hits << std::endl;
+}
+
+// A framework-sized sheet where only the grid and list rules apply to the page
+std::string generate_framework_stylesheet(size_t components) {
+    std::ostringstream css;
+    css << generate_stylesheet(60);
+    for (size_t i = 0; i < components; ++i) {
+        css << ".btn-" << i << ":hover { color: red; }\n";
+        css << ".card-" << i << " .card-body > p { margin: 0; }\n";
+        css << "#modal-" << i << " .modal-header { padding: 4px; }\n";
+        css << "nav.navbar-" << i << " a { display: block; }\n";
+        css << "[data-toggle-" << i << "] { cursor: pointer; }\n";
+    }
+    return css.str();
+}
+
+void bench_rule_pruning() {
+    std::cout << "\nStyle computation with a framework stylesheet (all rules vs feature-pruned)" << std::endl;
+
+    WebPageParser parser;
+    std::string html = generate_document(20, 20);
+    html.insert(html.find("</head>"), "<style>" + generate_framework_stylesheet(400) + "</style>");
+    ParsedDocument document = parser.parse_html_with_css(html);
+
+    std::cout << "  rules kept: " << document.rule_set.entries().size() << " of "
+              << document.rule_set.total_rules() << std::endl;
+
+    // A second parse of the same page carries the unpruned rules
+    ParsedDocument unpruned = parser.parse_html_with_css(html);
+    unpruned.rule_set = RuleSet::build(unpruned.stylesheets);
+    auto results = run_bench_rounds({
+        {"compute_all_styles, all rules", [&]() {
+            StyleEngine engine(unpruned);
+            return engine.compute_all_styles().size();
+        }},
+        {"compute_all_styles, pruned", [&]() {
+            StyleEngine engine(document);
+            return engine.compute_all_styles().size();
+        }},
+    }, 3);
+    const BenchResult& all_rules = results[0];
+    const BenchResult& pruned_rules = results[1];
+
+    print_result(all_rules);
+    print_result(pruned_rules);
+    print_speedup(all_rules, pruned_rules);
+}
+
+void bench_tokenizer() {
+    std::cout << "\nTokenizing a ~1 MB framework stylesheet (zero-copy tokens)" << std::endl;
+
+    std::string css;
+    while (css.size() < (1u << 20)) {
+        css += generate_framework_stylesheet(400);
+    }
+    css += ".esc\\61pe { content: \"quote\\\"d\"; }\n"; // escapes take the side-buffer path
+
+    size_t tokens = 0;
+    size_t allocations = 0;
+    auto tokenize = run_bench("CSSTokenizer::next_token", 5, [&]() {
+        size_t before = allocation_count.load();
+        CSS3Parser::CSSTokenizer tokenizer(css);
+        tokens = 0;
+        while (tokenizer.next_token().type != CSS3Parser::TokenType::EOF_TOKEN) {
+            ++tokens;
+        }
+        allocations = allocation_count.load() - before;
+        return tokens;
+    });
+
+    print_result(tokenize);
+    double mb_per_s = tokenize.total_ms > 0.0 ? (css.size() * 5 / 1048576.0) / (tokenize.total_ms / 1000.0) : 0.0;
+    std::cout << "  " << tokens << " tokens, " << std::fixed << std::setprecision(1) << mb_per_s << " MB/s, "
+              << allocations << " allocations per pass" << std::endl;
+}
+
+void bench_parser() {
+    std::cout << "\nParsing a ~1 MB framework stylesheet (bounded lookahead)" << std::endl;
+
+    std::string css;
+    while (css.size() < (1u << 20)) {
+        css += generate_framework_stylesheet(400);
+    }
+
+    size_t rules = 0;
+    auto parse = run_bench("CSSParser::parse_stylesheet", 3, [&]() {
+        CSS3Parser::CSSParser parser(css);
+        rules = parser.parse_stylesheet()->rules.size();
+        return rules;
+    });
+
+    print_result(parse);
+    double mb_per_s = parse.total_ms > 0.0 ? (css.size() * 3 / 1048576.0) / (parse.total_ms / 1000.0) : 0.0;
+    std::cout << "  " << rules << " rules, " << std::fixed << std::setprecision(1) << mb_per_s
+              << " MB/s, lookahead " << sizeof(CSS3Parser::Token) * CSS3Parser::CSSTokenizer::lookahead_capacity
+              << " bytes regardless of input size" << std::endl;
+}
+
+void bench_parser_front_ends() {
+    std::cout << "\nParser front ends on a ~1 MB stylesheet (pull tokenizer vs token array pre-pass)" << std::endl;
+
+    std::string css;
+    while (css.size() < (1u << 20)) {
+        css += generate_framework_stylesheet(400);
+    }
+
+    auto pull = run_bench("pull-based CSSTokenizer", 3, [&]() {
+        CSS3Parser::CSSParser parser(css);
+        return parser.parse_stylesheet()->rules.size();
+    });
+
+    CSS3Parser::CSSParser::ParseOptions options;
+    options.token_prepass = true;
+    auto prepass = run_bench("CSSTokenArray pre-pass", 3, [&]() {
+        CSS3Parser::CSSParser parser(css, options);
+        return parser.parse_stylesheet()->rules.size();
+    });
+
+    // The pre-pass on its own: one tight loop over the input
+    size_t array_bytes = 0;
+    size_t token_count = 0;
+    auto fill = run_bench("CSSTokenArray::build only", 5, [&]() {
+        CSS3Parser::CSSTokenizer tokenizer(css);
+        CSS3Parser::CSSTokenArray tokens;
+        tokens.build(tokenizer);
+        array_bytes = tokens.memory_usage();
+        token_count = tokens.size();
+        return token_count;
+    });
+
+    print_result(pull);
+    print_result(prepass);
+    print_speedup(pull, prepass);
+    print_result(fill);
+    double mb = css.size() / 1048576.0;
+    std::cout << "  pull " << std::fixed << std::setprecision(1) << (mb * 3) / (pull.total_ms / 1000.0)
+              << " MB/s, pre-pass " << (mb * 3) / (prepass.total_ms / 1000.0) << " MB/s, array fill "
+              << (mb * 5) / (fill.total_ms / 1000.0) << " MB/s" << std::endl;
+    CSS3Parser::CSSParser pulled(css);
+    CSS3Parser::CSSParser prepassed(css, options);
+    bool identical = pulled.parse_stylesheet()->to_string() == prepassed.parse_stylesheet()->to_string();
+    std::cout << "  " << token_count << " tokens in " << array_bytes / 1024 << " KiB of arrays ("
+              << std::setprecision(1) << double(array_bytes) / token_count << " bytes/token), output "
+              << (identical ? "identical" : "DIFFERS") << std::endl;
+}
+
+// Unminified framework source: license banner, doc comments, indentation
+std::string generate_unminified_stylesheet(size_t components) {
+    std::ostringstream css;
+    css << "/*!\n";
+    for (int line = 0; line < 40; ++line) {
+        css << " * Permission is hereby granted, free of charge, to any person obtaining a copy of this software\n";
+    }
+    css << " */\n\n";
+    for (size_t i = 0; i < components; ++i) {
+        css << "/* ==========================================================================\n"
+            << "   Component " << i << ": buttons and cards\n"
+            << "   ========================================================================== */\n\n"
+            << ".btn-" << i << " {\n"
+            << "    display: inline-block;    /* keeps the baseline */\n"
+            << "    padding: 6px 12px;\n"
+            << "    color: #333333;\n"
+            << "}\n\n"
+            << ".card-" << i << " .card-body {\n"
+            << "    margin: 0;\n"
+            << "    border-radius: 4px;\n"
+            << "}\n\n";
+    }
+    return css.str();
+}
+
+void bench_trivia_skipping() {
+    std::cout << "\nUnminified ~1 MB stylesheet (whitespace and comment skipping)" << std::endl;
+
+    std::string css;
+    while (css.size() < (1u << 20)) {
+        css += generate_unminified_stylesheet(1000);
+    }
+
+    size_t tokens = 0;
+    auto tokenize = [&]() {
+        CSS3Parser::CSSTokenizer tokenizer(css);
+        tokens = 0;
+        while (tokenizer.next_token().type != CSS3Parser::TokenType::EOF_TOKEN) {
+            ++tokens;
+        }
+        return size_t(1);
+    };
+    size_t rules = 0;
+    auto parse = [&]() {
+        CSS3Parser::CSSParser parser(css);
+        rules = parser.parse_stylesheet()->rules.size();
+        return size_t(1);
+    };
+    
+    // The same runs with the scans forced onto the byte loop
+    auto scalar = [](const std::function<size_t()>& body) {
+        return [body]() {
+            CSS3Parser::CSSTokenizer::set_vector_scanning(false);
+            size_t result = body();
+            CSS3Parser::CSSTokenizer::set_vector_scanning(true);
+            return result;
+        };
+    };
+    auto tokenize_results = run_bench_rounds({
+        {"CSSTokenizer::next_token, scalar", scalar(tokenize)},
+        {"CSSTokenizer::next_token, SSE2", tokenize},
+    }, 5);
+    auto parse_results = run_bench_rounds({
+        {"CSSParser::parse_stylesheet, scalar", scalar(parse)},
+        {"CSSParser::parse_stylesheet, SSE2", parse},
+    }, 3);
+
+    double mb = css.size() / 1048576.0;
+    for (const auto* results : {&tokenize_results, &parse_results}) {
+        for (const auto& result : *results) {
+            print_result(result);
+            std::cout << "    " << std::fixed << std::setprecision(1)
+                      << (mb * result.operations) / (result.total_ms / 1000.0) << " MB/s" << std::endl;
+        }
+        print_speedup((*results)[0], (*results)[1]);
+    }
+    std::cout << "  " << tokens << " tokens, " << rules << " rules" << std::endl;
+}
+
+// Declarations with the value shapes real stylesheets use: keywords,
+// lengths, colors, comma lists and functions
+std::string generate_declaration_heavy_stylesheet(size_t rules) {
+    std::ostringstream css;
+    for (size_t i = 0; i < rules; ++i) {
+        css << ".c" << i << " { display: block; margin: 0 auto; padding: " << (i % 16) << "px 8px; "
+            << "color: #33" << (i % 10) << "; font-family: \"Helvetica Neue\", Arial, sans-serif; "
+            << "background: url(img/" << i << ".png) no-repeat; transform: translate(" << (i % 50)
+            << "px, 4px); z-index: " << i << "; }\n";
+    }
+    return css.str();
+}
+
+size_t count_declarations(const CSS3Parser::CSSStyleSheet& sheet) {
+    size_t count = 0;
+    for (auto* rule : sheet.get_style_rules()) {
+        count += rule->declarations.size();
+    }
+    return count;
+}
+
+void bench_value_memory() {
+    std::cout << "\nMemory per declaration on a ~1 MB stylesheet (compact CSSValue)" << std::endl;
+
+    std::string css;
+    while (css.size() < (1u << 20)) {
+        css += generate_declaration_heavy_stylesheet(2000);
+    }
+
+    size_t before = live_bytes.load();
+    std::unique_ptr<CSS3Parser::CSSStyleSheet> sheet;
+    {
+        CSS3Parser::CSSParser parser(css);
+        sheet = parser.parse_stylesheet();
+    }
+    size_t retained = live_bytes.load() - before;
+    size_t declarations = count_declarations(*sheet);
+    size_t arena_bytes = 0;
+    for (const auto& arena : sheet->arenas) {
+        arena_bytes += arena->bytes_reserved();
+    }
+
+    std::cout << "  sizeof(CSSValue) " << sizeof(CSS3Parser::CSSValue) << " bytes, sizeof(CSSDeclaration) "
+              << sizeof(CSS3Parser::CSSDeclaration) << " bytes" << std::endl;
+    std::cout << "  " << declarations << " declarations, " << retained / 1024 << " KiB retained ("
+              << retained / std::max<size_t>(declarations, 1) << " bytes/declaration, arena "
+              << arena_bytes / 1024 << " KiB)" << std::endl;
+}
+
+void bench_shorthand_expansion() {
+    std::cout << "\nShorthand expansion at parse time (~1 MB stylesheet)" << std::endl;
+
+    std::ostringstream shorthands;
+    for (size_t i = 0; i < 2000; ++i) {
+        shorthands << ".s" << i << " { border: " << (i % 4) << "px solid #ccc; font: italic "
+                   << (10 + i % 8) << "px/1.4 Georgia, serif; flex: 1 1 " << (i % 100)
+                   << "px; transition: opacity .3s ease, transform 1s; }\n";
+    }
+    std::string css;
+    while (css.size() < (1u << 20)) {
+        css += generate_declaration_heavy_stylesheet(1000) + shorthands.str();
+    }
+
+    CSS3Parser::CSSParser::ParseOptions kept;
+    kept.expand_shorthands = false;
+    std::unique_ptr<CSS3Parser::CSSStyleSheet> unexpanded;
+    size_t longhands = 0;
+    auto parses = run_bench_rounds({
+        {"parse, shorthands kept (per rule)", [&]() {
+            CSS3Parser::CSSParser parser(css, kept);
+            unexpanded = parser.parse_stylesheet();
+            return unexpanded->get_style_rules().size();
+        }},
+        {"parse, shorthands expanded (per rule)", [&]() {
+            CSS3Parser::CSSParser parser(css);
+            auto sheet = parser.parse_stylesheet();
+            longhands = count_declarations(*sheet);
+            return sheet->get_style_rules().size();
+        }},
+    }, 3);
+    const BenchResult& parse_kept = parses[0];
+    const BenchResult& parse_expanded = parses[1];
+
+    // What each element would pay if the cascade re-read shorthands itself
+    std::vector<const CSS3Parser::CSSDeclaration*> shorthand_declarations;
+    for (auto* rule : unexpanded->get_style_rules()) {
+        for (const auto& decl : rule->declarations) {
+            if (CSS3Parser::property_info(decl.id).is_shorthand()) shorthand_declarations.push_back(&decl);
+        }
+    }
+    CSS3Parser::CSSValueArena arena;
+    std::vector<CSS3Parser::CSSDeclaration> out;
+    auto expand = run_bench("expand_shorthand, per declaration", 5, [&]() {
+        for (const auto* decl : shorthand_declarations) {
+            out.clear();
+            CSS3Parser::expand_shorthand(*decl, arena, out);
+        }
+        return shorthand_declarations.size();
+    });
+
+    print_result(parse_kept);
+    print_result(parse_expanded);
+    print_result(expand);
+    double overhead_us = (parse_expanded.total_ms - parse_kept.total_ms) * 1e3 / 3 / shorthand_declarations.size();
+    std::cout << "  " << shorthand_declarations.size() << " shorthands expanded once into " << longhands
+              << " declarations; parse time " << std::fixed << std::setprecision(2)
+              << parse_expanded.total_ms / parse_kept.total_ms << "x, " << overhead_us
+              << " us per shorthand, paid per sheet where the cascade would pay the per-declaration time per matched element"
+              << std::endl;
+}
+
+void bench_number_lexing() {
+    std::cout << "\nNumber lexing (stod + to_string vs from_chars on the lexeme)" << std::endl;
+
+    std::ostringstream css;
+    for (size_t i = 0; i < 20000; ++i) {
+        css << ".n" << i << " { width: " << (i % 997) << "." << (i % 10) << "px; opacity: 0."
+            << (i % 100) << "; z-index: " << i << "; line-height: 1.25e1px; }\n";
+    }
+    std::string text = css.str();
+
+    // Collect the numeric lexemes once so both sides convert the same text
+    CSS3Parser::CSSTokenizer tokenizer(text);
+    std::vector<std::string_view> lexemes;
+    for (auto token = tokenizer.next_token(); token.type != CSS3Parser::TokenType::EOF_TOKEN;
+         token = tokenizer.next_token()) {
+        if (token.type == CSS3Parser::TokenType::Number || token.type == CSS3Parser::TokenType::Dimension) {
+            lexemes.push_back(token.value.substr(0, token.value.size() - token.unit.size()));
+        }
+    }
+
+    size_t legacy_allocations = 0;
+    auto legacy = run_bench("std::stod + std::to_string", 20, [&]() {
+        size_t before = allocation_count.load();
+        for (auto lexeme : lexemes) {
+            std::string digits(lexeme);
+            std::string repr = std::to_string(std::stod(digits)); // "12.500000"
+            volatile size_t length = repr.size();
+            (void)length;
+        }
+        legacy_allocations = allocation_count.load() - before;
+        return lexemes.size();
+    });
+
+    size_t allocations = 0;
+    auto from_chars = run_bench("std::from_chars, lexeme kept", 20, [&]() {
+        size_t before = allocation_count.load();
+        for (auto lexeme : lexemes) {
+            double number = 0.0;
+            std::from_chars(lexeme.data(), lexeme.data() + lexeme.size(), number);
+            volatile double sink = number;
+            (void)sink;
+        }
+        allocations = allocation_count.load() - before;
+        return lexemes.size();
+    });
+
+    print_result(legacy);
+    print_result(from_chars);
+    print_speedup(legacy, from_chars);
+    std::cout << "  allocations per pass: " << legacy_allocations << " vs " << allocations << std::endl;
+}
+
+void bench_property_lookup() {
+    std::cout << "\nProperty name lookup (string set + substr vs perfect hash)" << std::endl;
+
+    // Every known name, plus prefixed, custom and unknown spellings
+    std::vector<std::string> names;
+    for (size_t i = 2; i < CSS3Parser::property_count; ++i) {
+        std::string name(CSS3Parser::property_name(static_cast<CSS3Parser::PropertyId>(i)));
+        names.push_back(name);
+        if (i % 8 == 0) names.push_back("-webkit-" + name);
+    }
+    names.push_back("--brand-color");
+    names.push_back("colour");
+    names.push_back("-ms-not-a-property");
+
+    // What CSSParser::is_valid_property used to do
+    std::unordered_set<std::string> legacy_set;
+    for (size_t i = 2; i < CSS3Parser::property_count; ++i) {
+        legacy_set.emplace(CSS3Parser::property_name(static_cast<CSS3Parser::PropertyId>(i)));
+    }
+    auto legacy_valid = [&](const std::string& property) {
+        if (property.substr(0, 2) == "--") return true;
+        for (const char* prefix : {"-webkit-", "-moz-", "-ms-", "-o-"}) {
+            std::string p(prefix);
+            if (property.substr(0, p.length()) == p) {
+                std::string unprefixed = property.substr(p.length());
+                return legacy_set.count(unprefixed) > 0 || legacy_set.count(property) > 0;
+            }
+        }
+        return legacy_set.count(property) > 0;
+    };
+
+    size_t legacy_allocations = 0;
+    size_t legacy_known = 0;
+    auto legacy = run_bench("unordered_set + substr", 2000, [&]() {
+        size_t before = allocation_count.load();
+        legacy_known = 0;
+        for (const auto& name : names) {
+            legacy_known += legacy_valid(name);
+        }
+        legacy_allocations = allocation_count.load() - before;
+        return names.size();
+    });
+
+    size_t allocations = 0;
+    size_t known = 0;
+    auto hashed = run_bench("property_id (perfect hash)", 2000, [&]() {
+        size_t before = allocation_count.load();
+        known = 0;
+        for (const auto& name : names) {
+            known += CSS3Parser::property_id(name) != CSS3Parser::PropertyId::Unknown;
+        }
+        allocations = allocation_count.load() - before;
+        return names.size();
+    });
+
+    print_result(legacy);
+    print_result(hashed);
+    print_speedup(legacy, hashed);
+    std::cout << "  allocations per pass: " << legacy_allocations << " vs " << allocations
+              << ", known names " << legacy_known << " vs " << known << std::endl;
+}
+
+// Rules with the kind of mistakes that reach production: typos, swapped values and units where keywords belong
+std::string generate_sloppy_stylesheet(size_t rules) {
+    std::ostringstream css;
+    for (size_t i = 0; i < rules; ++i) {
+        css << ".r" << i << " { width: " << (i % 100)
+            << "px; color: " << (i % 2 ? "red" : "redish") << "; display: " << (i % 4 ? "flex" : "flexbox")
+            << "; margin-top: " << (i % 3 ? "4px" : "solid") << "; opacity: 0.9; z-index: " << (i % 5 ? "2" : "2.5")
+            << "; background: " << (i % 6 ? "#fff" : "12px") << " url(bg.png) no-repeat; }\n";
+    }
+    return css.str();
+}
+
+void bench_value_validation() {
+    std::cout << "\nValue validation against the property grammars" << std::endl;
+
+    std::string css = generate_sloppy_stylesheet(2000);
+    CSS3Parser::CSSParser::ParseOptions unchecked;
+    unchecked.validate_values = false;
+
+    size_t unchecked_declarations = 0;
+    auto parse_unchecked = run_bench("parse, values unchecked (per decl)", 5, [&]() {
+        CSS3Parser::CSSParser parser(css, unchecked);
+        unchecked_declarations = count_declarations(*parser.parse_stylesheet());
+        return unchecked_declarations;
+    });
+
+    size_t checked_declarations = 0;
+    auto parse_checked = run_bench("parse, values validated (per decl)", 5, [&]() {
+        CSS3Parser::CSSParser parser(css);
+        checked_declarations = count_declarations(*parser.parse_stylesheet());
+        return unchecked_declarations;
+    });
+
+    // The validator on its own, over values that have already been parsed
+    CSS3Parser::CSSParser source(css, unchecked);
+    auto sheet = source.parse_stylesheet();
+    std::vector<CSS3Parser::CSSDeclaration> declarations;
+    for (auto* rule : sheet->get_style_rules()) {
+        declarations.insert(declarations.end(), rule->declarations.begin(), rule->declarations.end());
+    }
+    CSS3Parser::CSSValueArena arena;
+    auto validate = run_bench("validate_value (per decl)", 20, [&]() {
+        for (const auto& decl : declarations) {
+            CSS3Parser::CSSValue value = decl.value;
+            CSS3Parser::validate_value(decl.id, value, arena);
+        }
+        return declarations.size();
+    });
+
+    print_result(parse_unchecked);
+    print_result(parse_checked);
+    print_result(validate);
+    std::cout << "  " << unchecked_declarations - checked_declarations << " of " << unchecked_declarations
+              << " declarations dropped at parse time instead of being cascaded for every matching element"
+              << std::endl;
+}
+
+void bench_math_functions() {
+    std::cout << "\nMath functions (re-parse per use vs compiled stack code)" << std::endl;
+
+    const char* expressions[] = {
+        "calc(100% - 20px)", "calc(2 * (1in + 4px) - 50%)", "min(10px, 5vw)", "clamp(1rem, 2.5vw, 2rem)",
+        "calc((100% - 3 * 16px) / 4)", "max(50%, calc(300px + 2em))", "calc(100vh - 56px - 2rem)",
+        "calc(min(10px, 5vw) * 2 + 1em)",
+    };
+    std::ostringstream css;
+    for (size_t i = 0; i < 20000; ++i) {
+        css << ".m" << i << " { width: " << expressions[i % 8] << "; }\n";
+    }
+    std::string text = css.str();
+
+    std::unique_ptr<CSS3Parser::CSSStyleSheet> sheet;
+    auto parse = run_bench("parse + compile (per declaration)", 3, [&]() {
+        CSS3Parser::CSSParser parser(text);
+        sheet = parser.parse_stylesheet();
+        return count_declarations(*sheet);
+    });
+
+    std::vector<const CSS3Parser::CalcExpression*> compiled;
+    size_t instructions = 0;
+    for (auto* rule : sheet->get_style_rules()) {
+        for (const auto& decl : rule->declarations) {
+            if (decl.value.is_math()) {
+                compiled.push_back(decl.value.math());
+                instructions += decl.value.math()->size;
+            }
+        }
+    }
+
+    // Every element resolves its widths against its own percentage basis
+    CSS3Parser::CalcContext context;
+    context.viewport_width = 1280;
+    context.viewport_height = 720;
+    double sink = 0.0;
+    auto evaluate = run_bench("evaluate compiled (per expression)", 50, [&]() {
+        for (const auto* expression : compiled) {
+            context.percentage_basis += 1.0;
+            sink += expression->evaluate(context);
+        }
+        return compiled.size();
+    });
+
+    // What a consumer of the old "expression" string had to do on every use
+    std::vector<std::string> sources;
+    for (size_t i = 0; i < 2000; ++i) sources.push_back(expressions[i % 8]);
+    auto reparse = run_bench("re-parse text, then evaluate", 3, [&]() {
+        for (const auto& source : sources) {
+            CSS3Parser::CSSParser parser(source);
+            CSS3Parser::CSSValue value = parser.parse_value();
+            context.percentage_basis += 1.0;
+            if (value.is_math()) sink += value.math()->evaluate(context);
+        }
+        return sources.size();
+    });
+
+    print_result(parse);
+    print_result(reparse);
+    print_result(evaluate);
+    double reparse_ns = reparse.total_ms * 1e6 / std::max<size_t>(reparse.operations, 1);
+    double evaluate_ns = evaluate.total_ms * 1e6 / std::max<size_t>(evaluate.operations, 1);
+    std::cout << "  speedup per use: " << std::fixed << std::setprecision(2) << reparse_ns / evaluate_ns << "x"
+              << std::endl;
+    std::cout << "  " << std::fixed << std::setprecision(2)
+              << static_cast<double>(instructions) / std::max<size_t>(compiled.size(), 1)
+              << " instructions per expression after folding (checksum " << std::setprecision(0) << sink << ")"
+              << std::endl;
+}
+
+// Design-token stylesheet: hundreds of variables on :root, read through var()
+// by the component rules. With literal = true every var() is written out as
+// the value it would resolve to, which is the cost floor for the same cascade.
+std::string generate_token_stylesheet(size_t tokens, bool literal) {
+    std::map<std::string, std::string> values;
+    std::ostringstream root;
+    root << ":root {";
+    for (size_t i = 0; i < tokens / 3; ++i) {
+        std::ostringstream color, space, size;
+        color << "#" << std::hex << std::setw(6) << std::setfill('0') << (i * 0x10203 & 0xFFFFFF);
+        space << (i % 40) << "px";
+        size << "calc(" << ((i % 20) * 2) << "px + 1em)";
+        values["--color-" + std::to_string(i)] = color.str();
+        values["--space-" + std::to_string(i)] = space.str();
+        values["--size-" + std::to_string(i)] = size.str();
+        root << " --color-" << i << ": " << color.str() << "; --space-" << i << ": " << space.str()
+             << "; --size-" << i << ": calc(var(--space-" << (i % 20) << ") * 2 + 1em);";
+    }
+    root << " }\n";
+
+    auto token = [&](const std::string& name) { return literal ? values[name] : "var(" + name + ")"; };
+    std::ostringstream css;
+    if (!literal) css << root.str();
+    for (size_t theme = 0; theme < 4; ++theme) {
+        std::string accent = "--color-" + std::to_string(theme * 7);
+        css << ".theme-" << theme << " { ";
+        if (!literal) css << "--accent: var(" << accent << "); ";
+        css << "color: " << (literal ? values[accent] : "var(--accent)") << "; }\n";
+        css << ".theme-" << theme << " .link { border: 1px solid " << (literal ? values[accent] : "var(--accent)")
+            << "; }\n";
+    }
+    css << ".item { padding: " << token("--space-1") << " " << token("--space-2") << "; margin: "
+        << token("--size-3") << "; }\n";
+    for (size_t col = 0; col < 12; ++col) {
+        css << ".col-" << col << " { width: calc(" << (col + 1) * 8 << "% - " << token("--space-" + std::to_string(col))
+            << "); background-color: " << token("--color-" + std::to_string(col + 20)) << "; }\n";
+    }
+    css << ".label { font-size: " << token("--space-12") << "; line-height: " << token("--size-4") << "; }\n";
+    css << ".active { background-color: " << token("--color-9") << "; }\n";
+    return css.str();
+}
+
+void bench_custom_properties() {
+    std::cout << "\nCustom properties (literal values vs var() resolved per element)" << std::endl;
+
+    WebPageParser parser;
+    std::string html = generate_document(20, 20);
+    auto with_sheet = [&](bool literal) {
+        std::string page = html;
+        page.insert(page.find("</head>"), "<style>" + generate_token_stylesheet(300, literal) + "</style>");
+        return parser.parse_html_with_css(page);
+    };
+    ParsedDocument literal_document = with_sheet(true);
+    ParsedDocument token_document = with_sheet(false);
+
+    auto literal = run_bench("compute_all_styles, literal values", 5, [&]() {
+        StyleEngine engine(literal_document);
+        return engine.compute_all_styles().size();
+    });
+    CSS3Parser::VariableResolver::Stats stats;
+    auto tokens = run_bench("compute_all_styles, 300 tokens + var()", 5, [&]() {
+        StyleEngine engine(token_document);
+        size_t elements = engine.compute_all_styles().size();
+        stats = engine.variable_stats();
+        return elements;
+    });
+
+    print_result(literal);
+    print_result(tokens);
+    std::cout << "  var() overhead: " << std::fixed << std::setprecision(2) << tokens.total_ms / literal.total_ms
+              << "x; per run " << stats.maps_built << " maps built, " << stats.map_hits << " shared, "
+              << stats.substitutions << " substitutions, " << stats.substitution_hits << " memo hits" << std::endl;
+}
+
+// Responsive framework sheet: every component restyled at five breakpoints,
+// in one @media block per breakpoint as frameworks ship them
+std::string generate_responsive_stylesheet(size_t components) {
+    static const char* breakpoints[] = {
+        "(min-width: 576px)", "(min-width: 768px)", "screen and (min-width: 992px)", "(1200px <= width)",
+        "(min-width: 1400px) and (orientation: landscape)",
+    };
+    std::ostringstream css;
+    for (size_t i = 0; i < components; ++i) css << ".col-" << (i % 12) << ".c" << i << " { width: 100%; }\n";
+    for (const char* breakpoint : breakpoints) {
+        css << "@media " << breakpoint << " {\n";
+        for (size_t i = 0; i < components; ++i) css << "  .col-" << (i % 12) << " .c" << i << " { width: 50%; }\n";
+        css << "}\n";
+    }
+    css << "@media print { .item { display: none; } }\n";
+    return css.str();
+}
+
+void bench_media_queries() {
+    std::cout << "\nMedia queries (evaluate per rule vs cached condition bits)" << std::endl;
+
+    WebPageParser parser;
+    std::string html = generate_document(20, 20);
+    html.insert(html.find("</head>"), "<style>" + generate_responsive_stylesheet(300) + "</style>");
+    ParsedDocument document = parser.parse_html_with_css(html);
+    document.rule_set = RuleSet::build(document.stylesheets);
+    const RuleSet& rules = document.rule_set;
+
+    std::vector<const HTML5Parser::Node*> elements;
+    collect_elements(*document.html_document, elements);
+    CSS3Parser::MediaEnvironment phone;
+    phone.width = 390;
+    phone.height = 844;
+
+    // Deciding which rules are in play for each element of the document
+    auto per_rule = run_bench("evaluate each rule's queries", 3, [&]() {
+        size_t live = 0;
+        for (size_t e = 0; e < elements.size(); ++e) {
+            for (const auto& entry : rules.entries()) {
+                bool holds = true;
+                for (uint32_t c = entry.media; holds && c != 0; c = rules.media_conditions()[c].parent) {
+                    holds = rules.media_conditions()[c].query->evaluate(phone);
+                }
+                live += holds;
+            }
+        }
+        return live;
+    });
+    auto cached = run_bench("condition bits, skip whole blocks", 3, [&]() {
+        MediaMatches media = rules.evaluate_media(phone);
+        size_t live = 0;
+        const auto& entries = rules.entries();
+        for (size_t e = 0; e < elements.size(); ++e) {
+            for (size_t i = 0; i < entries.size(); ++i) {
+                if (!media.test(entries[i].media)) {
+                    i = entries[i].block_end - 1;
+                    continue;
+                }
+                live++;
+            }
+        }
+        return live;
+    });
+
+    CSS3Parser::MediaEnvironment desktop;
+    auto styles = run_bench("compute_all_styles, phone then desktop", 3, [&]() {
+        StyleEngine engine(document);
+        engine.set_environment(phone);
+        size_t count = engine.compute_all_styles().size();
+        engine.set_environment(desktop);
+        return count + engine.compute_all_styles().size();
+    });
+
+    std::cout << "  " << rules.entries().size() << " rules under " << rules.media_conditions().size() - 1
+              << " media conditions, " << elements.size() << " elements" << std::endl;
+    print_result(per_rule);
+    print_result(cached);
+    print_speedup(per_rule, cached);
+    print_result(styles);
+}
+
+void bench_multi_viewport() {
+    std::cout << "\nResponsive snapshot at three viewports (three passes vs one)" << std::endl;
+
+    // A base sheet with every breakpoint re-laying out the same components
+    std::string css = generate_stylesheet(600);
+    size_t step = 0;
+    for (const char* breakpoint : {"(min-width: 576px)", "(min-width: 768px)", "(min-width: 992px)"}) {
+        std::ostringstream block;
+        block << "@media " << breakpoint << " {\n";
+        for (size_t i = 0; i < 120; ++i) {
+            switch (i % 4) {
+                case 0: block << ".col-" << (i % 12) << " { width: " << (i % 12 + 1) * 8 << "%; }\n"; break;
+                case 1: block << ".section { padding: " << step * 8 << "px; }\n"; break;
+                case 2: block << ".list > li.active a { margin: " << step << "px; }\n"; break;
+                case 3: block << ".theme-" << (i % 4) << " .link { display: inline-block; }\n"; break;
+            }
+        }
+        block << "}\n";
+        css += block.str();
+        step++;
+    }
+    WebPageParser parser;
+    std::string html = generate_document(20, 20);
+    html.insert(html.find("</head>"), "<style>" + css + "</style>");
+    ParsedDocument document = parser.parse_html_with_css(html);
+
+    std::vector<CSS3Parser::MediaEnvironment> viewports(3);
+    viewports[0].width = 390;
+    viewports[0].height = 844;
+    viewports[1].width = 820;
+    viewports[1].height = 1180;
+
+    // ns/op is per element styled, so the three-viewport runs count each element three times
+    auto results = run_bench_rounds({
+        {"compute_all_styles, one viewport", [&]() {
+            StyleEngine engine(document);
+            engine.set_environment(viewports.back());
+            return engine.compute_all_styles().size();
+        }},
+        {"compute_all_styles per viewport", [&]() {
+            StyleEngine engine(document);
+            size_t count = 0;
+            for (const auto& viewport : viewports) {
+                engine.set_environment(viewport);
+                count += engine.compute_all_styles().size();
+            }
+            return count;
+        }},
+        {"compute_all_styles(viewports)", [&]() {
+            StyleEngine engine(document);
+            size_t count = 0;
+            for (const auto& styles : engine.compute_all_styles(viewports)) count += styles.size();
+            return count;
+        }},
+    }, 5);
+    const BenchResult& single = results[0];
+    const BenchResult& separate = results[1];
+    const BenchResult& shared = results[2];
+
+    print_result(single);
+    print_result(separate);
+    print_result(shared);
+    print_speedup(separate, shared);
+    if (single.total_ms > 0.0) {
+        std::cout << "  cost of three viewports in one pass: " << std::fixed << std::setprecision(2)
+                  << shared.total_ms / single.total_ms << "x one viewport" << std::endl;
+    }
+}
+
+// Progressive enhancement: every component ships a fallback and an enhanced
+// version behind @supports, one of which the engine does not support
+std::string generate_feature_query_stylesheet(size_t components, const char* unsupported) {
+    std::ostringstream css;
+    for (size_t i = 0; i < components; ++i) {
+        css << "@supports (display: grid) and (gap: 1rem) {\n"
+            << "  .section .col-" << (i % 12) << " { display: grid; gap: 1rem; }\n"
+            << "  .list > li.item:nth-child(" << i % 7 + 1 << ") a { margin: " << i % 9 << "px; }\n}\n";
+        css << "@supports " << unsupported << " {\n"
+            << "  .section .col-" << (i % 12) << " { float: left; width: " << (i % 50) << "%; }\n"
+            << "  .list > li.item a .label { padding: " << i % 5 << "px; }\n}\n";
+    }
+    return css.str();
+}
+
+void bench_feature_queries() {
+    std::cout << "\n@supports fallbacks (retained vs pruned at load)" << std::endl;
+
+    std::string html = generate_document(20, 20);
+    std::string pruned_css = generate_feature_query_stylesheet(400, "(display: -ms-grid-nonsense)");
+    std::string kept_css = generate_feature_query_stylesheet(400, "(float: left)");
+
+    size_t kept_rules = 0, pruned_rules = 0;
+    auto load = [&](const std::string& css, size_t& rules) {
+        WebPageParser parser;
+        std::string page = html;
+        page.insert(page.find("</head>"), "<style>" + css + "</style>");
+        ParsedDocument document = parser.parse_html_with_css(page);
+        rules = document.rule_set.entries().size();
+        return document;
+    };
+    ParsedDocument kept = load(kept_css, kept_rules);
+    ParsedDocument pruned = load(pruned_css, pruned_rules);
+
+    auto parse_kept = run_bench("parse, both branches hold", 5, [&]() {
+        CSS3Parser::CSSParser parser(kept_css);
+        return parser.parse_stylesheet()->rules.size();
+    });
+    auto parse_pruned = run_bench("parse, fallbacks pruned", 5, [&]() {
+        CSS3Parser::CSSParser parser(pruned_css);
+        return parser.parse_stylesheet()->rules.size();
+    });
+    auto styles_kept = run_bench("compute_all_styles, both branches", 3, [&]() {
+        StyleEngine engine(kept);
+        return engine.compute_all_styles().size();
+    });
+    auto styles_pruned = run_bench("compute_all_styles, fallbacks pruned", 3, [&]() {
+        StyleEngine engine(pruned);
+        return engine.compute_all_styles().size();
+    });
+
+    std::cout << "  rule set entries: " << kept_rules << " with both branches, " << pruned_rules
+              << " with fallbacks pruned" << std::endl;
+    print_result(parse_kept);
+    print_result(parse_pruned);
+    print_speedup(parse_kept, parse_pruned);
+    print_result(styles_kept);
+    print_result(styles_pruned);
+    print_speedup(styles_kept, styles_pruned);
+}
+
+// A design system split into cascade layers, with components styled through
+// @scope; flat repeats the same rules without the at-rules around them
+std::string generate_layered_stylesheet(size_t components, bool flat) {
+    std::ostringstream css;
+    if (!flat) css << "@layer reset, base, components, utilities;\n";
+    const char* layers[] = {"reset", "base", "components", "utilities"};
+    for (size_t i = 0; i < components; ++i) {
+        const char* layer = layers[i % 4];
+        if (!flat) css << "@layer " << layer << " {\n";
+        css << "  .section .col-" << (i % 12) << " { margin: " << (i % 9) << "px; }\n"
+            << "  .list > li.item a { padding: " << (i % 5) << "px; }\n";
+        if (!flat) css << "}\n";
+
+        if (flat) {
+            css << ".theme-" << (i % 4) << " .link { color: red; }\n";
+        } else {
+            css << "@scope (.theme-" << (i % 4) << ") to (.label) {\n  .link { color: red; }\n}\n";
+        }
+    }
+    return css.str();
+}
+
+void bench_layers_and_scope() {
+    std::cout << "\n@layer and @scope (ranked through cascade keys)" << std::endl;
+
+    std::string html = generate_document(20, 20);
+    auto load = [&](bool flat) {
+        WebPageParser parser;
+        std::string page = html;
+        page.insert(page.find("</head>"), "<style>" + generate_layered_stylesheet(400, flat) + "</style>");
+        return parser.parse_html_with_css(page);
+    };
+    ParsedDocument flat = load(true);
+    ParsedDocument layered = load(false);
+
+    auto styles_flat = run_bench("compute_all_styles, flat", 3, [&]() {
+        StyleEngine engine(flat);
+        return engine.compute_all_styles().size();
+    });
+    auto styles_layered = run_bench("compute_all_styles, layered + scoped", 3, [&]() {
+        StyleEngine engine(layered);
+        return engine.compute_all_styles().size();
+    });
+
+    std::cout << "  rule set entries: " << flat.rule_set.entries().size() << " flat, "
+              << layered.rule_set.entries().size() << " layered" << std::endl;
+    print_result(styles_flat);
+    print_result(styles_layered);
+    print_speedup(styles_flat, styles_layered);
+}
+
+// Component styles written with nesting, and the same rules flattened by hand
+std::string generate_nested_stylesheet(size_t components, bool nested) {
+    std::ostringstream css;
+    for (size_t i = 0; i < components; ++i) {
+        std::string section = ".theme-" + std::to_string(i % 4) + " .section";
+        if (nested) {
+            css << section << " {\n  margin: " << (i % 9) << "px;\n"
+                << "  & .list > li.item { padding: " << (i % 5) << "px; }\n"
+                << "  .col-" << (i % 12) << " a, .active a { color: red; }\n"
+                << "  &.row .label { display: block; }\n}\n";
+        } else {
+            css << section << " { margin: " << (i % 9) << "px; }\n"
+                << section << " .list > li.item { padding: " << (i % 5) << "px; }\n"
+                << section << " .col-" << (i % 12) << " a, " << section << " .active a { color: red; }\n"
+                << section << ".row .label { display: block; }\n";
+        }
+    }
+    return css.str();
+}
+
+void bench_nesting() {
+    std::cout << "\nNested style rules (flattened at parse time)" << std::endl;
+
+    std::string html = generate_document(20, 20);
+    std::string nested_css = generate_nested_stylesheet(400, true);
+    std::string flat_css = generate_nested_stylesheet(400, false);
+    auto load = [&](const std::string& css) {
+        WebPageParser parser;
+        std::string page = html;
+        page.insert(page.find("</head>"), "<style>" + css + "</style>");
+        return parser.parse_html_with_css(page);
+    };
+    ParsedDocument flat = load(flat_css);
+    ParsedDocument nested = load(nested_css);
+
+    auto parse_flat = run_bench("parse, flattened by hand", 5, [&]() {
+        CSS3Parser::CSSParser parser(flat_css);
+        return parser.parse_stylesheet()->rules.size();
+    });
+    auto parse_nested = run_bench("parse, nested", 5, [&]() {
+        CSS3Parser::CSSParser parser(nested_css);
+        return parser.parse_stylesheet()->rules.size();
+    });
+    auto styles_flat = run_bench("compute_all_styles, flattened by hand", 3, [&]() {
+        StyleEngine engine(flat);
+        return engine.compute_all_styles().size();
+    });
+    auto styles_nested = run_bench("compute_all_styles, nested", 3, [&]() {
+        StyleEngine engine(nested);
+        return engine.compute_all_styles().size();
+    });
+
+    std::cout << "  source: " << flat_css.size() / 1024 << " KB flattened, " << nested_css.size() / 1024
+              << " KB nested; rule set entries: " << flat.rule_set.entries().size() << " and "
+              << nested.rule_set.entries().size() << std::endl;
+    print_result(parse_flat);
+    print_result(parse_nested);
+    print_speedup(parse_flat, parse_nested);
+    print_result(styles_flat);
+    print_result(styles_nested);
+    print_speedup(styles_flat, styles_nested);
+}
+
+// An animation library: @keyframes blocks of over a hundred steps, with a broken step and a
+// broken declaration in each so error recovery scales along with the rest
+std::string generate_animation_library(size_t animations, size_t& keyframes) {
+    std::ostringstream css;
+    keyframes = 0;
+    for (size_t i = 0; i < animations; ++i) {
+        css << "@keyframes anim-" << i << " {\n";
+        for (size_t step = 0; step <= 100; ++step) {
+            css << "  " << step << "% { transform: translateX(" << step << "px); opacity: 0." << step % 10
+                << "; margin: " << i % 7 << "px auto; }\n";
+        }
+        css << "  from, to { top: 0; left: 0 }\n"
+            << "  bogus { top: 1px }\n"
+            << "  52% { color: red {x} ; top: 1px }\n}\n";
+        css << ".anim-" << i << " { animation: anim-" << i << " 1s; color: red; : oops; padding: 0 }\n";
+        keyframes += 103; // 0% to 100%, "from, to" and the second 52%
+    }
+    return css.str();
+}
+
+void bench_parse_scaling() {
+    std::cout << "\nParse time against input size (animation library, no truncation)" << std::endl;
+
+    std::vector<std::pair<double, double>> points; // MB, ms
+    for (size_t animations : {160, 320, 640}) {
+        size_t expected = 0;
+        std::string css = generate_animation_library(animations, expected);
+
+        size_t keyframes = 0;
+        auto parse = run_bench("parse " + std::to_string(animations) + " animations", 3, [&]() {
+            CSS3Parser::CSSParser parser(css);
+            auto sheet = parser.parse_stylesheet();
+            keyframes = 0;
+            for (const auto& rule : sheet->rules) {
+                if (rule->type == CSS3Parser::RuleType::AtRule) {
+                    keyframes += static_cast<const CSS3Parser::AtRule&>(*rule).rules.size();
+                }
+            }
+            return css.size();
+        });
+
+        double mb = css.size() / 1048576.0;
+        points.emplace_back(mb, parse.total_ms);
+        std::cout << "  " << std::fixed << std::setprecision(1) << mb << " MB: " << keyframes << " of " << expected
+                  << " keyframes kept" << std::endl;
+        print_result(parse);
+    }
+    double per_mb_small = points.front().second / points.front().first;
+    double per_mb_large = points.back().second / points.back().first;
+    std::cout << "  ms per MB, " << std::setprecision(1) << points.back().first << " MB vs "
+              << points.front().first << " MB: " << std::setprecision(2) << per_mb_large / per_mb_small
+              << " (1.00 is linear)" << std::endl;
+}
+
+void bench_parallel_parse() {
+    std::cout << "\nParallel parsing of a ~4 MB stylesheet (" << std::thread::hardware_concurrency() << " hardware threads)"
+              << std::endl;
+
+    size_t keyframes = 0;
+    std::string css = generate_animation_library(320, keyframes);
+    while (css.size() < (4u << 20)) {
+        css += generate_framework_stylesheet(400);
+    }
+
+    auto parse_with = [&](size_t threads, std::string& text, size_t& errors) {
+        CSS3Parser::CSSParser::ParseOptions options;
+        options.parse_threads = threads;
+        CSS3Parser::CSSParser parser(css, options);
+        auto sheet = parser.parse_stylesheet();
+        text = sheet->to_string();
+        errors = parser.get_errors().size();
+        return sheet->rules.size();
+    };
+    std::string sequential_text, parallel_text;
+    size_t sequential_errors = 0, parallel_errors = 0;
+    parse_with(1, sequential_text, sequential_errors);
+    parse_with(0, parallel_text, parallel_errors);
+
+    auto parse = [&](size_t threads) {
+        CSS3Parser::CSSParser::ParseOptions options;
+        options.parse_threads = threads;
+        CSS3Parser::CSSParser parser(css, options);
+        return parser.parse_stylesheet()->rules.size();
+    };
+    auto sequential = run_bench("parse, one thread", 3, [&]() { return parse(1); });
+    auto four = run_bench("parse, parse_threads = 4", 3, [&]() { return parse(4); });
+    auto every_core = run_bench("parse, one chunk per core", 3, [&]() { return parse(0); });
+
+    std::cout << "  " << std::fixed << std::setprecision(1) << css.size() / 1048576.0 << " MB, "
+              << sequential_errors << " errors; output and errors "
+              << (sequential_text == parallel_text && sequential_errors == parallel_errors ? "match" : "DIFFER")
+              << std::endl;
+    print_result(sequential);
+    print_result(four);
+    print_speedup(sequential, four);
+    print_result(every_core);
+    print_speedup(sequential, every_core);
+}
+
+void bench_stylesheet_cache() {
+    std::cout << "\nA corpus of 40 pages sharing one framework stylesheet (fresh parse vs StyleSheetCache)"
+              << std::endl;
+
+    std::string framework = "<style>" + generate_framework_stylesheet(400) + "</style>";
+    std::vector<std::string> pages;
+    for (size_t i = 0; i < 40; ++i) {
+        std::string page = generate_document(10, 10);
+        page.insert(page.find("</head>"), framework + "<style>.page-" + std::to_string(i) + " { color: red; }</style>");
+        pages.push_back(std::move(page));
+    }
+
+    auto load_corpus = [&](bool cache) {
+        WebPageParser::ParseOptions options;
+        options.cache_stylesheets = cache;
+        WebPageParser parser(options);
+        size_t rules = 0;
+        for (const std::string& page : pages) rules += parser.parse_html_with_css(page).rule_set.total_rules();
+        return rules;
+    };
+    size_t fresh_rules = 0, cached_rules = 0;
+    auto fresh = run_bench("parse_html_with_css, fresh CSSParser", 1, [&]() {
+        fresh_rules = load_corpus(false);
+        return pages.size();
+    });
+    StyleSheetCache::shared().clear();
+    auto cached = run_bench("parse_html_with_css, cached sheets", 1, [&]() {
+        cached_rules = load_corpus(true);
+        return pages.size();
+    });
+
+    StyleSheetCache::Stats stats = StyleSheetCache::shared().stats();
+    std::cout << "  cache: " << stats.hits << " hits, " << stats.misses << " misses, " << stats.entries
+              << " entries, " << stats.bytes / 1024 << " KB of " << StyleSheetCache::shared().byte_budget() / 1048576
+              << " MB; rules " << (fresh_rules == cached_rules ? "match" : "DIFFER") << std::endl;
+    print_result(fresh);
+    print_result(cached);
+    print_speedup(fresh, cached);
+}
+
+} // namespace
+
+void bench_line_lookup() {
+    std::cout << "\nResolving 1000 positions to lines in a ~1 MB stylesheet" << std::endl;
+
+    std::string css;
+    while (css.size() < (1u << 20)) {
+        css += generate_framework_stylesheet(400);
+    }
+    std::vector<size_t> offsets;
+    for (size_t i = 0; i < 1000; ++i) {
+        offsets.push_back((i * 7919u * 131u) % css.size());
+    }
+
+    // What CSSTokenizer::reset used to do for every position
+    size_t legacy_lines = 0;
+    auto rescan = run_bench("rescan prefix per position", 1, [&]() {
+        legacy_lines = 0;
+        for (size_t offset : offsets) {
+            size_t line = 1;
+            for (size_t i = 0; i < offset; ++i) {
+                if (css[i] == '\n') line++;
+            }
+            legacy_lines += line;
+        }
+        return offsets.size();
+    });
+
+    size_t indexed_lines = 0;
+    auto indexed = run_bench("LineIndex, built per pass", 1, [&]() {
+        BrowserParser::LineIndex index(css);
+        indexed_lines = 0;
+        for (size_t offset : offsets) {
+            indexed_lines += index.locate(offset).line;
+        }
+        return offsets.size();
+    });
+
+    print_result(rescan);
+    print_result(indexed);
+    print_speedup(rescan, indexed);
+    std::cout << "  results " << (legacy_lines == indexed_lines ? "match" : "DIFFER") << std::endl;
+}
+
+int main() {
+    std::cout << "Browser Parser Microbenchmarks" << std::endl;
+    std::cout << "==============================" << std::endl;
+
+    bench_selector_matching();
+    bench_class_matching();
+    bench_attribute_matching();
+    bench_rule_pruning();
+    bench_tokenizer();
+    bench_parser();
+    bench_parser_front_ends();
+    bench_trivia_skipping();
+    bench_value_memory();
+    bench_shorthand_expansion();
+    bench_number_lexing();
+    bench_property_lookup();
+    bench_value_validation();
+    bench_math_functions();
+    bench_custom_properties();
+    bench_media_queries();
+    bench_multi_viewport();
+    bench_feature_queries();
+    bench_layers_and_scope();
+    bench_nesting();
+    bench_parse_scaling();
+    bench_parallel_parse();
+    bench_stylesheet_cache();
+    bench_line_lookup();
+
+    return 0;
+}
@@ -34,34 +34,22 @@ public:
         
         WebPageParser parser(options);
         
+        // Linked files go in with the page so they share its layer order and rule set
+        std::vector<std::string> linked_stylesheets;
+        if (!css_file.empty()) {
+            std::cout << "🎨 Parsing external stylesheet: " << css_file << std::endl;
+            linked_stylesheets.push_back(read_file(css_file));
+        }
+        
         // Parse HTML file
         std::cout << "\n📄 Parsing web document: " << html_file << std::endl;
-        auto document = parser.parse_html_file(html_file);
+        auto document = parser.parse_html_file(html_file, linked_stylesheets);
         
         if (!document.html_document) {
             std::cerr << "❌ Failed to parse HTML document" << std::endl;
             return;
         }
         
-        // Parse additional CSS file if provided
-        if (!css_file.empty()) {
-            std::cout << "🎨 Parsing external stylesheet: " << css_file << std::endl;
-            std::string css_content = read_file(css_file);
-            if (!css_content.empty()) {
-                CSS3Parser::CSSParser css_parser(css_content, options.css_options);
-                auto stylesheet = css_parser.parse_stylesheet();
-                
-                if (stylesheet) {
-                    document.stylesheets.push_back(std::move(stylesheet));
-                }
-                
-                // Collect external CSS parse errors
-                for (const auto& error : css_parser.get_errors()) {
-                    document.parse_errors.push_back("External CSS: " + error.message);
-                }
-            }
-        }
-        
         // Display comprehensive parsing results
         display_parsing_summary(document);
         display_html_analysis(document);
@@ -105,6 +93,7 @@ private:
         std::cout << "📊 HTML Elements: " << document.stats.html_elements << std::endl;
         std::cout << "🎨 CSS Stylesheets: " << document.stylesheets.size() << std::endl;
         std::cout << "📋 CSS Rules: " << document.stats.css_rules << std::endl;
+        std::cout << "✂️  Rules Pruned: " << document.stats.css_rules_pruned << std::endl;
         std::cout << "🎯 CSS Declarations: " << document.stats.css_declarations << std::endl;
         std::cout << "💄 Inline Styles: " << document.inline_styles.size() << std::endl;
         std::cout << "⚠️  Parse Errors: " << document.parse_errors.size() << std::endl;
@@ -196,7 +185,8 @@ private:
         std::cout << "----------------------------------------" << std::endl;
         
         std::cout << "🎨 Style Sources:" << std::endl;
-        std::cout << "   External Stylesheets: " << document.stylesheets.size() << std::endl;
+        std::cout << "   Internal Stylesheets: " << document.stylesheets.size() - document.linked_stylesheets << std::endl;
+        std::cout << "   External Stylesheets: " << document.linked_stylesheets << std::endl;
         std::cout << "   Inline Styles: " << document.inline_styles.size() << std::endl;
         
         if (!document.parse_errors.empty()) {
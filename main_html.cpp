@@ -67,7 +67,8 @@ int main(int argc, char* argv[]) {
     if (!errors.empty()) {
         std::cout << "\n=== Parse Errors ===" << std::endl;
         for (const auto& error : errors) {
-            std::cout << "Error: " << error.what() << std::endl;
+            std::cout << "Error: " << error.what() << " at line " << error.line
+                      << ", column " << error.column << std::endl;
         }
     }
     
@@ -0,0 +1,48 @@
+#ifndef BROWSER_TEST_SUPPORT_H
+#define BROWSER_TEST_SUPPORT_H
+
+#include <chrono>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+
+// Minimal checks for the regression tests: a failed EXPECT reports where it
+// failed and the test keeps going; finish() turns the tally into an exit code
+namespace TestSupport {
+
+inline int& failures() {
+    static int count = 0;
+    return count;
+}
+
+inline void expect(bool passed, const char* condition, const char* file, int line) {
+    if (passed) return;
+    ++failures();
+    std::cerr << file << ":" << line << ": expected " << condition << std::endl;
+}
+
+// Runs work on another thread and gives up on the whole program if it
+// does not return in time, so a parser that loops forever fails the test
+// instead of hanging the run
+template <typename Work>
+bool finishes(Work&& work, const char* what, std::chrono::seconds limit = std::chrono::seconds(5)) {
+    auto done = std::async(std::launch::async, std::forward<Work>(work));
+    if (done.wait_for(limit) == std::future_status::ready) return true;
+    std::cerr << "  timed out: " << what << std::endl;
+    std::_Exit(1);
+}
+
+inline int finish(const char* name) {
+    if (failures() == 0) {
+        std::cout << "  " << name << ": ok" << std::endl;
+        return 0;
+    }
+    std::cerr << "  " << name << ": " << failures() << " failure(s)" << std::endl;
+    return 1;
+}
+
+} // namespace TestSupport
+
+#define EXPECT(condition) TestSupport::expect((condition), #condition, __FILE__, __LINE__)
+
+#endif // BROWSER_TEST_SUPPORT_H
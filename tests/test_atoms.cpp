@@ -0,0 +1,84 @@
+#include "BrowserParser.h"
+#include "TestSupport.h"
+
+using namespace BrowserParser;
+
+namespace {
+
+std::string unique_page(int i) {
+    std::string n = std::to_string(i);
+    return "<html><head><style>.c" + n + " #i" + n + "{color:red} x-" + n + "{margin:1px}</style></head>"
+           "<body><div class=c" + n + " id=i" + n + " data-" + n + "=y><x-" + n + ">t</x-" + n + "></div></body></html>";
+}
+
+void test_sets_hold_large_ids() {
+    AtomSet set;
+    EXPECT(set.empty());
+    EXPECT(set.insert(7));
+    EXPECT(!set.insert(7));
+    EXPECT(set.insert(4000000000u));
+    EXPECT(!set.insert(null_atom));
+    for (Atom atom = 100; atom < 200; ++atom) set.insert(atom * 1024);
+    EXPECT(set.size() == 102);
+    EXPECT(set.contains(7) && set.contains(4000000000u) && set.contains(150 * 1024));
+    EXPECT(!set.contains(8) && !set.contains(null_atom) && !set.contains(150 * 1024 + 1));
+}
+
+void test_leases_release_and_recycle() {
+    size_t before = AtomTable::instance().size();
+    Atom leased;
+    {
+        AtomLease lease;
+        AtomScope scope(&lease);
+        leased = intern_atom("lease-only-name");
+        EXPECT(intern_atom("lease-only-name") == leased);
+        EXPECT(atom_name(leased) == "lease-only-name");
+        EXPECT(AtomTable::instance().size() == before + 1);
+    }
+    EXPECT(find_atom("lease-only-name") == null_atom);
+    EXPECT(AtomTable::instance().size() == before);
+    {
+        // The freed id is handed out again
+        AtomLease lease;
+        AtomScope scope(&lease);
+        EXPECT(intern_atom("another-lease-only-name") == leased);
+    }
+
+    // A permanent atom survives the lease that interned it first
+    Atom kept;
+    {
+        AtomLease lease;
+        AtomScope scope(&lease);
+        kept = intern_atom("pinned-name");
+        EXPECT(intern_permanent_atom("pinned-name") == kept);
+    }
+    EXPECT(find_atom("pinned-name") == kept);
+}
+
+void test_documents_do_not_grow_the_table() {
+    WebPageParser::ParseOptions options;
+    options.cache_stylesheets = false;
+    WebPageParser parser(options);
+    {
+        ParsedDocument warm = parser.parse_html_with_css(unique_page(0));
+        EXPECT(warm.document_features.contains(find_atom("c0")));
+        EXPECT(warm.document_features.contains(find_atom("data-0")));
+        EXPECT(warm.rule_set.entries().size() == 2);
+    }
+    size_t baseline = AtomTable::instance().size();
+    for (int i = 1; i <= 500; ++i) {
+        ParsedDocument document = parser.parse_html_with_css(unique_page(i));
+        EXPECT(document.rule_set.entries().size() == 2);
+    }
+    EXPECT(find_atom("c250") == null_atom);
+    EXPECT(AtomTable::instance().size() <= baseline);
+}
+
+} // namespace
+
+int main() {
+    test_sets_hold_large_ids();
+    test_leases_release_and_recycle();
+    test_documents_do_not_grow_the_table();
+    return TestSupport::finish("atoms");
+}
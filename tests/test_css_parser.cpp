@@ -0,0 +1,377 @@
+#include "CSSParser.h"
+#include "TestSupport.h"
+#include <cmath>
+#include <limits>
+
+using namespace CSS3Parser;
+
+namespace {
+
+struct Parsed {
+    std::unique_ptr<CSSStyleSheet> sheet;
+    size_t errors = 0;
+};
+
+Parsed parse(const std::string& css, bool token_prepass) {
+    CSSParser::ParseOptions options;
+    options.token_prepass = token_prepass;
+    CSSParser parser(css, options);
+    Parsed parsed;
+    parsed.sheet = parser.parse_stylesheet();
+    parsed.errors = parser.get_errors().size();
+    return parsed;
+}
+
+const StyleRule* style_rule(const CSSStyleSheet& sheet, size_t index) {
+    if (index >= sheet.rules.size() || sheet.rules[index]->type != RuleType::Style) return nullptr;
+    return static_cast<const StyleRule*>(sheet.rules[index].get());
+}
+
+void test_custom_property_blocks(bool token_prepass) {
+    Parsed parsed = parse("a{--x: { a: b }; color: red} b{--y:{c:d} !important}", token_prepass);
+    EXPECT(parsed.errors == 0);
+    const StyleRule* a = style_rule(*parsed.sheet, 0);
+    EXPECT(a && a->declarations.size() == 2);
+    if (a && a->declarations.size() == 2) {
+        EXPECT(a->declarations[0].property == "--x");
+        EXPECT(a->declarations[0].value.type == ValueType::Custom);
+        EXPECT(a->declarations[0].value.text() == "{ a: b }");
+        EXPECT(a->declarations[1].property == "color");
+    }
+    const StyleRule* b = style_rule(*parsed.sheet, 1);
+    EXPECT(b && b->declarations.size() == 1);
+    if (b && b->declarations.size() == 1) {
+        EXPECT(b->declarations[0].value.text() == "{c:d}");
+        EXPECT(b->declarations[0].important);
+    }
+}
+
+void test_blocks_do_not_start_nested_rules(bool token_prepass) {
+    // The block belongs to --x; the rule after it is still nested
+    Parsed parsed = parse("a{--x:{b:c}; &:hover{color:red} color:blue}", token_prepass);
+    EXPECT(parsed.errors == 0);
+    const StyleRule* a = style_rule(*parsed.sheet, 0);
+    EXPECT(a && a->declarations.size() == 1 && a->declarations[0].property == "--x");
+    EXPECT(parsed.sheet->rules.size() == 3);
+}
+
+void test_plain_custom_values_stay_typed(bool token_prepass) {
+    Parsed parsed = parse("a{--gap: 4px 2px; --c: var(--d, red)}", token_prepass);
+    EXPECT(parsed.errors == 0);
+    const StyleRule* a = style_rule(*parsed.sheet, 0);
+    EXPECT(a && a->declarations.size() == 2);
+    if (a && a->declarations.size() == 2) {
+        EXPECT(a->declarations[0].value.type == ValueType::List);
+        EXPECT(a->declarations[1].value.is_function());
+    }
+}
+
+// The array derives most values from token offsets; every value must still
+// match what the tokenizer handed out, escapes and odd lexemes included
+void test_token_array_values() {
+    const std::string css =
+        "@media screen{a#x.b\\31 c:hover::before{content:'q\\'t' \"d\";background:url( a\\)b.png )}}"
+        " @\\66oo x(1px,2e3%,-.5em) u+0-7f #\\41 b <!-- --> |= ~= url(  plain.png  ) 'open";
+    CSSTokenizer reference(css);
+    CSSTokenizer source(css);
+    CSSTokenArray tokens;
+    tokens.build(source);
+    for (size_t i = 0;; ++i) {
+        Token expected = reference.next_token();
+        if (i >= tokens.size()) {
+            EXPECT(i < tokens.size());
+            break;
+        }
+        Token actual = tokens.token(i);
+        EXPECT(actual.type == expected.type);
+        EXPECT(actual.value == expected.value);
+        EXPECT(actual.start_pos == expected.start_pos && actual.end_pos == expected.end_pos);
+        if (expected.type == TokenType::EOF_TOKEN) {
+            EXPECT(i + 1 == tokens.size());
+            break;
+        }
+    }
+}
+
+// Runs of every length around the 16-byte block, comments whose "*/" falls
+// on and across block edges, and an unterminated comment at the end
+void test_vector_and_scalar_scans_agree() {
+    std::string css;
+    for (size_t length = 0; length < 40; ++length) {
+        css += "a" + std::string(length, " \t\n\r\f"[length % 5]) + "b";
+        css += "/*" + std::string(length, length % 2 ? '*' : '/') + "*/c \r\n";
+    }
+    css += "d /* open";
+    
+    auto tokens = [&](bool vector) {
+        CSSTokenizer::set_vector_scanning(vector);
+        CSSTokenizer tokenizer(css);
+        std::vector<std::pair<TokenType, size_t>> out;
+        for (Token token = tokenizer.next_token();; token = tokenizer.next_token()) {
+            out.emplace_back(token.type, token.end_pos);
+            if (token.type == TokenType::EOF_TOKEN) break;
+        }
+        return out;
+    };
+    auto scalar = tokens(false);
+    auto vector = tokens(true);
+    EXPECT(CSSTokenizer::vector_scanning());
+    EXPECT(scalar.size() > 200);
+    EXPECT(scalar == vector);
+}
+
+// Plain lexemes view the tokenizer's buffer; decoded ones live in stable
+// storage of the tokenizer. Neither depends on the caller's string
+void test_tokens_view_the_source() {
+    auto css = std::make_unique<std::string>(".nav-item{content:\"plain\";--x:\\66oo 'a\\'b' 12px}");
+    CSSTokenizer tokenizer(*css);
+    css.reset();
+    std::string_view input = tokenizer.input();
+    auto inside = [&](std::string_view value) {
+        return value.data() >= input.data() && value.data() + value.size() <= input.data() + input.size();
+    };
+    
+    std::vector<Token> tokens;
+    for (Token token = tokenizer.next_token(); token.type != TokenType::EOF_TOKEN; token = tokenizer.next_token()) {
+        tokens.push_back(token);
+    }
+    std::vector<std::string> values;
+    for (const Token& token : tokens) {
+        if (token.type != TokenType::Whitespace) values.emplace_back(token.value);
+    }
+    EXPECT((values == std::vector<std::string>{".", "nav-item", "{", "content", ":", "plain", ";", "--x", ":",
+                                               "foo", "a'b", "12px", "}"}));
+    for (const Token& token : tokens) {
+        bool escaped = token.value == "foo" || token.value == "a'b";
+        EXPECT(inside(token.value) != escaped);
+        if (token.type == TokenType::Dimension) EXPECT(token.unit == "px" && inside(token.unit));
+    }
+}
+
+// Peeking any distance within the ring, in any order, hands out the same
+// tokens as plain reading; the ring wraps many times over this input
+void test_lookahead_ring() {
+    const std::string css = "a b c d e f g h i j k l m n o p q r s t u v w x y z 1 2 3 4 5 6 7 8 9";
+    std::vector<size_t> expected;
+    {
+        CSSTokenizer reference(css);
+        for (Token token = reference.next_token();; token = reference.next_token()) {
+            expected.push_back(token.start_pos);
+            if (token.type == TokenType::EOF_TOKEN) break;
+        }
+    }
+    
+    CSSTokenizer tokenizer(css);
+    std::vector<size_t> actual;
+    for (size_t step = 0; actual.empty() || actual.back() != css.size(); ++step) {
+        size_t depth = step % CSSTokenizer::lookahead_capacity;
+        size_t ahead = actual.size() + depth;
+        const Token& peeked = tokenizer.peek_token(depth);
+        EXPECT(ahead < expected.size() ? peeked.start_pos == expected[ahead] : peeked.type == TokenType::EOF_TOKEN);
+        EXPECT(tokenizer.peek_token(0).start_pos == expected[actual.size()]);
+        actual.push_back(tokenizer.next_token().start_pos);
+        if (actual.size() > expected.size()) break;
+    }
+    EXPECT(actual == expected);
+    EXPECT(tokenizer.at_end());
+    EXPECT(tokenizer.peek_token(CSSTokenizer::lookahead_capacity).type == TokenType::EOF_TOKEN);
+    
+    // Buffered tokens are dropped on reset
+    tokenizer.reset(2);
+    EXPECT(!tokenizer.at_end());
+    EXPECT(tokenizer.peek_token(0).value == "b");
+    tokenizer.peek_token(5);
+    tokenizer.reset(0);
+    EXPECT(tokenizer.next_token().value == "a");
+}
+
+struct Lexed {
+    TokenType type;
+    double number;
+    bool integer;
+    std::string unit;
+};
+
+Lexed lex_number(const std::string& css) {
+    CSSTokenizer tokenizer(css);
+    Token token = tokenizer.next_token();
+    return {token.type, token.numeric_value, token.is_integer, std::string(token.unit)};
+}
+
+void test_numeric_lexing() {
+    auto is = [](const Lexed& lexed, TokenType type, double number, bool integer, const std::string& unit = "") {
+        return lexed.type == type && lexed.number == number && lexed.integer == integer && lexed.unit == unit;
+    };
+    EXPECT(is(lex_number("12"), TokenType::Number, 12, true));
+    EXPECT(is(lex_number("+3"), TokenType::Number, 3, true));
+    EXPECT(is(lex_number("-.5e2"), TokenType::Number, -50, false));
+    EXPECT(is(lex_number("1e3"), TokenType::Number, 1000, false));
+    EXPECT(is(lex_number("0.1"), TokenType::Number, 0.1, false)); // correctly rounded
+    EXPECT(is(lex_number("10%"), TokenType::Percentage, 10, true, "%"));
+    EXPECT(is(lex_number("1.5E2px"), TokenType::Dimension, 150, false, "px"));
+    EXPECT(is(lex_number("1.5em"), TokenType::Dimension, 1.5, false, "em")); // 'e' then no digit
+    EXPECT(is(lex_number("1e+px"), TokenType::Dimension, 1, true, "e"));
+    EXPECT(is(lex_number("2--x"), TokenType::Dimension, 2, true, "--x"));
+    EXPECT(lex_number("1.").type == TokenType::Number && lex_number("1.").integer);
+    EXPECT(lex_number("-0").number == 0 && std::signbit(lex_number("-0").number));
+    
+    // Out of range values clamp rather than collapse to zero
+    const double largest = std::numeric_limits<double>::max();
+    EXPECT(is(lex_number("1e400px"), TokenType::Dimension, largest, false, "px"));
+    EXPECT(lex_number("-1e400").number == -largest);
+    EXPECT(lex_number(std::string(400, '9')).number == largest);
+    EXPECT(lex_number("0.000001e400").number == largest);
+    EXPECT(lex_number("1e-400").number == 0);
+    EXPECT(lex_number("0." + std::string(400, '0') + "1").number == 0);
+    EXPECT(lex_number("1e99999999999999999999").number == largest);
+}
+
+std::string declaration_texts(const StyleRule& rule) {
+    std::string text;
+    for (const auto& decl : rule.declarations) text += decl.to_string() + (decl.implicit ? "* " : " ");
+    return text;
+}
+
+void test_shorthands_expand(bool token_prepass) {
+    Parsed parsed = parse("a{margin:1px 2px; font:italic 12px/1.5 serif; border-top:1px solid red !important}"
+                          "b{padding:foo; gap:var(--g); margin:inherit}", token_prepass);
+    EXPECT(parsed.errors == 1); // padding
+    const StyleRule* a = style_rule(*parsed.sheet, 0);
+    EXPECT(a && declaration_texts(*a) ==
+                    "margin-top: 1px margin-right: 2px margin-bottom: 1px margin-left: 2px "
+                    "font-style: italic font-variant: normal* font-weight: normal* font-stretch: normal* "
+                    "font-size: 12px line-height: 1.5 font-family: serif "
+                    "border-top-width: 1px !important border-top-style: solid !important "
+                    "border-top-color: red !important ");
+    
+    const StyleRule* b = style_rule(*parsed.sheet, 1);
+    EXPECT(b && b->declarations.size() == 6);
+    if (b && b->declarations.size() == 6) {
+        // var() waits for substitution, with the whole value on each longhand
+        EXPECT(b->declarations[0].property == "row-gap" && b->declarations[0].pending_substitution);
+        EXPECT(b->declarations[1].shorthand == PropertyId::Gap);
+        EXPECT(b->declarations[2].property == "margin-top" && b->declarations[2].value.text() == "inherit");
+    }
+    
+    CSSParser::ParseOptions kept;
+    kept.token_prepass = token_prepass;
+    kept.expand_shorthands = false;
+    CSSParser parser("a{margin:1px 2px}", kept);
+    auto sheet = parser.parse_stylesheet();
+    const StyleRule* rule = style_rule(*sheet, 0);
+    EXPECT(rule && rule->declarations.size() == 1 && rule->declarations[0].property == "margin");
+}
+
+std::vector<std::string> selector_texts(const CSSStyleSheet& sheet) {
+    std::vector<std::string> texts;
+    for (const auto& rule : sheet.rules) {
+        if (rule->type == RuleType::Style) {
+            texts.push_back(static_cast<const StyleRule&>(*rule).selectors.to_string());
+        }
+    }
+    return texts;
+}
+
+void test_nesting_flattens(bool token_prepass) {
+    Parsed parsed = parse(".nav li{color:red; &.active > a{color:blue} span{margin:0} .x &{padding:0}}", token_prepass);
+    EXPECT(parsed.errors == 0);
+    std::vector<std::string> texts = selector_texts(*parsed.sheet);
+    EXPECT(texts.size() == 4);
+    if (texts.size() == 4) {
+        EXPECT(texts[0] == ".nav li");
+        EXPECT(texts[1] == ".nav li.active > a");
+        EXPECT(texts[2] == ".nav li span");
+        EXPECT(texts[3] == ".x .nav li");
+    }
+}
+
+void test_nesting_inside_selector_arguments(bool token_prepass) {
+    // & in :is(), :not() and :has() stands for :is(parent); a selector that
+    // holds one there is not made relative to the parent again
+    Parsed parsed = parse(".p{ :is(&) .c{color:red} :not(& > .d){color:red} .e:has(> &){color:red} }", token_prepass);
+    EXPECT(parsed.errors == 0);
+    std::vector<std::string> texts = selector_texts(*parsed.sheet);
+    EXPECT(texts.size() == 4);
+    if (texts.size() == 4) {
+        EXPECT(texts[1] == ":is(:is(.p)) .c");
+        EXPECT(texts[2] == ":not(:is(.p) > .d)");
+        EXPECT(texts[3] == ".e:has(:scope > :is(.p))");
+    }
+    for (const std::string& text : texts) EXPECT(text.find('&') == std::string::npos);
+    
+    const StyleRule* c = style_rule(*parsed.sheet, 1);
+    EXPECT(c && c->selectors.selectors.front().specificity() == Specificity(0, 2, 0));
+}
+
+// Each of these once left the lexer spinning at end of input: the nested-rule
+// lookahead had filled the token ring, so at_end() never became true
+void test_unterminated_input_finishes(bool token_prepass) {
+    const char* inputs[] = {
+        "a{b:c \"x", "a{b:c 'x", "a{b:url(x", "a{b:c url(x(", "a{b:url( x", "a{b:url(x y",
+        "a{b:c u+1", "a{b:c \\", "a{b:c #", "a{b:c @",
+    };
+    for (const char* input : inputs) {
+        bool finished = TestSupport::finishes([&] { parse(input, token_prepass); }, input);
+        EXPECT(finished);
+    }
+}
+
+void test_supports_conditions() {
+    for (const char* holds : {"(display: grid)", "(DISPLAY: GRID)", "((display: grid))", "(--x: anything)",
+                              "(color: var(--x))", "(width: calc(1px + 1%))", "not (display: bogus)",
+                              "(display: grid) and (color: red)", "(display: bogus) or (color: red)",
+                              "selector(a > b)", "selector(a:hover::after)", "selector(:has(> a))",
+                              "not selector(:bogus)"}) {
+        EXPECT(CSSParser::supports_condition(holds));
+    }
+    for (const char* fails : {"(display: bogus)", "(bogus: 1)", "(display: grid) and (color: 1px)",
+                              "(width: calc(1px + 1s))", "selector(:bogus)", "selector(a[)", "foo(bar)",
+                              "display: grid", "(display:grid)and(color:red)", // "and(" is a function
+                              "(display: grid) and (color: red) or (x: y)"}) { // and/or need parentheses to mix
+        EXPECT(!CSSParser::supports_condition(fails));
+    }
+}
+
+void test_failed_supports_is_pruned(bool token_prepass) {
+    Parsed parsed = parse("@supports (display: bogus) { a { color: red } b { c: { d } } } "
+                          "@supports (display: grid) { p { color: blue } } "
+                          "@supports (display: bogus) or selector(:hover) { q { color: green } } "
+                          "@supports { r { color: red } } s { color: gray }", token_prepass);
+    const auto& rules = parsed.sheet->rules;
+    EXPECT(rules.size() == 5);
+    if (rules.size() != 5) return;
+    std::vector<bool> supported;
+    std::vector<size_t> children;
+    for (size_t i = 0; i < 4; ++i) {
+        const auto* at_rule = rules[i]->type == RuleType::AtRule ? static_cast<const AtRule*>(rules[i].get()) : nullptr;
+        EXPECT(at_rule && at_rule->name == "supports");
+        supported.push_back(at_rule && at_rule->supported);
+        children.push_back(at_rule ? at_rule->rules.size() : 99);
+    }
+    EXPECT((supported == std::vector<bool>{false, true, true, false}));
+    EXPECT((children == std::vector<size_t>{0, 1, 1, 0})); // pruned blocks never build their rules
+    const StyleRule* after = style_rule(*parsed.sheet, 4);
+    EXPECT(after && after->selectors.to_string() == "s");
+}
+
+} // namespace
+
+int main() {
+    test_token_array_values();
+    test_vector_and_scalar_scans_agree();
+    test_tokens_view_the_source();
+    test_lookahead_ring();
+    test_numeric_lexing();
+    test_supports_conditions();
+    for (bool token_prepass : {false, true}) {
+        test_custom_property_blocks(token_prepass);
+        test_blocks_do_not_start_nested_rules(token_prepass);
+        test_plain_custom_values_stay_typed(token_prepass);
+        test_shorthands_expand(token_prepass);
+        test_nesting_flattens(token_prepass);
+        test_nesting_inside_selector_arguments(token_prepass);
+        test_unterminated_input_finishes(token_prepass);
+        test_failed_supports_is_pruned(token_prepass);
+    }
+    return TestSupport::finish("css parser");
+}
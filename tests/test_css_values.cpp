@@ -0,0 +1,251 @@
+#include "CSSParser.h"
+#include "TestSupport.h"
+#include <cctype>
+#include <cmath>
+
+using namespace CSS3Parser;
+
+namespace {
+
+const StyleRule* first_rule(const CSSStyleSheet& sheet) {
+    auto rules = sheet.get_style_rules();
+    return rules.empty() ? nullptr : rules.front();
+}
+
+void test_values_are_compact() {
+    EXPECT(sizeof(CSSValue) == 16);
+
+    CSSValueArena arena;
+    CSSValue list = CSSValue::make_list({CSSValue("a"), CSSValue::make_dimension(2.5, "px"),
+                                         CSSValue::make_number(50, CSSUnit::Percent)}, arena, true);
+    EXPECT(list.type == ValueType::List && list.size() == 3 && list.is_comma_separated());
+    EXPECT(list.to_string() == "a, 2.5px, 50%");
+    EXPECT(list[1].is_length() && list[1].numeric_value() == 2.5 && list[1].unit_text() == "px");
+
+    CSSValue function = CSSValue::make_function("rgb", {CSSValue::make_number(1), CSSValue::make_number(2)}, arena);
+    EXPECT(function.is_function() && function.text() == "rgb" && function.size() == 2);
+    EXPECT(function.to_string() == "rgb(1, 2)");
+
+    // Unknown units are atoms; text lives in the arena
+    CSSValue odd = CSSValue::make_dimension(3, "furlongs");
+    EXPECT(odd.to_string() == "3furlongs");
+    CSSValue text = CSSValue::make_text(ValueType::String, "hi there", arena);
+    EXPECT(text.text() == "hi there" && text.to_string() == "\"hi there\"");
+
+    // Copies share the arena's items
+    CSSValue copy = list;
+    EXPECT(copy.begin() == list.begin());
+}
+
+void test_arena_storage() {
+    CSSValueArena arena;
+    std::string big(40 * 1024, 'x'); // larger than a chunk
+    std::string_view stored = arena.store(big);
+    EXPECT(stored == big && stored.data() != big.data());
+    std::vector<std::string_view> small;
+    for (int i = 0; i < 2000; ++i) small.push_back(arena.store("v" + std::to_string(i)));
+    for (int i = 0; i < 2000; ++i) EXPECT(small[i] == "v" + std::to_string(i));
+    for (size_t alignment : {1, 2, 8, 16}) {
+        void* at = arena.allocate(3, alignment);
+        EXPECT(reinterpret_cast<uintptr_t>(at) % alignment == 0);
+    }
+    EXPECT(arena.bytes_used() >= big.size() && arena.bytes_reserved() >= arena.bytes_used());
+}
+
+void test_values_outlive_the_parser() {
+    std::unique_ptr<CSSStyleSheet> sheet;
+    {
+        CSSParser parser("a{font-family:\"A B\", serif; margin:calc(1px + 2%) 3em; color:rgba(1,2,3,.5)}");
+        sheet = parser.parse_stylesheet();
+    }
+    EXPECT(!sheet->arenas.empty());
+    const StyleRule* rule = first_rule(*sheet);
+    EXPECT(rule && rule->declarations.size() == 6);
+    if (rule && rule->declarations.size() == 6) {
+        EXPECT(rule->declarations[0].value.to_string() == "\"A B\", serif");
+        EXPECT(rule->declarations[1].value.to_string() == "calc(1px + 2%)");
+        EXPECT(rule->declarations[5].value.is_color() && rule->declarations[5].value.color().values[3] == 0.5);
+    }
+}
+
+void test_property_ids() {
+    // Every name in the table finds its own id, in any case
+    for (size_t i = 2; i < property_count; ++i) {
+        PropertyId id = static_cast<PropertyId>(i);
+        std::string name(property_name(id));
+        EXPECT(property_id(name) == id);
+        for (char& c : name) c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+        EXPECT(property_id(name) == id);
+        EXPECT(property_id("-webkit-" + name) == id);
+    }
+    EXPECT(property_id("-moz-transition") == PropertyId::Transition);
+    EXPECT(property_id("word-wrap") == PropertyId::OverflowWrap);
+    EXPECT(property_id("grid-gap") == PropertyId::Gap);
+    EXPECT(property_id("--x") == PropertyId::Custom);
+    for (const char* unknown : {"", "-", "--", "colr", "colors", "color ", "-webkit-", "-khtml-color", "x-color"}) {
+        EXPECT(property_id(unknown) == PropertyId::Unknown);
+    }
+    
+    EXPECT(property_info(PropertyId::Color).inherited);
+    EXPECT(!property_info(PropertyId::MarginTop).inherited);
+    EXPECT(property_info(PropertyId::Margin).is_shorthand() && property_info(PropertyId::Margin).longhand_count == 4);
+    
+    // Declarations resolve their id from the name as written
+    CSSParser parser("a{COLOR:red; -webkit-transition-duration:1s; --v:1; bogus:1}");
+    auto sheet = parser.parse_stylesheet();
+    const StyleRule* rule = first_rule(*sheet);
+    EXPECT(rule && rule->declarations.size() == 4);
+    if (rule && rule->declarations.size() == 4) {
+        EXPECT(rule->declarations[0].id == PropertyId::Color);
+        EXPECT(rule->declarations[1].id == PropertyId::TransitionDuration);
+        EXPECT(rule->declarations[2].id == PropertyId::Custom);
+        EXPECT(rule->declarations[3].id == PropertyId::Unknown);
+    }
+}
+
+// Parses `a{<declaration>}` and returns the declarations that survived
+std::vector<CSSDeclaration> declarations_of(const std::string& declaration, size_t* errors = nullptr,
+                                            bool validate = true) {
+    CSSParser::ParseOptions options;
+    options.validate_values = validate;
+    CSSParser parser("a{" + declaration + "}", options);
+    auto sheet = parser.parse_stylesheet();
+    if (errors) *errors = parser.get_errors().size();
+    const StyleRule* rule = first_rule(*sheet);
+    return rule ? rule->declarations : std::vector<CSSDeclaration>{};
+}
+
+void test_value_grammars() {
+    for (const char* valid : {"width:10px", "width:0", "width:calc(1px + 2%)", "width:var(--w)", "width:inherit",
+                              "width:attr(x)", "color:red", "color:#abc", "color:rgb(1 2 3)", "display:flex",
+                              "display:block flow", "opacity:.5", "z-index:3", "line-height:1.5",
+                              "font-weight:bold", "font-weight:950", "touch-action:pan-x pan-y",
+                              "overscroll-behavior:contain none", "transition-duration:1s, 2ms"}) {
+        size_t errors = 0;
+        EXPECT(declarations_of(valid, &errors).size() == 1 && errors == 0);
+    }
+    for (const char* invalid : {"width:red", "width:10", "width:10px 20px", "width:calc(1s)", "WIDTH:red",
+                                "color:10px", "display:bogus", "opacity:a", "z-index:1.5",
+                                "touch-action:none pan-x", "overscroll-behavior:contain none auto",
+                                "transition-duration:1px"}) {
+        size_t errors = 0;
+        EXPECT(declarations_of(invalid, &errors).empty() && errors == 1);
+        // Without validation the declaration is kept as written
+        EXPECT(declarations_of(invalid, &errors, false).size() == 1 && errors == 0);
+    }
+
+    // Validation retypes what the grammar reads differently from the tokens
+    auto zero = declarations_of("width:0");
+    EXPECT(zero.size() == 1 && zero[0].value.type == ValueType::Length && zero[0].value.to_string() == "0px");
+    auto named = declarations_of("color:red");
+    EXPECT(named.size() == 1 && named[0].value.is_color());
+
+    // Called directly, unknown properties and custom properties are left alone
+    CSSValueArena arena;
+    CSSValue keyword("bogus");
+    EXPECT(!validate_value(PropertyId::Display, keyword, arena));
+    EXPECT(validate_value(PropertyId::Unknown, keyword, arena));
+    EXPECT(validate_value(PropertyId::Custom, keyword, arena));
+    CSSValue length = CSSValue::make_dimension(4, "px");
+    EXPECT(validate_value(PropertyId::MarginTop, length, arena));
+    EXPECT(!validate_value(PropertyId::Opacity, length, arena));
+}
+
+// The value of `x: <expression>`, with its sheet kept alive for the arena
+struct Parsed {
+    std::unique_ptr<CSSStyleSheet> sheet;
+    CSSValue value;
+};
+
+Parsed parse_value(const std::string& expression) {
+    CSSParser parser("a{x:" + expression + "}");
+    Parsed parsed;
+    parsed.sheet = parser.parse_stylesheet();
+    const StyleRule* rule = first_rule(*parsed.sheet);
+    if (rule && rule->declarations.size() == 1) parsed.value = rule->declarations[0].value;
+    return parsed;
+}
+
+bool near(double a, double b) { return std::fabs(a - b) < 1e-9; }
+
+void test_math_folding() {
+    // Absolute units fold into one px term; the percentage stays its own
+    Parsed folded = parse_value("calc(2 * (1in + 4px) - 50%)");
+    const CalcExpression* math = folded.value.math();
+    EXPECT(math && math->size == 3 && math->type == CalcType::LengthPercentage);
+    if (math) {
+        CalcContext context;
+        context.percentage_basis = 200;
+        EXPECT(near(math->evaluate(context), 100));
+        EXPECT(math->to_string() == "calc(200px - 50%)");
+    }
+
+    struct Case {
+        const char* expression;
+        CalcType type;
+        double expected;
+    };
+    CalcContext context;
+    context.font_size = 10;
+    context.root_font_size = 20;
+    context.viewport_width = 1000;
+    context.viewport_height = 500;
+    context.percentage_basis = 400;
+    const Case cases[] = {
+        {"calc(1px + 2px * 3)", CalcType::Length, 7},
+        {"calc((1px + 2px) * 3)", CalcType::Length, 9},
+        {"calc(10px / 4)", CalcType::Length, 2.5},
+        {"calc(1em + 1rem + 10vw + 10vh)", CalcType::Length, 180},
+        {"calc(1ex + 1ch)", CalcType::Length, 10},
+        {"calc(2.54cm + 72pt)", CalcType::Length, 192},
+        {"calc(25% + 1em)", CalcType::LengthPercentage, 110},
+        {"calc(1turn - 90deg)", CalcType::Angle, 270},
+        {"calc(1s + 500ms)", CalcType::Time, 1.5},
+        {"calc(2 * pi)", CalcType::Number, 2 * 3.14159265358979323846},
+        {"min(10px, 2em, 50%)", CalcType::LengthPercentage, 10},
+        {"max(10px, 2em, 1vw)", CalcType::Length, 20},
+        {"min(1in, 100px)", CalcType::Length, 96},
+        {"clamp(10px, 5vw, 30px)", CalcType::Length, 30},
+        {"clamp(10px, 0.5vw, 30px)", CalcType::Length, 10},
+        {"clamp(40px, 1em, 30px)", CalcType::Length, 40}, // min wins over max
+        {"calc(1px + min(2em, 3vw) * 2)", CalcType::Length, 41},
+        {"-webkit-calc(3px)", CalcType::Length, 3},
+    };
+    for (const Case& c : cases) {
+        Parsed parsed = parse_value(c.expression);
+        const CalcExpression* expression = parsed.value.math();
+        EXPECT(expression && expression->type == c.type);
+        EXPECT(expression && near(expression->evaluate(context), c.expected));
+    }
+}
+
+void test_invalid_math_stays_a_function() {
+    for (const char* invalid : {"calc(1px + 1s)", "calc(1px * 2px)", "calc(2 / 1px)", "calc(1px + 2)",
+                                "calc(1px 2px)", "calc(1px +)", "calc()", "min(1px, 1deg)", "clamp(1px, 2px)",
+                                "calc(1fr + 1px)", "calc(var(--x) + 1px)", "calc(foo(1px))", "calc(1px, 2px)"}) {
+        Parsed parsed = parse_value(invalid);
+        EXPECT(parsed.value.is_function() && !parsed.value.math());
+    }
+
+    // compile_math on a hand-built function, and on anything else
+    CSSValueArena arena;
+    CSSValue compiled;
+    CSSValue sum = CSSValue::make_function("calc", {CSSValue::make_list({CSSValue::make_dimension(1, "px"),
+        CSSValue("+"), CSSValue::make_dimension(1, "in")}, arena)}, arena);
+    EXPECT(compile_math(sum, arena, compiled) && compiled.math() && near(compiled.math()->evaluate({}), 97));
+    EXPECT(!compile_math(CSSValue::make_dimension(1, "px"), arena, compiled));
+    EXPECT(!compile_math(CSSValue::make_function("rgb", {CSSValue::make_number(1)}, arena), arena, compiled));
+}
+
+} // namespace
+
+int main() {
+    test_values_are_compact();
+    test_arena_storage();
+    test_values_outlive_the_parser();
+    test_property_ids();
+    test_value_grammars();
+    test_math_folding();
+    test_invalid_math_stays_a_function();
+    return TestSupport::finish("css values");
+}
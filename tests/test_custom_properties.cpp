@@ -0,0 +1,93 @@
+#include "BrowserParser.h"
+#include "TestSupport.h"
+
+using namespace BrowserParser;
+
+namespace {
+
+const HTML5Parser::Node* find_by_id(const HTML5Parser::Node& node, const std::string& id) {
+    auto it = node.attributes.find("id");
+    if (node.type == HTML5Parser::NodeType::Element && it != node.attributes.end() && it->second == id) {
+        return &node;
+    }
+    for (const auto& child : node.children) {
+        if (const HTML5Parser::Node* found = find_by_id(*child, id)) return found;
+    }
+    return nullptr;
+}
+
+// Computed value of property on the element with id, or "" when unset. A
+// custom property is looked up among the element's variables.
+std::string computed(const std::string& css, const std::string& body, const std::string& id,
+                     const std::string& property) {
+    WebPageParser parser;
+    ParsedDocument document = parser.parse_html_with_css("<html><head><style>" + css +
+                                                         "</style></head><body>" + body + "</body></html>");
+    StyleEngine engine(document);
+    auto styles = engine.compute_all_styles();
+    const HTML5Parser::Node* element = find_by_id(*document.html_document, id);
+    if (!element) return "<missing element>";
+    const StyleEngine::ComputedStyle& style = styles.at(element);
+    if (property.rfind("--", 0) == 0) {
+        const CSS3Parser::CSSValue* value = style.variables.find(find_atom(property));
+        return value ? value->to_string() : "";
+    }
+    auto it = style.properties.find(property);
+    return it != style.properties.end() ? it->second.to_string() : "";
+}
+
+void test_substitution() {
+    const std::string body = "<p id=x></p>";
+    EXPECT(computed("p{--c:red; color:var(--c)}", body, "x", "color") == "red");
+    EXPECT(computed("p{--w:10px; padding-top:var(--w)}", body, "x", "padding-top") == "10px");
+    EXPECT(computed("p{--a:var(--b); --b:2px; margin-top:var(--a)}", body, "x", "margin-top") == "2px");
+    EXPECT(computed("p{--w:5px; width:calc(var(--w) * 2)}", body, "x", "width") == "calc(10px)");
+    // A shorthand's longhands each take their part of the substituted value
+    EXPECT(computed("p{--m:1px 2px; margin:var(--m)}", body, "x", "margin-left") == "2px");
+}
+
+void test_fallbacks() {
+    const std::string body = "<p id=x></p>";
+    EXPECT(computed("p{color:var(--missing, blue)}", body, "x", "color") == "blue");
+    EXPECT(computed("p{color:var(--missing, var(--also, green))}", body, "x", "color") == "green");
+    EXPECT(computed("p{--c:red; color:var(--c, blue)}", body, "x", "color") == "red");
+    EXPECT(computed("p{--c:var(--missing, 3px); --c2:var(--c)}", body, "x", "--c2") == "3px");
+    // No fallback: invalid at computed-value time, so the property is unset
+    EXPECT(computed("p{color:var(--missing)}", body, "x", "color") == "");
+    // A substituted value that breaks the property's grammar is just as invalid
+    EXPECT(computed("p{--c:10px; color:var(--c)}", body, "x", "color") == "");
+}
+
+void test_cycles_are_invalid() {
+    const std::string body = "<p id=x></p>";
+    EXPECT(computed("p{--a:var(--a)}", body, "x", "--a") == "");
+    EXPECT(computed("p{--a:var(--b); --b:var(--a); --c:1px}", body, "x", "--a") == "");
+    EXPECT(computed("p{--a:var(--b); --b:var(--a); --c:1px}", body, "x", "--b") == "");
+    EXPECT(computed("p{--a:var(--b); --b:var(--a); --c:1px}", body, "x", "--c") == "1px");
+    // A fallback does not rescue a property on a cycle, but does rescue its users
+    EXPECT(computed("p{--a:var(--b, 1px); --b:var(--a, 2px)}", body, "x", "--a") == "");
+    EXPECT(computed("p{--a:var(--a); width:var(--a, 4px)}", body, "x", "width") == "4px");
+    EXPECT(computed("p{--a:var(--a); --x:var(--a, 4px)}", body, "x", "--x") == "4px");
+}
+
+void test_inheritance() {
+    const std::string body = "<div id=a><p id=b><span id=c></span></p></div>";
+    const std::string css = "div{--c:red; --w:3px} p{--w:5px} span{color:var(--c); width:var(--w)}";
+    EXPECT(computed(css, body, "c", "--c") == "red");
+    EXPECT(computed(css, body, "c", "color") == "red");
+    EXPECT(computed(css, body, "c", "width") == "5px");
+    EXPECT(computed(css, body, "a", "--w") == "3px");
+    // Children inherit the value resolved where it was declared, not the reference
+    EXPECT(computed("div{--b:1px; --a:var(--b)} p{--b:2px; margin-top:var(--a)}", body, "b", "margin-top") == "1px");
+    EXPECT(computed("div{--b:1px} p{--a:var(--b)} p{--b:2px}", body, "b", "--a") == "2px");
+}
+
+} // namespace
+
+int main() {
+    test_substitution();
+    test_fallbacks();
+    test_cycles_are_invalid();
+    test_inheritance();
+    return TestSupport::finish("custom properties");
+}
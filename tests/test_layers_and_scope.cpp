@@ -0,0 +1,103 @@
+#include "BrowserParser.h"
+#include "TestSupport.h"
+
+using namespace BrowserParser;
+
+namespace {
+
+const HTML5Parser::Node* find_by_id(const HTML5Parser::Node& node, const std::string& id) {
+    auto it = node.attributes.find("id");
+    if (node.type == HTML5Parser::NodeType::Element && it != node.attributes.end() && it->second == id) {
+        return &node;
+    }
+    for (const auto& child : node.children) {
+        if (const HTML5Parser::Node* found = find_by_id(*child, id)) return found;
+    }
+    return nullptr;
+}
+
+// Computed value of property on the element with id, or "" when unset
+std::string computed(const std::string& css, const std::string& body, const std::string& id,
+                     const std::string& property = "color") {
+    WebPageParser parser;
+    ParsedDocument document = parser.parse_html_with_css("<html><head><style>" + css +
+                                                         "</style></head><body>" + body + "</body></html>");
+    StyleEngine engine(document);
+    auto styles = engine.compute_all_styles();
+    const HTML5Parser::Node* element = find_by_id(*document.html_document, id);
+    if (!element) return "<missing element>";
+    const auto& properties = styles.at(element).properties;
+    auto it = properties.find(property);
+    return it != properties.end() ? it->second.to_string() : "";
+}
+
+void test_layer_order() {
+    const std::string body = "<p id=x class=a></p>";
+    // Later layers win regardless of specificity
+    EXPECT(computed("@layer one { #x { color: red } } @layer two { p { color: blue } }", body, "x") == "blue");
+    // ...in the order layers are first named, not the order their blocks appear
+    EXPECT(computed("@layer two, one; @layer one { p { color: red } } @layer two { #x { color: blue } }",
+                    body, "x") == "red");
+    EXPECT(computed("@layer one { p { color: red } } @layer two { p { color: blue } } @layer one { p { color: green } }",
+                    body, "x") == "blue");
+    // Sublayers rank inside their parent; a parent's own rules follow its sublayers
+    EXPECT(computed("@layer a { @layer x { p { color: red } } p { color: blue } } @layer a.y { p { color: green } }",
+                    body, "x") == "blue");
+    EXPECT(computed("@layer a.x, b; @layer b { p { color: red } } @layer a { @layer x { #x { color: blue } } }",
+                    body, "x") == "red");
+    // Anonymous layers are ordered like named ones
+    EXPECT(computed("@layer { #x { color: red } } @layer { p { color: blue } }", body, "x") == "blue");
+}
+
+void test_unlayered_beats_layered() {
+    const std::string body = "<p id=x class=a></p>";
+    EXPECT(computed("p { color: blue } @layer one { #x.a { color: red } }", body, "x") == "blue");
+    EXPECT(computed("@layer one { #x { color: red } } p { color: blue }", body, "x") == "blue");
+    // Within one layer, specificity and order decide as usual
+    EXPECT(computed("@layer one { #x { color: red } p { color: blue } }", body, "x") == "red");
+}
+
+void test_important_reverses_layers() {
+    const std::string body = "<p id=x class=a></p>";
+    EXPECT(computed("@layer one { p { color: red !important } } @layer two { p { color: blue !important } }",
+                    body, "x") == "red");
+    EXPECT(computed("p { color: blue !important } @layer one { p { color: red !important } }", body, "x") == "red");
+    // Important in a layer still beats normal declarations anywhere
+    EXPECT(computed("@layer one { p { color: red !important } } #x { color: blue }", body, "x") == "red");
+}
+
+void test_scope_root_and_limit() {
+    const std::string body =
+        "<div class=card><p id=in class=title></p><div class=footer><p id=below class=title></p></div></div>"
+        "<p id=out class=title></p>";
+    const std::string css = "@scope (.card) to (.footer) { .title { color: red } }";
+    EXPECT(computed(css, body, "in") == "red");
+    EXPECT(computed(css, body, "below") == "");
+    EXPECT(computed(css, body, "out") == "");
+    // :scope is the root, so a child combinator anchors on it
+    EXPECT(computed("@scope (.card) { :scope > p { color: red } }", body, "in") == "red");
+    EXPECT(computed("@scope (.card) { :scope > p { color: red } }", body, "below") == "");
+    // A root with no match scopes nothing
+    EXPECT(computed("@scope (.absent) { p { color: red } }", body, "in") == "");
+}
+
+void test_scope_proximity() {
+    const std::string body = "<div class=light><div class=dark><p id=x></p></div></div>";
+    // With equal specificity the nearer root wins, whatever the order
+    const std::string css = "@scope (.dark) { p { color: white } } @scope (.light) { p { color: black } }";
+    EXPECT(computed(css, body, "x") == "white");
+    EXPECT(computed("@scope (.light) { p { color: black } } @scope (.dark) { p { color: white } }", body, "x") == "white");
+    // Specificity still comes first
+    EXPECT(computed("@scope (.light) { p#x { color: black } } @scope (.dark) { p { color: white } }", body, "x") == "black");
+}
+
+} // namespace
+
+int main() {
+    test_layer_order();
+    test_unlayered_beats_layered();
+    test_important_reverses_layers();
+    test_scope_root_and_limit();
+    test_scope_proximity();
+    return TestSupport::finish("layers and scope");
+}
@@ -0,0 +1,73 @@
+#include "BrowserParser.h"
+#include "TestSupport.h"
+#include <random>
+
+using namespace BrowserParser;
+
+namespace {
+
+// Byte-at-a-time reference: "\n", "\r\n" and a lone "\r" end a line
+LineIndex::Location reference_locate(const std::string& text, size_t offset) {
+    LineIndex::Location location{1, 1};
+    for (size_t i = 0; i < offset && i < text.size(); ++i) {
+        bool ends = text[i] == '\n' || (text[i] == '\r' && (i + 1 == text.size() || text[i + 1] != '\n'));
+        if (ends) {
+            location.line++;
+            location.column = 1;
+        } else {
+            location.column++;
+        }
+    }
+    return location;
+}
+
+void test_matches_reference() {
+    // Breaks of every kind land on and across the 16-byte block edges
+    std::mt19937 random(7);
+    const char* pieces[] = {"\n", "\r\n", "\r", "a", "bc", "\r\r\n", "\n\r"};
+    std::string text;
+    while (text.size() < 4000) text += pieces[random() % 7];
+    LineIndex index(text);
+    for (size_t offset = 0; offset <= text.size() + 2; ++offset) {
+        LineIndex::Location expected = reference_locate(text, offset);
+        LineIndex::Location actual = index.locate(offset);
+        EXPECT(actual.line == expected.line && actual.column == expected.column);
+    }
+    EXPECT(index.line_count() == reference_locate(text, text.size()).line);
+
+    LineIndex empty("");
+    EXPECT(empty.locate(0).line == 1 && empty.locate(0).column == 1 && empty.line_count() == 1);
+}
+
+void test_css_errors_report_lines() {
+    const std::string css = "a{color:red}\r\n\rb{ color: red; bogus-one: 1 }\n  c{\n bogus-two: 2 }";
+    CSS3Parser::CSSParser parser(css);
+    parser.parse_stylesheet();
+    std::vector<size_t> lines;
+    for (const auto& error : parser.get_errors()) {
+        LineIndex::Location expected = reference_locate(css, error.position);
+        EXPECT(error.line == expected.line && error.column == expected.column);
+        lines.push_back(error.line);
+    }
+    EXPECT((lines == std::vector<size_t>{3, 5}));
+}
+
+void test_html_errors_report_lines() {
+    const std::string html = "<html>\r\n<body>\n\n  <div><p>x\n</body></html>";
+    HTML5Parser::Parser parser(html);
+    parser.parse();
+    EXPECT(!parser.get_errors().empty());
+    for (const auto& error : parser.get_errors()) {
+        LineIndex::Location expected = reference_locate(html, error.position);
+        EXPECT(error.line == expected.line && error.column == expected.column);
+    }
+}
+
+} // namespace
+
+int main() {
+    test_matches_reference();
+    test_css_errors_report_lines();
+    test_html_errors_report_lines();
+    return TestSupport::finish("line index");
+}
@@ -0,0 +1,50 @@
+#include "CSSParser.h"
+#include "TestSupport.h"
+
+using namespace CSS3Parser;
+
+namespace {
+
+bool matches(const std::string& query, double width, double font_size = 16.0) {
+    MediaEnvironment environment;
+    environment.width = width;
+    environment.font_size = font_size;
+    return MediaQueryList::compile(query).evaluate(environment);
+}
+
+void test_constant_calc() {
+    EXPECT(matches("(min-width: calc(300px + 1px))", 400));
+    EXPECT(!matches("(min-width: calc(300px + 1px))", 300));
+    EXPECT(matches("(min-width: calc(300px + 1px))", 301));
+    EXPECT(matches("(max-width: min(500px, 2in * 3))", 500));
+    EXPECT(!matches("(max-width: min(500px, 2in * 3))", 501));
+}
+
+void test_relative_calc_follows_environment() {
+    EXPECT(matches("(min-width: calc(20em + 10px))", 330));
+    EXPECT(!matches("(min-width: calc(20em + 10px))", 330, 20.0));
+    EXPECT(matches("screen and (width >= calc(10rem * 2))", 320));
+}
+
+void test_calc_in_ranges() {
+    EXPECT(matches("(calc(200px + 100px) <= width < calc(1000px))", 300));
+    EXPECT(!matches("(calc(200px + 100px) <= width < calc(1000px))", 1000));
+    EXPECT(matches("(width > calc(100px - 1px))", 100));
+}
+
+void test_invalid_calc_fails_the_query() {
+    // A percentage has nothing to resolve against in a media query
+    EXPECT(!matches("(min-width: calc(50% + 1px))", 2000));
+    EXPECT(!matches("(min-width: calc(1s))", 2000));
+    EXPECT(matches("(min-width: calc(1s)), (min-width: 10px)", 2000));
+}
+
+} // namespace
+
+int main() {
+    test_constant_calc();
+    test_relative_calc_follows_environment();
+    test_calc_in_ranges();
+    test_invalid_calc_fails_the_query();
+    return TestSupport::finish("media queries");
+}
@@ -0,0 +1,118 @@
+#include "BrowserParser.h"
+#include "TestSupport.h"
+
+using namespace BrowserParser;
+
+namespace {
+
+using StyleMap = std::map<const HTML5Parser::Node*, StyleEngine::ComputedStyle>;
+using SharedStyleMap = StyleEngine::SharedStyleMap;
+
+std::vector<CSS3Parser::MediaEnvironment> viewports(const std::vector<double>& widths) {
+    std::vector<CSS3Parser::MediaEnvironment> environments;
+    for (double width : widths) {
+        CSS3Parser::MediaEnvironment environment;
+        environment.width = width;
+        environments.push_back(environment);
+    }
+    return environments;
+}
+
+bool same_styles(const SharedStyleMap& a, const StyleMap& b) {
+    if (a.size() != b.size()) return false;
+    for (const auto& [node, shared] : a) {
+        const StyleEngine::ComputedStyle& style = *shared;
+        auto other = b.find(node);
+        if (other == b.end() || other->second.properties.size() != style.properties.size()) return false;
+        for (const auto& [property, value] : style.properties) {
+            auto it = other->second.properties.find(property);
+            if (it == other->second.properties.end() || it->second.to_string() != value.to_string()) return false;
+        }
+    }
+    return true;
+}
+
+// One pass over every environment has to agree with one pass per environment
+void expect_matches_single_passes(const std::string& css, const std::string& body,
+                                  const std::vector<double>& widths) {
+    WebPageParser parser;
+    ParsedDocument document = parser.parse_html_with_css("<html><head><style>" + css +
+                                                         "</style></head><body>" + body + "</body></html>");
+    auto environments = viewports(widths);
+    StyleEngine engine(document);
+    auto combined = engine.compute_all_styles(environments);
+    EXPECT(combined.size() == environments.size());
+    for (size_t i = 0; i < environments.size() && i < combined.size(); ++i) {
+        StyleEngine single(document);
+        single.set_environment(environments[i]);
+        EXPECT(same_styles(combined[i], single.compute_all_styles()));
+    }
+}
+
+std::string property_of(const SharedStyleMap& styles, const std::string& class_name, const std::string& property) {
+    for (const auto& [node, style] : styles) {
+        auto it = node->attributes.find("class");
+        if (it == node->attributes.end() || it->second != class_name) continue;
+        auto value = style->properties.find(property);
+        return value != style->properties.end() ? value->second.to_string() : "";
+    }
+    return "<missing element>";
+}
+
+void test_inherit_of_non_inherited_property() {
+    const std::string css = "@media (min-width:600px){.p{padding:10px;width:50px}} "
+                            ".c{padding:inherit} .d{width:inherit}";
+    const std::string body = "<div class=p><span class=c></span><span class=d></span></div>";
+    expect_matches_single_passes(css, body, {400, 800});
+    
+    WebPageParser parser;
+    ParsedDocument document = parser.parse_html_with_css("<html><head><style>" + css +
+                                                         "</style></head><body>" + body + "</body></html>");
+    StyleEngine engine(document);
+    auto styles = engine.compute_all_styles(viewports({400, 800}));
+    EXPECT(property_of(styles[1], "c", "padding-top") == "10px");
+    EXPECT(property_of(styles[1], "d", "width") == "50px");
+    EXPECT(property_of(styles[0], "d", "width") == "initial");
+}
+
+void test_shared_and_diverging_cascades() {
+    expect_matches_single_passes(
+        "body{color:black} .a{margin:1px} @media (max-width:500px){.a{margin:2px;color:red}} "
+        "@media (min-width:700px){.b{--gap:4px} .c{padding:var(--gap)}} "
+        "@media (min-width:900px){.a{width:10px}} .a > p{font-size:inherit}",
+        "<div class=a><p class=b><span class=c></span></p></div><div class=b><i class=c></i></div>",
+        {320, 600, 800, 1024});
+}
+
+void test_agreeing_viewports_share_styles() {
+    WebPageParser parser;
+    ParsedDocument document = parser.parse_html_with_css(
+        "<html><head><style>.a{margin:1px} @media (min-width:700px){.b{color:red}}</style></head>"
+        "<body><div class=a></div><div class=b></div></body></html>");
+    StyleEngine engine(document);
+    auto styles = engine.compute_all_styles(viewports({320, 400, 800}));
+    size_t shared = 0, own = 0;
+    for (const auto& [node, style] : styles[0]) {
+        EXPECT(styles[1].at(node) == style);
+        if (styles[2].at(node) == style) ++shared; else ++own;
+    }
+    EXPECT(own == 1 && shared + own == styles[0].size());
+}
+
+void test_properties_read_by_children_ignore_spelling() {
+    // Children read the conditional padding back through 'inherit' whatever
+    // name or shorthand either side uses
+    expect_matches_single_passes("@media (min-width:600px){.p{padding-top:10px;margin:2px}} "
+                                 ".c{PADDING-TOP:inherit} .d{margin-left:inherit}",
+                                 "<div class=p><span class=c></span><span class=d></span></div>", {400, 800});
+}
+
+} // namespace
+
+int main() {
+    test_inherit_of_non_inherited_property();
+    test_shared_and_diverging_cascades();
+    test_agreeing_viewports_share_styles();
+    test_properties_read_by_children_ignore_spelling();
+    return TestSupport::finish("multi-viewport styles");
+}
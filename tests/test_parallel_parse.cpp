@@ -0,0 +1,87 @@
+#include "CSSParser.h"
+#include "TestSupport.h"
+#include <sstream>
+#include <thread>
+
+using namespace CSS3Parser;
+
+namespace {
+
+// Top-level rules of every kind, with braces, quotes and comment markers
+// hidden in strings, urls and comments so the chunk scan has to skip them
+std::string generate_sheet(size_t bytes) {
+    std::ostringstream css;
+    for (size_t i = 0; css.tellp() < static_cast<std::streamoff>(bytes); ++i) {
+        css << ".c" << i << " > a[title=\"}{" << i << "\"]:hover { content: '/* ;}'; color: red }\n";
+        css << "@media (min-width: " << i % 900 << "px) { .m" << i << " { margin: " << i % 9 << "px } }\n";
+        css << ".n" << i << " { padding: 0; & .x { background: url(a}" << i << ".png) } }\n";
+        css << "/* } { " << i << " */ @import url(\"x" << i << ".css\");\n";
+        if (i % 97 == 0) css << ".bad" << i << " { color: ; width: 1px 2px 3px }\n";
+        if (i % 211 == 0) css << "@keyframes k" << i << " { from { opacity: 0 } to { opacity: 1 } }\n";
+    }
+    return css.str();
+}
+
+struct Result {
+    std::string text;
+    std::vector<std::string> errors;
+    size_t chunks = 0;
+};
+
+Result parse(const std::string& css, size_t threads) {
+    CSSParser::ParseOptions options;
+    options.parse_threads = threads;
+    CSSParser parser(css, options);
+    auto sheet = parser.parse_stylesheet();
+    Result result;
+    result.text = sheet->to_string();
+    for (const auto& import : sheet->imports) result.text += "@import " + import + "\n";
+    for (const auto& error : parser.get_errors()) {
+        result.errors.push_back(error.message + " @" + std::to_string(error.line) + ":" + std::to_string(error.column));
+    }
+    result.chunks = sheet->arenas.size() - 1; // each chunk's, then the parser's own
+    return result;
+}
+
+void test_chunks_match_serial() {
+    CSSParser::set_available_cores(4);
+    std::string css = generate_sheet(600 * 1024);
+    Result serial = parse(css, 1);
+    for (size_t threads : {2, 3, 4}) {
+        Result chunked = parse(css, threads);
+        EXPECT(chunked.chunks == threads);
+        EXPECT(chunked.text == serial.text);
+        EXPECT(chunked.errors == serial.errors);
+    }
+    EXPECT(!serial.errors.empty());
+
+    // A split inside an unterminated block is parsed again from where the
+    // previous chunk stopped
+    std::string broken = css;
+    broken.insert(broken.size() / 3, ".open { color: red; ");
+    Result broken_serial = parse(broken, 1);
+    Result broken_chunked = parse(broken, 4);
+    EXPECT(broken_chunked.text == broken_serial.text);
+    EXPECT(broken_chunked.errors == broken_serial.errors);
+    CSSParser::set_available_cores(0);
+}
+
+void test_serial_fallback() {
+    std::string css = generate_sheet(600 * 1024);
+    CSSParser::set_available_cores(1);
+    EXPECT(parse(css, 4).chunks == 0);
+    CSSParser::set_available_cores(4);
+    EXPECT(parse(generate_sheet(100 * 1024), 4).chunks == 0); // too small to split
+    EXPECT(parse(css, 8).chunks == 4);
+    EXPECT(parse(css, 0).chunks == 4);
+    CSSParser::set_available_cores(0);
+    EXPECT(CSSParser::available_cores() == std::thread::hardware_concurrency());
+}
+
+} // namespace
+
+int main() {
+    test_chunks_match_serial();
+    test_serial_fallback();
+    return TestSupport::finish("parallel parse");
+}
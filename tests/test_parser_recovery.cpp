@@ -0,0 +1,78 @@
+#include "CSSParser.h"
+#include "TestSupport.h"
+#include <random>
+
+using namespace CSS3Parser;
+
+namespace {
+
+// Touches every construct error recovery has to skip: blocks, nested rules,
+// at-rules with and without blocks, functions, strings, urls and escapes
+const std::string sample =
+    "@import url(\"a.css\") screen; @charset \"utf-8\";\n"
+    "@media (min-width: calc(300px + 1px)) and (hover) { .a > b:is(.c, #d)::before { color: rgb(1 2 3 / 50%) } }\n"
+    ".nav { margin: 0 auto; & li:hover { --x: { a: b }; content: 'q\\'t' } .y & { background: url( a\\)b.png ) } }\n"
+    "@supports (display: grid) and selector(:has(> a)) { @layer base { p[title~=\"x\" i] { width: min(10px, 2em) } } }\n"
+    "@scope (.card) to (.footer) { :scope > .title { font: italic bold 12px/30px Georgia, serif !important } }\n"
+    "@keyframes spin { from { transform: rotate(0deg) } to { transform: rotate(360deg) } }\n"
+    "@font-face { font-family: \"X\"; src: url(x.woff2) format(\"woff2\") }\n"
+    "a { b: var(--c, var(--d, 1px)) } u+0-7f { } <!-- --> \\66oo { }";
+
+void parse_all(const std::string& css, bool token_prepass, size_t threads = 1) {
+    CSSParser::ParseOptions options;
+    options.token_prepass = token_prepass;
+    options.parse_threads = threads;
+    CSSParser parser(css, options);
+    parser.parse_stylesheet();
+}
+
+void test_every_prefix_finishes() {
+    for (bool token_prepass : {false, true}) {
+        for (size_t length = 0; length <= sample.size(); ++length) {
+            std::string prefix = sample.substr(0, length);
+            EXPECT(TestSupport::finishes([&] { parse_all(prefix, token_prepass); }, prefix.c_str()));
+        }
+    }
+}
+
+void test_garbage_finishes() {
+    // Punctuation-heavy noise opens and closes blocks, functions and strings at random
+    const std::string alphabet = "{}[]();:,.#@!&>+~*/\\\"'= -_axz019%\n";
+    std::mt19937 random(12345);
+    for (int round = 0; round < 300; ++round) {
+        std::string css;
+        size_t length = random() % 400;
+        for (size_t i = 0; i < length; ++i) css += alphabet[random() % alphabet.size()];
+        bool token_prepass = round % 2 == 1;
+        EXPECT(TestSupport::finishes([&] { parse_all(css, token_prepass); }, css.c_str()));
+    }
+}
+
+void test_unbalanced_blocks_finish() {
+    const char* inputs[] = {
+        "a{", "a{b{c{d{", "a{b:c(d(e(", "@media (x{", "@supports (((", "a{}}}}}} b{c:d}",
+        "a[b=", "a:is(", "a{b:c;} @media screen{ a{ b{ c: {", "))))}}}}]]]]", "a{--x:{{{{",
+    };
+    for (bool token_prepass : {false, true}) {
+        for (const char* input : inputs) {
+            EXPECT(TestSupport::finishes([&] { parse_all(input, token_prepass); }, input));
+        }
+    }
+}
+
+void test_large_broken_sheet_finishes_in_parallel() {
+    // A truncated rule at the end of every chunk-sized piece
+    std::string css;
+    while (css.size() < 512 * 1024) css += sample.substr(0, sample.size() / 2) + "}\n" + sample;
+    EXPECT(TestSupport::finishes([&] { parse_all(css, false, 4); }, "parallel parse", std::chrono::seconds(60)));
+}
+
+} // namespace
+
+int main() {
+    test_every_prefix_finishes();
+    test_garbage_finishes();
+    test_unbalanced_blocks_finish();
+    test_large_broken_sheet_finishes_in_parallel();
+    return TestSupport::finish("parser recovery");
+}
@@ -0,0 +1,190 @@
+#include "BrowserParser.h"
+#include "TestSupport.h"
+
+using namespace BrowserParser;
+
+namespace {
+
+const HTML5Parser::Node* find_by_id(const HTML5Parser::Node& node, const std::string& id) {
+    auto it = node.attributes.find("id");
+    if (node.type == HTML5Parser::NodeType::Element && it != node.attributes.end() && it->second == id) {
+        return &node;
+    }
+    for (const auto& child : node.children) {
+        if (const HTML5Parser::Node* found = find_by_id(*child, id)) return found;
+    }
+    return nullptr;
+}
+
+// Computed value of property on the element with id, or "" when unset
+std::string computed(const std::string& css, const std::string& body, const std::string& id,
+                     const std::string& property) {
+    WebPageParser parser;
+    ParsedDocument document = parser.parse_html_with_css("<html><head><style>" + css +
+                                                         "</style></head><body>" + body + "</body></html>");
+    StyleEngine engine(document);
+    auto styles = engine.compute_all_styles();
+    const HTML5Parser::Node* element = find_by_id(*document.html_document, id);
+    if (!element) return "<missing element>";
+    const auto& properties = styles.at(element).properties;
+    auto it = properties.find(property);
+    return it != properties.end() ? it->second.to_string() : "";
+}
+
+void test_dynamic_pseudo_classes() {
+    const std::string css = "a{color:blue} a:hover{color:red} a:focus{color:green} a:visited{color:gray}";
+    EXPECT(computed(css, "<a id=x href=#>link</a>", "x", "color") == "blue");
+    EXPECT(computed("p:unknown-state{color:red}", "<p id=x></p>", "x", "color") == "");
+}
+
+void test_pseudo_elements() {
+    EXPECT(computed("p::before{padding-top:5px}", "<p id=x></p>", "x", "padding-top") == "");
+    EXPECT(computed("p:after{color:red}", "<p id=x></p>", "x", "color") == "");
+    EXPECT(computed("p, p::first-line{color:red}", "<p id=x></p>", "x", "color") == "red");
+}
+
+void test_logical_pseudo_classes() {
+    const std::string body = "<p id=a class=x></p><p id=b></p>";
+    EXPECT(computed("p:not(.x){color:red}", body, "a", "color") == "");
+    EXPECT(computed("p:not(.x){color:red}", body, "b", "color") == "red");
+    EXPECT(computed("p:not(.y, .x){color:red}", body, "a", "color") == "");
+    EXPECT(computed(":is(.x, #b){color:red}", body, "a", "color") == "red");
+    EXPECT(computed(":is(.x, #b){color:red}", body, "b", "color") == "red");
+    EXPECT(computed(":where(span){color:red}", body, "a", "color") == "");
+    EXPECT(computed("p:not(:hover){color:red}", body, "a", "color") == "red");
+}
+
+void test_has() {
+    const std::string body = "<div id=a><img></div><div id=b><p><img></p></div><div id=c></div><span></span>";
+    EXPECT(computed("div:has(img){color:red}", body, "a", "color") == "red");
+    EXPECT(computed("div:has(img){color:red}", body, "b", "color") == "red");
+    EXPECT(computed("div:has(img){color:red}", body, "c", "color") == "");
+    EXPECT(computed("div:has(> img){color:red}", body, "b", "color") == "");
+    EXPECT(computed("div:has(+ span){color:red}", body, "c", "color") == "red");
+    EXPECT(computed("div:has(+ span){color:red}", body, "b", "color") == "");
+}
+
+void test_structural_pseudo_classes() {
+    const std::string body = "<ul><li id=a></li><li id=b></li><li id=c></li></ul>";
+    EXPECT(computed("li:nth-child(odd){color:red}", body, "a", "color") == "red");
+    EXPECT(computed("li:nth-child(odd){color:red}", body, "b", "color") == "");
+    EXPECT(computed("li:nth-child(2n+1){color:red}", body, "c", "color") == "red");
+    EXPECT(computed("li:nth-last-child(1){color:red}", body, "c", "color") == "red");
+    EXPECT(computed("li:nth-child(-n+2){color:red}", body, "c", "color") == "");
+    EXPECT(computed("li:last-of-type{color:red}", body, "c", "color") == "red");
+}
+
+void test_class_matching() {
+    // Any run of HTML whitespace separates classes; names are case-sensitive
+    const std::string body = "<p id=a class=\"  b\ta\n c \"></p><p id=b class=ab></p><p id=c class=A></p>";
+    EXPECT(computed(".a{color:red}", body, "a", "color") == "red");
+    EXPECT(computed(".a.b.c{color:red}", body, "a", "color") == "red");
+    EXPECT(computed(".a.d{color:red}", body, "a", "color") == "");
+    EXPECT(computed(".a{color:red}", body, "b", "color") == "");
+    EXPECT(computed(".a{color:red}", body, "c", "color") == "");
+    EXPECT(computed("p:not(.a){color:red}", body, "b", "color") == "red");
+    
+    // Enough classes to set every signature bit still match exactly
+    std::string many = "<p id=m class=\"";
+    for (int i = 0; i < 200; ++i) many += "k" + std::to_string(i) + " ";
+    many += "\"></p>";
+    EXPECT(computed(".k199{color:red}", many, "m", "color") == "red");
+    EXPECT(computed(".k200{color:red}", many, "m", "color") == "");
+}
+
+void test_class_atoms() {
+    WebPageParser parser;
+    auto document = parser.parse_html("<p id=x class=\"b a b\"></p>");
+    const HTML5Parser::Node* p = find_by_id(*document, "x");
+    EXPECT(p && p->class_atoms.size() == 2);
+    if (p) {
+        const auto& atoms = p->class_atoms;
+        EXPECT(atoms[0] == find_atom("b") && atoms[1] == find_atom("a"));
+        EXPECT(p->class_signature == (atom_signature_bit(atoms[0]) | atom_signature_bit(atoms[1])));
+    }
+    
+    ParsedDocument page = parser.parse_html_with_css("<html><body><p class=\"b a b\"></p><i class=a></i></body></html>");
+    auto report = HTMLCSSAnalyzer::analyze(page);
+    EXPECT(report.elements_with_classes == 2);
+    EXPECT(report.class_usage["a"] == 2 && report.class_usage["b"] == 1);
+}
+
+bool attribute_matches(const std::string& selector, const std::string& value) {
+    CSS3Parser::CSSParser parser(selector);
+    CSS3Parser::SelectorList list = parser.parse_selector_list();
+    if (list.selectors.empty() || list.selectors.front().empty()) return false;
+    const auto& simples = list.selectors.front().components.front().selector.selectors;
+    if (simples.empty() || simples.front().type != CSS3Parser::SelectorType::Attribute) return false;
+    HTML5Parser::Node element;
+    element.attributes["t"] = value;
+    return CSSMatcher::matches_attribute_selector(simples.front().attribute, element);
+}
+
+void test_attribute_operators() {
+    // Long enough values run the 16-byte search as well as the tail
+    const std::string long_value = "lorem ipsum dolor sit amet consectetur adipiscing elit sed do";
+    EXPECT(attribute_matches("[t]", ""));
+    EXPECT(attribute_matches("[t=a]", "a") && !attribute_matches("[t=a]", "ab"));
+    EXPECT(attribute_matches("[t~=sit]", long_value) && attribute_matches("[t~=do]", long_value));
+    EXPECT(attribute_matches("[t~=b]", "a\tb\nc") && !attribute_matches("[t~=b]", "abc"));
+    EXPECT(!attribute_matches("[t~=\"a b\"]", "a b"));
+    EXPECT(attribute_matches("[t^=lorem]", long_value) && !attribute_matches("[t^=ipsum]", long_value));
+    EXPECT(attribute_matches("[t$=\"sed do\"]", long_value) && !attribute_matches("[t$=sed]", long_value));
+    EXPECT(attribute_matches("[t*=\"elit sed\"]", long_value));
+    EXPECT(attribute_matches("[t*=\"m dolor s\"]", long_value)); // straddles the first block
+    EXPECT(!attribute_matches("[t*=elix]", long_value));
+    EXPECT(attribute_matches("[t|=en]", "en") && attribute_matches("[t|=en]", "en-US"));
+    EXPECT(!attribute_matches("[t|=en]", "eng"));
+    
+    // An empty value never matches the substring operators
+    for (const char* op : {"^=", "$=", "*=", "~="}) {
+        EXPECT(!attribute_matches(std::string("[t") + op + "\"\"]", long_value));
+    }
+}
+
+void test_attribute_case_flag() {
+    const std::string long_value = "Lorem Ipsum Dolor Sit Amet Consectetur Adipiscing ELIT";
+    EXPECT(!attribute_matches("[t*=\"dolor sit\"]", long_value));
+    EXPECT(attribute_matches("[t*=\"dolor sit\" i]", long_value));
+    EXPECT(attribute_matches("[t$=elit i]", long_value) && attribute_matches("[t^=LOREM i]", long_value));
+    EXPECT(attribute_matches("[t=ABC i]", "abc") && !attribute_matches("[t=ABC]", "abc"));
+    EXPECT(attribute_matches("[t~=AMET i]", long_value) && attribute_matches("[t|=en i]", "EN-gb"));
+    EXPECT(!attribute_matches("[t=\"a-\" i]", "A_")); // only letters fold
+    EXPECT(computed("[title=\"HI\" i]{color:red}", "<p id=x title=hi></p>", "x", "color") == "red");
+    EXPECT(computed("[title=\"HI\"]{color:red}", "<p id=x title=hi></p>", "x", "color") == "");
+}
+
+void test_unused_rule_analysis() {
+    // Rules for states the document cannot show are still in use
+    WebPageParser parser;
+    ParsedDocument document = parser.parse_html_with_css(
+        "<html><head><style>a:hover{color:red} p::before{content:'x'} p:not(.q){color:blue} "
+        "span:hover{color:red}</style></head><body><a href=#>x</a><p class=q></p></body></html>");
+    auto report = HTMLCSSAnalyzer::analyze(document);
+    EXPECT(report.unused_selectors == 2); // p:not(.q) and span:hover
+}
+
+void test_supports_blocks_reach_the_cascade() {
+    const std::string body = "<p id=x></p>";
+    EXPECT(computed("@supports (display: grid) { p { color: red } }", body, "x", "color") == "red");
+    EXPECT(computed("@supports (display: bogus) { p { color: red } }", body, "x", "color") == "");
+    EXPECT(computed("@media screen { @supports not (display: bogus) { p { color: red } } }", body, "x", "color") == "red");
+    EXPECT(computed("@supports selector(:has(a)) { @media (min-width: 0) { p { color: red } } }", body, "x", "color") == "red");
+}
+
+} // namespace
+
+int main() {
+    test_dynamic_pseudo_classes();
+    test_pseudo_elements();
+    test_logical_pseudo_classes();
+    test_has();
+    test_structural_pseudo_classes();
+    test_class_matching();
+    test_class_atoms();
+    test_attribute_operators();
+    test_attribute_case_flag();
+    test_unused_rule_analysis();
+    test_supports_blocks_reach_the_cascade();
+    return TestSupport::finish("selector matching");
+}
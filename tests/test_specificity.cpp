@@ -0,0 +1,64 @@
+#include "CSSParser.h"
+#include "TestSupport.h"
+
+using namespace CSS3Parser;
+
+namespace {
+
+Specificity specificity_of(const std::string& selector) {
+    CSSParser parser(selector);
+    SelectorList list = parser.parse_selector_list();
+    return list.selectors.empty() ? Specificity(999, 999, 999) : list.selectors.front().specificity();
+}
+
+void test_simple_selectors() {
+    EXPECT(specificity_of("*") == Specificity(0, 0, 0));
+    EXPECT(specificity_of("div p") == Specificity(0, 0, 2));
+    EXPECT(specificity_of("#a .b[c]:hover") == Specificity(1, 3, 0));
+    EXPECT(specificity_of("p::before") == Specificity(0, 0, 2));
+}
+
+void test_where() {
+    EXPECT(specificity_of(":where(#a, .b)") == Specificity(0, 0, 0));
+    EXPECT(specificity_of("p:where(#a) .c") == Specificity(0, 1, 1));
+}
+
+void test_is_not_has() {
+    EXPECT(specificity_of(":not(#x)") == Specificity(1, 0, 0));
+    EXPECT(specificity_of(":not(.a, #b, p)") == Specificity(1, 0, 0));
+    EXPECT(specificity_of(":is(p, .a .b)") == Specificity(0, 2, 0));
+    EXPECT(specificity_of("a:is(em, strong)") == Specificity(0, 0, 2));
+    EXPECT(specificity_of(":has(> img)") == Specificity(0, 0, 1));
+    EXPECT(specificity_of("div:has(#x, .y)") == Specificity(1, 0, 1));
+    EXPECT(specificity_of(":not(:is(#a, .b))") == Specificity(1, 0, 0));
+}
+
+void test_legacy_pseudo_elements() {
+    EXPECT(specificity_of("p:before") == Specificity(0, 0, 2));
+    EXPECT(specificity_of("p:after") == Specificity(0, 0, 2));
+    EXPECT(specificity_of("p:first-line") == Specificity(0, 0, 2));
+    EXPECT(specificity_of("p:first-letter") == Specificity(0, 0, 2));
+    SimpleSelector legacy(SelectorType::Pseudo);
+    legacy.pseudo.name = ":before";
+    EXPECT(legacy.specificity() == Specificity(0, 0, 1));
+}
+
+void test_cascade_order() {
+    // :not(#x) outranks two classes even though it comes first
+    CSSParser parser("p:not(#x){color:red} p.a.b{color:blue}");
+    auto sheet = parser.parse_stylesheet();
+    auto first = static_cast<const StyleRule*>(sheet->rules[0].get());
+    auto second = static_cast<const StyleRule*>(sheet->rules[1].get());
+    EXPECT(first->compiled_selectors[0].specificity > second->compiled_selectors[0].specificity);
+}
+
+} // namespace
+
+int main() {
+    test_simple_selectors();
+    test_where();
+    test_is_not_has();
+    test_legacy_pseudo_elements();
+    test_cascade_order();
+    return TestSupport::finish("specificity");
+}
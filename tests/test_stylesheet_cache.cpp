@@ -0,0 +1,120 @@
+#include "BrowserParser.h"
+#include "TestSupport.h"
+
+using namespace BrowserParser;
+
+namespace {
+
+const std::string framework_css =
+    ".btn{color:red} .card .title{font-weight:bold} #missing{color:blue} "
+    "@media (min-width:600px){.btn{padding:4px} @media (hover:hover){.card:hover{color:green}}} "
+    "@scope (.card) to (.footer){.title{color:navy}} @scope (.absent){.title{color:gray}} "
+    "@supports (display:grid){.grid{display:grid}}";
+
+std::string page(const std::string& extra_css) {
+    return "<html><head><style>" + framework_css + "</style><style>" + extra_css +
+           "</style></head><body><div class=card><p class=title>t</p><a class=btn>b</a></div></body></html>";
+}
+
+// Rule sets agree when they keep the same rules, selectors and cascade order
+// under equivalent media conditions and scopes
+bool same_rule_sets(const RuleSet& a, const RuleSet& b) {
+    if (a.entries().size() != b.entries().size() || a.total_rules() != b.total_rules()) return false;
+    for (size_t i = 0; i < a.entries().size(); ++i) {
+        const auto& x = a.entries()[i];
+        const auto& y = b.entries()[i];
+        if (x.rule != y.rule || x.selectors != y.selectors || x.order_base != y.order_base ||
+            x.block_end != y.block_end || (x.scope == 0) != (y.scope == 0)) {
+            return false;
+        }
+        if ((x.media == 0) != (y.media == 0)) return false;
+        if (x.media != 0 && a.media_conditions()[x.media].query != b.media_conditions()[y.media].query) return false;
+        if (x.scope != 0 && a.scopes()[x.scope].bounds != b.scopes()[y.scope].bounds) return false;
+    }
+    return true;
+}
+
+void test_documents_reuse_cached_rule_sets() {
+    StyleSheetCache::shared().clear();
+    WebPageParser parser;
+    ParsedDocument first = parser.parse_html_with_css(page(".first{color:red}"));
+    ParsedDocument second = parser.parse_html_with_css(page(".btn{color:blue}"));
+    
+    StyleSheetCache::Stats stats = StyleSheetCache::shared().stats();
+    EXPECT(stats.hits == 1);
+    EXPECT(stats.misses == 3);
+    EXPECT(first.stylesheets[0] == second.stylesheets[0]);
+    
+    for (const ParsedDocument* document : {&first, &second}) {
+        RuleSet rebuilt = RuleSet::build(document->stylesheets, &document->document_features);
+        EXPECT(same_rule_sets(document->rule_set, rebuilt));
+    }
+    EXPECT(first.rule_set.pruned_rules() == 3); // #missing, .grid and .first
+}
+
+void test_cached_and_uncached_styles_agree() {
+    WebPageParser::ParseOptions options;
+    options.cache_stylesheets = false;
+    WebPageParser uncached_parser(options);
+    WebPageParser cached_parser;
+    ParsedDocument uncached = uncached_parser.parse_html_with_css(page(".btn{color:blue}"));
+    ParsedDocument cached = cached_parser.parse_html_with_css(page(".btn{color:blue}"));
+    
+    auto flatten = [](const ParsedDocument& document) {
+        std::vector<std::string> out;
+        StyleEngine engine(document);
+        std::function<void(const HTML5Parser::Node&)> visit = [&](const HTML5Parser::Node& node) {
+            if (node.type == HTML5Parser::NodeType::Element) {
+                for (const auto& [property, value] : engine.compute_style(node).properties) {
+                    out.push_back(node.tag_name + " " + property + ":" + value.to_string());
+                }
+            }
+            for (const auto& child : node.children) visit(*child);
+        };
+        visit(*document.html_document);
+        return out;
+    };
+    EXPECT(flatten(uncached) == flatten(cached));
+}
+
+void test_linked_sheets_join_the_rule_set() {
+    const std::string html = "<html><head><style>@layer b, a; p{color:red}</style></head>"
+                             "<body><div class=card>c</div><p>p</p></body></html>";
+    // The page ranks b below a, so a's rule wins though the linked sheet names b last
+    const std::string linked = ".card{margin:4px} @layer a{.card{color:blue}} @layer b{.card{color:green}}";
+    for (bool cache : {false, true}) {
+        WebPageParser::ParseOptions options;
+        options.cache_stylesheets = cache;
+        WebPageParser parser(options);
+        ParsedDocument document = parser.parse_html_with_css(html, {linked});
+        EXPECT(document.stylesheets.size() == 2 && document.linked_stylesheets == 1);
+        EXPECT(document.rule_set.entries().size() == 4);
+        
+        HTMLCSSAnalyzer::AnalysisReport report = HTMLCSSAnalyzer::analyze(document);
+        EXPECT(report.unused_selectors == 0);
+        EXPECT(report.internal_stylesheets == 1 && report.external_stylesheets == 1);
+        
+        StyleEngine engine(document);
+        const HTML5Parser::Node* card = nullptr;
+        std::function<void(const HTML5Parser::Node&)> find = [&](const HTML5Parser::Node& node) {
+            if (node.tag_name == "div") card = &node;
+            for (const auto& child : node.children) find(*child);
+        };
+        find(*document.html_document);
+        EXPECT(card != nullptr);
+        if (card) {
+            auto properties = engine.compute_style(*card).properties;
+            EXPECT(properties.count("color") && properties.at("color").to_string() == "blue");
+            EXPECT(properties.count("margin-top") || properties.count("margin"));
+        }
+    }
+}
+
+} // namespace
+
+int main() {
+    test_documents_reuse_cached_rule_sets();
+    test_cached_and_uncached_styles_agree();
+    test_linked_sheets_join_the_rule_set();
+    return TestSupport::finish("stylesheet cache");
+}